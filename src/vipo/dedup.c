@@ -0,0 +1,458 @@
+//  dedup.c
+//
+//  change-only publishing of device records, see dedup.h. devices live in
+//  open addressed tables of fixed size, one per partition, found by the
+//  hash of their key within a few slots of where it points; records are
+//  hashed with 64 bit FNV-1a while walking the parsed json, so nothing is
+//  printed to hash it. the key's low bits pick the partition and the rest
+//  the slot.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "dedup.h"
+
+#define PROBES 8                // slots a device may be found in
+#define SORT_ON_STACK 32
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+typedef struct dedup_entry {
+    uint64_t key;               // 0 for an empty slot
+    uint64_t hash;
+    time_t   sent;              // when it was last published, monotonic seconds
+} dedup_entry_t;
+
+typedef struct dedup_part {
+    pthread_mutex_t lock;       // guards the table and counts
+    dedup_entry_t *table;
+    size_t mask;
+    uint64_t records;           // keyed records looked at
+    uint64_t unchanged;
+    uint64_t refreshed;
+    uint64_t evicted;
+    size_t devices;
+} __attribute__((aligned(64))) dedup_part_t;
+
+struct vipo_dedup {
+    dedup_part_t parts[VIPO_DEDUP_PARTITIONS];
+    char **keys;
+    size_t nkeys;
+    char **ignore;
+    size_t nignore;
+    int refresh;
+    uint64_t unkeyed;           // updated atomically, there is no partition to count it in
+    size_t capacity;
+};
+
+static time_t now_secs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+/* comma separated names, trimmed of blanks */
+static char **split_list(const char *list, size_t *n)
+{
+    *n = 0;
+    if (list == NULL)
+        return NULL;
+    char **names = malloc((strlen(list) / 2 + 1) * sizeof(char *));
+    const char *p = list;
+    while (*p != '\0') {
+        while (*p == ' ' || *p == '\t' || *p == ',')
+            p++;
+        const char *end = p;
+        while (*end != '\0' && *end != ',')
+            end++;
+        const char *last = end;
+        while (last > p && (last[-1] == ' ' || last[-1] == '\t'))
+            last--;
+        if (last > p)
+            names[(*n)++] = strndup(p, last - p);
+        p = end;
+    }
+    return names;
+}
+
+static void free_list(char **names, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        free(names[i]);
+    free(names);
+}
+
+static uint64_t fnv(uint64_t h, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+static int ignored(const vipo_dedup_t *dd, const char *name)
+{
+    for (size_t i = 0; i < dd->nignore; i++) {
+        if (strcmp(dd->ignore[i], name) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static int by_name(const void *a, const void *b)
+{
+    return strcmp((*(const cJSON * const *) a)->string, (*(const cJSON * const *) b)->string);
+}
+
+/* hash a value in canonical form. top is set for the record itself, the only level names are ignored at */
+static uint64_t hash_value(const vipo_dedup_t *dd, uint64_t h, const cJSON *item, int top)
+{
+    unsigned char tag = (unsigned char) (item->type & 0xFF);
+    h = fnv(h, &tag, 1);
+    if (cJSON_IsNumber(item)) {
+        double d = item->valuedouble;
+        if (d == 0)
+            d = 0;              // -0 is 0
+        h = fnv(h, &d, sizeof(d));
+    } else if (cJSON_IsString(item)) {
+        h = fnv(h, item->valuestring, strlen(item->valuestring) + 1);
+    } else if (cJSON_IsArray(item)) {
+        for (const cJSON *el = item->child; el != NULL; el = el->next)
+            h = hash_value(dd, h, el, 0);
+        h = fnv(h, "]", 1);
+    } else if (cJSON_IsObject(item)) {
+        const cJSON *stack[SORT_ON_STACK];
+        const cJSON **members = stack;
+        size_t n = 0;
+        for (const cJSON *el = item->child; el != NULL; el = el->next)
+            n++;
+        if (n > SORT_ON_STACK)
+            members = malloc(n * sizeof(cJSON *));
+        n = 0;
+        for (const cJSON *el = item->child; el != NULL; el = el->next)
+            members[n++] = el;
+        qsort(members, n, sizeof(cJSON *), by_name);
+        for (size_t i = 0; i < n; i++) {
+            if (top && ignored(dd, members[i]->string))
+                continue;
+            h = fnv(h, members[i]->string, strlen(members[i]->string) + 1);
+            h = hash_value(dd, h, members[i], 0);
+        }
+        if (members != stack)
+            free(members);
+        h = fnv(h, "}", 1);
+    }
+    return h;
+}
+
+/* fill in a record's mark. the key is 0 when the record doesn't have all the key properties */
+static void mark_record(const vipo_dedup_t *dd, const cJSON *record, vipo_dedup_mark_t *mark)
+{
+    mark->key = 0;
+    mark->hash = 0;
+    if (!cJSON_IsObject(record))
+        return;
+    uint64_t key = FNV_OFFSET;
+    for (size_t i = 0; i < dd->nkeys; i++) {
+        const cJSON *value = cJSON_GetObjectItemCaseSensitive(record, dd->keys[i]);
+        if (value == NULL)
+            return;
+        key = hash_value(dd, key, value, 0);
+    }
+    mark->key = (key == 0 ? 1 : key);
+    mark->hash = hash_value(dd, FNV_OFFSET, record, 1);
+}
+
+static dedup_part_t *partition_of(vipo_dedup_t *dd, uint64_t key)
+{
+    return &dd->parts[VIPO_DEDUP_PARTITION(key)];
+}
+
+static dedup_entry_t *slot(dedup_part_t *part, uint64_t key, size_t probe)
+{
+    return &part->table[(key / VIPO_DEDUP_PARTITIONS + probe) & part->mask];
+}
+
+/* called with the partition's lock held */
+static dedup_entry_t *lookup(dedup_part_t *part, uint64_t key)
+{
+    for (size_t i = 0; i < PROBES; i++) {
+        dedup_entry_t *entry = slot(part, key, i);
+        if (entry->key == key)
+            return entry;
+    }
+    return NULL;
+}
+
+/* RETURN 1 if the record should be published */
+static int wanted(vipo_dedup_t *dd, const vipo_dedup_mark_t *mark, time_t now)
+{
+    if (mark->key == 0) {
+        __atomic_add_fetch(&dd->unkeyed, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+    dedup_part_t *part = partition_of(dd, mark->key);
+    int publish = 1;
+    pthread_mutex_lock(&part->lock);
+    part->records++;
+    dedup_entry_t *entry = lookup(part, mark->key);
+    if (entry != NULL && entry->hash == mark->hash) {
+        if (dd->refresh > 0 && now - entry->sent >= dd->refresh) {
+            part->refreshed++;
+        } else {
+            part->unchanged++;
+            publish = 0;
+        }
+    }
+    pthread_mutex_unlock(&part->lock);
+    return publish;
+}
+
+static const char *skip_blanks(const char *p)
+{
+    while (isspace((unsigned char) *p))
+        p++;
+    return p;
+}
+
+/* p is at a '"'. RETURN just past the closing one, or NULL if there isn't one */
+static const char *skip_string(const char *p)
+{
+    for (p++; *p != '"'; p++) {
+        if (*p == '\\' && p[1] != '\0')
+            p++;
+        else if (*p == '\0')
+            return NULL;
+    }
+    return p + 1;
+}
+
+/* RETURN just past the value p is at, or NULL if it doesn't end */
+static const char *skip_value(const char *p)
+{
+    if (*p == '"')
+        return skip_string(p);
+    if (*p != '{' && *p != '[') {
+        while (*p != '\0' && *p != ',' && *p != '}' && *p != ']' && !isspace((unsigned char) *p))
+            p++;
+        return p;
+    }
+    int depth = 0;
+    do {
+        if (*p == '"') {
+            if ((p = skip_string(p)) == NULL)
+                return NULL;
+            continue;
+        }
+        if (*p == '{' || *p == '[')
+            depth++;
+        else if (*p == '}' || *p == ']')
+            depth--;
+        else if (*p == '\0')
+            return NULL;
+        p++;
+    } while (depth > 0);
+    return p;
+}
+
+/* RETURN where the value of json's top level member called name starts, or NULL */
+static const char *find_member(const char *json, const char *name)
+{
+    size_t len = strlen(name);
+    const char *p = skip_blanks(json);
+    if (*p != '{')
+        return NULL;
+    p = skip_blanks(p + 1);
+    while (*p == '"') {
+        const char *end = skip_string(p);
+        if (end == NULL)
+            return NULL;
+        int match = ((size_t) (end - p - 2) == len && memcmp(p + 1, name, len) == 0);
+        p = skip_blanks(end);
+        if (*p != ':')
+            return NULL;
+        p = skip_blanks(p + 1);
+        if (match)
+            return p;
+        if ((p = skip_value(p)) == NULL)
+            return NULL;
+        p = skip_blanks(p);
+        if (*p != ',')
+            return NULL;
+        p = skip_blanks(p + 1);
+    }
+    return NULL;
+}
+
+/*
+ * vipo_dedup_create --
+ *
+ *      keys - comma separated names of the properties that identify a device
+ *      ignore - comma separated names of record properties that don't count as a change, or NULL
+ *      devices - how many devices to remember, rounded up to a power of 2 of at least PROBES a partition
+ *      refreshSecs - publish unchanged devices again after this long, 0 for never
+ *
+ * RETURN NULL if there are no keys
+ */
+vipo_dedup_t *vipo_dedup_create(const char *keys, const char *ignore, size_t devices, int refreshSecs)
+{
+    vipo_dedup_t *dd = malloc(sizeof(vipo_dedup_t));
+    memset(dd, 0, sizeof(vipo_dedup_t));
+    dd->keys = split_list(keys, &dd->nkeys);
+    if (dd->nkeys == 0) {
+        vipo_dedup_free(dd);
+        return NULL;
+    }
+    dd->ignore = split_list(ignore, &dd->nignore);
+    size_t size = PROBES;
+    while (size * VIPO_DEDUP_PARTITIONS < devices)
+        size *= 2;
+    for (int i = 0; i < VIPO_DEDUP_PARTITIONS; i++) {
+        dd->parts[i].table = calloc(size, sizeof(dedup_entry_t));
+        dd->parts[i].mask = size - 1;
+        pthread_mutex_init(&dd->parts[i].lock, NULL);
+    }
+    dd->capacity = size * VIPO_DEDUP_PARTITIONS;
+    dd->refresh = refreshSecs;
+    return dd;
+}
+
+/*
+ * vipo_dedup_filter --
+ *
+ *      json - a parsed discovery message. records that haven't changed are removed from an array
+ *      marks / nmarks - set to what to pass to vipo_dedup_commit once the rest are published. free *marks
+ *
+ * RETURN the number of records left to publish. 0 means the message can be dropped; if json is an array
+ *      and fewer than its original size are left, it has to be printed again
+ */
+int vipo_dedup_filter(vipo_dedup_t *dd, cJSON *json, vipo_dedup_mark_t **marks, size_t *nmarks)
+{
+    int array = cJSON_IsArray(json);
+    int n = (array ? cJSON_GetArraySize(json) : 1);
+    vipo_dedup_mark_t *m = malloc((n > 0 ? n : 1) * sizeof(vipo_dedup_mark_t));
+    int *keep = malloc((n > 0 ? n : 1) * sizeof(int));
+    int i = 0;
+    for (cJSON *record = (array ? json->child : json); i < n; record = record->next, i++)
+        mark_record(dd, record, &m[i]);
+
+    time_t now = now_secs();
+    for (i = 0; i < n; i++)
+        keep[i] = wanted(dd, &m[i], now);
+
+    int left = 0;
+    cJSON *record = (array ? json->child : json);
+    for (i = 0; i < n; i++) {
+        cJSON *next = record->next;
+        if (keep[i]) {
+            m[left++] = m[i];
+        } else if (array) {
+            cJSON_Delete(cJSON_DetachItemViaPointer(json, record));
+        }
+        record = next;
+    }
+    free(keep);
+    *marks = m;
+    *nmarks = left;
+    return left;
+}
+
+/*
+ * vipo_dedup_commit --
+ *
+ * remember the records vipo_dedup_filter let through, now that they are published
+ */
+void vipo_dedup_commit(vipo_dedup_t *dd, const vipo_dedup_mark_t *marks, size_t nmarks)
+{
+    time_t now = now_secs();
+    for (size_t i = 0; i < nmarks; i++) {
+        if (marks[i].key == 0)
+            continue;
+        dedup_part_t *part = partition_of(dd, marks[i].key);
+        pthread_mutex_lock(&part->lock);
+        dedup_entry_t *entry = lookup(part, marks[i].key);
+        if (entry == NULL) {
+            // an empty slot, or else the one published longest ago
+            for (size_t p = 0; p < PROBES; p++) {
+                dedup_entry_t *s = slot(part, marks[i].key, p);
+                if (s->key == 0) {
+                    entry = s;
+                    break;
+                }
+                if (entry == NULL || s->sent < entry->sent)
+                    entry = s;
+            }
+            if (entry->key == 0)
+                part->devices++;
+            else
+                part->evicted++;
+            entry->key = marks[i].key;
+        }
+        entry->hash = marks[i].hash;
+        entry->sent = now;
+        pthread_mutex_unlock(&part->lock);
+    }
+}
+
+/*
+ * vipo_dedup_key --
+ *
+ *      json - a discovery message as received, NUL terminated
+ *
+ * find the device a message is about without parsing all of it. RETURN the key vipo_dedup_filter will mark
+ *      its record with, or 0 if it isn't a single record with the key properties
+ */
+uint64_t vipo_dedup_key(const vipo_dedup_t *dd, const char *json)
+{
+    uint64_t key = FNV_OFFSET;
+    for (size_t i = 0; i < dd->nkeys; i++) {
+        const char *at = find_member(json, dd->keys[i]);
+        cJSON *value;
+        if (at == NULL || (value = cJSON_ParseWithOpts(at, NULL, 0)) == NULL)
+            return 0;
+        key = hash_value(dd, key, value, 0);
+        cJSON_Delete(value);
+    }
+    return (key == 0 ? 1 : key);
+}
+
+void vipo_dedup_stats(vipo_dedup_t *dd, vipo_dedup_stats_t *stats)
+{
+    memset(stats, 0, sizeof(vipo_dedup_stats_t));
+    for (int i = 0; i < VIPO_DEDUP_PARTITIONS; i++) {
+        dedup_part_t *part = &dd->parts[i];
+        pthread_mutex_lock(&part->lock);
+        stats->records += part->records;
+        stats->unchanged += part->unchanged;
+        stats->refreshed += part->refreshed;
+        stats->evicted += part->evicted;
+        stats->devices += part->devices;
+        pthread_mutex_unlock(&part->lock);
+    }
+    stats->unkeyed = __atomic_load_n(&dd->unkeyed, __ATOMIC_RELAXED);
+    stats->records += stats->unkeyed;
+    stats->capacity = dd->capacity;
+}
+
+void vipo_dedup_free(vipo_dedup_t *dd)
+{
+    if (dd == NULL)
+        return;
+    free_list(dd->keys, dd->nkeys);
+    free_list(dd->ignore, dd->nignore);
+    for (int i = 0; i < VIPO_DEDUP_PARTITIONS; i++) {
+        if (dd->parts[i].table != NULL) {
+            free(dd->parts[i].table);
+            pthread_mutex_destroy(&dd->parts[i].lock);
+        }
+    }
+    free(dd);
+}
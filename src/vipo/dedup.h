@@ -0,0 +1,58 @@
+//  dedup.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#ifndef VIPO_DEDUP_H
+#define VIPO_DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cjson.h"
+
+/*
+ * change-only publishing. a discovery message is a device record or an
+ * array of them, and a record's device is named by one or more of its
+ * properties (the DEDUPKEY setting). each record is hashed in a canonical
+ * form (object members in key order, numbers by value, the DEDUPIGNORE
+ * properties left out) and only records whose hash differs from the last
+ * one published for their device are sent on. a device that hasn't changed
+ * is still published again once refresh seconds have passed.
+ *
+ * the table holds a fixed number of devices and, when full, forgets the one
+ * that was published longest ago. a record is remembered only once it has
+ * been published (vipo_dedup_commit), so one that failed goes out again.
+ *
+ * the table is split into partitions by device, each with its own lock. a
+ * worker pool sharded on VIPO_DEDUP_PARTITION of vipo_dedup_key has each
+ * partition used by one worker, so the locks are only contended by records
+ * that arrive without their device known up front, in arrays.
+ */
+#define VIPO_DEDUP_PARTITIONS 64
+#define VIPO_DEDUP_PARTITION(key) ((key) % VIPO_DEDUP_PARTITIONS)
+
+typedef struct vipo_dedup vipo_dedup_t;
+
+typedef struct vipo_dedup_mark {
+    uint64_t key;           // hash of the device's key properties
+    uint64_t hash;          // hash of the whole record
+} vipo_dedup_mark_t;
+
+typedef struct vipo_dedup_stats {
+    uint64_t records;       // records looked at
+    uint64_t unchanged;     // records left out
+    uint64_t refreshed;     // unchanged records sent anyway because they were due
+    uint64_t unkeyed;       // records without the key properties, always sent
+    uint64_t evicted;       // devices forgotten to make room
+    size_t   devices;       // devices remembered now
+    size_t   capacity;
+} vipo_dedup_stats_t;
+
+vipo_dedup_t *vipo_dedup_create(const char *keys, const char *ignore, size_t devices, int refreshSecs);
+int vipo_dedup_filter(vipo_dedup_t *dd, cJSON *json, vipo_dedup_mark_t **marks, size_t *nmarks);
+void vipo_dedup_commit(vipo_dedup_t *dd, const vipo_dedup_mark_t *marks, size_t nmarks);
+uint64_t vipo_dedup_key(const vipo_dedup_t *dd, const char *json);
+void vipo_dedup_stats(vipo_dedup_t *dd, vipo_dedup_stats_t *stats);
+void vipo_dedup_free(vipo_dedup_t *dd);
+
+#endif
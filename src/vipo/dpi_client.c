@@ -11,11 +11,12 @@
 #include <errno.h>
 #include <string.h>
 #include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
-#include <sys/select.h>
 
 #include <arpa/inet.h>
 
@@ -23,9 +24,7 @@
 #include "vme.h"
 #include "log.h"
 
-#define INITBUFSIZE 512 // max number of bytes we can get at once
-#define PROT_EOT "EOT"
-#define PROT_ACK "ACK"
+#define INITBUFSIZE 512
 
 static const char *hostname = "localhost";
 
@@ -38,157 +37,225 @@ void *get_in_addr(struct sockaddr *sa) {
     return &(((struct sockaddr_in6*) sa)->sin6_addr);
 }
 
-void build_fd_set(fd_set *read_fds, int listen_sock) {
-    FD_ZERO(read_fds);
-    FD_SET(listen_sock, read_fds);
-}
-
-void config_hostname_port(char *hostname, char *port)
-{
-    /* todo: read from config file */
-    strncpy(hostname, "locahost", MAXHOSTNAMELEN);
-    strncpy(port, "3490", MAXPORTLEN);
-}
-
-dpi_client_t *_dpi_client_alloc()
+/*
+ * dpi_client_new --
+ *
+ *      transport - DPI_INET, DPI_USOCK or DPI_SHM
+ *      address - port or host:port for inet, socket path for the others (a leading @ for the abstract namespace)
+ *
+ * allocate an unconnected client for one DPI endpoint.
+ */
+dpi_client_t *dpi_client_new(dpi_transport_t transport, const char *address)
 {
     dpi_client_t *dpic = malloc(sizeof(dpi_client_t));
     memset(dpic, 0, sizeof(dpi_client_t));
+    dpic->socket_fd = -1;
+    dpic->transport = transport;
+    dpic->address = strdup(address);
+    dpic->state = DPI_IDLE;
+    dpi_decoder_init(&dpic->dec, INITBUFSIZE);
     return dpic;
 }
 
-dpi_client_t *init_dpi_usock_client(char *socket_path)
+static int connect_usock(dpi_client_t *dpic)
 {
     struct sockaddr_un addr;
     int sock_fd;
 
-    dpi_client_t *dpic = _dpi_client_alloc();
-    dpic->socket_fd = -1;
-    if ((sock_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
-        log_info("socket error");
-        return NULL;
+    if ((sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+        log_info("client: socket %s", strerror(errno));
+        return -1;
     }
-    
+
     memset(&addr, 0, sizeof(addr));
     addr.sun_family = AF_UNIX;
     // linux virtual socket address space
-    if (*socket_path == '\0') {
+    const char *socket_path = dpic->address;
+    if (*socket_path == '@') {
         *addr.sun_path = '\0';
         strncpy(addr.sun_path+1, socket_path+1, sizeof(addr.sun_path)-2);
     } else {
         strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path)-1);
     }
-    
-    if (connect(sock_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
-        log_info("client: connect %s", strerror(errno));
-        return NULL;
-    }
 
     dpic->socket_fd = sock_fd;
-    return dpic;
+    if (connect(sock_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        // EAGAIN is a full backlog, not a connect in progress: give up and let the backoff retry
+        if (errno == EINPROGRESS)
+            return 1;
+        log_info("client: connect %s: %s", socket_path, strerror(errno));
+        dpi_client_close(dpic);
+        return -1;
+    }
+    return 0;
 }
 
-dpi_client_t *init_dpi_inet_client(char *port)
+static int connect_inet(dpi_client_t *dpic)
 {
-    int sockfd;
     struct addrinfo hints, *servinfo, *p;
     int rv;
-    char s[INET6_ADDRSTRLEN];
+    char host[MAXHOSTNAMELEN];
+    const char *port = dpic->address;
+
+    snprintf(host, sizeof(host), "%s", hostname);
+    const char *colon = strrchr(dpic->address, ':');
+    if (colon != NULL) {
+        snprintf(host, sizeof(host), "%.*s", (int) (colon - dpic->address), dpic->address);
+        port = colon + 1;
+    }
 
-    dpi_client_t *dpic = _dpi_client_alloc();
-    dpic->socket_fd = -1;
-    
     memset(&hints, 0, sizeof hints);
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
-    
-    if ((rv = getaddrinfo(hostname, port, &hints, &servinfo)) != 0) {
-        log_die("getaddrinfo: %s\n", gai_strerror(rv));
+
+    if ((rv = getaddrinfo(host, port, &hints, &servinfo)) != 0) {
+        log_info("client: getaddrinfo %s: %s", dpic->address, gai_strerror(rv));
+        return -1;
     }
-    
-    // loop through all the results and connect to the first we can
-    for (p = servinfo; p != NULL; p = p->ai_next) {
-        if ((sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
-            log_info("client: socket", strerror(errno));
-            continue;
-        }
-        
-        if (connect(sockfd, p->ai_addr, p->ai_addrlen) == -1) {
-            close(sockfd);
-            log_info("client: connect %s", strerror(errno));
+
+    // use the first address we can start connecting to
+    int result = -1;
+    for (p = servinfo; p != NULL && result == -1; p = p->ai_next) {
+        int sockfd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, p->ai_protocol);
+        if (sockfd == -1) {
+            log_info("client: socket %s", strerror(errno));
             continue;
         }
-        
-        log_info("socket descriptor is %d", sockfd);
         dpic->socket_fd = sockfd;
-        break;
+        if (connect(sockfd, p->ai_addr, p->ai_addrlen) == 0) {
+            result = 0;
+        } else if (errno == EINPROGRESS) {
+            result = 1;
+        } else {
+            log_info("client: connect %s: %s", dpic->address, strerror(errno));
+            dpi_client_close(dpic);
+        }
     }
-    
-    
-    if (p == NULL) {
-        log_info("client: failed to connect\n");
-        return NULL;
+    freeaddrinfo(servinfo);
+    return result;
+}
+
+/*
+ * dpi_client_connect --
+ *
+ *      dpic - an unconnected client
+ *
+ * start a non-blocking connect to the DPI. when it returns 1 the socket becomes writable once the connect
+ * completes one way or the other, and dpi_client_finish_connect tells which.
+ *
+ * RETURN 0 when connected, 1 while in progress, -1 on failure
+ */
+int dpi_client_connect(dpi_client_t *dpic)
+{
+    dpi_decoder_reset(&dpic->dec);
+    dpic->framing = DPI_FRAMING_UNKNOWN;
+    dpic->gen++;
+    dpic->received = dpic->completed = dpic->acked = 0;
+    if (dpic->done != NULL)
+        memset(dpic->done, 0, dpic->done_cap);
+    int rc = (dpic->transport == DPI_INET ? connect_inet(dpic) : connect_usock(dpic));
+    dpic->state = (rc == 0 ? DPI_CONNECTED : (rc == 1 ? DPI_CONNECTING : DPI_IDLE));
+    if (rc == 0)
+        log_info("client: connected to %s", dpic->address);
+    return rc;
+}
+
+/*
+ * dpi_client_finish_connect --
+ *
+ *      dpic - a client whose connect was in progress and whose socket is now writable
+ *
+ * RETURN 0 if the connect succeeded, -1 (with the socket closed) if it didn't
+ */
+int dpi_client_finish_connect(dpi_client_t *dpic)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(dpic->socket_fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+        err = errno;
+    if (err != 0) {
+        log_info("client: connect %s: %s", dpic->address, strerror(err));
+        dpi_client_close(dpic);
+        return -1;
     }
-    
-    inet_ntop(p->ai_family, get_in_addr((struct sockaddr *) p->ai_addr), s, sizeof s);
-    log_info("client: connecting to %s", s);
-    
-    freeaddrinfo(servinfo); // all done with this structure
-    return dpic;
+    dpic->state = DPI_CONNECTED;
+    log_info("client: connected to %s", dpic->address);
+    return 0;
 }
 
-char *fetch_discovery_msg(dpi_client_t *dpic)
+/*
+ * dpi_client_recv --
+ *
+ * as recv(MSG_DONTWAIT) on the DPI's socket, or from its ring for DPI_SHM
+ */
+ssize_t dpi_client_recv(dpi_client_t *dpic, char *buf, size_t len)
 {
-    size_t numbytes;
-    fd_set read_fds;
-    vmebuf_t  *buf = vmebuf_ensure_size(NULL, INITBUFSIZE);
-
-    struct timeval timeout;
-    timeout.tv_sec = 300;
-    timeout.tv_usec = 0;
-
-    build_fd_set(&read_fds, dpic->socket_fd);
-    log_info("waiting for more data...");
-    /* todo: do not time out */
-    int activity = select(dpic->socket_fd + 1, &read_fds, NULL, NULL, &timeout);
-    log_info("select: activity %d\n", activity);
-    if (activity == 0) {
-        log_info("client: select timed out");
-        return NULL;
+    if (dpic->shm != NULL)
+        return dpi_shm_read(dpic->shm, buf, len);
+    return recv(dpic->socket_fd, buf, len, MSG_DONTWAIT);
+}
+
+void dpi_client_close(dpi_client_t *dpic)
+{
+    dpi_shm_detach(dpic->shm);
+    dpic->shm = NULL;
+    if (dpic->socket_fd != -1)
+        close(dpic->socket_fd);
+    dpic->socket_fd = -1;
+    dpic->state = DPI_IDLE;
+}
+
+void dpi_client_free(dpi_client_t *dpic)
+{
+    if (dpic == NULL)
+        return;
+    dpi_client_close(dpic);
+    dpi_decoder_free(&dpic->dec);
+    free(dpic->done);
+    free(dpic->address);
+    free(dpic);
+}
+
+/* connect, waiting for it to complete */
+static dpi_client_t *connect_blocking(dpi_client_t *dpic)
+{
+    int rc = dpi_client_connect(dpic);
+    if (rc == 1) {
+        struct pollfd pfd = { .fd = dpic->socket_fd, .events = POLLOUT };
+        while (poll(&pfd, 1, -1) == -1 && errno == EINTR)
+            ;
+        rc = dpi_client_finish_connect(dpic);
     }
-    if (activity == -1) {
-        log_info("client: error on select %s", strerror(errno));
+    if (rc == -1) {
+        dpi_client_free(dpic);
         return NULL;
     }
+    return dpic;
+}
 
-    size_t avail = buf->limit - buf->len;
-    while ((numbytes = recv(dpic->socket_fd, (&buf->data[0]) + buf->len, avail, 0)) == avail) {
-        buf->len += numbytes;
-        buf->data = realloc(buf->data, buf->limit*2);
-        buf->limit = buf->limit*2;
-        avail = buf->limit - buf->len;
-    }
+dpi_client_t *init_dpi_usock_client(char *socket_path)
+{
+    return connect_blocking(dpi_client_new(DPI_USOCK, socket_path));
+}
+
+dpi_client_t *init_dpi_inet_client(char *port)
+{
+    return connect_blocking(dpi_client_new(DPI_INET, port));
+}
 
-    if (numbytes == -1) {
-        log_syserr("recv");
-        /* NOTREACHED */
-    } else if (numbytes == 0 && buf->len == 0) {
-        log_info("server has closed the connection...\n");
+/* connect, then wait for the DPI to hand over its ring */
+dpi_client_t *init_dpi_shm_client(char *socket_path)
+{
+    dpi_client_t *dpic = connect_blocking(dpi_client_new(DPI_SHM, socket_path));
+    if (dpic == NULL)
         return NULL;
-    } else if (numbytes == sizeof(PROT_EOT)-1 && memcmp(buf->data, PROT_EOT, sizeof(PROT_EOT)) == 0){
-        log_info("received end of transmission");
+    struct pollfd pfd = { .fd = dpic->socket_fd, .events = POLLIN };
+    while (poll(&pfd, 1, -1) == -1 && errno == EINTR)
+        ;
+    if ((dpic->shm = dpi_shm_attach(dpic->socket_fd)) == NULL) {
+        dpi_client_free(dpic);
         return NULL;
-    } else {
-        buf->len += numbytes;
-        buf->data[buf->len] = '\0';
-        log_debug("client: received '%s'\n", buf->data);
-        numbytes = send(dpic->socket_fd, PROT_ACK, sizeof(PROT_ACK)-1, 0);
-        if (numbytes == -1) {
-            log_syserr("error sending acknowledgement");
-        }
     }
-
-    char *data = vmebuf_tostr(buf);
-    vmebuf_dealloc(buf);
-    return data;
+    dpic->framing = DPI_FRAMING_FRAMED;
+    return dpic;
 }
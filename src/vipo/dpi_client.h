@@ -5,8 +5,46 @@
 #ifndef VIPO_DPI_CLIENT_H
 #define VIPO_DPI_CLIENT_H
 
+#include <time.h>
+#include "vme.h"
+#include "dpi_frame.h"
+#include "dpi_shm.h"
+
+typedef enum {
+    DPI_INET,
+    DPI_USOCK,
+    DPI_SHM             // a ring in shared memory, offered over a unix socket. see dpi_shm.h
+} dpi_transport_t;
+
+typedef enum {
+    DPI_IDLE,           // not connected, waiting for retry_at
+    DPI_CONNECTING,     // non-blocking connect under way
+    DPI_CONNECTED
+} dpi_state_t;
+
+typedef enum {
+    DPI_FRAMING_UNKNOWN,    // nothing received yet on this connection
+    DPI_FRAMING_NONE,       // the original protocol, a message is what arrives in one burst
+    DPI_FRAMING_FRAMED      // see dpi_frame.h
+} dpi_framing_t;
+
 struct dpi_client {
 	int socket_fd;
+	dpi_transport_t transport;
+	char *address;              // "port" or "host:port" for inet, a path for unix sockets
+	dpi_shm_t *shm;             // for DPI_SHM, once the DPI has handed over its ring
+	dpi_state_t state;
+	dpi_framing_t framing;
+	dpi_decoder_t dec;          // bytes received and not yet handed on
+	uint64_t gen;               // bumped on every connect, so late completions for an old connection are ignored
+	uint64_t received;          // messages handed on from this connection
+	uint64_t completed;         // how many of those, from the first, are queued or published
+	uint64_t acked;             // how many the DPI has been told about
+	uint8_t *done;              // messages past completed that are done, a ring of done_cap
+	size_t done_cap;
+	int backoff_ms;
+	struct timespec retry_at;
+	struct dpi_client *next;
 };
 
 typedef struct dpi_client dpi_client_t;
@@ -14,8 +52,18 @@ typedef struct dpi_client dpi_client_t;
 #define MAXHOSTNAMELEN 512
 #define MAXPORTLEN 5
 
+#define PROT_EOT "EOT"
+#define PROT_ACK "ACK"
+
+dpi_client_t *dpi_client_new(dpi_transport_t transport, const char *address);
+int dpi_client_connect(dpi_client_t *dpic);
+int dpi_client_finish_connect(dpi_client_t *dpic);
+ssize_t dpi_client_recv(dpi_client_t *dpic, char *buf, size_t len);
+void dpi_client_close(dpi_client_t *dpic);
+void dpi_client_free(dpi_client_t *dpic);
+
 dpi_client_t *init_dpi_usock_client(char *socket_path);
 dpi_client_t *init_dpi_inet_client(char *port);
-char *fetch_discovery_msg(dpi_client_t *dpic);
+dpi_client_t *init_dpi_shm_client(char *socket_path);
 
 #endif
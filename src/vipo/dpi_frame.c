@@ -0,0 +1,206 @@
+//  dpi_frame.c
+//
+//  framing for the DPI protocol, see dpi_frame.h for the wire format. the
+//  decoder keeps partial frames across reads and, once it has seen a
+//  header, makes room for exactly the rest of that frame so the next read
+//  can take it whole: in its own buffer for a small frame, and for a large
+//  one in a new buffer that the frame's taker keeps, so it is never copied.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dpi_frame.h"
+
+#define MIN_READ 4096
+
+static uint32_t get_len(const char *hdr)
+{
+    const unsigned char *p = (const unsigned char *) hdr;
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+void dpi_frame_header(char *hdr, dpi_frame_type_t type, uint32_t len)
+{
+    hdr[0] = (char) (len >> 24);
+    hdr[1] = (char) (len >> 16);
+    hdr[2] = (char) (len >> 8);
+    hdr[3] = (char) len;
+    hdr[4] = (char) type;
+}
+
+/*
+ * dpi_ack_encode --
+ *
+ *      frame - DPI_FRAME_HDR_SIZE + DPI_ACK_SIZE bytes to write the whole ACK frame to
+ *      count - DATA frames acknowledged since the connection opened
+ *      window - how many more the DPI may send beyond count
+ */
+void dpi_ack_encode(char *frame, uint64_t count, uint32_t window)
+{
+    dpi_frame_header(frame, DPI_FRAME_ACK, DPI_ACK_SIZE);
+    unsigned char *p = (unsigned char *) frame + DPI_FRAME_HDR_SIZE;
+    for (int i = 0; i < 8; i++)
+        p[i] = (unsigned char) (count >> (56 - 8 * i));
+    for (int i = 0; i < 4; i++)
+        p[8 + i] = (unsigned char) (window >> (24 - 8 * i));
+}
+
+/* RETURN 0 with count and window filled in, or -1 if frame isn't a valid ACK */
+int dpi_ack_decode(const dpi_frame_t *frame, uint64_t *count, uint32_t *window)
+{
+    if (frame->type != DPI_FRAME_ACK || frame->len != DPI_ACK_SIZE)
+        return -1;
+    const unsigned char *p = (const unsigned char *) frame->payload;
+    *count = 0;
+    for (int i = 0; i < 8; i++)
+        *count = (*count << 8) | p[i];
+    *window = get_len((const char *) p + 8);
+    return 0;
+}
+
+void dpi_decoder_init(dpi_decoder_t *dec, size_t size)
+{
+    memset(dec, 0, sizeof(dpi_decoder_t));
+    dec->buf = vmebuf_ensure_size(NULL, size);
+}
+
+void dpi_decoder_reset(dpi_decoder_t *dec)
+{
+    vmebuf_truncate(dec->buf);
+    dec->pos = 0;
+    if (dec->frame != NULL) {
+        vmebuf_dealloc(dec->frame);
+        dec->frame = NULL;
+    }
+}
+
+void dpi_decoder_free(dpi_decoder_t *dec)
+{
+    dpi_decoder_reset(dec);
+    vmebuf_dealloc(dec->buf);
+    dec->buf = NULL;
+}
+
+/*
+ * dpi_decoder_detach --
+ *
+ * take everything read so far, for unframed DPIs whose message is whatever arrived. the decoder carries on
+ * with a new buffer. RETURN the old one, with room for a terminating NUL after its bytes
+ */
+vmebuf_t *dpi_decoder_detach(dpi_decoder_t *dec)
+{
+    vmebuf_t *buf = dec->buf;
+    if (dec->pos > 0) {
+        memmove(buf->data, buf->data + dec->pos, buf->len - dec->pos);
+        buf->len -= dec->pos;
+        dec->pos = 0;
+    }
+    if (buf->limit == buf->len)
+        vmebuf_ensure_size(buf, buf->len + 1);
+    dec->buf = vmebuf_ensure_size(NULL, MIN_READ);
+    return buf;
+}
+
+/* a whole frame header that starts a large frame, which then goes to a buffer of its own */
+static int start_large_frame(dpi_decoder_t *dec)
+{
+    vmebuf_t *buf = dec->buf;
+    if (buf->len < DPI_FRAME_HDR_SIZE)
+        return 0;
+    uint32_t len = get_len(buf->data);
+    unsigned char type = (unsigned char) buf->data[4];
+    if (len > DPI_FRAME_MAX || len < DPI_COPYBREAK || type < DPI_FRAME_DATA || type > DPI_FRAME_ACK ||
+        buf->len - DPI_FRAME_HDR_SIZE >= len)
+        return 0;
+    // room for a NUL, so whoever takes it can treat it as a string
+    dec->frame = vmebuf_ensure_size(NULL, (size_t) len + 1);
+    dec->frame_len = len;
+    dec->frame_type = type;
+    dec->frame->len = buf->len - DPI_FRAME_HDR_SIZE;
+    memcpy(dec->frame->data, buf->data + DPI_FRAME_HDR_SIZE, dec->frame->len);
+    vmebuf_truncate(buf);
+    return 1;
+}
+
+/*
+ * dpi_decoder_space --
+ *
+ *      dec - the decoder
+ *      avail - set to the number of bytes that may be written at the returned address
+ *
+ * where to read the next bytes to. frames already taken are dropped first, and when a frame header is
+ * pending the space is exactly what's left of that frame (or at least MIN_READ if more than one fits).
+ */
+char *dpi_decoder_space(dpi_decoder_t *dec, size_t *avail)
+{
+    vmebuf_t *buf = dec->buf;
+    if (dec->pos > 0) {
+        memmove(buf->data, buf->data + dec->pos, buf->len - dec->pos);
+        buf->len -= dec->pos;
+        dec->pos = 0;
+    }
+    if (dec->frame != NULL || start_large_frame(dec)) {
+        *avail = dec->frame_len - dec->frame->len;
+        return dec->frame->data + dec->frame->len;
+    }
+    size_t want = MIN_READ;
+    if (buf->len >= DPI_FRAME_HDR_SIZE && get_len(buf->data) <= DPI_FRAME_MAX) {
+        size_t frame = DPI_FRAME_HDR_SIZE + (size_t) get_len(buf->data);
+        if (frame > buf->len && frame - buf->len > want)
+            want = frame - buf->len;
+    }
+    if (buf->limit - buf->len < want)
+        vmebuf_ensure_size(buf, buf->len + want);
+    *avail = buf->limit - buf->len;
+    return buf->data + buf->len;
+}
+
+void dpi_decoder_commit(dpi_decoder_t *dec, size_t len)
+{
+    if (dec->frame != NULL)
+        dec->frame->len += len;
+    else
+        dec->buf->len += len;
+}
+
+/*
+ * dpi_decoder_next --
+ *
+ *      dec - the decoder
+ *      frame - filled in with the next frame
+ *
+ * RETURN 1 when a frame was taken, 0 if more bytes are needed, -1 if the stream is not valid framing. a
+ * frame with a buf of its own must be vmebuf_dealloc'd or handed on by the caller
+ */
+int dpi_decoder_next(dpi_decoder_t *dec, dpi_frame_t *frame)
+{
+    if (dec->frame != NULL) {
+        if (dec->frame->len < dec->frame_len)
+            return 0;
+        frame->type = dec->frame_type;
+        frame->payload = dec->frame->data;
+        frame->len = dec->frame_len;
+        frame->buf = dec->frame;
+        dec->frame = NULL;
+        return 1;
+    }
+    vmebuf_t *buf = dec->buf;
+    size_t have = buf->len - dec->pos;
+    if (have < DPI_FRAME_HDR_SIZE)
+        return 0;
+    const char *hdr = buf->data + dec->pos;
+    uint32_t len = get_len(hdr);
+    unsigned char type = (unsigned char) hdr[4];
+    if (len > DPI_FRAME_MAX || type < DPI_FRAME_DATA || type > DPI_FRAME_ACK)
+        return -1;
+    if (have < DPI_FRAME_HDR_SIZE + (size_t) len)
+        return 0;
+    frame->type = type;
+    frame->payload = hdr + DPI_FRAME_HDR_SIZE;
+    frame->len = len;
+    frame->buf = NULL;
+    dec->pos += DPI_FRAME_HDR_SIZE + len;
+    return 1;
+}
@@ -0,0 +1,74 @@
+//  dpi_frame.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#ifndef VIPO_DPI_FRAME_H
+#define VIPO_DPI_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "vme.h"
+
+/*
+ * DPI wire format. every message is a frame:
+ *
+ *      +----------------+--------+-------------------+
+ *      | length (4, BE) | type   | payload (length)  |
+ *      +----------------+--------+-------------------+
+ *
+ * length counts only the payload and is below 16MB, so the first byte of a
+ * frame is always 0. that is how a framed stream is told apart from the
+ * original unframed protocol, whose messages start with json or "EOT".
+ *
+ * acknowledgements are cumulative and carry flow control. an ACK payload is
+ * the number of DATA frames received on this connection that are now safely
+ * queued or published (8 bytes, BE) and the window (4 bytes, BE): how many
+ * DATA frames the DPI may have sent beyond that count. a DPI starts with a
+ * window of 1 and learns the real one from the first ACK. if the connection
+ * drops, whatever wasn't acknowledged should be sent again.
+ */
+#define DPI_FRAME_HDR_SIZE 5
+#define DPI_FRAME_MAX ((1u << 24) - 1)
+#define DPI_ACK_SIZE 12
+#define DPI_COPYBREAK 4096      // payloads this big are read into a buffer of their own
+
+typedef enum {
+    DPI_FRAME_DATA = 1,     // a discovery message
+    DPI_FRAME_EOT = 2,      // end of transmission, no payload
+    DPI_FRAME_ACK = 3       // acknowledgement, sent by vipo
+} dpi_frame_type_t;
+
+typedef struct dpi_frame {
+    dpi_frame_type_t type;
+    const char *payload;    // points into the decoder's buffer, valid until the next read
+    uint32_t len;
+    vmebuf_t *buf;          // if not NULL, the payload is alone in this buffer, which is now the caller's
+} dpi_frame_t;
+
+/*
+ * a streaming decoder: read into it, then take as many whole frames as have
+ * arrived. small frames are batched up in one buffer and taken in place.
+ * once the header of a frame of DPI_COPYBREAK or more has arrived, the rest
+ * of it is read into a buffer sized for it alone that is handed over whole.
+ */
+typedef struct dpi_decoder {
+    vmebuf_t *buf;
+    size_t pos;             // start of the first undecoded byte
+    vmebuf_t *frame;        // the large frame being read, if any
+    uint32_t frame_len;
+    dpi_frame_type_t frame_type;
+} dpi_decoder_t;
+
+void dpi_decoder_init(dpi_decoder_t *dec, size_t size);
+void dpi_decoder_reset(dpi_decoder_t *dec);
+void dpi_decoder_free(dpi_decoder_t *dec);
+char *dpi_decoder_space(dpi_decoder_t *dec, size_t *avail);
+void dpi_decoder_commit(dpi_decoder_t *dec, size_t len);
+int dpi_decoder_next(dpi_decoder_t *dec, dpi_frame_t *frame);
+vmebuf_t *dpi_decoder_detach(dpi_decoder_t *dec);
+
+void dpi_frame_header(char *hdr, dpi_frame_type_t type, uint32_t len);
+void dpi_ack_encode(char *frame, uint64_t count, uint32_t window);
+int dpi_ack_decode(const dpi_frame_t *frame, uint64_t *count, uint32_t *window);
+
+#endif
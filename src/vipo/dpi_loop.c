@@ -0,0 +1,600 @@
+//  dpi_loop.c
+//
+//  an epoll event loop that keeps connections open to any number of DPI
+//  endpoints, reads from them without blocking, hands each discovery
+//  message to a callback, and reconnects with backoff when an endpoint
+//  goes away. messages are handed on in buffers the callback keeps, which
+//  for large frames and unframed bursts are the very ones read into. DPIs
+//  that frame their messages (dpi_frame.h) may send up to a window of them
+//  back to back and get cumulative ACKs; those that don't are still
+//  supported, a burst at a time. DPIs on a shared memory ring (dpi_shm.h)
+//  are read like framed ones, from the ring instead of a socket, and
+//  acknowledged through it. dpi_loop_stop may be called from a signal
+//  handler.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "dpi_loop.h"
+#include "log.h"
+
+#define MAXEVENTS 64
+#define MIN_BACKOFF_MS 500
+#define MAX_BACKOFF_MS 30000
+#define MAX_READS 16            // per wakeup, so one busy DPI can't starve the others
+
+typedef struct completion {
+    dpi_client_t *dpic;
+    uint64_t gen;
+    uint64_t seq;
+    int ok;
+} completion_t;
+
+struct dpi_loop {
+    int epoll_fd;
+    int stop_fd;                // eventfd, written to by dpi_loop_stop
+    int wake_fd;                // eventfd, written to by dpi_loop_complete
+    pthread_mutex_t lock;       // guards the completions
+    completion_t *completions;
+    size_t ncompletions;
+    size_t completions_cap;
+    dpi_client_t *clients;
+    dpi_msg_fn on_message;
+    dpi_commit_fn on_commit;
+    void *state;
+    uint32_t window;            // unacknowledged DATA frames a DPI may have in flight
+    dpi_loop_stats_t stats;     // only the loop's thread writes to it, others read it with dpi_loop_stats
+};
+
+static long ms_until(const struct timespec *when)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long ms = (when->tv_sec - now.tv_sec) * 1000 + (when->tv_nsec - now.tv_nsec) / 1000000;
+    return (ms < 0 ? 0 : ms);
+}
+
+static void count(uint64_t *counter, uint64_t n)
+{
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+static void connected(dpi_loop_t *loop, dpi_client_t *dpic)
+{
+    dpic->backoff_ms = 0;
+    count(&loop->stats.connects, 1);
+    __atomic_store_n(&loop->stats.connected, loop->stats.connected + 1, __ATOMIC_RELAXED);
+}
+
+static void disconnect(dpi_loop_t *loop, dpi_client_t *dpic)
+{
+    if (dpic->state == DPI_CONNECTED)
+        __atomic_store_n(&loop->stats.connected, loop->stats.connected - 1, __ATOMIC_RELAXED);
+    dpi_client_close(dpic);
+}
+
+static void schedule_retry(dpi_loop_t *loop, dpi_client_t *dpic)
+{
+    disconnect(loop, dpic);
+    dpic->backoff_ms = (dpic->backoff_ms == 0 ? MIN_BACKOFF_MS : dpic->backoff_ms * 2);
+    if (dpic->backoff_ms > MAX_BACKOFF_MS)
+        dpic->backoff_ms = MAX_BACKOFF_MS;
+    clock_gettime(CLOCK_MONOTONIC, &dpic->retry_at);
+    dpic->retry_at.tv_sec += dpic->backoff_ms / 1000;
+    dpic->retry_at.tv_nsec += (dpic->backoff_ms % 1000) * 1000000L;
+    if (dpic->retry_at.tv_nsec >= 1000000000L) {
+        dpic->retry_at.tv_sec++;
+        dpic->retry_at.tv_nsec -= 1000000000L;
+    }
+    log_info("client: retrying %s in %d ms", dpic->address, dpic->backoff_ms);
+}
+
+static void watch(dpi_loop_t *loop, dpi_client_t *dpic, int op)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (dpic->state == DPI_CONNECTING ? EPOLLOUT : EPOLLIN | EPOLLRDHUP);
+    ev.data.ptr = dpic;
+    if (epoll_ctl(loop->epoll_fd, op, dpic->socket_fd, &ev) == -1)
+        log_syserr("epoll_ctl");
+}
+
+static void start_connect(dpi_loop_t *loop, dpi_client_t *dpic)
+{
+    int rc = dpi_client_connect(dpic);
+    if (rc == -1) {
+        schedule_retry(loop, dpic);
+        return;
+    }
+    if (rc == 0)
+        connected(loop, dpic);
+    watch(loop, dpic, EPOLL_CTL_ADD);
+}
+
+static void send_legacy_ack(dpi_client_t *dpic)
+{
+    if (send(dpic->socket_fd, PROT_ACK, sizeof(PROT_ACK)-1, MSG_NOSIGNAL) == -1)
+        log_info("client: error sending acknowledgement to %s: %s", dpic->address, strerror(errno));
+}
+
+/*
+ * tell the DPI how many messages are safely taken, committing them first:
+ * a cumulative ACK for framed DPIs, one ACK per message for the others.
+ * returns -1 if they couldn't be committed.
+ */
+static int send_ack(dpi_loop_t *loop, dpi_client_t *dpic)
+{
+    if (dpic->completed == dpic->acked || dpic->socket_fd == -1)
+        return 0;
+    if (loop->on_commit != NULL && loop->on_commit(loop->state) != 0)
+        return -1;
+    if (dpic->shm != NULL) {
+        dpi_shm_ack(dpic->shm, dpic->completed);
+    } else if (dpic->framing == DPI_FRAMING_FRAMED) {
+        char ack[DPI_FRAME_HDR_SIZE + DPI_ACK_SIZE];
+        dpi_ack_encode(ack, dpic->completed, loop->window);
+        if (send(dpic->socket_fd, ack, sizeof(ack), MSG_NOSIGNAL) == -1) {
+            log_info("client: error sending acknowledgement to %s: %s", dpic->address, strerror(errno));
+            return 0;
+        }
+    } else {
+        for (uint64_t n = dpic->acked; n < dpic->completed; n++)
+            send_legacy_ack(dpic);
+    }
+    count(&loop->stats.acked, dpic->completed - dpic->acked);
+    dpic->acked = dpic->completed;
+    return 0;
+}
+
+/* messages can finish out of order, completed only moves past an unbroken run of them */
+static void mark_done(dpi_client_t *dpic, uint64_t seq)
+{
+    if (seq < dpic->completed || seq >= dpic->received)
+        return;
+    size_t mask = dpic->done_cap - 1;
+    dpic->done[seq & mask] = 1;
+    while (dpic->completed < dpic->received && dpic->done[dpic->completed & mask]) {
+        dpic->done[dpic->completed & mask] = 0;
+        dpic->completed++;
+    }
+}
+
+static void grow_done(dpi_client_t *dpic)
+{
+    uint64_t need = dpic->received - dpic->completed + 1;
+    if (need <= dpic->done_cap)
+        return;
+    size_t cap = (dpic->done_cap == 0 ? 64 : dpic->done_cap * 2);
+    while (cap < need)
+        cap *= 2;
+    uint8_t *done = calloc(cap, 1);
+    for (uint64_t seq = dpic->completed; seq < dpic->received; seq++)
+        done[seq & (cap - 1)] = dpic->done[seq & (dpic->done_cap - 1)];
+    free(dpic->done);
+    dpic->done = done;
+    dpic->done_cap = cap;
+}
+
+/* hand a message on, and with it msg. returns -1 if it couldn't be taken */
+static int take(dpi_loop_t *loop, dpi_client_t *dpic, vmebuf_t *msg)
+{
+    grow_done(dpic);
+    uint64_t seq = dpic->received;
+    int rc = loop->on_message(loop->state, dpic, seq, msg);
+    if (rc == -1)
+        return -1;
+    dpic->received++;
+    count(&loop->stats.received, 1);
+    if (rc == 0)
+        mark_done(dpic, seq);
+    return 0;
+}
+
+/*
+ * unframed DPIs: hand on whatever has been read. a message is what arrives
+ * in one burst, and a burst of just EOT ends a transmission. returns -1 if
+ * the message couldn't be taken.
+ */
+static int deliver_burst(dpi_loop_t *loop, dpi_client_t *dpic)
+{
+    vmebuf_t *buf = dpic->dec.buf;
+    int rc = 0;
+    if (buf->len == 0)
+        return 0;
+    if (buf->len == sizeof(PROT_EOT)-1 && memcmp(buf->data, PROT_EOT, buf->len) == 0) {
+        log_info("received end of transmission from %s", dpic->address);
+        dpi_decoder_reset(&dpic->dec);
+    } else {
+        log_debug("client: received %zu bytes from %s", buf->len, dpic->address);
+        if ((rc = take(loop, dpic, dpi_decoder_detach(&dpic->dec))) == 0)
+            rc = send_ack(loop, dpic);
+    }
+    return rc;
+}
+
+/* a frame's payload as a buffer of its own, copied out of the decoder's only if it's small */
+static vmebuf_t *frame_payload(dpi_frame_t *frame)
+{
+    if (frame->buf != NULL)
+        return frame->buf;
+    vmebuf_t *msg = vmebuf_ensure_size(NULL, (size_t) frame->len + 1);
+    memcpy(msg->data, frame->payload, frame->len);
+    msg->len = frame->len;
+    return msg;
+}
+
+/*
+ * framed DPIs: hand on every whole frame received so far, acknowledging
+ * once half the window is done. returns -1 on a framing error or if a
+ * message couldn't be taken.
+ */
+static int deliver_frames(dpi_loop_t *loop, dpi_client_t *dpic)
+{
+    dpi_frame_t frame;
+    int rc;
+    uint32_t every = (loop->window > 1 ? loop->window / 2 : 1);
+    while ((rc = dpi_decoder_next(&dpic->dec, &frame)) == 1) {
+        if (frame.type == DPI_FRAME_DATA) {
+            if (dpic->shm == NULL && dpic->received - dpic->acked >= loop->window)
+                log_info("client: %s is sending beyond its window of %u", dpic->address, loop->window);
+            if (take(loop, dpic, frame_payload(&frame)) != 0)
+                return -1;
+            if (dpic->completed - dpic->acked >= every && send_ack(loop, dpic) != 0)
+                return -1;
+            continue;
+        }
+        if (frame.buf != NULL)
+            vmebuf_dealloc(frame.buf);
+        if (frame.type == DPI_FRAME_EOT) {
+            log_info("received end of transmission from %s", dpic->address);
+        } else {
+            log_info("client: unexpected frame type %d from %s", frame.type, dpic->address);
+            return -1;
+        }
+    }
+    return rc;
+}
+
+/*
+ * a shared memory DPI has answered the connect with its ring. from here on its socket is only watched for
+ * hangup, and the ring's eventfd for data. RETURN -1 if it sent something else
+ */
+static int attach_shm(dpi_loop_t *loop, dpi_client_t *dpic)
+{
+    if ((dpic->shm = dpi_shm_attach(dpic->socket_fd)) == NULL) {
+        schedule_retry(loop, dpic);
+        return -1;
+    }
+    dpic->framing = DPI_FRAMING_FRAMED;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLRDHUP;
+    ev.data.ptr = dpic;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, dpic->socket_fd, &ev) == -1)
+        log_syserr("epoll_ctl");
+    ev.events = EPOLLIN;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, dpic->shm->data_fd, &ev) == -1)
+        log_syserr("epoll_ctl");
+    log_info("client: attached to shared memory from %s, %llu bytes", dpic->address,
+             (unsigned long long) dpic->shm->hdr->capacity);
+    return 0;
+}
+
+static void drop(dpi_loop_t *loop, dpi_client_t *dpic)
+{
+    send_ack(loop, dpic);
+    log_info("client: dropping the connection to %s after %llu messages", dpic->address,
+             (unsigned long long) dpic->acked);
+    count(&loop->stats.dropped, 1);
+    schedule_retry(loop, dpic);
+}
+
+static void on_readable(dpi_loop_t *loop, dpi_client_t *dpic)
+{
+    for (int reads = 0; ; reads++) {
+        // an unframed message ends where the reads run dry, so it is read to the end however long it takes.
+        // that can't starve anyone, a legacy DPI sends nothing more until it has had its ACK
+        if (reads >= MAX_READS && dpic->framing != DPI_FRAMING_NONE) {
+            // epoll will report the rest, acknowledge what we have meanwhile
+            if (dpic->shm != NULL)
+                dpi_shm_rearm(dpic->shm);
+            if (dpic->framing == DPI_FRAMING_FRAMED && send_ack(loop, dpic) != 0)
+                drop(loop, dpic);
+            return;
+        }
+        size_t avail;
+        char *at = dpi_decoder_space(&dpic->dec, &avail);
+        ssize_t n = dpi_client_recv(dpic, at, avail);
+        if (n > 0) {
+            count(&loop->stats.bytes_in, (uint64_t) n);
+            dpi_decoder_commit(&dpic->dec, n);
+            if (dpic->framing == DPI_FRAMING_UNKNOWN)
+                dpic->framing = (dpic->dec.buf->data[0] == 0 ? DPI_FRAMING_FRAMED : DPI_FRAMING_NONE);
+            if (dpic->framing == DPI_FRAMING_FRAMED && deliver_frames(loop, dpic) == -1) {
+                drop(loop, dpic);
+                return;
+            }
+            continue;
+        }
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // caught up, acknowledge everything taken so far
+            int rc = (dpic->framing == DPI_FRAMING_NONE ? deliver_burst(loop, dpic) : send_ack(loop, dpic));
+            if (rc != 0)
+                drop(loop, dpic);
+            return;
+        }
+        if (n == 0)
+            log_info("%s has closed the connection", dpic->address);
+        else
+            log_info("client: recv from %s: %s", dpic->address, strerror(errno));
+        disconnect(loop, dpic);
+        if (dpic->framing == DPI_FRAMING_NONE)
+            deliver_burst(loop, dpic);
+        schedule_retry(loop, dpic);
+        return;
+    }
+}
+
+/*
+ * dpi_loop_create --
+ *
+ *      on_message - called on the loop's thread for each message received from any endpoint
+ *      on_commit - optional, called on the loop's thread before acknowledging messages
+ *      state - passed through to both
+ */
+dpi_loop_t *dpi_loop_create(dpi_msg_fn on_message, dpi_commit_fn on_commit, void *state)
+{
+    dpi_loop_t *loop = malloc(sizeof(dpi_loop_t));
+    memset(loop, 0, sizeof(dpi_loop_t));
+    loop->on_message = on_message;
+    loop->on_commit = on_commit;
+    loop->state = state;
+    loop->window = DPI_DEFAULT_WINDOW;
+    if ((loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+        log_syserr("epoll_create1");
+    if ((loop->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+        log_syserr("eventfd");
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->stop_fd, &ev) == -1)
+        log_syserr("epoll_ctl");
+    if ((loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+        log_syserr("eventfd");
+    ev.data.ptr = loop;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev) == -1)
+        log_syserr("epoll_ctl");
+    pthread_mutex_init(&loop->lock, NULL);
+    return loop;
+}
+
+/*
+ * dpi_loop_set_window --
+ *
+ *      window - how many messages a framed DPI may send before waiting for an ACK
+ */
+void dpi_loop_set_window(dpi_loop_t *loop, uint32_t window)
+{
+    loop->window = (window == 0 ? 1 : window);
+}
+
+/*
+ * dpi_loop_add --
+ *
+ *      transport - DPI_INET, DPI_USOCK or DPI_SHM
+ *      address - port (or host:port) or socket path of the endpoint
+ *
+ * add an endpoint, connected once the loop runs. returns 0.
+ */
+int dpi_loop_add(dpi_loop_t *loop, dpi_transport_t transport, const char *address)
+{
+    dpi_client_t *dpic = dpi_client_new(transport, address);
+    dpic->next = loop->clients;
+    loop->clients = dpic;
+    loop->stats.endpoints++;
+    return 0;
+}
+
+/*
+ * dpi_loop_add_list --
+ *
+ *      addresses - comma separated list of endpoints, as in the DPIPORT and DPISOCKETPATH settings
+ *
+ * RETURN the number of endpoints added
+ */
+int dpi_loop_add_list(dpi_loop_t *loop, dpi_transport_t transport, const char *addresses)
+{
+    int added = 0;
+    if (addresses == NULL)
+        return 0;
+    char *list = strdup(addresses);
+    char *save = NULL;
+    for (char *addr = strtok_r(list, ",", &save); addr != NULL; addr = strtok_r(NULL, ",", &save)) {
+        if (*addr != '\0' && dpi_loop_add(loop, transport, addr) == 0)
+            added++;
+    }
+    free(list);
+    return added;
+}
+
+/* apply what dpi_loop_complete has queued up, and acknowledge it */
+static void process_completions(dpi_loop_t *loop)
+{
+    uint64_t count;
+    if (read(loop->wake_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+        log_info("eventfd read: %s", strerror(errno));
+
+    pthread_mutex_lock(&loop->lock);
+    completion_t *done = loop->completions;
+    size_t n = loop->ncompletions;
+    loop->completions = NULL;
+    loop->ncompletions = loop->completions_cap = 0;
+    pthread_mutex_unlock(&loop->lock);
+
+    for (size_t i = 0; i < n; i++) {
+        dpi_client_t *dpic = done[i].dpic;
+        if (dpic->gen != done[i].gen || dpic->state != DPI_CONNECTED)
+            continue;
+        if (done[i].ok)
+            mark_done(dpic, done[i].seq);
+        else
+            drop(loop, dpic);
+    }
+    free(done);
+    for (dpi_client_t *dpic = loop->clients; dpic != NULL; dpic = dpic->next) {
+        if (dpic->state == DPI_CONNECTED && send_ack(loop, dpic) != 0)
+            drop(loop, dpic);
+    }
+}
+
+/*
+ * dpi_loop_run --
+ *
+ * connect to every endpoint and process their messages until dpi_loop_stop is called.
+ * returns 0 after a stop, -1 if epoll fails.
+ */
+int dpi_loop_run(dpi_loop_t *loop)
+{
+    struct epoll_event events[MAXEVENTS];
+
+    for (dpi_client_t *dpic = loop->clients; dpic != NULL; dpic = dpic->next)
+        start_connect(loop, dpic);
+
+    for (;;) {
+        // sleep no longer than the next reconnect is due
+        long timeout = -1;
+        for (dpi_client_t *dpic = loop->clients; dpic != NULL; dpic = dpic->next) {
+            if (dpic->state == DPI_IDLE) {
+                long ms = ms_until(&dpic->retry_at);
+                if (timeout == -1 || ms < timeout)
+                    timeout = ms;
+            }
+        }
+
+        int n = epoll_wait(loop->epoll_fd, events, MAXEVENTS, (int) timeout);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            log_info("epoll_wait: %s", strerror(errno));
+            return -1;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == loop) {
+                process_completions(loop);
+                continue;
+            }
+            dpi_client_t *dpic = events[i].data.ptr;
+            if (dpic == NULL) {
+                uint64_t count;
+                if (read(loop->stop_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+                    log_info("eventfd read: %s", strerror(errno));
+                log_info("shutting down");
+                return 0;
+            }
+            if (dpic->state == DPI_CONNECTING) {
+                if (dpi_client_finish_connect(dpic) == 0) {
+                    connected(loop, dpic);
+                    watch(loop, dpic, EPOLL_CTL_MOD);
+                } else {
+                    schedule_retry(loop, dpic);
+                }
+            } else if (dpic->state == DPI_CONNECTED && dpic->transport == DPI_SHM && dpic->shm == NULL) {
+                // the DPI may have filled the ring already, without ringing a vipo it hadn't seen sleep
+                if (attach_shm(loop, dpic) == 0)
+                    on_readable(loop, dpic);
+            } else if (dpic->state == DPI_CONNECTED) {
+                if (dpic->shm != NULL && (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+                    dpic->shm->peer_gone = 1;       // but take what it left in the ring first
+                on_readable(loop, dpic);
+            }
+        }
+
+        for (dpi_client_t *dpic = loop->clients; dpic != NULL; dpic = dpic->next) {
+            if (dpic->state == DPI_IDLE && ms_until(&dpic->retry_at) == 0)
+                start_connect(loop, dpic);
+        }
+    }
+}
+
+/*
+ * dpi_loop_complete --
+ *
+ *      dpic, gen, seq - identify a message on_message returned 1 for
+ *      ok - 1 if it is now queued or published, 0 if it failed and the DPI should send it again
+ *
+ * finish with a message. safe to call from any thread; the ACK goes out from the loop's thread.
+ */
+void dpi_loop_complete(dpi_loop_t *loop, dpi_client_t *dpic, uint64_t gen, uint64_t seq, int ok)
+{
+    pthread_mutex_lock(&loop->lock);
+    if (loop->ncompletions == loop->completions_cap) {
+        loop->completions_cap = (loop->completions_cap == 0 ? 64 : loop->completions_cap * 2);
+        loop->completions = realloc(loop->completions, loop->completions_cap * sizeof(completion_t));
+    }
+    completion_t *c = &loop->completions[loop->ncompletions++];
+    c->dpic = dpic;
+    c->gen = gen;
+    c->seq = seq;
+    c->ok = ok;
+    int first = (loop->ncompletions == 1);
+    pthread_mutex_unlock(&loop->lock);
+    if (first) {
+        uint64_t one = 1;
+        ssize_t rc = write(loop->wake_fd, &one, sizeof(one));
+        (void) rc;
+    }
+}
+
+/* a copy of the loop's counters, safe to take from any thread */
+void dpi_loop_stats(dpi_loop_t *loop, dpi_loop_stats_t *stats)
+{
+    stats->endpoints = loop->stats.endpoints;
+    stats->connected = __atomic_load_n(&loop->stats.connected, __ATOMIC_RELAXED);
+    stats->connects = __atomic_load_n(&loop->stats.connects, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&loop->stats.dropped, __ATOMIC_RELAXED);
+    stats->received = __atomic_load_n(&loop->stats.received, __ATOMIC_RELAXED);
+    stats->bytes_in = __atomic_load_n(&loop->stats.bytes_in, __ATOMIC_RELAXED);
+    stats->acked = __atomic_load_n(&loop->stats.acked, __ATOMIC_RELAXED);
+}
+
+/*
+ * dpi_loop_stop --
+ *
+ * make dpi_loop_run return. safe to call from a signal handler or another thread.
+ */
+void dpi_loop_stop(dpi_loop_t *loop)
+{
+    uint64_t one = 1;
+    ssize_t rc = write(loop->stop_fd, &one, sizeof(one));
+    (void) rc;
+}
+
+void dpi_loop_destroy(dpi_loop_t *loop)
+{
+    if (loop == NULL)
+        return;
+    while (loop->clients != NULL) {
+        dpi_client_t *dpic = loop->clients;
+        loop->clients = dpic->next;
+        dpi_client_free(dpic);
+    }
+    close(loop->wake_fd);
+    close(loop->stop_fd);
+    close(loop->epoll_fd);
+    pthread_mutex_destroy(&loop->lock);
+    free(loop->completions);
+    free(loop);
+}
@@ -0,0 +1,47 @@
+//  dpi_loop.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#ifndef VIPO_DPI_LOOP_H
+#define VIPO_DPI_LOOP_H
+
+#include <stdint.h>
+#include "dpi_client.h"
+
+typedef struct dpi_loop dpi_loop_t;
+
+/*
+ * called for each discovery message. msg is the callback's to keep or vmebuf_dealloc, whatever it returns,
+ * and has room for a NUL after msg->len bytes. return 0 once the message is queued or published, or -1 if it
+ * couldn't be, which drops the connection unacknowledged so the DPI sends it again. return 1 to finish with
+ * it later, from any thread, with dpi_loop_complete(dpic->gen, seq).
+ */
+typedef int (*dpi_msg_fn)(void *state, dpi_client_t *dpic, uint64_t seq, vmebuf_t *msg);
+
+/* called before acknowledging messages, to make them durable. return 0, or -1 to hold the ACK back */
+typedef int (*dpi_commit_fn)(void *state);
+
+#define DPI_DEFAULT_WINDOW 32
+
+/* what the loop has done since it started, for monitoring */
+typedef struct dpi_loop_stats {
+    int         endpoints;
+    int         connected;      // endpoints connected now
+    uint64_t    connects;
+    uint64_t    dropped;        // connections given up on after a framing error or a message that couldn't be taken
+    uint64_t    received;       // messages handed on
+    uint64_t    bytes_in;
+    uint64_t    acked;
+} dpi_loop_stats_t;
+
+dpi_loop_t *dpi_loop_create(dpi_msg_fn on_message, dpi_commit_fn on_commit, void *state);
+void dpi_loop_set_window(dpi_loop_t *loop, uint32_t window);
+int dpi_loop_add(dpi_loop_t *loop, dpi_transport_t transport, const char *address);
+int dpi_loop_add_list(dpi_loop_t *loop, dpi_transport_t transport, const char *addresses);
+int dpi_loop_run(dpi_loop_t *loop);
+void dpi_loop_stats(dpi_loop_t *loop, dpi_loop_stats_t *stats);
+void dpi_loop_complete(dpi_loop_t *loop, dpi_client_t *dpic, uint64_t gen, uint64_t seq, int ok);
+void dpi_loop_stop(dpi_loop_t *loop);
+void dpi_loop_destroy(dpi_loop_t *loop);
+
+#endif
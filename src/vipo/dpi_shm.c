@@ -0,0 +1,150 @@
+//  dpi_shm.c
+//
+//  vipo's end of the shared memory transport, see dpi_shm.h. reads copy
+//  straight from the ring into the frame decoder, so a message crosses
+//  from the DPI in one copy and, while the DPI keeps the ring busy, no
+//  system calls.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "dpi_shm.h"
+#include "log.h"
+
+static void ring(int fd)
+{
+    uint64_t one = 1;
+    ssize_t rc = write(fd, &one, sizeof(one));
+    (void) rc;
+}
+
+/*
+ * dpi_shm_attach --
+ *
+ *      sock_fd - a connected socket to the DPI, with its hello waiting to be read
+ *
+ * RETURN the mapped ring, or NULL if the DPI didn't send a valid one
+ */
+dpi_shm_t *dpi_shm_attach(int sock_fd)
+{
+    dpi_shm_hello_t hello;
+    int fds[3];
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = { .iov_base = &hello, .iov_len = sizeof(hello) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n = recvmsg(sock_fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (n == -1) {
+        log_info("client: shared memory hello: %s", strerror(errno));
+        return NULL;
+    }
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        log_info("client: no shared memory offered, is this a shared memory DPI?");
+        if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            int *got = (int *) CMSG_DATA(cmsg);
+            for (size_t i = 0; i < (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int); i++)
+                close(got[i]);
+        }
+        return NULL;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    void *map = MAP_FAILED;
+    if (n == sizeof(hello) && hello.magic == DPI_SHM_MAGIC && hello.version == DPI_SHM_VERSION &&
+        hello.size > DPI_SHM_HDR_SIZE)
+        map = mmap(NULL, hello.size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    dpi_shm_hdr_t *hdr = map;
+    if (map == MAP_FAILED || hdr->magic != DPI_SHM_MAGIC ||
+        hdr->capacity != hello.size - DPI_SHM_HDR_SIZE || (hdr->capacity & (hdr->capacity - 1)) != 0) {
+        log_info("client: the DPI's shared memory isn't usable");
+        if (map != MAP_FAILED)
+            munmap(map, hello.size);
+        close(fds[1]);
+        close(fds[2]);
+        return NULL;
+    }
+
+    dpi_shm_t *shm = malloc(sizeof(dpi_shm_t));
+    memset(shm, 0, sizeof(dpi_shm_t));
+    shm->hdr = hdr;
+    shm->ring = (char *) map + DPI_SHM_HDR_SIZE;
+    shm->size = hello.size;
+    shm->data_fd = fds[1];
+    shm->space_fd = fds[2];
+    return shm;
+}
+
+/*
+ * dpi_shm_read --
+ *
+ * like recv: copy up to len bytes out of the ring. RETURN the number copied, -1 with errno EAGAIN when the
+ * ring is empty (data_fd becomes readable once it isn't), or 0 when it's empty and the DPI has gone
+ */
+ssize_t dpi_shm_read(dpi_shm_t *shm, char *buf, size_t len)
+{
+    dpi_shm_hdr_t *hdr = shm->hdr;
+    uint64_t tail = hdr->tail;
+    uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        uint64_t count;
+        if (read(shm->data_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+            log_info("client: shared memory eventfd: %s", strerror(errno));
+        __atomic_store_n(&hdr->consumer_sleeping, 1, __ATOMIC_SEQ_CST);
+        head = __atomic_load_n(&hdr->head, __ATOMIC_SEQ_CST);
+        if (head == tail) {
+            if (shm->peer_gone)
+                return 0;
+            errno = EAGAIN;
+            return -1;
+        }
+        __atomic_store_n(&hdr->consumer_sleeping, 0, __ATOMIC_RELAXED);
+    }
+
+    size_t n = (head - tail < len ? (size_t) (head - tail) : len);
+    size_t at = (size_t) (tail & (hdr->capacity - 1));
+    size_t first = (n < hdr->capacity - at ? n : hdr->capacity - at);
+    memcpy(buf, shm->ring + at, first);
+    memcpy(buf + first, shm->ring, n - first);
+    __atomic_store_n(&hdr->tail, tail + n, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&hdr->producer_sleeping, 0, __ATOMIC_SEQ_CST))
+        ring(shm->space_fd);
+    return (ssize_t) n;
+}
+
+/* tell the DPI count messages are taken */
+void dpi_shm_ack(dpi_shm_t *shm, uint64_t count)
+{
+    __atomic_store_n(&shm->hdr->acked, count, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&shm->hdr->producer_sleeping, 0, __ATOMIC_SEQ_CST))
+        ring(shm->space_fd);
+}
+
+/* have data_fd report readable again, for a reader that stops before the ring is empty */
+void dpi_shm_rearm(dpi_shm_t *shm)
+{
+    ring(shm->data_fd);
+}
+
+void dpi_shm_detach(dpi_shm_t *shm)
+{
+    if (shm == NULL)
+        return;
+    munmap(shm->hdr, shm->size);
+    close(shm->data_fd);
+    close(shm->space_fd);
+    free(shm);
+}
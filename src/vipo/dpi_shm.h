@@ -0,0 +1,69 @@
+//  dpi_shm.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#ifndef VIPO_DPI_SHM_H
+#define VIPO_DPI_SHM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * the shared memory transport, for a DPI on the same host. vipo connects to
+ * the DPI's unix socket as it would for DPI_USOCK, and the DPI answers with
+ * a dpi_shm_hello_t carrying three descriptors (SCM_RIGHTS): a memfd holding
+ * a dpi_shm_hdr_t and the ring after it, an eventfd the DPI rings when it
+ * adds to the ring, and one vipo rings when it makes room or acknowledges.
+ * nothing else goes over the socket; it stays open so that each side sees
+ * the other go away.
+ *
+ * the ring is single producer, single consumer: a stream of frames as in
+ * dpi_frame.h, which may wrap around its end. head and tail count the bytes
+ * ever written and read, and the DPI only moves head past whole frames. a
+ * side that runs out of work sets its sleeping flag, looks once more, and
+ * waits on its eventfd; the other side only writes that eventfd when it
+ * finds the flag set, so while both are busy no system calls are made.
+ *
+ * acked is the cumulative count of DATA frames vipo has published or
+ * spooled, as in a DPI_FRAME_ACK. frames beyond it should be sent again if
+ * vipo reconnects. the ring's size is all the flow control there is.
+ */
+#define DPI_SHM_MAGIC 0x56504d53        // "VPMS"
+#define DPI_SHM_VERSION 1
+#define DPI_SHM_HDR_SIZE 4096           // the ring starts a page in
+
+typedef struct dpi_shm_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;                                  // of the ring, a power of 2
+    uint64_t head __attribute__((aligned(64)));         // written by the DPI
+    uint32_t consumer_sleeping;
+    uint64_t tail __attribute__((aligned(64)));         // written by vipo
+    uint64_t acked;
+    uint32_t producer_sleeping;
+} dpi_shm_hdr_t;
+
+typedef struct dpi_shm_hello {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;                      // of the memfd, DPI_SHM_HDR_SIZE + capacity
+} dpi_shm_hello_t;
+
+/* vipo's end of a ring */
+typedef struct dpi_shm {
+    dpi_shm_hdr_t *hdr;
+    char *ring;
+    size_t size;
+    int data_fd;                        // eventfd, rung by the DPI
+    int space_fd;                       // eventfd, rung by vipo
+    int peer_gone;                      // the DPI has closed its socket, read what's left and stop
+} dpi_shm_t;
+
+dpi_shm_t *dpi_shm_attach(int sock_fd);
+ssize_t dpi_shm_read(dpi_shm_t *shm, char *buf, size_t len);
+void dpi_shm_ack(dpi_shm_t *shm, uint64_t count);
+void dpi_shm_rearm(dpi_shm_t *shm);
+void dpi_shm_detach(dpi_shm_t *shm);
+
+#endif
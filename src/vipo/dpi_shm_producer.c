@@ -0,0 +1,328 @@
+//  dpi_shm_producer.c
+//
+//  the DPI's end of the shared memory transport, see dpi_shm_producer.h.
+//  it only needs libc, so a DPI can link libdpishm.a without libvme.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#include "dpi_shm.h"
+#include "dpi_shm_producer.h"
+
+#define DEFAULT_CAPACITY (1 << 20)
+#define MIN_CAPACITY (1 << 16)
+#define FRAME_HDR_SIZE 5        // as in dpi_frame.h
+#define FRAME_DATA 1
+#define FRAME_EOT 2
+
+struct dpi_shm_producer {
+    int listen_fd;
+    int sock_fd;                // vipo's connection, -1 when it isn't attached
+    size_t capacity;
+    dpi_shm_hdr_t *hdr;
+    char *ring;
+    size_t size;
+    int data_fd;
+    int space_fd;
+    uint64_t sent;
+};
+
+static void detach(dpi_shm_producer_t *p)
+{
+    if (p->hdr != NULL)
+        munmap(p->hdr, p->size);
+    p->hdr = NULL;
+    if (p->sock_fd != -1)
+        close(p->sock_fd);
+    if (p->data_fd != -1)
+        close(p->data_fd);
+    if (p->space_fd != -1)
+        close(p->space_fd);
+    p->sock_fd = p->data_fd = p->space_fd = -1;
+}
+
+static long ms_left(const struct timespec *deadline)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long ms = (deadline->tv_sec - now.tv_sec) * 1000 + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+    return (ms < 0 ? 0 : ms);
+}
+
+/*
+ * dpi_shm_listen --
+ *
+ *      path - unix socket path for vipo's DPISHMPATH, a leading @ for the abstract namespace
+ *      capacity - ring size in bytes, rounded up to a power of 2. 0 for 1MB
+ *
+ * RETURN NULL (errno set) if the socket can't be set up
+ */
+dpi_shm_producer_t *dpi_shm_listen(const char *path, size_t capacity)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (*path == '@') {
+        strncpy(addr.sun_path + 1, path + 1, sizeof(addr.sun_path) - 2);
+    } else {
+        strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+        unlink(path);
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return NULL;
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(fd, 1) == -1) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+
+    dpi_shm_producer_t *p = malloc(sizeof(dpi_shm_producer_t));
+    memset(p, 0, sizeof(dpi_shm_producer_t));
+    p->listen_fd = fd;
+    p->sock_fd = p->data_fd = p->space_fd = -1;
+    if (capacity == 0)
+        capacity = DEFAULT_CAPACITY;
+    p->capacity = MIN_CAPACITY;
+    while (p->capacity < capacity)
+        p->capacity *= 2;
+    return p;
+}
+
+/* set up a new ring and hand it to vipo on sock_fd */
+static int offer_ring(dpi_shm_producer_t *p)
+{
+    p->size = DPI_SHM_HDR_SIZE + p->capacity;
+    int mem_fd = memfd_create("dpi-shm", MFD_CLOEXEC);
+    if (mem_fd == -1)
+        return -1;
+    if (ftruncate(mem_fd, p->size) == -1 ||
+        (p->hdr = mmap(NULL, p->size, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0)) == MAP_FAILED) {
+        p->hdr = NULL;
+        close(mem_fd);
+        return -1;
+    }
+    p->ring = (char *) p->hdr + DPI_SHM_HDR_SIZE;
+    p->hdr->magic = DPI_SHM_MAGIC;
+    p->hdr->version = DPI_SHM_VERSION;
+    p->hdr->capacity = p->capacity;
+    p->data_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    p->space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (p->data_fd == -1 || p->space_fd == -1) {
+        close(mem_fd);
+        return -1;
+    }
+
+    dpi_shm_hello_t hello = { DPI_SHM_MAGIC, DPI_SHM_VERSION, p->size };
+    int fds[3] = { mem_fd, p->data_fd, p->space_fd };
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = { .iov_base = &hello, .iov_len = sizeof(hello) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    ssize_t n = sendmsg(p->sock_fd, &msg, MSG_NOSIGNAL);
+    close(mem_fd);
+    return (n == sizeof(hello) ? 0 : -1);
+}
+
+/*
+ * dpi_shm_accept --
+ *
+ *      timeoutMs - how long to wait for vipo to connect, negative for as long as it takes
+ *
+ * drop the ring vipo had, if any, and wait for it to attach to a new one. RETURN 0 once it has, or -1
+ */
+int dpi_shm_accept(dpi_shm_producer_t *p, int timeoutMs)
+{
+    detach(p);
+    struct pollfd pfd = { .fd = p->listen_fd, .events = POLLIN };
+    int rc;
+    while ((rc = poll(&pfd, 1, timeoutMs)) == -1 && errno == EINTR)
+        ;
+    if (rc <= 0) {
+        if (rc == 0)
+            errno = ETIMEDOUT;
+        return -1;
+    }
+    if ((p->sock_fd = accept4(p->listen_fd, NULL, NULL, SOCK_CLOEXEC)) == -1)
+        return -1;
+    p->sent = 0;
+    if (offer_ring(p) != 0) {
+        int err = errno;
+        detach(p);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static int have_space(dpi_shm_producer_t *p, uint64_t need)
+{
+    uint64_t tail = __atomic_load_n(&p->hdr->tail, __ATOMIC_SEQ_CST);
+    return p->capacity - (p->hdr->head - tail) >= need;
+}
+
+static int have_acked(dpi_shm_producer_t *p, uint64_t count)
+{
+    return __atomic_load_n(&p->hdr->acked, __ATOMIC_SEQ_CST) >= count;
+}
+
+/*
+ * wait until ready says so, sleeping on space_fd once vipo knows to ring it. RETURN 0, or -1 with errno
+ * ETIMEDOUT, or EPIPE when vipo has gone
+ */
+static int wait_for(dpi_shm_producer_t *p, int (*ready)(dpi_shm_producer_t *, uint64_t), uint64_t arg, int timeoutMs)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    if (timeoutMs > 0) {
+        deadline.tv_sec += timeoutMs / 1000;
+        deadline.tv_nsec += (timeoutMs % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+    for (;;) {
+        if (p->hdr == NULL) {
+            errno = EPIPE;
+            return -1;
+        }
+        if (ready(p, arg))
+            return 0;
+        __atomic_store_n(&p->hdr->producer_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (ready(p, arg)) {
+            __atomic_store_n(&p->hdr->producer_sleeping, 0, __ATOMIC_RELAXED);
+            return 0;
+        }
+        int wait = (timeoutMs < 0 ? -1 : (int) ms_left(&deadline));
+        if (wait == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        struct pollfd pfd[2] = {
+            { .fd = p->space_fd, .events = POLLIN },
+            { .fd = p->sock_fd, .events = POLLRDHUP }
+        };
+        if (poll(pfd, 2, wait) == -1 && errno != EINTR)
+            return -1;
+        if (pfd[1].revents & (POLLRDHUP | POLLHUP | POLLERR)) {
+            detach(p);
+            errno = EPIPE;
+            return -1;
+        }
+        if (pfd[0].revents & POLLIN) {
+            uint64_t count;
+            ssize_t rc = read(p->space_fd, &count, sizeof(count));
+            (void) rc;
+        }
+    }
+}
+
+static void put(dpi_shm_producer_t *p, uint64_t pos, const void *data, size_t len)
+{
+    size_t at = (size_t) (pos & (p->capacity - 1));
+    size_t first = (len < p->capacity - at ? len : p->capacity - at);
+    memcpy(p->ring + at, data, first);
+    memcpy(p->ring, (const char *) data + first, len - first);
+}
+
+static int send_frame(dpi_shm_producer_t *p, int type, const void *msg, size_t len, int timeoutMs)
+{
+    uint64_t need = FRAME_HDR_SIZE + len;
+    if (need > p->capacity) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (wait_for(p, have_space, need, timeoutMs) != 0)
+        return -1;
+    unsigned char hdr[FRAME_HDR_SIZE] = {
+        (unsigned char) (len >> 24), (unsigned char) (len >> 16), (unsigned char) (len >> 8),
+        (unsigned char) len, (unsigned char) type
+    };
+    uint64_t head = p->hdr->head;
+    put(p, head, hdr, sizeof(hdr));
+    if (len > 0)
+        put(p, head + sizeof(hdr), msg, len);
+    __atomic_store_n(&p->hdr->head, head + need, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&p->hdr->consumer_sleeping, 0, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        ssize_t rc = write(p->data_fd, &one, sizeof(one));
+        (void) rc;
+    }
+    return 0;
+}
+
+/*
+ * dpi_shm_send --
+ *
+ *      msg / len - a discovery message, below 16MB and no bigger than the ring
+ *      timeoutMs - how long to wait for room, negative for as long as it takes
+ *
+ * RETURN 0 once it is in the ring, or -1 (errno ETIMEDOUT, EMSGSIZE, or EPIPE when vipo has gone)
+ */
+int dpi_shm_send(dpi_shm_producer_t *p, const void *msg, size_t len, int timeoutMs)
+{
+    if (len >= (1u << 24)) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (send_frame(p, FRAME_DATA, msg, len, timeoutMs) != 0)
+        return -1;
+    p->sent++;
+    return 0;
+}
+
+/* tell vipo a transmission is over, as the socket transports' EOT does */
+int dpi_shm_send_eot(dpi_shm_producer_t *p, int timeoutMs)
+{
+    return send_frame(p, FRAME_EOT, NULL, 0, timeoutMs);
+}
+
+/* RETURN the number of messages sent since vipo attached */
+uint64_t dpi_shm_sent(dpi_shm_producer_t *p)
+{
+    return p->sent;
+}
+
+/* RETURN how many of them vipo has published or spooled */
+uint64_t dpi_shm_acked(dpi_shm_producer_t *p)
+{
+    return (p->hdr == NULL ? 0 : __atomic_load_n(&p->hdr->acked, __ATOMIC_SEQ_CST));
+}
+
+/* wait until vipo has acknowledged count messages. RETURN 0, or -1 as for dpi_shm_send */
+int dpi_shm_wait_acked(dpi_shm_producer_t *p, uint64_t count, int timeoutMs)
+{
+    return wait_for(p, have_acked, count, timeoutMs);
+}
+
+void dpi_shm_close(dpi_shm_producer_t *p)
+{
+    if (p == NULL)
+        return;
+    detach(p);
+    close(p->listen_fd);
+    free(p);
+}
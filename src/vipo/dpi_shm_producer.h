@@ -0,0 +1,38 @@
+//  dpi_shm_producer.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#ifndef VIPO_DPI_SHM_PRODUCER_H
+#define VIPO_DPI_SHM_PRODUCER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * the DPI's end of the shared memory transport (dpi_shm.h), built as
+ * libdpishm.a. a DPI listens on a unix socket, waits for vipo to attach,
+ * and sends messages into the ring:
+ *
+ *      dpi_shm_producer_t *p = dpi_shm_listen("/var/run/dpi.sock", 0);
+ *      while (dpi_shm_accept(p, -1) == 0) {
+ *          // resend anything past what vipo acknowledged before, then
+ *          while (dpi_shm_send(p, json, len, -1) == 0)
+ *              ...
+ *      }
+ *
+ * a producer is for one thread. calls that wait return -1 once vipo has
+ * gone, after which dpi_shm_accept waits for it to come back with a new
+ * ring; counts start over with it.
+ */
+typedef struct dpi_shm_producer dpi_shm_producer_t;
+
+dpi_shm_producer_t *dpi_shm_listen(const char *path, size_t capacity);
+int dpi_shm_accept(dpi_shm_producer_t *p, int timeoutMs);
+int dpi_shm_send(dpi_shm_producer_t *p, const void *msg, size_t len, int timeoutMs);
+int dpi_shm_send_eot(dpi_shm_producer_t *p, int timeoutMs);
+uint64_t dpi_shm_sent(dpi_shm_producer_t *p);
+uint64_t dpi_shm_acked(dpi_shm_producer_t *p);
+int dpi_shm_wait_acked(dpi_shm_producer_t *p, uint64_t count, int timeoutMs);
+void dpi_shm_close(dpi_shm_producer_t *p);
+
+#endif
@@ -0,0 +1,638 @@
+//  dpisim.c
+//
+//  a simulated DPI, for running and benchmarking vipo without a real one.
+//  it listens on any number of endpoints as a DPI would and, once vipo has
+//  connected, sends it discovery messages, replayed from a file or made up
+//  to a size distribution, at a given rate. messages vipo hasn't
+//  acknowledged are sent again when it reconnects, and at the end each
+//  endpoint gets an EOT. it reports throughput from the first message sent
+//  to the last acknowledged, and the latency of the acknowledgements.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "dpi_frame.h"
+#include "dpi_shm_producer.h"
+#include "cjson.h"
+
+#define PROT_EOT "EOT"          // the unframed protocol, as in dpi_client.h
+#define PROT_ACK "ACK"
+#define DEFAULT_COUNT 10000
+#define DEFAULT_SIZE 512
+#define DEFAULT_DEVICES 1000
+#define ACK_TIMEOUT_MS 30000    // give up on an endpoint when vipo acknowledges nothing for this long
+#define NS 1000000000ULL
+
+static char *usage =
+    "dpisim [options] endpoint...\n"
+    "  endpoint      port or host:port to listen on, unix:path (a leading @ for the abstract namespace),\n"
+    "                or shm:path to offer a shared memory ring on a unix socket\n"
+    "  -c count      listen on count endpoints for each one given: consecutive ports, or paths ending -1, -2...\n"
+    "  -n messages   to send on each endpoint (default 10000)\n"
+    "  -d seconds    send for this long instead\n"
+    "  -r rate       messages per second on each endpoint, 0 for as fast as vipo takes them (default)\n"
+    "  -s min[-max]  message size in bytes (default 512), uniformly distributed between min and max\n"
+    "  -e            exponentially distributed sizes instead, from min with a mean halfway to max\n"
+    "  -k devices    distinct devices the made up messages describe (default 1000)\n"
+    "  -f file       replay messages from file, one per line or a single json document, instead\n"
+    "  -l            use the unframed protocol, one message per acknowledgement\n";
+
+typedef enum {
+    SIM_TCP,
+    SIM_UNIX,
+    SIM_SHM
+} sim_transport_t;
+
+typedef struct sim_opts {
+    uint64_t count;
+    double seconds;
+    double rate;
+    size_t min_size;
+    size_t max_size;
+    int exponential;
+    uint32_t devices;
+    int legacy;
+    char **replay;              // messages from -f, or NULL
+    size_t *replay_len;
+    size_t nreplay;
+} sim_opts_t;
+
+typedef struct sim_endpoint {
+    sim_transport_t transport;
+    char *address;
+    int id;
+    int listen_fd;
+    dpi_shm_producer_t *shm;
+    pthread_t thread;
+    char *msg;                  // room for a frame header and the largest message
+    size_t msg_cap;
+    uint64_t total;             // messages to send, only known up front with -n
+    uint64_t next;              // index of the next message to send
+    uint64_t acked;             // messages acknowledged, counted from the first connection
+    uint64_t *sent_at;          // ns, by message index
+    size_t sent_cap;
+    uint32_t *latency;          // us, in the order acknowledged
+    uint64_t bytes;
+    uint64_t reconnects;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    int failed;
+} sim_endpoint_t;
+
+static sim_opts_t opts;
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * NS + now.tv_nsec;
+}
+
+static uint64_t splitmix(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static size_t pick_size(uint64_t r)
+{
+    if (opts.max_size <= opts.min_size)
+        return opts.min_size;
+    double u = (double) (r >> 11) / (double) (1ULL << 53);
+    size_t span = opts.max_size - opts.min_size;
+    if (!opts.exponential)
+        return opts.min_size + (size_t) (u * (span + 1));
+    double size = opts.min_size - log(1 - u) * span / 2;
+    return (size > opts.max_size ? opts.max_size : (size_t) size);
+}
+
+/*
+ * make_message --
+ *
+ * write message index of the endpoint after the frame header in ep->msg. the same index always makes the
+ * same message, so one vipo missed can be sent again. RETURN its length
+ */
+static size_t make_message(sim_endpoint_t *ep, uint64_t index)
+{
+    char *at = ep->msg + DPI_FRAME_HDR_SIZE;
+    if (opts.replay != NULL) {
+        size_t i = index % opts.nreplay;
+        memcpy(at, opts.replay[i], opts.replay_len[i]);
+        return opts.replay_len[i];
+    }
+    uint64_t r = splitmix(index * 31 + ep->id);
+    uint32_t device = (uint32_t) (r % opts.devices);
+    size_t len = (size_t) sprintf(at, "{\"mac\":\"02:%02x:%02x:%02x:%02x:%02x\",\"ip\":\"10.%u.%u.%u\","
+                                  "\"seq\":%llu,\"seen\":%ld,\"pad\":\"",
+                                  ep->id & 0xFF, (device >> 24) & 0xFF, (device >> 16) & 0xFF,
+                                  (device >> 8) & 0xFF, device & 0xFF, (device >> 16) & 0xFF,
+                                  (device >> 8) & 0xFF, device & 0xFF, (unsigned long long) index,
+                                  (long) time(NULL));
+    size_t want = pick_size(splitmix(r));
+    if (want > len + 2) {
+        memset(at + len, 'x', want - len - 2);
+        len = want - 2;
+    }
+    memcpy(at + len, "\"}", 2);
+    return len + 2;
+}
+
+static int more_to_send(sim_endpoint_t *ep)
+{
+    if (opts.seconds > 0 && ep->total == UINT64_MAX &&
+        now_ns() - ep->start_ns >= (uint64_t) (opts.seconds * NS))
+        ep->total = ep->next;
+    return ep->next < ep->total;
+}
+
+/* RETURN when the next message is due, in ns */
+static uint64_t due_at(sim_endpoint_t *ep)
+{
+    return (opts.rate > 0 ? ep->start_ns + (uint64_t) (ep->next * (NS / opts.rate)) : 0);
+}
+
+static void record_sent(sim_endpoint_t *ep, size_t len)
+{
+    if (ep->next >= ep->sent_cap) {
+        ep->sent_cap = (ep->sent_cap == 0 ? 4096 : ep->sent_cap * 2);
+        ep->sent_at = realloc(ep->sent_at, ep->sent_cap * sizeof(uint64_t));
+        ep->latency = realloc(ep->latency, ep->sent_cap * sizeof(uint32_t));
+    }
+    ep->sent_at[ep->next++] = now_ns();
+    ep->bytes += len;
+}
+
+/* vipo has acknowledged messages up to index upto */
+static void record_acked(sim_endpoint_t *ep, uint64_t upto)
+{
+    if (upto > ep->next)
+        upto = ep->next;
+    if (upto <= ep->acked)
+        return;
+    uint64_t now = now_ns();
+    for (; ep->acked < upto; ep->acked++)
+        ep->latency[ep->acked] = (uint32_t) ((now - ep->sent_at[ep->acked]) / 1000);
+    ep->end_ns = now;
+}
+
+static int send_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+            return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * take whatever acknowledgements have arrived, without waiting. base is the index of the first message
+ * sent on this connection. RETURN -1 when vipo has gone or sent something unexpected
+ */
+static int read_acks(sim_endpoint_t *ep, int fd, dpi_decoder_t *dec, uint64_t base, uint64_t *window,
+                     uint64_t *legacy_bytes)
+{
+    for (;;) {
+        size_t avail;
+        char *at = dpi_decoder_space(dec, &avail);
+        ssize_t n = recv(fd, at, avail, MSG_DONTWAIT);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (n <= 0)
+            return -1;
+        if (opts.legacy) {
+            // every ACK is 3 bytes, and there's nothing else
+            *legacy_bytes += n;
+            dpi_decoder_reset(dec);
+            record_acked(ep, base + *legacy_bytes / (sizeof(PROT_ACK) - 1));
+            continue;
+        }
+        dpi_decoder_commit(dec, n);
+        dpi_frame_t frame;
+        int rc;
+        while ((rc = dpi_decoder_next(dec, &frame)) == 1) {
+            uint64_t count;
+            uint32_t w;
+            if (frame.buf != NULL || dpi_ack_decode(&frame, &count, &w) != 0) {
+                if (frame.buf != NULL)
+                    vmebuf_dealloc(frame.buf);
+                fprintf(stderr, "%s: unexpected frame type %d from vipo\n", ep->address, frame.type);
+                return -1;
+            }
+            record_acked(ep, base + count);
+            *window = (w == 0 ? 1 : w);
+        }
+        if (rc == -1)
+            return -1;
+    }
+}
+
+/* one connection from vipo over a socket. RETURN 0 once everything is acknowledged, -1 if vipo went away */
+static int run_socket(sim_endpoint_t *ep, int fd)
+{
+    dpi_decoder_t dec;
+    dpi_decoder_init(&dec, 4096);
+    uint64_t base = ep->acked, window = 1, legacy_bytes = 0;
+    uint64_t last_progress = now_ns();
+    int rc = -1;
+    ep->next = ep->acked;
+
+    for (;;) {
+        int more = more_to_send(ep);
+        if (!more && ep->acked == ep->next) {
+            rc = 0;
+            break;
+        }
+        uint64_t now = now_ns();
+        long wait = -1;
+        if (more && ep->next - ep->acked < window) {
+            uint64_t due = due_at(ep);
+            if (due <= now) {
+                size_t len = make_message(ep, ep->next);
+                char *frame = ep->msg;
+                size_t frame_len = len + DPI_FRAME_HDR_SIZE;
+                if (opts.legacy) {
+                    frame += DPI_FRAME_HDR_SIZE;
+                    frame_len -= DPI_FRAME_HDR_SIZE;
+                } else {
+                    dpi_frame_header(frame, DPI_FRAME_DATA, (uint32_t) len);
+                }
+                if (send_all(fd, frame, frame_len) != 0)
+                    break;
+                record_sent(ep, len);
+                if (read_acks(ep, fd, &dec, base, &window, &legacy_bytes) != 0)
+                    break;
+                continue;
+            }
+            wait = (long) ((due - now + 999999) / 1000000);
+        }
+        if (wait == -1 || wait > ACK_TIMEOUT_MS)
+            wait = ACK_TIMEOUT_MS;
+
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int n = poll(&pfd, 1, (int) wait);
+        if (n == -1 && errno != EINTR)
+            break;
+        uint64_t acked = ep->acked;
+        if (n > 0 && read_acks(ep, fd, &dec, base, &window, &legacy_bytes) != 0)
+            break;
+        if (ep->acked != acked || ep->acked == ep->next) {
+            last_progress = now_ns();
+        } else if (now_ns() - last_progress >= (uint64_t) ACK_TIMEOUT_MS * 1000000) {
+            fprintf(stderr, "%s: nothing acknowledged for %d seconds, giving up\n", ep->address,
+                    ACK_TIMEOUT_MS / 1000);
+            ep->failed = 1;
+            rc = 0;
+            break;
+        }
+    }
+
+    if (rc == 0 && !ep->failed) {
+        char eot[DPI_FRAME_HDR_SIZE];
+        dpi_frame_header(eot, DPI_FRAME_EOT, 0);
+        if (opts.legacy)
+            send_all(fd, PROT_EOT, sizeof(PROT_EOT) - 1);
+        else
+            send_all(fd, eot, sizeof(eot));
+    }
+    dpi_decoder_free(&dec);
+    return rc;
+}
+
+/* vipo attached to the ring. RETURN as for run_socket */
+static int run_shm(sim_endpoint_t *ep)
+{
+    dpi_shm_producer_t *p = ep->shm;
+    uint64_t base = ep->acked;
+    ep->next = ep->acked;
+
+    while (more_to_send(ep)) {
+        uint64_t due;
+        while ((due = due_at(ep)) > now_ns()) {
+            uint64_t left = due - now_ns();
+            struct timespec nap = { 0, (long) (left < 1000000 ? left : 1000000) };
+            nanosleep(&nap, NULL);
+            record_acked(ep, base + dpi_shm_acked(p));
+        }
+        size_t len = make_message(ep, ep->next);
+        if (dpi_shm_send(p, ep->msg + DPI_FRAME_HDR_SIZE, len, ACK_TIMEOUT_MS) != 0)
+            goto failed;
+        record_sent(ep, len);
+        record_acked(ep, base + dpi_shm_acked(p));
+    }
+    while (ep->acked < ep->next) {
+        if (dpi_shm_wait_acked(p, ep->acked - base + 1, ACK_TIMEOUT_MS) != 0)
+            goto failed;
+        record_acked(ep, base + dpi_shm_acked(p));
+    }
+    dpi_shm_send_eot(p, 1000);
+    return 0;
+
+failed:
+    if (errno == EPIPE)
+        return -1;
+    fprintf(stderr, "%s: %s, giving up\n", ep->address, strerror(errno));
+    ep->failed = 1;
+    return 0;
+}
+
+static int accept_vipo(sim_endpoint_t *ep)
+{
+    if (ep->transport == SIM_SHM)
+        return dpi_shm_accept(ep->shm, -1);
+    int fd;
+    while ((fd = accept(ep->listen_fd, NULL, NULL)) == -1 && errno == EINTR)
+        ;
+    return fd;
+}
+
+static void *endpoint_main(void *arg)
+{
+    sim_endpoint_t *ep = arg;
+    for (;;) {
+        int fd = accept_vipo(ep);
+        if (fd == -1) {
+            fprintf(stderr, "%s: accept: %s\n", ep->address, strerror(errno));
+            ep->failed = 1;
+            break;
+        }
+        if (ep->start_ns == 0)
+            ep->start_ns = ep->end_ns = now_ns();
+        int rc = (ep->transport == SIM_SHM ? run_shm(ep) : run_socket(ep, fd));
+        if (ep->transport != SIM_SHM)
+            close(fd);
+        if (rc == 0)
+            break;
+        ep->reconnects++;
+        fprintf(stderr, "%s: vipo went away, sending again from message %llu\n", ep->address,
+                (unsigned long long) ep->acked);
+    }
+    return NULL;
+}
+
+static int listen_socket(sim_endpoint_t *ep)
+{
+    if (ep->transport == SIM_SHM) {
+        ep->shm = dpi_shm_listen(ep->address, 0);
+        return (ep->shm == NULL ? -1 : 0);
+    }
+    if (ep->transport == SIM_UNIX) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (*ep->address == '@') {
+            strncpy(addr.sun_path + 1, ep->address + 1, sizeof(addr.sun_path) - 2);
+        } else {
+            strncpy(addr.sun_path, ep->address, sizeof(addr.sun_path) - 1);
+            unlink(ep->address);
+        }
+        if ((ep->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+            return -1;
+        if (bind(ep->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+            return -1;
+        return listen(ep->listen_fd, 1);
+    }
+
+    char *host = NULL, *port = ep->address;
+    char *colon = strrchr(ep->address, ':');
+    if (colon != NULL) {
+        host = strndup(ep->address, colon - ep->address);
+        port = colon + 1;
+    }
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int rc = getaddrinfo(host, port, &hints, &res);
+    free(host);
+    if (rc != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    int on = 1;
+    rc = -1;
+    if ((ep->listen_fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) != -1 &&
+        setsockopt(ep->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == 0 &&
+        bind(ep->listen_fd, res->ai_addr, res->ai_addrlen) == 0)
+        rc = listen(ep->listen_fd, 1);
+    freeaddrinfo(res);
+    return rc;
+}
+
+/* one json document, or one message per non-empty line */
+static int load_replay(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *text = malloc(size + 1);
+    size_t got = fread(text, 1, size, fp);
+    fclose(fp);
+    text[got] = '\0';
+
+    size_t lines = 1;
+    for (size_t i = 0; i < got; i++)
+        lines += (text[i] == '\n');
+    opts.replay = malloc(lines * sizeof(char *));
+    opts.replay_len = malloc(lines * sizeof(size_t));
+    cJSON *doc = cJSON_Parse(text);
+    if (doc != NULL) {
+        cJSON_Delete(doc);
+        cJSON_Minify(text);
+        opts.replay[opts.nreplay] = text;
+        opts.replay_len[opts.nreplay++] = strlen(text);
+        return 0;
+    }
+    for (char *line = strtok(text, "\r\n"); line != NULL; line = strtok(NULL, "\r\n")) {
+        if (*line == '\0')
+            continue;
+        opts.replay[opts.nreplay] = line;
+        opts.replay_len[opts.nreplay++] = strlen(line);
+    }
+    return (opts.nreplay == 0 ? -1 : 0);
+}
+
+static int by_value(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *name, uint64_t messages, uint64_t bytes, uint64_t ns, uint32_t *latency,
+                   uint64_t reconnects)
+{
+    double secs = (ns > 0 ? (double) ns / NS : 0);
+    printf("%s: %llu messages, %.2fMB in %.2fs", name, (unsigned long long) messages, bytes / 1e6, secs);
+    if (secs > 0)
+        printf(", %.0f msgs/s, %.2fMB/s", messages / secs, bytes / 1e6 / secs);
+    if (messages > 0) {
+        double sum = 0;
+        qsort(latency, messages, sizeof(uint32_t), by_value);
+        for (uint64_t i = 0; i < messages; i++)
+            sum += latency[i];
+        printf("; ack latency avg %.2fms p50 %.2fms p99 %.2fms max %.2fms", sum / messages / 1000,
+               latency[messages / 2] / 1000.0, latency[messages * 99 / 100] / 1000.0,
+               latency[messages - 1] / 1000.0);
+    }
+    if (reconnects > 0)
+        printf(", %llu reconnects", (unsigned long long) reconnects);
+    printf("\n");
+}
+
+/* the address of copy i (from 0) of an endpoint given with -c */
+static char *nth_address(sim_transport_t transport, const char *address, int i, int copies)
+{
+    char *name;
+    if (copies == 1) {
+        name = strdup(address);
+    } else if (transport == SIM_TCP) {
+        const char *colon = strrchr(address, ':');
+        const char *port = (colon != NULL ? colon + 1 : address);
+        int hostlen = (int) (port - address);
+        name = malloc(strlen(address) + 16);
+        sprintf(name, "%.*s%ld", hostlen, address, strtol(port, NULL, 10) + i);
+    } else {
+        name = malloc(strlen(address) + 16);
+        sprintf(name, "%s-%d", address, i + 1);
+    }
+    return name;
+}
+
+int main(int argc, char *argv[])
+{
+    int copies = 1, c;
+    opts.count = DEFAULT_COUNT;
+    opts.min_size = opts.max_size = DEFAULT_SIZE;
+    opts.devices = DEFAULT_DEVICES;
+    while ((c = getopt(argc, argv, "c:n:d:r:s:ek:f:l")) != -1) {
+        switch (c) {
+        case 'c': copies = atoi(optarg); break;
+        case 'n': opts.count = strtoull(optarg, NULL, 10); break;
+        case 'd': opts.seconds = atof(optarg); break;
+        case 'r': opts.rate = atof(optarg); break;
+        case 's': {
+            char *end;
+            opts.min_size = opts.max_size = strtoul(optarg, &end, 10);
+            if (*end == '-')
+                opts.max_size = strtoul(end + 1, NULL, 10);
+            break;
+        }
+        case 'e': opts.exponential = 1; break;
+        case 'k': opts.devices = (uint32_t) strtoul(optarg, NULL, 10); break;
+        case 'f':
+            if (load_replay(optarg) != 0) {
+                fprintf(stderr, "cannot read messages from %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'l': opts.legacy = 1; break;
+        default:
+            fprintf(stderr, "%s", usage);
+            exit(1);
+        }
+    }
+    if (optind == argc || copies < 1 || opts.max_size < opts.min_size || opts.max_size > DPI_FRAME_MAX ||
+        opts.devices == 0) {
+        fprintf(stderr, "%s", usage);
+        exit(1);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    size_t largest = opts.max_size + 128;
+    for (size_t i = 0; i < opts.nreplay; i++) {
+        if (opts.replay_len[i] + 1 > largest)
+            largest = opts.replay_len[i] + 1;
+    }
+    int nendpoints = (argc - optind) * copies;
+    sim_endpoint_t *eps = calloc(nendpoints, sizeof(sim_endpoint_t));
+    for (int i = 0; i < nendpoints; i++) {
+        sim_endpoint_t *ep = &eps[i];
+        const char *arg = argv[optind + i / copies];
+        ep->transport = SIM_TCP;
+        if (strncmp(arg, "unix:", 5) == 0) {
+            ep->transport = SIM_UNIX;
+            arg += 5;
+        } else if (strncmp(arg, "shm:", 4) == 0) {
+            ep->transport = SIM_SHM;
+            arg += 4;
+        }
+        if (ep->transport == SIM_SHM && opts.legacy) {
+            fprintf(stderr, "-l doesn't apply to shared memory\n");
+            exit(1);
+        }
+        ep->address = nth_address(ep->transport, arg, i % copies, copies);
+        ep->id = i;
+        ep->total = (opts.seconds > 0 ? UINT64_MAX : opts.count);
+        ep->msg_cap = largest + DPI_FRAME_HDR_SIZE;
+        ep->msg = malloc(ep->msg_cap);
+        if (listen_socket(ep) != 0) {
+            fprintf(stderr, "cannot listen on %s: %s\n", ep->address, strerror(errno));
+            exit(1);
+        }
+        printf("waiting for vipo on %s\n", ep->address);
+    }
+    fflush(stdout);
+
+    for (int i = 0; i < nendpoints; i++)
+        pthread_create(&eps[i].thread, NULL, endpoint_main, &eps[i]);
+    uint64_t messages = 0, bytes = 0, reconnects = 0, first = 0, last = 0;
+    for (int i = 0; i < nendpoints; i++) {
+        pthread_join(eps[i].thread, NULL);
+        messages += eps[i].acked;
+        bytes += eps[i].bytes;
+        reconnects += eps[i].reconnects;
+        if (first == 0 || (eps[i].start_ns != 0 && eps[i].start_ns < first))
+            first = eps[i].start_ns;
+        if (eps[i].end_ns > last)
+            last = eps[i].end_ns;
+    }
+
+    uint32_t *all = malloc((messages > 0 ? messages : 1) * sizeof(uint32_t));
+    uint64_t at = 0;
+    int failed = 0;
+    for (int i = 0; i < nendpoints; i++) {
+        sim_endpoint_t *ep = &eps[i];
+        memcpy(all + at, ep->latency, ep->acked * sizeof(uint32_t));
+        at += ep->acked;
+        if (nendpoints > 1)
+            report(ep->address, ep->acked, ep->bytes, ep->end_ns - ep->start_ns, ep->latency, ep->reconnects);
+        failed |= ep->failed;
+        if (ep->transport == SIM_SHM)
+            dpi_shm_close(ep->shm);
+        else
+            close(ep->listen_fd);
+        free(ep->address);
+        free(ep->msg);
+        free(ep->sent_at);
+        free(ep->latency);
+    }
+    report("total", messages, bytes, last - first, all, reconnects);
+    free(all);
+    free(eps);
+    return failed;
+}
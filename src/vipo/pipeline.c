@@ -0,0 +1,441 @@
+//  pipeline.c
+//
+//  the worker and publisher stages of vipo, see pipeline.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pipeline.h"
+#include "cjson.h"
+#include "log.h"
+
+#define QUEUE_DEPTH 1024
+#define MIN_SHARD_DEPTH 64
+#define PUBLISH_BATCH 64
+#define REPORT_SECS 60
+
+typedef struct vipo_msg {
+    dpi_client_t *dpic;
+    uint64_t gen;
+    uint64_t seq;
+    struct timespec queued;     // when it entered the queue it is in
+    vmebuf_t *buf;              // as read, then compacted in place; NULL once handed to libvme
+    vipo_dedup_mark_t *marks;   // the records to remember once published
+    size_t nmarks;
+} vipo_msg_t;
+
+typedef struct vipo_stage {
+    const char *name;
+    pthread_mutex_t lock;       // guards the timings
+    uint64_t items;
+    double wait_ms;
+    double max_wait_ms;
+    double busy_ms;
+} vipo_stage_t;
+
+struct vipo_pipeline {
+    dpi_loop_t *loop;
+    VME vme;
+    vme_spool_t *spool;
+    vipo_dedup_t *dedup;
+    char *topic;
+    vipo_stage_t stages[VIPO_STAGES];   // parse, then publish
+    vipo_shards_t parse_in;             // one shard per worker
+    vipo_queue_t publish_in;
+    vipo_shard_by_t shard_by;
+    struct vipo_worker *workers;
+    int nworkers;
+    pthread_t publisher;
+    uint64_t published;
+    uint64_t bytes_out;
+    uint64_t rejected;
+    uint64_t failed;
+    uint64_t invalid;
+    uint64_t unchanged;         // messages with nothing left to publish after dedup
+    struct timespec last_report;
+};
+
+typedef struct vipo_worker {
+    vipo_pipeline_t *p;
+    int shard;
+    pthread_t thread;
+} vipo_worker_t;
+
+#define PARSE 0
+#define PUBLISH 1
+
+static const char *shard_by_name(vipo_shard_by_t shardBy)
+{
+    switch (shardBy) {
+    case VIPO_SHARD_DEVICE: return "device";
+    case VIPO_SHARD_CONNECTION: return "connection";
+    default: return "nothing";
+    }
+}
+
+static double elapsed_ms(const struct timespec *since, const struct timespec *now)
+{
+    return (now->tv_sec - since->tv_sec) * 1000.0 + (now->tv_nsec - since->tv_nsec) / 1e6;
+}
+
+static void stage_init(vipo_stage_t *stage, const char *name)
+{
+    memset(stage, 0, sizeof(vipo_stage_t));
+    stage->name = name;
+    pthread_mutex_init(&stage->lock, NULL);
+}
+
+static void stage_destroy(vipo_stage_t *stage)
+{
+    pthread_mutex_destroy(&stage->lock);
+}
+
+/* account for n messages taken off the stage's queue at start and finished now */
+static void stage_record(vipo_stage_t *stage, vipo_msg_t **msgs, size_t n, const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&stage->lock);
+    for (size_t i = 0; i < n; i++) {
+        double wait = elapsed_ms(&msgs[i]->queued, start);
+        stage->wait_ms += wait;
+        if (wait > stage->max_wait_ms)
+            stage->max_wait_ms = wait;
+    }
+    stage->busy_ms += elapsed_ms(start, &now);
+    stage->items += n;
+    pthread_mutex_unlock(&stage->lock);
+}
+
+static void finish(vipo_pipeline_t *p, vipo_msg_t *msg, int ok)
+{
+    dpi_loop_complete(p->loop, msg->dpic, msg->gen, msg->seq, ok);
+    if (ok && msg->nmarks > 0)
+        vipo_dedup_commit(p->dedup, msg->marks, msg->nmarks);
+    if (msg->buf != NULL)
+        vmebuf_dealloc(msg->buf);
+    free(msg->marks);
+    free(msg);
+}
+
+/*
+ * workers: drop what isn't json and, with dedup, the records that haven't
+ * changed. what is left keeps its buffer, with the whitespace taken out
+ * where it is, unless some of its records went and it has to be printed again.
+ * each works through its own shard, then helps with the unkeyed messages of
+ * the others.
+ */
+static void *worker_main(void *arg)
+{
+    vipo_worker_t *w = arg;
+    vipo_pipeline_t *p = w->p;
+    vipo_stage_t *stage = &p->stages[PARSE];
+    vipo_msg_t *msg;
+    while ((msg = vs_pop(&p->parse_in, w->shard)) != NULL) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        vmebuf_t *buf = msg->buf;
+        buf->data[buf->len] = '\0';
+        cJSON *json = cJSON_ParseWithOpts(buf->data, NULL, 1);
+        if (json == NULL) {
+            log_info("dropping a message that isn't json from %s", msg->dpic->address);
+            __atomic_add_fetch(&p->invalid, 1, __ATOMIC_RELAXED);
+            stage_record(stage, &msg, 1, &start);
+            finish(p, msg, 1);
+            continue;
+        }
+        if (p->dedup != NULL) {
+            int records = (cJSON_IsArray(json) ? cJSON_GetArraySize(json) : 1);
+            int left = vipo_dedup_filter(p->dedup, json, &msg->marks, &msg->nmarks);
+            if (left == 0) {
+                cJSON_Delete(json);
+                __atomic_add_fetch(&p->unchanged, 1, __ATOMIC_RELAXED);
+                stage_record(stage, &msg, 1, &start);
+                finish(p, msg, 1);
+                continue;
+            }
+            if (left < records) {
+                char *printed = cJSON_PrintUnformatted(json);
+                vmebuf_dealloc(buf);
+                buf = msg->buf = malloc(sizeof(vmebuf_t));
+                buf->data = printed;
+                buf->len = strlen(printed);
+                buf->limit = buf->len + 1;
+            }
+        }
+        cJSON_Delete(json);
+        cJSON_Minify(buf->data);
+        buf->len = strlen(buf->data);
+        stage_record(stage, &msg, 1, &start);
+        clock_gettime(CLOCK_MONOTONIC, &msg->queued);
+        if (vq_push(&p->publish_in, msg) != 0)
+            finish(p, msg, 0);
+    }
+    return NULL;
+}
+
+/*
+ * the publisher: a batch is whatever has queued up, at most PUBLISH_BATCH.
+ * with a spool the whole batch is made durable with one sync. otherwise
+ * each message's buffer is handed to libvme to publish as it is. a message
+ * the server refuses outright (see vme_rejected) counts as done, as sending
+ * it again can't help; any other failure leaves it unacknowledged, for the
+ * DPI to send again.
+ */
+static void publish_batch(vipo_pipeline_t *p, vipo_msg_t **batch, size_t n, int *ok)
+{
+    uint64_t published = 0, bytes = 0, rejected = 0;
+    if (p->spool != NULL) {
+        for (size_t i = 0; i < n; i++) {
+            ok[i] = (vme_spool_publish(p->spool, p->topic, batch[i]->buf->data, batch[i]->buf->len) == 0);
+            bytes += (ok[i] ? batch[i]->buf->len : 0);
+        }
+        if (vme_spool_sync(p->spool) != 0) {
+            log_info("failed to sync the spool");
+            memset(ok, 0, n * sizeof(int));
+            bytes = 0;
+        }
+        for (size_t i = 0; i < n; i++)
+            published += ok[i];
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            size_t len = batch[i]->buf->len;
+            vme_result_t *result = vme_publish_buf(p->vme, p->topic, batch[i]->buf, NULL, NULL);
+            batch[i]->buf = NULL;
+            ok[i] = 1;
+            if (result->vme_error_msg != NULL) {
+                log_info("publish to topic %s failed (HTTP %ld) with: %s", p->topic, result->vme_http_status, result->vme_error_msg);
+                ok[i] = vme_rejected(result);
+                rejected += ok[i];
+            } else {
+                published++;
+                bytes += len;
+            }
+            vme_free_result(result);
+        }
+    }
+    __atomic_add_fetch(&p->published, published, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&p->bytes_out, bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&p->rejected, rejected, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&p->failed, n - published - rejected, __ATOMIC_RELAXED);
+}
+
+static void *publisher_main(void *arg)
+{
+    vipo_pipeline_t *p = arg;
+    vipo_stage_t *stage = &p->stages[PUBLISH];
+    vipo_msg_t *batch[PUBLISH_BATCH];
+    int ok[PUBLISH_BATCH];
+    while (!vq_drained(&p->publish_in)) {
+        size_t n = vq_pop(&p->publish_in, (void **) batch, PUBLISH_BATCH, 1000);
+        if (n > 0) {
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            publish_batch(p, batch, n, ok);
+            stage_record(stage, batch, n, &start);
+            for (size_t i = 0; i < n; i++)
+                finish(p, batch[i], ok[i]);
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec - p->last_report.tv_sec >= REPORT_SECS) {
+            p->last_report = now;
+            vipo_pipeline_report(p);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * vipo_pipeline_start --
+ *
+ *      loop - where to report messages done with
+ *      vme - handle to publish with
+ *      spool - if not NULL, messages are spooled rather than published
+ *      topic - topic to publish to
+ *      workers - number of worker threads, 0 for one per core
+ *      dedup - if not NULL, only device records that changed are published
+ *      shardBy - which messages must be handled in order, by the same worker. VIPO_SHARD_DEVICE needs dedup
+ */
+vipo_pipeline_t *vipo_pipeline_start(dpi_loop_t *loop, VME vme, vme_spool_t *spool, const char *topic, int workers,
+                                     vipo_dedup_t *dedup, vipo_shard_by_t shardBy)
+{
+    vipo_pipeline_t *p = malloc(sizeof(vipo_pipeline_t));
+    memset(p, 0, sizeof(vipo_pipeline_t));
+    p->loop = loop;
+    p->vme = vme;
+    p->spool = spool;
+    p->dedup = dedup;
+    p->topic = strdup(topic);
+    p->shard_by = (shardBy == VIPO_SHARD_DEVICE && dedup == NULL ? VIPO_SHARD_NONE : shardBy);
+    stage_init(&p->stages[PARSE], "parse");
+    stage_init(&p->stages[PUBLISH], "publish");
+    clock_gettime(CLOCK_MONOTONIC, &p->last_report);
+
+    if (workers <= 0)
+        workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers <= 0)
+        workers = 1;
+    vs_init(&p->parse_in, workers, QUEUE_DEPTH / workers > MIN_SHARD_DEPTH ? QUEUE_DEPTH / workers : MIN_SHARD_DEPTH);
+    vq_init(&p->publish_in, QUEUE_DEPTH);
+    p->workers = malloc(workers * sizeof(vipo_worker_t));
+    for (int i = 0; i < workers; i++) {
+        p->workers[i].p = p;
+        p->workers[i].shard = i;
+        if (pthread_create(&p->workers[i].thread, NULL, worker_main, &p->workers[i]) != 0)
+            log_syserr("pthread_create");
+    }
+    p->nworkers = workers;
+    if (pthread_create(&p->publisher, NULL, publisher_main, p) != 0)
+        log_syserr("pthread_create");
+    log_info("pipeline: %d workers, sharded by %s", workers, shard_by_name(p->shard_by));
+    return p;
+}
+
+/*
+ * the shard a message goes to. by device, a message whose one record names its device goes to the worker
+ * that owns the device's dedup partition, and an array or a record without the key properties to any
+ * worker. by connection, everything from one DPI connection goes to the same worker.
+ */
+static uint64_t shard_key(vipo_pipeline_t *p, dpi_client_t *dpic, vmebuf_t *buf)
+{
+    if (p->shard_by == VIPO_SHARD_CONNECTION) {
+        uint64_t h = (uint64_t) (uintptr_t) dpic * 0x9E3779B97F4A7C15ULL;
+        return h ^ (h >> 32);
+    }
+    if (p->shard_by == VIPO_SHARD_DEVICE) {
+        buf->data[buf->len] = '\0';
+        uint64_t key = vipo_dedup_key(p->dedup, buf->data);
+        return (key == 0 ? VS_UNKEYED : VIPO_DEDUP_PARTITION(key));
+    }
+    return VS_UNKEYED;
+}
+
+/*
+ * vipo_pipeline_submit --
+ *
+ * the reader's side: pass a message in, waiting for room. the pipeline takes buf over, as dpi_msg_fn
+ * expects. RETURN 1 (it will be completed through the loop) or -1 if the pipeline is stopping.
+ */
+int vipo_pipeline_submit(vipo_pipeline_t *p, dpi_client_t *dpic, uint64_t seq, vmebuf_t *buf)
+{
+    vipo_msg_t *msg = malloc(sizeof(vipo_msg_t));
+    msg->dpic = dpic;
+    msg->gen = dpic->gen;
+    msg->seq = seq;
+    msg->buf = buf;
+    msg->marks = NULL;
+    msg->nmarks = 0;
+    clock_gettime(CLOCK_MONOTONIC, &msg->queued);
+    if (vs_push(&p->parse_in, msg, shard_key(p, dpic, buf)) != 0) {
+        vmebuf_dealloc(buf);
+        free(msg);
+        return -1;
+    }
+    return 1;
+}
+
+void vipo_pipeline_stats(vipo_pipeline_t *p, vipo_stage_stats_t stats[VIPO_STAGES])
+{
+    for (int i = 0; i < VIPO_STAGES; i++) {
+        vipo_stage_t *stage = &p->stages[i];
+        vipo_stage_stats_t *st = &stats[i];
+        memset(st, 0, sizeof(vipo_stage_stats_t));
+        st->name = stage->name;
+        if (i == PARSE) {
+            vipo_shards_stats_t in;
+            vs_stats(&p->parse_in, &in);
+            st->depth = in.depth;
+            st->max_depth = in.max_depth;
+            st->capacity = in.capacity;
+            st->full_waits = in.full_waits;
+            st->stolen = in.stolen;
+        } else {
+            pthread_mutex_lock(&p->publish_in.lock);
+            st->depth = p->publish_in.count;
+            st->max_depth = p->publish_in.max_depth;
+            st->capacity = p->publish_in.capacity;
+            st->full_waits = p->publish_in.full_waits;
+            pthread_mutex_unlock(&p->publish_in.lock);
+        }
+        pthread_mutex_lock(&stage->lock);
+        st->items = stage->items;
+        if (stage->items > 0) {
+            st->wait_ms = stage->wait_ms / stage->items;
+            st->busy_ms = stage->busy_ms / stage->items;
+        }
+        st->max_wait_ms = stage->max_wait_ms;
+        pthread_mutex_unlock(&stage->lock);
+    }
+}
+
+void vipo_pipeline_counts(vipo_pipeline_t *p, vipo_pipeline_counts_t *counts)
+{
+    counts->published = __atomic_load_n(&p->published, __ATOMIC_RELAXED);
+    counts->bytes_out = __atomic_load_n(&p->bytes_out, __ATOMIC_RELAXED);
+    counts->rejected = __atomic_load_n(&p->rejected, __ATOMIC_RELAXED);
+    counts->failed = __atomic_load_n(&p->failed, __ATOMIC_RELAXED);
+    counts->invalid = __atomic_load_n(&p->invalid, __ATOMIC_RELAXED);
+    counts->unchanged = __atomic_load_n(&p->unchanged, __ATOMIC_RELAXED);
+}
+
+/* log a line per stage */
+void vipo_pipeline_report(vipo_pipeline_t *p)
+{
+    vipo_stage_stats_t stats[VIPO_STAGES];
+    vipo_pipeline_stats(p, stats);
+    for (int i = 0; i < VIPO_STAGES; i++) {
+        log_info("pipeline %s: depth %zu/%zu (max %zu), %llu done, waited %.2fms avg %.2fms max, "
+                 "busy %.2fms avg, %llu full", stats[i].name, stats[i].depth, stats[i].capacity,
+                 stats[i].max_depth, (unsigned long long) stats[i].items, stats[i].wait_ms,
+                 stats[i].max_wait_ms, stats[i].busy_ms, (unsigned long long) stats[i].full_waits);
+    }
+    if (p->nworkers > 1)
+        log_info("pipeline: sharded by %s, %llu messages taken from another worker's shard",
+                 shard_by_name(p->shard_by), (unsigned long long) stats[PARSE].stolen);
+    vipo_pipeline_counts_t counts;
+    vipo_pipeline_counts(p, &counts);
+    log_info("pipeline: %llu published (%llu bytes), %llu rejected, %llu failed", (unsigned long long) counts.published,
+             (unsigned long long) counts.bytes_out, (unsigned long long) counts.rejected,
+             (unsigned long long) counts.failed);
+    if (counts.invalid > 0)
+        log_info("pipeline: %llu messages were not json", (unsigned long long) counts.invalid);
+    if (p->dedup != NULL) {
+        vipo_dedup_stats_t dd;
+        vipo_dedup_stats(p->dedup, &dd);
+        log_info("dedup: %llu of %llu records unchanged (%llu messages dropped), %llu refreshed, %llu unkeyed, "
+                 "%zu/%zu devices, %llu evicted", (unsigned long long) dd.unchanged,
+                 (unsigned long long) dd.records, (unsigned long long) counts.unchanged,
+                 (unsigned long long) dd.refreshed, (unsigned long long) dd.unkeyed, dd.devices, dd.capacity,
+                 (unsigned long long) dd.evicted);
+    }
+}
+
+/*
+ * vipo_pipeline_stop --
+ *
+ * finish what has been submitted and stop the threads. call once the loop has stopped submitting.
+ */
+void vipo_pipeline_stop(vipo_pipeline_t *p)
+{
+    if (p == NULL)
+        return;
+    vs_close(&p->parse_in);
+    for (int i = 0; i < p->nworkers; i++)
+        pthread_join(p->workers[i].thread, NULL);
+    vq_close(&p->publish_in);
+    pthread_join(p->publisher, NULL);
+    vipo_pipeline_report(p);
+    vs_destroy(&p->parse_in);
+    vq_destroy(&p->publish_in);
+    stage_destroy(&p->stages[PARSE]);
+    stage_destroy(&p->stages[PUBLISH]);
+    free(p->workers);
+    free(p->topic);
+    free(p);
+}
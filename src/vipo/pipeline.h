@@ -0,0 +1,69 @@
+//  pipeline.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#ifndef VIPO_PIPELINE_H
+#define VIPO_PIPELINE_H
+
+#include "vme.h"
+#include "dpi_loop.h"
+#include "queue.h"
+#include "shard.h"
+#include "dedup.h"
+
+/*
+ * the stages after the reader (the dpi loop): a pool of workers that
+ * validate and compact each discovery message, then a publisher that sends
+ * them on in batches, or spools them when there is a spool. a message
+ * stays in the buffer it was read into all the way to the publish. with
+ * dedup the workers also leave out device records that haven't changed. each stage reads
+ * from a bounded queue so a slow stage holds up the one before it, and in
+ * the end the DPI, whose messages aren't acknowledged until published.
+ *
+ * the workers' queue is sharded (shard.h). sharded by device, the messages
+ * about one device are handled in order by the worker that owns its part of
+ * the dedup table; by connection, those from one DPI connection are. what
+ * can't be placed goes to whichever worker is free.
+ */
+typedef enum {
+    VIPO_SHARD_NONE,
+    VIPO_SHARD_CONNECTION,
+    VIPO_SHARD_DEVICE
+} vipo_shard_by_t;
+
+typedef struct vipo_pipeline vipo_pipeline_t;
+
+typedef struct vipo_stage_stats {
+    const char *name;
+    size_t      depth;          // messages waiting for this stage now
+    size_t      max_depth;
+    size_t      capacity;
+    uint64_t    items;          // messages this stage has finished
+    uint64_t    full_waits;     // times the stage before had to wait for room
+    uint64_t    stolen;         // messages a worker took from another's shard
+    double      wait_ms;        // average time a message waited in the queue
+    double      max_wait_ms;
+    double      busy_ms;        // average time spent on a message
+} vipo_stage_stats_t;
+
+#define VIPO_STAGES 2
+
+/* what became of the messages that went through */
+typedef struct vipo_pipeline_counts {
+    uint64_t    published;      // or spooled
+    uint64_t    bytes_out;      // of those, as compacted
+    uint64_t    rejected;       // refused by the server, not sent again
+    uint64_t    failed;         // left for the DPI to send again
+    uint64_t    invalid;        // not json
+    uint64_t    unchanged;      // nothing left to publish after dedup
+} vipo_pipeline_counts_t;
+
+vipo_pipeline_t *vipo_pipeline_start(dpi_loop_t *loop, VME vme, vme_spool_t *spool, const char *topic, int workers,
+                                     vipo_dedup_t *dedup, vipo_shard_by_t shardBy);
+int vipo_pipeline_submit(vipo_pipeline_t *p, dpi_client_t *dpic, uint64_t seq, vmebuf_t *buf);
+void vipo_pipeline_stats(vipo_pipeline_t *p, vipo_stage_stats_t stats[VIPO_STAGES]);
+void vipo_pipeline_counts(vipo_pipeline_t *p, vipo_pipeline_counts_t *counts);
+void vipo_pipeline_report(vipo_pipeline_t *p);
+void vipo_pipeline_stop(vipo_pipeline_t *p);
+
+#endif
@@ -0,0 +1,126 @@
+//  queue.c
+//
+//  bounded blocking queue, see queue.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "queue.h"
+
+void vq_init(vipo_queue_t *q, size_t capacity)
+{
+    memset(q, 0, sizeof(vipo_queue_t));
+    q->capacity = (capacity == 0 ? 1 : capacity);
+    q->items = malloc(q->capacity * sizeof(void *));
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&q->not_empty, &attr);
+    pthread_cond_init(&q->not_full, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+void vq_destroy(vipo_queue_t *q)
+{
+    pthread_cond_destroy(&q->not_full);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_mutex_destroy(&q->lock);
+    free(q->items);
+}
+
+/*
+ * vq_push --
+ *
+ * add an item, waiting for room. RETURN 0, or -1 if the queue has been closed
+ */
+int vq_push(vipo_queue_t *q, void *item)
+{
+    pthread_mutex_lock(&q->lock);
+    if (q->count == q->capacity && !q->closed)
+        q->full_waits++;
+    while (q->count == q->capacity && !q->closed)
+        pthread_cond_wait(&q->not_full, &q->lock);
+    if (q->closed) {
+        pthread_mutex_unlock(&q->lock);
+        return -1;
+    }
+    q->items[(q->head + q->count) % q->capacity] = item;
+    q->count++;
+    q->pushed++;
+    if (q->count > q->max_depth)
+        q->max_depth = q->count;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+/*
+ * vq_pop --
+ *
+ *      items - where to put what is taken
+ *      max - the most to take
+ *      waitMs - how long to wait for the first item, negative to wait until there is one or the queue is closed
+ *
+ * RETURN the number of items taken, 0 if none arrived in time or the queue is closed and empty
+ */
+size_t vq_pop(vipo_queue_t *q, void **items, size_t max, int waitMs)
+{
+    struct timespec deadline;
+    if (waitMs >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += waitMs / 1000;
+        deadline.tv_nsec += (waitMs % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && !q->closed) {
+        if (waitMs < 0)
+            pthread_cond_wait(&q->not_empty, &q->lock);
+        else if (pthread_cond_timedwait(&q->not_empty, &q->lock, &deadline) != 0)
+            break;
+    }
+    size_t n = 0;
+    while (n < max && q->count > 0) {
+        items[n++] = q->items[q->head];
+        q->head = (q->head + 1) % q->capacity;
+        q->count--;
+    }
+    if (n > 0)
+        pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+    return n;
+}
+
+/* wake everyone up; pushes fail from now on, pops return what's left and then 0 */
+void vq_close(vipo_queue_t *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+}
+
+size_t vq_depth(vipo_queue_t *q)
+{
+    pthread_mutex_lock(&q->lock);
+    size_t depth = q->count;
+    pthread_mutex_unlock(&q->lock);
+    return depth;
+}
+
+/* RETURN 1 once the queue is closed and everything in it has been taken */
+int vq_drained(vipo_queue_t *q)
+{
+    pthread_mutex_lock(&q->lock);
+    int drained = (q->closed && q->count == 0);
+    pthread_mutex_unlock(&q->lock);
+    return drained;
+}
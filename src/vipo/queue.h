@@ -0,0 +1,39 @@
+//  queue.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#ifndef VIPO_QUEUE_H
+#define VIPO_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * a bounded blocking queue between pipeline stages. producers wait while it
+ * is full, which is what pushes back on the stage before, and consumers wait
+ * while it is empty. it keeps the counts the stage metrics are made from.
+ */
+typedef struct vipo_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    void **items;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    int closed;
+    size_t max_depth;
+    uint64_t pushed;
+    uint64_t full_waits;        // pushes that had to wait for room
+} vipo_queue_t;
+
+void vq_init(vipo_queue_t *q, size_t capacity);
+void vq_destroy(vipo_queue_t *q);
+int vq_push(vipo_queue_t *q, void *item);
+size_t vq_pop(vipo_queue_t *q, void **items, size_t max, int waitMs);
+void vq_close(vipo_queue_t *q);
+int vq_drained(vipo_queue_t *q);
+size_t vq_depth(vipo_queue_t *q);
+
+#endif
@@ -0,0 +1,319 @@
+//  report.c
+//
+//  vipo's stats as JSON, see report.h. the document is put together from
+//  each part's own stats call when it is asked for, nothing is kept here.
+//  the thread sleeps in poll on the socket and a stop eventfd, waking to
+//  answer a connection or when the file is due.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#include "report.h"
+#include "cjson.h"
+#include "log.h"
+
+#define DEFAULT_INTERVAL_SECS 10
+#define SEND_TIMEOUT_SECS 1     // for a reader that connects and doesn't read
+
+struct vipo_report {
+    vipo_report_opts_t opts;
+    char *socket_path;
+    char *file_path;
+    int listen_fd;
+    int stop_fd;
+    struct timespec started;
+    pthread_t thread;
+};
+
+static double since_secs(const struct timespec *when)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - when->tv_sec) + (now.tv_nsec - when->tv_nsec) / 1e9;
+}
+
+static void add_count(cJSON *obj, const char *name, uint64_t n)
+{
+    cJSON_AddNumberToObject(obj, name, (double) n);
+}
+
+static void add_loop(cJSON *root, dpi_loop_t *loop)
+{
+    dpi_loop_stats_t st;
+    dpi_loop_stats(loop, &st);
+    cJSON *dpi = cJSON_AddObjectToObject(root, "dpi");
+    add_count(dpi, "endpoints", st.endpoints);
+    add_count(dpi, "connected", st.connected);
+    add_count(dpi, "connects", st.connects);
+    add_count(dpi, "dropped", st.dropped);
+    add_count(dpi, "received", st.received);
+    add_count(dpi, "bytes_in", st.bytes_in);
+    add_count(dpi, "acked", st.acked);
+}
+
+static void add_pipeline(cJSON *root, vipo_pipeline_t *p)
+{
+    vipo_pipeline_counts_t counts;
+    vipo_stage_stats_t stages[VIPO_STAGES];
+    vipo_pipeline_counts(p, &counts);
+    vipo_pipeline_stats(p, stages);
+    cJSON *pipeline = cJSON_AddObjectToObject(root, "pipeline");
+    add_count(pipeline, "published", counts.published);
+    add_count(pipeline, "bytes_out", counts.bytes_out);
+    add_count(pipeline, "rejected", counts.rejected);
+    add_count(pipeline, "failed", counts.failed);
+    add_count(pipeline, "invalid", counts.invalid);
+    add_count(pipeline, "unchanged", counts.unchanged);
+    for (int i = 0; i < VIPO_STAGES; i++) {
+        cJSON *stage = cJSON_AddObjectToObject(pipeline, stages[i].name);
+        add_count(stage, "depth", stages[i].depth);
+        add_count(stage, "max_depth", stages[i].max_depth);
+        add_count(stage, "capacity", stages[i].capacity);
+        add_count(stage, "done", stages[i].items);
+        add_count(stage, "full_waits", stages[i].full_waits);
+        add_count(stage, "stolen", stages[i].stolen);
+        cJSON_AddNumberToObject(stage, "wait_ms_avg", stages[i].wait_ms);
+        cJSON_AddNumberToObject(stage, "wait_ms_max", stages[i].max_wait_ms);
+        cJSON_AddNumberToObject(stage, "busy_ms_avg", stages[i].busy_ms);
+    }
+}
+
+static void add_dedup(cJSON *root, vipo_dedup_t *dedup)
+{
+    vipo_dedup_stats_t st;
+    vipo_dedup_stats(dedup, &st);
+    cJSON *dd = cJSON_AddObjectToObject(root, "dedup");
+    add_count(dd, "records", st.records);
+    add_count(dd, "unchanged", st.unchanged);
+    add_count(dd, "refreshed", st.refreshed);
+    add_count(dd, "unkeyed", st.unkeyed);
+    add_count(dd, "evicted", st.evicted);
+    add_count(dd, "devices", st.devices);
+    add_count(dd, "capacity", st.capacity);
+}
+
+static void add_vantiq(cJSON *root, VME vme)
+{
+    vme_stats_t st;
+    if (vme_get_stats(vme, &st) != 0)
+        return;
+    cJSON *vantiq = cJSON_AddObjectToObject(root, "vantiq");
+    add_count(vantiq, "requests", st.requests);
+    add_count(vantiq, "errors", st.errors);
+    add_count(vantiq, "bytes_out", st.bytes_out);
+    add_count(vantiq, "bytes_in", st.bytes_in);
+    add_count(vantiq, "published", st.published);
+    add_count(vantiq, "publish_errors", st.publish_errors);
+    add_count(vantiq, "publish_dropped", st.publish_dropped);
+    add_count(vantiq, "queue_depth", st.queue_depth);
+    add_count(vantiq, "queue_capacity", st.queue_capacity);
+    cJSON *latency = cJSON_AddObjectToObject(vantiq, "latency_ms");
+    cJSON_AddNumberToObject(latency, "avg", st.latency_avg_ms);
+    cJSON_AddNumberToObject(latency, "p50", st.latency_p50_ms);
+    cJSON_AddNumberToObject(latency, "p99", st.latency_p99_ms);
+    cJSON_AddNumberToObject(latency, "max", st.latency_max_ms);
+}
+
+/*
+ * vipo_report_json --
+ *
+ * RETURN the stats as they are now, a string to free
+ */
+char *vipo_report_json(vipo_report_t *r)
+{
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "uptime_secs", since_secs(&r->started));
+    if (r->opts.loop != NULL)
+        add_loop(root, r->opts.loop);
+    if (r->opts.pipeline != NULL)
+        add_pipeline(root, r->opts.pipeline);
+    if (r->opts.dedup != NULL)
+        add_dedup(root, r->opts.dedup);
+    if (r->opts.spool != NULL) {
+        cJSON *spool = cJSON_AddObjectToObject(root, "spool");
+        add_count(spool, "pending", vme_spool_pending(r->opts.spool));
+    }
+    if (r->opts.vme != NULL)
+        add_vantiq(root, r->opts.vme);
+    char *json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    return json;
+}
+
+static int write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        data += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+/* one document per connection, then hang up */
+static void answer(vipo_report_t *r)
+{
+    int fd = accept(r->listen_fd, NULL, NULL);
+    if (fd == -1) {
+        if (errno != EINTR && errno != EAGAIN)
+            log_info("report: accept on %s: %s", r->socket_path, strerror(errno));
+        return;
+    }
+    struct timeval tv = { SEND_TIMEOUT_SECS, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    char *json = vipo_report_json(r);
+    if (write_all(fd, json, strlen(json)) != 0 || write_all(fd, "\n", 1) != 0)
+        log_info("report: writing to a reader of %s: %s", r->socket_path, strerror(errno));
+    free(json);
+    close(fd);
+}
+
+/* replace the file, by way of a temporary one next to it */
+static void write_file(vipo_report_t *r)
+{
+    size_t len = strlen(r->file_path) + sizeof(".tmp");
+    char *tmp = malloc(len);
+    snprintf(tmp, len, "%s.tmp", r->file_path);
+    FILE *out = fopen(tmp, "w");
+    if (out == NULL) {
+        log_info("report: cannot write %s: %s", tmp, strerror(errno));
+        free(tmp);
+        return;
+    }
+    char *json = vipo_report_json(r);
+    fprintf(out, "%s\n", json);
+    free(json);
+    if (fclose(out) != 0 || rename(tmp, r->file_path) != 0) {
+        log_info("report: cannot replace %s: %s", r->file_path, strerror(errno));
+        unlink(tmp);
+    }
+    free(tmp);
+}
+
+static void *report_main(void *arg)
+{
+    vipo_report_t *r = arg;
+    struct pollfd fds[2];
+    fds[0].fd = r->stop_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = r->listen_fd;
+    fds[1].events = POLLIN;
+    int nfds = (r->listen_fd != -1 ? 2 : 1);
+    struct timespec last_write;
+    clock_gettime(CLOCK_MONOTONIC, &last_write);
+    for (;;) {
+        int timeout = -1;
+        if (r->file_path != NULL) {
+            double due = r->opts.interval_secs - since_secs(&last_write);
+            timeout = (due > 0 ? (int) (due * 1000) + 1 : 0);
+        }
+        int n = poll(fds, nfds, timeout);
+        if (n == -1 && errno != EINTR) {
+            log_info("report: poll: %s", strerror(errno));
+            break;
+        }
+        if (n > 0 && (fds[0].revents & POLLIN))
+            break;
+        if (n > 0 && nfds == 2 && (fds[1].revents & POLLIN))
+            answer(r);
+        if (r->file_path != NULL && since_secs(&last_write) >= r->opts.interval_secs) {
+            clock_gettime(CLOCK_MONOTONIC, &last_write);
+            write_file(r);
+        }
+    }
+    return NULL;
+}
+
+static int listen_on(const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (*path == '@') {
+        strncpy(addr.sun_path + 1, path + 1, sizeof(addr.sun_path) - 2);
+    } else {
+        strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+        unlink(path);
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(fd, 8) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * vipo_report_start --
+ *
+ *      opts - where to report to and what on. copied, but the parts it points to must outlive the report
+ *
+ * RETURN the running report, or NULL if the socket couldn't be listened on
+ */
+vipo_report_t *vipo_report_start(const vipo_report_opts_t *opts)
+{
+    vipo_report_t *r = malloc(sizeof(vipo_report_t));
+    memset(r, 0, sizeof(vipo_report_t));
+    r->opts = *opts;
+    if (r->opts.interval_secs <= 0)
+        r->opts.interval_secs = DEFAULT_INTERVAL_SECS;
+    r->socket_path = (opts->socket_path != NULL ? strdup(opts->socket_path) : NULL);
+    r->file_path = (opts->file_path != NULL ? strdup(opts->file_path) : NULL);
+    r->listen_fd = -1;
+    clock_gettime(CLOCK_MONOTONIC, &r->started);
+    if (r->socket_path != NULL && (r->listen_fd = listen_on(r->socket_path)) == -1) {
+        log_info("report: cannot listen on %s: %s", r->socket_path, strerror(errno));
+        free(r->socket_path);
+        free(r->file_path);
+        free(r);
+        return NULL;
+    }
+    if ((r->stop_fd = eventfd(0, EFD_CLOEXEC)) == -1)
+        log_syserr("eventfd");
+    if (pthread_create(&r->thread, NULL, report_main, r) != 0)
+        log_syserr("pthread_create");
+    return r;
+}
+
+/*
+ * vipo_report_stop --
+ *
+ * stop answering, write the file one last time and remove the socket
+ */
+void vipo_report_stop(vipo_report_t *r)
+{
+    if (r == NULL)
+        return;
+    uint64_t one = 1;
+    ssize_t rc = write(r->stop_fd, &one, sizeof(one));
+    (void) rc;
+    pthread_join(r->thread, NULL);
+    if (r->file_path != NULL)
+        write_file(r);
+    if (r->listen_fd != -1) {
+        close(r->listen_fd);
+        if (*r->socket_path != '@')
+            unlink(r->socket_path);
+    }
+    close(r->stop_fd);
+    free(r->socket_path);
+    free(r->file_path);
+    free(r);
+}
@@ -0,0 +1,38 @@
+//  report.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#ifndef VIPO_REPORT_H
+#define VIPO_REPORT_H
+
+#include "vme.h"
+#include "dpi_loop.h"
+#include "pipeline.h"
+#include "dedup.h"
+
+/*
+ * vipo's counters and gauges as one JSON document: what the loop has read
+ * from the DPIs, what became of it in the pipeline, dedup, the spool and
+ * what libvme has sent (vme_get_stats). a thread of its own serves it to
+ * whoever connects to a unix socket, one document per connection, and/or
+ * rewrites a file with it every so often. the file is replaced whole, so
+ * readers never see half of one.
+ */
+typedef struct vipo_report_opts {
+    const char     *socket_path;    // NULL for no socket, a leading @ for the abstract namespace
+    const char     *file_path;      // NULL for no file
+    int             interval_secs;  // between writes of the file
+    dpi_loop_t     *loop;
+    vipo_pipeline_t *pipeline;
+    vipo_dedup_t   *dedup;          // any of these may be NULL
+    vme_spool_t    *spool;
+    VME             vme;
+} vipo_report_opts_t;
+
+typedef struct vipo_report vipo_report_t;
+
+vipo_report_t *vipo_report_start(const vipo_report_opts_t *opts);
+char *vipo_report_json(vipo_report_t *r);
+void vipo_report_stop(vipo_report_t *r);
+
+#endif
@@ -0,0 +1,228 @@
+//  shard.c
+//
+//  the sharded input to the worker pool, see shard.h. each shard has its
+//  own lock, taken by its worker and by the reader pushing to it; other
+//  workers only take it to steal, which they do from the shard with the
+//  most unkeyed items waiting. the loads the reader and thieves pick
+//  shards by are read without the lock, so they are only a guide.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shard.h"
+
+static size_t load_of(const size_t *count)
+{
+    return __atomic_load_n(count, __ATOMIC_RELAXED);
+}
+
+static void ring_put(vs_ring_t *ring, size_t capacity, void *item)
+{
+    ring->items[(ring->head + ring->count) % capacity] = item;
+    __atomic_store_n(&ring->count, ring->count + 1, __ATOMIC_RELAXED);
+}
+
+static void *ring_take(vs_ring_t *ring, size_t capacity)
+{
+    void *item = ring->items[ring->head];
+    ring->head = (ring->head + 1) % capacity;
+    __atomic_store_n(&ring->count, ring->count - 1, __ATOMIC_RELAXED);
+    return item;
+}
+
+static size_t depth(const vipo_shard_t *shard)
+{
+    return shard->keyed.count + shard->unkeyed.count;
+}
+
+/*
+ * vs_init --
+ *
+ *      nshards - one per worker
+ *      capacity - items each shard holds before pushes to it wait
+ */
+void vs_init(vipo_shards_t *s, int nshards, size_t capacity)
+{
+    memset(s, 0, sizeof(vipo_shards_t));
+    s->nshards = (nshards < 1 ? 1 : nshards);
+    s->capacity = (capacity == 0 ? 1 : capacity);
+    if (posix_memalign((void **) &s->shards, 64, s->nshards * sizeof(vipo_shard_t)) != 0)
+        abort();
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    for (int i = 0; i < s->nshards; i++) {
+        vipo_shard_t *shard = &s->shards[i];
+        memset(shard, 0, sizeof(vipo_shard_t));
+        shard->keyed.items = malloc(s->capacity * sizeof(void *));
+        shard->unkeyed.items = malloc(s->capacity * sizeof(void *));
+        pthread_mutex_init(&shard->lock, NULL);
+        pthread_cond_init(&shard->not_empty, &attr);
+        pthread_cond_init(&shard->not_full, &attr);
+    }
+    pthread_condattr_destroy(&attr);
+}
+
+void vs_destroy(vipo_shards_t *s)
+{
+    for (int i = 0; i < s->nshards; i++) {
+        vipo_shard_t *shard = &s->shards[i];
+        pthread_cond_destroy(&shard->not_full);
+        pthread_cond_destroy(&shard->not_empty);
+        pthread_mutex_destroy(&shard->lock);
+        free(shard->keyed.items);
+        free(shard->unkeyed.items);
+    }
+    free(s->shards);
+}
+
+/* the shard with the least waiting, counting what its worker has in hand */
+static vipo_shard_t *least_loaded(vipo_shards_t *s)
+{
+    int start = (int) (__atomic_fetch_add(&s->next, 1, __ATOMIC_RELAXED) % s->nshards);
+    vipo_shard_t *best = NULL;
+    size_t best_load = 0;
+    for (int i = 0; i < s->nshards; i++) {
+        vipo_shard_t *shard = &s->shards[(start + i) % s->nshards];
+        size_t load = load_of(&shard->keyed.count) + load_of(&shard->unkeyed.count) +
+                      (size_t) __atomic_load_n(&shard->busy, __ATOMIC_RELAXED);
+        if (best == NULL || load < best_load) {
+            best = shard;
+            best_load = load;
+            if (load == 0)
+                break;
+        }
+    }
+    return best;
+}
+
+/*
+ * vs_push --
+ *
+ *      key - picks the shard, VS_UNKEYED for an item any worker may take
+ *
+ * add an item, waiting for room. RETURN 0, or -1 once the shards are closed
+ */
+int vs_push(vipo_shards_t *s, void *item, uint64_t key)
+{
+    vipo_shard_t *shard = (key != VS_UNKEYED ? &s->shards[key % s->nshards] : least_loaded(s));
+    pthread_mutex_lock(&shard->lock);
+    if (depth(shard) == s->capacity && !__atomic_load_n(&s->closed, __ATOMIC_RELAXED))
+        shard->full_waits++;
+    while (depth(shard) == s->capacity && !__atomic_load_n(&s->closed, __ATOMIC_RELAXED))
+        pthread_cond_wait(&shard->not_full, &shard->lock);
+    if (__atomic_load_n(&s->closed, __ATOMIC_RELAXED)) {
+        pthread_mutex_unlock(&shard->lock);
+        return -1;
+    }
+    ring_put(key != VS_UNKEYED ? &shard->keyed : &shard->unkeyed, s->capacity, item);
+    if (depth(shard) > shard->max_depth)
+        shard->max_depth = depth(shard);
+    pthread_cond_signal(&shard->not_empty);
+    pthread_mutex_unlock(&shard->lock);
+    return 0;
+}
+
+/* take an unkeyed item from whichever other shard has the most. RETURN NULL when none has any */
+static void *steal(vipo_shards_t *s, int thief)
+{
+    for (;;) {
+        vipo_shard_t *victim = NULL;
+        size_t most = 0;
+        for (int i = 0; i < s->nshards; i++) {
+            size_t n = load_of(&s->shards[i].unkeyed.count);
+            if (i != thief && n > most) {
+                victim = &s->shards[i];
+                most = n;
+            }
+        }
+        if (victim == NULL)
+            return NULL;
+        pthread_mutex_lock(&victim->lock);
+        void *item = NULL;
+        if (victim->unkeyed.count > 0) {
+            item = ring_take(&victim->unkeyed, s->capacity);
+            victim->stolen++;
+            pthread_cond_signal(&victim->not_full);
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if (item != NULL)
+            return item;
+    }
+}
+
+/*
+ * vs_pop --
+ *
+ *      shard - the calling worker's own
+ *
+ * take the next item for a worker: its own keyed items first, then its own unkeyed ones, then another's. waits
+ * while there are none. RETURN NULL once the shards are closed and the worker's own is empty
+ */
+void *vs_pop(vipo_shards_t *s, int shard)
+{
+    vipo_shard_t *own = &s->shards[shard];
+    for (;;) {
+        void *item = NULL;
+        pthread_mutex_lock(&own->lock);
+        if (own->keyed.count > 0)
+            item = ring_take(&own->keyed, s->capacity);
+        else if (own->unkeyed.count > 0)
+            item = ring_take(&own->unkeyed, s->capacity);
+        if (item != NULL) {
+            __atomic_store_n(&own->busy, 1, __ATOMIC_RELAXED);
+            pthread_cond_signal(&own->not_full);
+            pthread_mutex_unlock(&own->lock);
+            return item;
+        }
+        pthread_mutex_unlock(&own->lock);
+
+        if ((item = steal(s, shard)) != NULL) {
+            __atomic_store_n(&own->busy, 1, __ATOMIC_RELAXED);
+            return item;
+        }
+
+        pthread_mutex_lock(&own->lock);
+        if (depth(own) == 0) {
+            __atomic_store_n(&own->busy, 0, __ATOMIC_RELAXED);
+            if (__atomic_load_n(&s->closed, __ATOMIC_RELAXED)) {
+                pthread_mutex_unlock(&own->lock);
+                return NULL;
+            }
+            pthread_cond_wait(&own->not_empty, &own->lock);
+        }
+        pthread_mutex_unlock(&own->lock);
+    }
+}
+
+/* wake everyone up; pushes fail from now on, pops return what's left and then NULL */
+void vs_close(vipo_shards_t *s)
+{
+    __atomic_store_n(&s->closed, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < s->nshards; i++) {
+        vipo_shard_t *shard = &s->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        pthread_cond_broadcast(&shard->not_empty);
+        pthread_cond_broadcast(&shard->not_full);
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+void vs_stats(vipo_shards_t *s, vipo_shards_stats_t *stats)
+{
+    memset(stats, 0, sizeof(vipo_shards_stats_t));
+    stats->capacity = s->capacity * s->nshards;
+    for (int i = 0; i < s->nshards; i++) {
+        vipo_shard_t *shard = &s->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        stats->depth += depth(shard);
+        if (shard->max_depth > stats->max_depth)
+            stats->max_depth = shard->max_depth;
+        stats->full_waits += shard->full_waits;
+        stats->stolen += shard->stolen;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
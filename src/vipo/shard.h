@@ -0,0 +1,64 @@
+//  shard.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#ifndef VIPO_SHARD_H
+#define VIPO_SHARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * the input to a pool of workers, one shard per worker. a keyed item always
+ * goes to shard key % shards and only that shard's worker takes it, in
+ * the order pushed, so whatever a key stands for (a device, a connection) is
+ * handled by one thread at a time and in order. unkeyed items go to the
+ * least loaded shard, and a worker with nothing of its own steals them from
+ * the others. each shard is bounded: pushes wait for room, as with
+ * vipo_queue_t.
+ */
+#define VS_UNKEYED UINT64_MAX
+
+typedef struct vs_ring {
+    void **items;
+    size_t head;
+    size_t count;
+} vs_ring_t;
+
+typedef struct vipo_shard {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    vs_ring_t keyed;
+    vs_ring_t unkeyed;
+    int busy;                   // its worker has something in hand
+    size_t max_depth;
+    uint64_t full_waits;
+    uint64_t stolen;            // unkeyed items other workers took from it
+} __attribute__((aligned(64))) vipo_shard_t;
+
+typedef struct vipo_shards {
+    vipo_shard_t *shards;
+    int nshards;
+    size_t capacity;            // of each shard
+    unsigned next;              // where the search for the least loaded starts, to spread ties
+    int closed;
+} vipo_shards_t;
+
+typedef struct vipo_shards_stats {
+    size_t depth;
+    size_t max_depth;           // the deepest any one shard has been
+    size_t capacity;            // of all of them together
+    uint64_t full_waits;
+    uint64_t stolen;
+} vipo_shards_stats_t;
+
+void vs_init(vipo_shards_t *s, int nshards, size_t capacity);
+void vs_destroy(vipo_shards_t *s);
+int vs_push(vipo_shards_t *s, void *item, uint64_t key);
+void *vs_pop(vipo_shards_t *s, int shard);
+void vs_close(vipo_shards_t *s);
+void vs_stats(vipo_shards_t *s, vipo_shards_stats_t *stats);
+
+#endif
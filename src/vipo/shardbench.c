@@ -0,0 +1,221 @@
+//  shardbench.c
+//
+//  measures how the worker stage scales with cores. a reader thread feeds
+//  made up discovery messages through the sharded queue (shard.h) to 1..N
+//  workers that do what vipo's do with each one: parse it, drop unchanged
+//  device records (dedup.h) and compact it. it is run three ways: single
+//  records sharded by device, arrays of records that can't be placed and
+//  are left to whichever worker is free, and everything unsharded.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "shard.h"
+#include "dedup.h"
+#include "cjson.h"
+
+#define DEFAULT_MESSAGES 200000
+#define DEFAULT_DEVICES 10000
+#define DEFAULT_SIZE 512
+#define TEMPLATES 8192          // distinct messages, cycled through
+#define ARRAY_RECORDS 4
+#define SHARD_DEPTH 256
+
+static char *usage = "shardbench [-n messages] [-w max workers] [-k devices] [-s record size]";
+
+typedef enum {
+    BY_DEVICE,
+    UNKEYED,
+    UNSHARDED
+} bench_mode_t;
+
+typedef struct bench {
+    vipo_shards_t in;
+    vipo_dedup_t *dedup;
+    uint64_t published;
+} bench_t;
+
+typedef struct bench_worker {
+    bench_t *b;
+    int shard;
+    pthread_t thread;
+} bench_worker_t;
+
+typedef struct bench_msg {
+    size_t len;
+    char data[];
+} bench_msg_t;
+
+static char *templates[TEMPLATES];
+static size_t template_len[TEMPLATES];
+static size_t template_rssi[TEMPLATES];     // where the first record's two digit rssi is
+
+/* RETURN the offset of the rssi digits */
+static size_t make_record(char *at, size_t size, unsigned device, unsigned seq)
+{
+    int len = sprintf(at, "{\"mac\":\"02:00:%02x:%02x:%02x:%02x\", \"seq\":%u, \"rssi\":",
+                      (device >> 24) & 0xFF, (device >> 16) & 0xFF, (device >> 8) & 0xFF, device & 0xFF, seq);
+    size_t rssi = (size_t) len;
+    len += sprintf(at + len, "%02u, \"pad\":\"", device % 100);
+    if ((size_t) len + 2 < size) {
+        memset(at + len, 'x', size - len - 2);
+        len = (int) size - 2;
+    }
+    strcpy(at + len, "\"}");
+    return rssi;
+}
+
+/* arrays of records for UNKEYED, single records otherwise */
+static void make_templates(bench_mode_t mode, unsigned devices, size_t size)
+{
+    size_t records = (mode == UNKEYED ? ARRAY_RECORDS : 1);
+    for (int i = 0; i < TEMPLATES; i++) {
+        char *t = templates[i] = realloc(templates[i], records * (size + 128) + 8);
+        char *at = t;
+        if (mode == UNKEYED)
+            *at++ = '[';
+        for (size_t r = 0; r < records; r++) {
+            if (r > 0)
+                *at++ = ',';
+            unsigned seq = (unsigned) (i * records + r);
+            size_t rssi = make_record(at, size, seq % devices, seq);
+            if (r == 0)
+                template_rssi[i] = (size_t) (at - t) + rssi;
+            at += strlen(at);
+        }
+        if (mode == UNKEYED)
+            *at++ = ']';
+        *at = '\0';
+        template_len[i] = (size_t) (at - t);
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    bench_worker_t *w = arg;
+    bench_t *b = w->b;
+    bench_msg_t *msg;
+    uint64_t published = 0;
+    while ((msg = vs_pop(&b->in, w->shard)) != NULL) {
+        cJSON *json = cJSON_ParseWithOpts(msg->data, NULL, 1);
+        vipo_dedup_mark_t *marks = NULL;
+        size_t nmarks = 0;
+        int left = vipo_dedup_filter(b->dedup, json, &marks, &nmarks);
+        if (left > 0) {
+            if (cJSON_IsArray(json) && left < cJSON_GetArraySize(json))
+                free(cJSON_PrintUnformatted(json));
+            else
+                cJSON_Minify(msg->data);
+            vipo_dedup_commit(b->dedup, marks, nmarks);
+            published++;
+        }
+        cJSON_Delete(json);
+        free(marks);
+        free(msg);
+    }
+    __atomic_add_fetch(&b->published, published, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static double now_secs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* RETURN messages per second through nworkers */
+static double run(bench_mode_t mode, int nworkers, uint64_t messages, unsigned devices)
+{
+    bench_t b;
+    memset(&b, 0, sizeof(b));
+    vs_init(&b.in, nworkers, SHARD_DEPTH);
+    b.dedup = vipo_dedup_create("mac", "seq", devices * 2, 0);
+    bench_worker_t *workers = malloc(nworkers * sizeof(bench_worker_t));
+    double start = now_secs();
+    for (int i = 0; i < nworkers; i++) {
+        workers[i].b = &b;
+        workers[i].shard = i;
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+
+    // the reader: copy each message into a buffer of its own, as vipo reads them, and place it
+    for (uint64_t i = 0; i < messages; i++) {
+        size_t t = i % TEMPLATES;
+        bench_msg_t *msg = malloc(sizeof(bench_msg_t) + template_len[t] + 1);
+        msg->len = template_len[t];
+        memcpy(msg->data, templates[t], msg->len + 1);
+        // the first record changes every other time round
+        unsigned rssi = (unsigned) ((i / TEMPLATES / 2 * 7 + t) % 100);
+        msg->data[template_rssi[t]] = (char) ('0' + rssi / 10);
+        msg->data[template_rssi[t] + 1] = (char) ('0' + rssi % 10);
+        uint64_t key = VS_UNKEYED;
+        if (mode == BY_DEVICE) {
+            uint64_t device = vipo_dedup_key(b.dedup, msg->data);
+            key = (device == 0 ? VS_UNKEYED : VIPO_DEDUP_PARTITION(device));
+        }
+        vs_push(&b.in, msg, key);
+    }
+    vs_close(&b.in);
+    for (int i = 0; i < nworkers; i++)
+        pthread_join(workers[i].thread, NULL);
+    double secs = now_secs() - start;
+
+    vipo_shards_stats_t stats;
+    vs_stats(&b.in, &stats);
+    if (stats.stolen > 0 && nworkers > 1)
+        fprintf(stderr, "  %d workers: %llu stolen\n", nworkers, (unsigned long long) stats.stolen);
+    vs_destroy(&b.in);
+    vipo_dedup_free(b.dedup);
+    free(workers);
+    return messages / secs;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t messages = DEFAULT_MESSAGES;
+    int max_workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned devices = DEFAULT_DEVICES;
+    size_t size = DEFAULT_SIZE;
+    int c;
+    while ((c = getopt(argc, argv, "n:w:k:s:")) != -1) {
+        switch (c) {
+        case 'n': messages = strtoull(optarg, NULL, 10); break;
+        case 'w': max_workers = atoi(optarg); break;
+        case 'k': devices = (unsigned) strtoul(optarg, NULL, 10); break;
+        case 's': size = strtoul(optarg, NULL, 10); break;
+        default:
+            fprintf(stderr, "%s\n", usage);
+            exit(1);
+        }
+    }
+    if (max_workers < 1 || devices == 0 || messages == 0) {
+        fprintf(stderr, "%s\n", usage);
+        exit(1);
+    }
+
+    static const char *names[] = { "by device", "unkeyed arrays", "unsharded" };
+    printf("%llu messages, %u devices, %zu byte records, %ld cores\n", (unsigned long long) messages, devices,
+           size, sysconf(_SC_NPROCESSORS_ONLN));
+    for (bench_mode_t mode = BY_DEVICE; mode <= UNSHARDED; mode++) {
+        make_templates(mode, devices, size);
+        printf("%s:\n", names[mode]);
+        double base = 0;
+        for (int n = 1; n <= max_workers; n = (n < max_workers && n * 2 > max_workers ? max_workers : n * 2)) {
+            double rate = run(mode, n, messages, devices);
+            if (n == 1)
+                base = rate;
+            printf("  %3d workers %10.0f msgs/s  x%.2f\n", n, rate, rate / base);
+            fflush(stdout);
+        }
+    }
+    for (int i = 0; i < TEMPLATES; i++)
+        free(templates[i]);
+    return 0;
+}
@@ -1,24 +1,61 @@
 //
-//  vipo.c 
+//  vipo.c
 //
 //  a C-based prototype application that delivers device discovery
 //  data provided by a 3rd party packet inspector to the VANTIQ server
 //
+//  runs until interrupted, keeping a connection open to every DPI endpoint
+//  listed in the config file (DPIPORT and DPISOCKETPATH both take a comma
+//  separated list) and publishing each message as it arrives, or spooling
+//  it to disk for delivery in the background when SPOOLDIR is set. reading,
+//  parsing and publishing run as a pipeline of threads, see pipeline.h,
+//  with the parsing sharded across cores.
+//  with DEDUPKEY set, only device records that changed are published, see
+//  dedup.h. STATSSOCKET and STATSFILE make its counters available as JSON,
+//  see report.h.
+//
 //  Copyright © 2018 VANTIQ. All rights reserved.
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <signal.h>
 #include <assert.h>
 
 #include "vme.h"
 #include "dpi_client.h"
+#include "dpi_loop.h"
+#include "pipeline.h"
+#include "report.h"
 #include "cjson.h"
 
+#define DISCOVERY_TOPIC "/ChinaUnicom/SmartHome/Discovery"
+#define DEDUP_DEVICES 65536
+#define DEDUP_REFRESH_SECS 600
+
 static char *usage = "vipo <config file path>";
 
 vmeconfig_t config;
 
+static dpi_loop_t *loop;
+
+static void on_signal(int sig)
+{
+    dpi_loop_stop(loop);
+}
+
+/*
+ * the loop reads, the pipeline's workers check and compact each message and
+ * its publisher sends them on (or spools them, when SPOOLDIR is set). the
+ * DPI hears that a message is taken once it's published or spooled.
+ */
+static int submit_msg(void *state, dpi_client_t *dpic, uint64_t seq, vmebuf_t *msg)
+{
+    vipo_pipeline_t **pipeline = state;
+    return vipo_pipeline_submit(*pipeline, dpic, seq, msg);
+}
+
 #ifdef CU_TEST
 int vipo_main(int argc, char *argv[])
 {
@@ -31,39 +68,91 @@ int main(int argc, char *argv[])
         exit(1);
 	}
 
-    vmeconfig_t config;
-    vme_parse_config(argv[1], &config);
+    if (vme_parse_config(argv[1], &config) == -1) {
+        fprintf(stderr, "cannot read config file %s\n", argv[1]);
+        exit(1);
+    }
 	VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+    if (vme == NULL) {
+        fprintf(stderr, "failed to connect to the VANTIQ server at %s\n", config.vantiq_url);
+        exit(1);
+    }
 
-    dpi_client_t *dpic = NULL;
-    int retries = 0;
-    do {
-        dpic =
-            (config.dpi_port != NULL ?
-                init_dpi_inet_client(config.dpi_port) :
-                init_dpi_usock_client(config.dpi_socket_path));
-        if (dpic == NULL) {
-            if (config.dpi_port != NULL)
-                fprintf(stderr, "failed to establish connection to the DPI on localhost port %s", config.dpi_port);
-            else
-                fprintf(stderr, "failed to establish connection to the DPI on unix socket %s", config.dpi_socket_path);
+    vme_spool_t *spool = NULL;
+    if (config.spool_dir != NULL && (spool = vme_spool_open(vme, config.spool_dir, NULL)) == NULL) {
+        fprintf(stderr, "cannot open spool directory %s\n", config.spool_dir);
+        exit(1);
+    }
+
+    vipo_pipeline_t *pipeline = NULL;
+    loop = dpi_loop_create(submit_msg, NULL, &pipeline);
+    if (config.dpi_credit != NULL)
+        dpi_loop_set_window(loop, (uint32_t) strtoul(config.dpi_credit, NULL, 10));
+    int endpoints = dpi_loop_add_list(loop, DPI_INET, config.dpi_port) +
+                    dpi_loop_add_list(loop, DPI_USOCK, config.dpi_socket_path) +
+                    dpi_loop_add_list(loop, DPI_SHM, config.dpi_shm_path);
+    if (endpoints == 0) {
+        fprintf(stderr, "no DPI endpoints configured, set DPIPORT, DPISOCKETPATH and/or DPISHMPATH\n");
+        exit(1);
+    }
+
+    vipo_dedup_t *dedup = NULL;
+    if (config.dedup_key != NULL) {
+        dedup = vipo_dedup_create(config.dedup_key, config.dedup_ignore,
+                                  config.dedup_size != NULL ? strtoul(config.dedup_size, NULL, 10) : DEDUP_DEVICES,
+                                  config.dedup_refresh != NULL ? atoi(config.dedup_refresh) : DEDUP_REFRESH_SECS);
+    }
+
+    vipo_shard_by_t shard_by = (dedup != NULL ? VIPO_SHARD_DEVICE : VIPO_SHARD_NONE);
+    if (config.shard_by != NULL) {
+        if (strcasecmp(config.shard_by, "device") == 0 && dedup != NULL) {
+            shard_by = VIPO_SHARD_DEVICE;
+        } else if (strcasecmp(config.shard_by, "connection") == 0) {
+            shard_by = VIPO_SHARD_CONNECTION;
+        } else if (strcasecmp(config.shard_by, "none") == 0) {
+            shard_by = VIPO_SHARD_NONE;
+        } else {
+            fprintf(stderr, "SHARDBY must be device (with DEDUPKEY set), connection or none\n");
+            exit(1);
         }
-    } while (retries-- > 0);
-
-    char *msg = NULL;
-    vme_result_t *result = NULL;
-    if (dpic != NULL) {
-        /* this will block until message receipt */
-        msg = fetch_discovery_msg(dpic);
-        // TODO: should only have to specify the topic not the full REST API path
-        result = vme_publish(vme, "/ChinaUnicom/SmartHome/Discovery", msg, strlen(msg));
-        if (result->vme_error_msg != NULL) {
-            fprintf(stderr, "publish to topic %s failed with: %s\n", "/ChinaUnicom/SmartHome/Discovery", result->vme_error_msg);
+    }
+
+    pipeline = vipo_pipeline_start(loop, vme, spool, DISCOVERY_TOPIC,
+                                   config.workers != NULL ? atoi(config.workers) : 0, dedup, shard_by);
+
+    vipo_report_t *report = NULL;
+    if (config.stats_socket != NULL || config.stats_file != NULL) {
+        vipo_report_opts_t opts = {
+            .socket_path = config.stats_socket,
+            .file_path = config.stats_file,
+            .interval_secs = (config.stats_interval != NULL ? atoi(config.stats_interval) : 0),
+            .loop = loop,
+            .pipeline = pipeline,
+            .dedup = dedup,
+            .spool = spool,
+            .vme = vme
+        };
+        if ((report = vipo_report_start(&opts)) == NULL) {
+            fprintf(stderr, "cannot serve stats on %s\n", config.stats_socket);
+            exit(1);
         }
-        free(msg);
-        vme_free_result(result);
     }
 
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int rc = dpi_loop_run(loop);
+
+    vipo_report_stop(report);
+    vipo_pipeline_stop(pipeline);
+    vipo_dedup_free(dedup);
+    dpi_loop_destroy(loop);
+    vme_spool_close(spool);
     vme_teardown(vme);
-    exit(0);
+    exit(rc == 0 ? 0 : 1);
 }
@@ -0,0 +1,232 @@
+//
+//  adapt.c
+//
+//  a controller that sizes batches (and the number of batches in flight) from what it observes instead of from a
+//  guess. every request reports its rows, bytes and latency. once per round (a request per connection in use) the
+//  controller decides: over the latency target or failing, the batch size is halved (and on failure so is the
+//  concurrency); under it, the batch grows, quickly at first and by small steps once bigger batches stop buying
+//  more rows/sec. extra connections are tried now and then and given back if they didn't raise throughput.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "adapt.h"
+#include "log.h"
+
+#define DEFAULT_TARGET_MS       1000
+#define DEFAULT_MIN_COUNT       10
+#define DEFAULT_MAX_COUNT       5000
+#define DEFAULT_MAX_BYTES       (4 * 1024 * 1024)
+#define DEFAULT_MAX_CONCURRENCY 8
+#define ALPHA                   0.3     // weight of the newest sample in the moving averages
+#define PROBE_ROUNDS            4       // rounds under target between tries at another connection
+#define HOLD_ROUNDS             16      // rounds to leave concurrency alone after a try that didn't pay off
+
+struct vme_adapt {
+    pthread_mutex_t     lock;
+    vme_adapt_opts_t    opts;
+    double              count;          // current batch size, in instances
+    int                 concurrency;
+    double              latency;        // moving averages
+    double              rate;
+    double              inst_bytes;
+    int                 slow_start;     // still growing geometrically
+    double              best_rate;
+    /* the round in progress */
+    uint32_t            round_samples;
+    uint32_t            round_failures;
+    double              round_latency;
+    double              round_rows;         // each request's rows times the requests in flight with it
+    double              round_ms;
+    /* concurrency probing */
+    int                 calm_rounds;
+    int                 hold;
+    int                 probing;
+    double              rate_before_probe;
+};
+
+double vc_elapsed_ms(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000.0 + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+/*
+ * vme_adapt_create --
+ *
+ *      opts - the latency target and the bounds the controller works within. NULL for the defaults: 1s per
+ *          request, 10 to 5000 instances and at most 4MB per batch, up to 8 connections.
+ *
+ * a controller can be shared by several writers or loads going to the same server.
+ */
+vme_adapt_t *vme_adapt_create(const vme_adapt_opts_t *opts)
+{
+    vme_adapt_t *a = malloc(sizeof(vme_adapt_t));
+    memset(a, 0, sizeof(vme_adapt_t));
+    if (opts != NULL)
+        a->opts = *opts;
+    if (a->opts.target_ms == 0)
+        a->opts.target_ms = DEFAULT_TARGET_MS;
+    if (a->opts.min_count == 0)
+        a->opts.min_count = DEFAULT_MIN_COUNT;
+    if (a->opts.max_count == 0)
+        a->opts.max_count = DEFAULT_MAX_COUNT;
+    if (a->opts.max_count < a->opts.min_count)
+        a->opts.max_count = a->opts.min_count;
+    if (a->opts.max_bytes == 0)
+        a->opts.max_bytes = DEFAULT_MAX_BYTES;
+    if (a->opts.max_concurrency <= 0)
+        a->opts.max_concurrency = DEFAULT_MAX_CONCURRENCY;
+    a->count = a->opts.min_count;
+    a->concurrency = 1;
+    a->slow_start = 1;
+    pthread_mutex_init(&a->lock, NULL);
+    return a;
+}
+
+void vme_adapt_free(vme_adapt_t *a)
+{
+    if (a == NULL)
+        return;
+    pthread_mutex_destroy(&a->lock);
+    free(a);
+}
+
+int vc_adapt_max_concurrency(const vme_adapt_t *a)
+{
+    return a->opts.max_concurrency;
+}
+
+static void settings_locked(const vme_adapt_t *a, vme_adapt_settings_t *s)
+{
+    s->batch_count = (uint32_t)a->count;
+    /* bytes only rein in batches of unusually large instances */
+    double bytes = (a->inst_bytes > 0 ? a->count * a->inst_bytes * 2 + 2 : (double)a->opts.max_bytes);
+    s->batch_bytes = (bytes < a->opts.max_bytes ? (size_t)bytes : a->opts.max_bytes);
+    s->concurrency = a->concurrency;
+    s->latency_ms = a->latency;
+    s->rows_per_sec = a->rate;
+}
+
+/*
+ * vme_adapt_settings --
+ *
+ *      a - controller returned by vme_adapt_create
+ *      settings - filled in with the current batch size and concurrency and the measurements behind them
+ */
+void vme_adapt_settings(vme_adapt_t *a, vme_adapt_settings_t *settings)
+{
+    pthread_mutex_lock(&a->lock);
+    settings_locked(a, settings);
+    pthread_mutex_unlock(&a->lock);
+}
+
+static void end_round(vme_adapt_t *a)
+{
+    double latency = a->round_latency / a->round_samples;
+    double rate = (a->round_ms > 0 ? a->round_rows * 1000.0 / a->round_ms : 0);
+    double target = a->opts.target_ms;
+
+    if (a->round_failures > 0 || latency > target) {
+        a->count *= 0.5;
+        a->slow_start = 0;
+        if (a->round_failures > 0 || a->count < a->opts.min_count) {
+            a->concurrency = (a->concurrency > 1 ? a->concurrency / 2 : 1);
+            a->hold = HOLD_ROUNDS;
+        } else if (a->probing) {
+            /* the extra connection is no use if requests got slower with it */
+            a->concurrency--;
+            a->hold = HOLD_ROUNDS;
+        }
+        a->probing = 0;
+        a->calm_rounds = 0;
+    } else {
+        if (a->probing) {
+            /* keep the extra connection only if it bought something */
+            if (rate < a->rate_before_probe * 1.05) {
+                a->concurrency--;
+                a->hold = HOLD_ROUNDS;
+            }
+            a->probing = 0;
+        }
+        /* a probe leaves the batch size alone for its round, so only the connection can take the credit */
+        if (a->hold > 0) {
+            a->hold--;
+        } else if (!a->slow_start && ++a->calm_rounds >= PROBE_ROUNDS && latency < target * 0.5
+                   && a->concurrency < a->opts.max_concurrency) {
+            a->rate_before_probe = rate;
+            a->concurrency++;
+            a->probing = 1;
+            a->calm_rounds = 0;
+        }
+        if (a->probing) {
+            /* growing resumes after the probe */
+        } else if (a->slow_start) {
+            double grow = target / (latency > 1 ? latency : 1);
+            a->count *= (grow < 2 ? (grow > 1.1 ? grow : 1.1) : 2);
+            if (rate < a->best_rate * 1.05)
+                a->slow_start = 0;
+        } else if (latency < target * 0.8) {
+            double step = a->count * 0.05;
+            a->count += (step > a->opts.min_count ? step : a->opts.min_count);
+        }
+    }
+    if (rate > a->best_rate)
+        a->best_rate = rate;
+    if (a->count < a->opts.min_count)
+        a->count = a->opts.min_count;
+    if (a->count > a->opts.max_count)
+        a->count = a->opts.max_count;
+
+    a->round_samples = a->round_failures = 0;
+    a->round_latency = a->round_rows = a->round_ms = 0;
+}
+
+/*
+ * vme_adapt_record --
+ *
+ *      a - the controller
+ *      rows / bytes - what the request carried
+ *      latencyMs - how long it took
+ *      inFlight - how many of the caller's requests were in flight together with it, itself included. throughput
+ *          is judged by what was actually sent in parallel, not by the concurrency the controller offered: a
+ *          caller that sends one batch at a time reports 1 and so never credits a probe with more rows/sec.
+ *      ok - whether the server took it
+ */
+void vme_adapt_record(vme_adapt_t *a, uint32_t rows, size_t bytes, double latencyMs, int inFlight, int ok)
+{
+    if (a == NULL)
+        return;
+    pthread_mutex_lock(&a->lock);
+    if (rows > 0) {
+        double inst = (double)bytes / rows;
+        a->inst_bytes = (a->inst_bytes == 0 ? inst : ALPHA * inst + (1 - ALPHA) * a->inst_bytes);
+    }
+    if (inFlight < 1)
+        inFlight = 1;
+    double rate = (latencyMs > 0 ? rows * 1000.0 / latencyMs * inFlight : 0);
+    a->latency = (a->latency == 0 ? latencyMs : ALPHA * latencyMs + (1 - ALPHA) * a->latency);
+    if (ok)
+        a->rate = (a->rate == 0 ? rate : ALPHA * rate + (1 - ALPHA) * a->rate);
+
+    a->round_samples++;
+    a->round_latency += latencyMs;
+    a->round_rows += (ok ? (double)rows * inFlight : 0);
+    a->round_ms += latencyMs;
+    if (!ok)
+        a->round_failures++;
+    if (a->round_samples >= (uint32_t)a->concurrency) {
+        uint32_t count = (uint32_t)a->count;
+        int concurrency = a->concurrency;
+        end_round(a);
+        if ((uint32_t)a->count != count || a->concurrency != concurrency)
+                log_debug("adaptive batching: %.0f instances, %d connections, %.1f ms, %.0f rows/s",
+                      a->count, a->concurrency, a->latency, a->rate);
+    }
+    pthread_mutex_unlock(&a->lock);
+}
@@ -0,0 +1,15 @@
+//  adapt.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#ifndef VANTIQ_ADAPT_H
+#define VANTIQ_ADAPT_H
+
+#include <time.h>
+
+#include "vme.h"
+
+int vc_adapt_max_concurrency(const vme_adapt_t *a);
+double vc_elapsed_ms(const struct timespec *since);
+
+#endif
@@ -0,0 +1,286 @@
+//
+//  bulkload.c
+//
+//  load a file of instances (a JSON array or NDJSON) into a type. the file is mapped rather than read; batches are
+//  lists of instance boundaries within the mapping, and each request body is produced by copying the instances
+//  straight from the mapping into libcurl's upload buffer with the brackets and commas of a JSON array around them.
+//  several batches are in flight at once on separate connections. a failed batch is reported with its position in
+//  the file so it can be retried.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vme.h"
+#include "jscan.h"
+#include "transfer.h"
+#include "utils.h"
+#include "vantiq_client.h"
+#include "adapt.h"
+#include "log.h"
+
+#define DEFAULT_BATCH_BYTES (256 * 1024)
+#define DEFAULT_BATCH_COUNT 500
+#define DEFAULT_CONCURRENCY 4
+
+typedef struct {
+    const char *map;
+    size_t     *spans;          // start / end (exclusive) offset of each instance
+    uint32_t    n;
+    uint32_t    max;
+    size_t      body_len;
+    /* upload progress */
+    int         phase;          // 0 '[', 1 instances, 2 ']', 3 done
+    uint32_t    elem;
+    size_t      elem_off;       // bytes of the current instance sent, the comma before it counts as one
+    struct timespec started;
+} load_batch_t;
+
+typedef struct {
+    const char *map;
+    size_t      size;
+    size_t      off;            // how far the scan got
+    vc_jscan_t  scan;
+    size_t      start;          // of the instance being scanned
+    size_t      pend_start;     // an instance scanned but too large for the batch it came up in
+    size_t      pend_end;
+    int         has_pending;
+    int         bad_input;
+} load_scan_t;
+
+static size_t batch_body(char *dst, size_t max, void *arg)
+{
+    load_batch_t *b = (load_batch_t *)arg;
+    size_t n = 0;
+    while (n < max && b->phase < 3) {
+        if (b->phase == 0) {
+            dst[n++] = '[';
+            b->phase = (b->n > 0 ? 1 : 2);
+        } else if (b->phase == 2) {
+            dst[n++] = ']';
+            b->phase = 3;
+        } else {
+            if (b->elem > 0 && b->elem_off == 0) {
+                dst[n++] = ',';
+                b->elem_off = 1;
+                continue;
+            }
+            size_t sent = b->elem_off - (b->elem > 0 ? 1 : 0);
+            size_t start = b->spans[2 * b->elem] + sent, end = b->spans[2 * b->elem + 1];
+            size_t len = (end - start < max - n ? end - start : max - n);
+            memcpy(dst + n, b->map + start, len);
+            n += len;
+            b->elem_off += len;
+            if (start + len == end) {
+                b->elem_off = 0;
+                if (++b->elem == b->n)
+                    b->phase = 2;
+            }
+        }
+    }
+    return n;
+}
+
+static void batch_add(load_batch_t *b, size_t start, size_t end)
+{
+    if (b->n == b->max) {
+        b->max = (b->max == 0 ? 64 : b->max * 2);
+        b->spans = realloc(b->spans, 2 * b->max * sizeof(size_t));
+    }
+    b->spans[2 * b->n] = start;
+    b->spans[2 * b->n + 1] = end;
+    b->n++;
+    b->body_len += (end - start) + (b->n > 1 ? 1 : 0);
+}
+
+/*
+ * take instances from the scan until the batch is full. an instance that would push a non empty batch over its
+ * byte budget is held back for the next batch; one that is bigger than the budget by itself goes alone.
+ * RETURN: 1 if the batch has instances, 0 at the end of the input
+ */
+static int next_batch(load_scan_t *s, load_batch_t *b, size_t maxBytes, uint32_t maxCount)
+{
+    b->n = 0;
+    b->body_len = 2;
+    b->phase = 0;
+    b->elem = 0;
+    b->elem_off = 0;
+    b->map = s->map;
+    if (s->has_pending) {
+        batch_add(b, s->pend_start, s->pend_end);
+        s->has_pending = 0;
+    }
+    while (b->n < maxCount && !s->bad_input) {
+        size_t end;
+        if (s->off < s->size) {
+            int event;
+            s->off += vc_jscan_next(&s->scan, s->map + s->off, s->size - s->off, &event);
+            if (event == JSCAN_START)
+                s->start = s->off - 1;
+            if (event != JSCAN_END)
+                continue;
+            end = s->off;
+        } else if (s->scan.in_scalar) {
+            /* a bare value at the very end of NDJSON ends with the file */
+            s->scan.in_scalar = 0;
+            end = s->size;
+        } else {
+            if (vc_jscan_in_element(&s->scan))
+                s->bad_input = 1;
+            break;
+        }
+        if (b->n > 0 && b->body_len + 1 + (end - s->start) > maxBytes) {
+            s->pend_start = s->start;
+            s->pend_end = end;
+            s->has_pending = 1;
+            break;
+        }
+        batch_add(b, s->start, end);
+    }
+    return b->n > 0;
+}
+
+/*
+ * vme_insert_file --
+ *
+ *      vme - handle returned from call to vme_init
+ *      rsURI - path to the resource we are inserting into
+ *      path - file holding a JSON array of instances or newline delimited instances
+ *      opts - batch size limits, number of connections, upsert and a per batch callback. NULL for the defaults
+ *          (256KB / 500 instances per batch, 4 connections, insert)
+ *
+ * RETURN: vme_count is the number of instances the server accepted. if any batch failed vme_error_msg says how
+ *      many, the callback in opts gets the details of each.
+ */
+vme_result_t *vme_insert_file(VME vme, const char *rsURI, const char *path, const vme_load_opts_t *opts)
+{
+    vantiq_client_t *vc = vc_from_vme(vme);
+    if (vc == NULL)
+        return vme_error_result("invalid VME handle");
+    vme_load_opts_t o;
+    memset(&o, 0, sizeof(o));
+    if (opts != NULL)
+        o = *opts;
+    if (o.batch_bytes == 0)
+        o.batch_bytes = DEFAULT_BATCH_BYTES;
+    if (o.batch_count == 0)
+        o.batch_count = DEFAULT_BATCH_COUNT;
+    if (o.concurrency <= 0)
+        o.concurrency = DEFAULT_CONCURRENCY;
+    vme_adapt_settings_t settings;
+    if (o.adapt != NULL) {
+        /* enough connections for the most the controller may ask for */
+        o.concurrency = vc_adapt_max_concurrency(o.adapt);
+    }
+
+    char errMsg[256];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        snprintf(errMsg, sizeof(errMsg), "can't open %.200s: %s", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return vme_error_result(errMsg);
+    }
+    load_scan_t scan;
+    memset(&scan, 0, sizeof(scan));
+    vc_jscan_init(&scan.scan);
+    scan.size = st.st_size;
+    if (scan.size > 0) {
+        void *map = mmap(NULL, scan.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            snprintf(errMsg, sizeof(errMsg), "can't map %.200s: %s", path, strerror(errno));
+            close(fd);
+            return vme_error_result(errMsg);
+        }
+        madvise(map, scan.size, MADV_SEQUENTIAL);
+        scan.map = map;
+    }
+    close(fd);
+
+    struct param *params = (o.upsert ? build_param(NULL, "upsert", "true") : NULL);
+    char *url = create_url(vc, rsURI, params);
+    free_params(params);
+
+    vc_xfer_pool_t *pool = vc_xfer_pool_create(vc, o.concurrency);
+    load_batch_t *batches = calloc(o.concurrency, sizeof(load_batch_t));
+    uint32_t inserted = 0, failed = 0, nBatches = 0;
+    int more = 1;
+    for (;;) {
+        vc_xfer_t *xfer;
+        size_t batchBytes = o.batch_bytes;
+        uint32_t batchCount = o.batch_count;
+        int concurrency = o.concurrency;
+        if (o.adapt != NULL) {
+            vme_adapt_settings(o.adapt, &settings);
+            batchBytes = settings.batch_bytes;
+            batchCount = settings.batch_count;
+            concurrency = settings.concurrency;
+        }
+        while (more && pool->active < concurrency && (xfer = vc_xfer_idle(pool)) != NULL) {
+            load_batch_t *b = &batches[xfer - pool->xfers];
+            more = next_batch(&scan, b, batchBytes, batchCount);
+            if (more) {
+                clock_gettime(CLOCK_MONOTONIC, &b->started);
+                vc_xfer_start(pool, xfer, "POST", url, b->body_len, batch_body, b, b);
+                nBatches++;
+            }
+        }
+        if ((xfer = vc_xfer_wait(pool, -1)) == NULL)
+            break;
+        load_batch_t *b = (load_batch_t *)xfer->user;
+        const char *err = vc_xfer_error(xfer);
+        /* it ran alongside the ones still going */
+        vme_adapt_record(o.adapt, b->n, b->body_len, vc_elapsed_ms(&b->started), pool->active + 1, err == NULL);
+        if (err != NULL) {
+            failed++;
+            log_debug("batch of %u instances at offset %zu failed: %s", b->n, b->spans[0], err);
+        } else {
+            inserted += b->n;
+        }
+        if (o.on_batch != NULL) {
+            vme_batch_t info;
+            info.offset = b->spans[0];
+            info.length = b->spans[2 * b->n - 1] - b->spans[0];
+            info.count = b->n;
+            info.data = scan.map + info.offset;
+            info.http_status = xfer->status;
+            info.error_msg = err;
+            o.on_batch(o.state, &info);
+        }
+        vc_xfer_release(pool, xfer);
+    }
+    vc_xfer_pool_destroy(pool);
+    for (int i = 0; i < o.concurrency; i++)
+        free(batches[i].spans);
+    free(batches);
+    free(url);
+    if (scan.map != NULL)
+        munmap((void *)scan.map, scan.size);
+
+    pthread_mutex_lock(&vc->lock);
+    if (vc->cache != NULL)
+        vc_cache_invalidate(vc->cache, rsURI);
+    pthread_mutex_unlock(&vc->lock);
+
+    vme_result_t *result;
+    if (scan.bad_input) {
+        snprintf(errMsg, sizeof(errMsg), "%.200s ends part way through an instance", path);
+        result = vme_error_result(errMsg);
+    } else if (failed > 0) {
+        snprintf(errMsg, sizeof(errMsg), "%u of %u batches failed", failed, nBatches);
+        result = vme_error_result(errMsg);
+    } else {
+        result = malloc(sizeof(vme_result_t));
+        memset(result, 0, sizeof(vme_result_t));
+    }
+    result->vme_count = inserted;
+    return result;
+}
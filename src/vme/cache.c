@@ -0,0 +1,245 @@
+//
+//  cache.c
+//
+//  an opt-in, per client cache of GET responses (selects and aggregates). entries are keyed by the full request url,
+//  expire after a TTL, are evicted least recently used first once the byte budget is exceeded, and are dropped when
+//  the client writes to the same resource type.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "cache.h"
+#include "log.h"
+
+#define CACHE_BUCKETS 64
+
+/* number of path segments in /api/vN/resources/<ns>/<name> */
+#define TYPE_PATH_SEGMENTS 5
+
+static time_t cache_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/*
+ * FNV-1a, plenty good enough to spread urls across a handful of buckets
+ */
+static uint32_t cache_hash(const char *str)
+{
+    uint32_t h = 2166136261u;
+    while (*str != '\0') {
+        h ^= (uint8_t)*str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*
+ * reduce a resource uri to the path of the type it refers to. e.g.
+ *      /api/v1/resources/custom/Employees/5b3a... -> /api/v1/resources/custom/Employees
+ *      /api/v1/resources/custom/Employees/aggregate -> /api/v1/resources/custom/Employees
+ * RETURN: allocated string, must be freed
+ */
+static char *type_path(const char *rsURI)
+{
+    const char *p = rsURI;
+    int segments = 0;
+    if (*p == '/')
+        p++;
+    while (*p != '\0') {
+        if (*p == '/' && ++segments == TYPE_PATH_SEGMENTS)
+            break;
+        p++;
+    }
+    size_t len = p - rsURI;
+    char *path = malloc(len + 1);
+    memcpy(path, rsURI, len);
+    path[len] = '\0';
+    return path;
+}
+
+static void lru_unlink(vc_cache_t *cache, vc_cache_entry_t *entry)
+{
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        cache->lru_head = entry->next;
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        cache->lru_tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void lru_push_head(vc_cache_t *cache, vc_cache_entry_t *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->lru_head;
+    if (cache->lru_head != NULL)
+        cache->lru_head->prev = entry;
+    cache->lru_head = entry;
+    if (cache->lru_tail == NULL)
+        cache->lru_tail = entry;
+}
+
+static void free_entry(vc_cache_entry_t *entry)
+{
+    free(entry->url);
+    free(entry->type_path);
+    free(entry->data);
+    free(entry->etag);
+    free(entry->last_modified);
+    free(entry);
+}
+
+/*
+ * unlink an entry from both its hash chain and the LRU list, then free it
+ */
+static void remove_entry(vc_cache_t *cache, vc_cache_entry_t *entry)
+{
+    vc_cache_entry_t **pp = &cache->buckets[entry->hash % CACHE_BUCKETS];
+    while (*pp != entry)
+        pp = &(*pp)->hnext;
+    *pp = entry->hnext;
+    lru_unlink(cache, entry);
+    cache->bytes -= entry->footprint;
+    free_entry(entry);
+}
+
+vc_cache_t *vc_cache_create(uint32_t ttlSecs, size_t maxBytes)
+{
+    vc_cache_t *cache = malloc(sizeof(vc_cache_t));
+    memset(cache, 0, sizeof(vc_cache_t));
+    cache->ttl = ttlSecs;
+    cache->max_bytes = maxBytes;
+    cache->buckets = calloc(CACHE_BUCKETS, sizeof(vc_cache_entry_t *));
+    return cache;
+}
+
+void vc_cache_destroy(vc_cache_t *cache)
+{
+    if (cache == NULL)
+        return;
+    vc_cache_entry_t *entry = cache->lru_head;
+    while (entry != NULL) {
+        vc_cache_entry_t *next = entry->next;
+        free_entry(entry);
+        entry = next;
+    }
+    free(cache->buckets);
+    free(cache);
+}
+
+/*
+ * find the entry for the url, fresh or not. a hit moves the entry to the head of the LRU list. stale entries are
+ * returned so the caller can revalidate them with the server.
+ */
+vc_cache_entry_t *vc_cache_lookup(vc_cache_t *cache, const char *url)
+{
+    uint32_t h = cache_hash(url);
+    vc_cache_entry_t *entry = cache->buckets[h % CACHE_BUCKETS];
+    while (entry != NULL && (entry->hash != h || strcmp(entry->url, url) != 0))
+        entry = entry->hnext;
+    if (entry != NULL) {
+        lru_unlink(cache, entry);
+        lru_push_head(cache, entry);
+    }
+    return entry;
+}
+
+int vc_cache_is_fresh(const vc_cache_entry_t *entry)
+{
+    return cache_now() < entry->expires;
+}
+
+/*
+ * the server told us (304 Not Modified) our copy is still good. give it another TTL worth of life
+ */
+void vc_cache_refresh(vc_cache_t *cache, vc_cache_entry_t *entry)
+{
+    entry->expires = cache_now() + cache->ttl;
+}
+
+/*
+ * add (or replace) the response for url. if the response by itself is larger than the budget we don't bother.
+ */
+void vc_cache_store(vc_cache_t *cache, const char *url, const char *rsURI, const vme_result_t *result,
+                    const char *etag, const char *lastModified)
+{
+    assert(result->vme_error_msg == NULL);
+
+    vc_cache_entry_t *old = vc_cache_lookup(cache, url);
+    if (old != NULL)
+        remove_entry(cache, old);
+
+    size_t footprint = sizeof(vc_cache_entry_t) + strlen(url) + 1 + result->vme_size
+        + (etag != NULL ? strlen(etag) + 1 : 0) + (lastModified != NULL ? strlen(lastModified) + 1 : 0);
+    if (footprint > cache->max_bytes)
+        return;
+    while (cache->bytes + footprint > cache->max_bytes && cache->lru_tail != NULL) {
+        log_trace("cache evicting %s", cache->lru_tail->url);
+        remove_entry(cache, cache->lru_tail);
+    }
+
+    vc_cache_entry_t *entry = malloc(sizeof(vc_cache_entry_t));
+    memset(entry, 0, sizeof(vc_cache_entry_t));
+    entry->url = strdup(url);
+    entry->hash = cache_hash(url);
+    entry->type_path = type_path(rsURI);
+    if (result->vme_size > 0) {
+        entry->data = malloc(result->vme_size);
+        memcpy(entry->data, result->vme_json_data, result->vme_size);
+    }
+    entry->size = result->vme_size;
+    entry->count = result->vme_count;
+    entry->etag = (etag != NULL ? strdup(etag) : NULL);
+    entry->last_modified = (lastModified != NULL ? strdup(lastModified) : NULL);
+    entry->expires = cache_now() + cache->ttl;
+    entry->footprint = footprint;
+
+    vc_cache_entry_t **bucket = &cache->buckets[entry->hash % CACHE_BUCKETS];
+    entry->hnext = *bucket;
+    *bucket = entry;
+    lru_push_head(cache, entry);
+    cache->bytes += footprint;
+}
+
+/*
+ * drop every entry that refers to the same type as rsURI. a NULL rsURI empties the cache.
+ */
+void vc_cache_invalidate(vc_cache_t *cache, const char *rsURI)
+{
+    char *path = (rsURI != NULL ? type_path(rsURI) : NULL);
+    vc_cache_entry_t *entry = cache->lru_head;
+    while (entry != NULL) {
+        vc_cache_entry_t *next = entry->next;
+        if (path == NULL || strcmp(entry->type_path, path) == 0)
+            remove_entry(cache, entry);
+        entry = next;
+    }
+    free(path);
+}
+
+/*
+ * hand back a copy of the cached response as though it just came from the server
+ */
+vme_result_t *vc_cache_result(const vc_cache_entry_t *entry)
+{
+    vme_result_t *result = malloc(sizeof(vme_result_t));
+    memset(result, 0, sizeof(vme_result_t));
+    if (entry->size > 0) {
+        result->vme_json_data = malloc(entry->size + 1);
+        memcpy(result->vme_json_data, entry->data, entry->size);
+        result->vme_json_data[entry->size] = '\0';
+    }
+    result->vme_size = entry->size;
+    result->vme_count = entry->count;
+    result->vme_http_status = 200;    // what the server answered when it was cached
+    return result;
+}
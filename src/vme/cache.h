@@ -0,0 +1,50 @@
+//  cache.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#ifndef VANTIQ_CACHE_H
+#define VANTIQ_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "vme.h"
+
+typedef struct vc_cache_entry {
+    char                  *url;         // full request url, the cache key
+    uint32_t               hash;
+    char                  *type_path;   // /api/vN/resources/<ns>/<name> used for invalidation
+    char                  *data;
+    size_t                 size;
+    uint32_t               count;
+    char                  *etag;
+    char                  *last_modified;
+    time_t                 expires;
+    size_t                 footprint;   // bytes charged against the cache budget
+    struct vc_cache_entry *hnext;       // hash bucket chain
+    struct vc_cache_entry *prev;        // LRU list, head is most recently used
+    struct vc_cache_entry *next;
+} vc_cache_entry_t;
+
+typedef struct vc_cache {
+    uint32_t           ttl;
+    size_t             max_bytes;
+    size_t             bytes;
+    vc_cache_entry_t **buckets;
+    vc_cache_entry_t  *lru_head;
+    vc_cache_entry_t  *lru_tail;
+} vc_cache_t;
+
+vc_cache_t *vc_cache_create(uint32_t ttlSecs, size_t maxBytes);
+void vc_cache_destroy(vc_cache_t *cache);
+
+vc_cache_entry_t *vc_cache_lookup(vc_cache_t *cache, const char *url);
+int vc_cache_is_fresh(const vc_cache_entry_t *entry);
+void vc_cache_refresh(vc_cache_t *cache, vc_cache_entry_t *entry);
+void vc_cache_store(vc_cache_t *cache, const char *url, const char *rsURI, const vme_result_t *result,
+                    const char *etag, const char *lastModified);
+void vc_cache_invalidate(vc_cache_t *cache, const char *rsURI);
+vme_result_t *vc_cache_result(const vc_cache_entry_t *entry);
+
+#endif
@@ -0,0 +1,247 @@
+//
+//  columns.c
+//
+//  decode a JSON array of (more or less) homogeneous instances, e.g. a page of select results, into columns:
+//  contiguous arrays of int64 / double / bool values, dictionary encoded strings and a null bitmap per column.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "vme.h"
+#include "cjson.h"
+#include "utils.h"
+#include "log.h"
+
+#define DICT_MIN_SLOTS 16
+
+/* string -> code hash table used while building a dictionary */
+typedef struct {
+    uint32_t   *slots;      // code + 1, 0 means empty
+    uint32_t    n_slots;
+    uint32_t    dict_limit;
+} dict_builder_t;
+
+static uint32_t str_hash(const char *str)
+{
+    uint32_t h = 2166136261u;
+    while (*str != '\0') {
+        h ^= (uint8_t)*str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void dict_grow(vme_column_t *col, dict_builder_t *db)
+{
+    uint32_t nSlots = db->n_slots * 2;
+    uint32_t *slots = calloc(nSlots, sizeof(uint32_t));
+    for (uint32_t code = 0; code < col->dict_size; code++) {
+        uint32_t i = str_hash(col->dict[code]) & (nSlots - 1);
+        while (slots[i] != 0)
+            i = (i + 1) & (nSlots - 1);
+        slots[i] = code + 1;
+    }
+    free(db->slots);
+    db->slots = slots;
+    db->n_slots = nSlots;
+}
+
+/*
+ * find the code for str, adding it to the dictionary if we haven't seen it before
+ */
+static uint32_t dict_code(vme_column_t *col, dict_builder_t *db, const char *str)
+{
+    uint32_t i = str_hash(str) & (db->n_slots - 1);
+    while (db->slots[i] != 0) {
+        uint32_t code = db->slots[i] - 1;
+        if (strcmp(col->dict[code], str) == 0)
+            return code;
+        i = (i + 1) & (db->n_slots - 1);
+    }
+    uint32_t code = col->dict_size++;
+    if (col->dict_size > db->dict_limit) {
+        db->dict_limit = (db->dict_limit == 0 ? DICT_MIN_SLOTS : db->dict_limit * 2);
+        col->dict = realloc(col->dict, db->dict_limit * sizeof(char *));
+    }
+    col->dict[code] = strdup(str);
+    db->slots[i] = code + 1;
+    /* keep the table at most half full */
+    if (col->dict_size * 2 > db->n_slots)
+        dict_grow(col, db);
+    return code;
+}
+
+static int is_integral(double d)
+{
+    return d >= -9.2233720368547758e18 && d < 9.2233720368547758e18 && d == (double)(int64_t)d;
+}
+
+/*
+ * the column type is that of the first non null value, except that integral numbers are widened to double as soon
+ * as a non integral value shows up.
+ */
+static vme_coltype_t infer_type(cJSON *instances, const char *path)
+{
+    vme_coltype_t type = VME_COL_NULL;
+    for (cJSON *inst = instances->child; inst != NULL; inst = inst->next) {
+        cJSON *value = json_lookup_path(inst, path);
+        if (value == NULL || cJSON_IsNull(value))
+            continue;
+        if (cJSON_IsNumber(value)) {
+            if (type == VME_COL_NULL)
+                type = VME_COL_INT64;
+            if (type == VME_COL_INT64 && !is_integral(value->valuedouble))
+                return VME_COL_DOUBLE;
+        } else if (type == VME_COL_NULL) {
+            if (cJSON_IsString(value))
+                return VME_COL_STRING;
+            if (cJSON_IsBool(value))
+                return VME_COL_BOOL;
+            /* objects and arrays don't make for a column */
+        }
+    }
+    return type;
+}
+
+static void fill_column(vme_column_t *col, cJSON *instances, size_t nRows)
+{
+    col->nulls = calloc((nRows + 7) / 8 + 1, 1);
+    dict_builder_t db = { NULL, 0, 0 };
+    switch (col->type) {
+        case VME_COL_INT64:  col->i64 = calloc(nRows + 1, sizeof(int64_t)); break;
+        case VME_COL_DOUBLE: col->f64 = calloc(nRows + 1, sizeof(double)); break;
+        case VME_COL_BOOL:   col->u8 = calloc(nRows + 1, sizeof(uint8_t)); break;
+        case VME_COL_STRING:
+            col->codes = calloc(nRows + 1, sizeof(uint32_t));
+            db.n_slots = DICT_MIN_SLOTS * 2;
+            db.slots = calloc(db.n_slots, sizeof(uint32_t));
+            break;
+        default: break;
+    }
+
+    size_t row = 0;
+    for (cJSON *inst = instances->child; inst != NULL; inst = inst->next, row++) {
+        cJSON *value = json_lookup_path(inst, col->name);
+        int isNull = 1;
+        if (value != NULL) {
+            switch (col->type) {
+                case VME_COL_INT64:
+                    if (cJSON_IsNumber(value)) {
+                        col->i64[row] = (int64_t)value->valuedouble;
+                        isNull = 0;
+                    }
+                    break;
+                case VME_COL_DOUBLE:
+                    if (cJSON_IsNumber(value)) {
+                        col->f64[row] = value->valuedouble;
+                        isNull = 0;
+                    }
+                    break;
+                case VME_COL_BOOL:
+                    if (cJSON_IsBool(value)) {
+                        col->u8[row] = cJSON_IsTrue(value) ? 1 : 0;
+                        isNull = 0;
+                    }
+                    break;
+                case VME_COL_STRING:
+                    if (cJSON_IsString(value)) {
+                        col->codes[row] = dict_code(col, &db, value->valuestring);
+                        isNull = 0;
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        if (isNull) {
+            col->nulls[row / 8] |= (uint8_t)(1 << (row % 8));
+            col->null_count++;
+        }
+    }
+    free(db.slots);
+}
+
+/*
+ * vme_decode_columns --
+ *
+ *      json - zero terminated JSON array of instances, e.g. vme_result_t::vme_json_data from a select
+ *      props - the properties to decode, dotted paths reach into nested objects. NULL means every property of the
+ *          first instance.
+ *      nProps - number of entries in props
+ *
+ *  RETURN: allocated columns, free with vme_free_columns. NULL if json isn't an array.
+ *
+ * values that don't match the type of their column (see vme.h) are decoded as nulls.
+ */
+vme_columns_t *vme_decode_columns(const char *json, const char **props, int nProps)
+{
+    cJSON *instances = cJSON_Parse(json);
+    if (instances == NULL || !cJSON_IsArray(instances)) {
+        log_debug("columnar decode expects a JSON array of instances");
+        cJSON_Delete(instances);
+        return NULL;
+    }
+
+    vme_columns_t *cols = malloc(sizeof(vme_columns_t));
+    memset(cols, 0, sizeof(vme_columns_t));
+    cols->n_rows = cJSON_GetArraySize(instances);
+
+    if (props == NULL) {
+        cJSON *first = instances->child;
+        nProps = 0;
+        if (first != NULL && cJSON_IsObject(first))
+            nProps = cJSON_GetArraySize(first);
+        cols->cols = calloc(nProps + 1, sizeof(vme_column_t));
+        int i = 0;
+        for (cJSON *prop = (nProps > 0 ? first->child : NULL); prop != NULL; prop = prop->next)
+            cols->cols[i++].name = strdup(prop->string);
+    } else {
+        cols->cols = calloc(nProps + 1, sizeof(vme_column_t));
+        for (int i = 0; i < nProps; i++)
+            cols->cols[i].name = strdup(props[i]);
+    }
+    cols->n_cols = nProps;
+
+    for (int i = 0; i < cols->n_cols; i++) {
+        vme_column_t *col = &cols->cols[i];
+        col->type = infer_type(instances, col->name);
+        fill_column(col, instances, cols->n_rows);
+    }
+    cJSON_Delete(instances);
+    return cols;
+}
+
+/*
+ * find a column by name, NULL if it wasn't decoded
+ */
+vme_column_t *vme_find_column(vme_columns_t *cols, const char *name)
+{
+    for (int i = 0; i < cols->n_cols; i++) {
+        if (strcmp(cols->cols[i].name, name) == 0)
+            return &cols->cols[i];
+    }
+    return NULL;
+}
+
+void vme_free_columns(vme_columns_t *cols)
+{
+    if (cols == NULL)
+        return;
+    for (int i = 0; i < cols->n_cols; i++) {
+        vme_column_t *col = &cols->cols[i];
+        for (uint32_t code = 0; code < col->dict_size; code++)
+            free(col->dict[code]);
+        free(col->dict);
+        free(col->codes);
+        free(col->i64);
+        free(col->f64);
+        free(col->u8);
+        free(col->nulls);
+        free(col->name);
+    }
+    free(cols->cols);
+    free(cols);
+}
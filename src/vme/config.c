@@ -22,7 +22,19 @@
 #define VANTIQ_URL "VANTIQ_BASEURL"
 #define VANTIQ_TOKEN "VANTIQTOKEN"
 #define DPI_SOCKET_PATH "DPISOCKETPATH"
+#define DPI_SHM_PATH "DPISHMPATH"
 #define LOG_LEVEL "LOG_LEVEL"
+#define DPI_CREDIT "DPICREDIT"
+#define SPOOL_DIR "SPOOLDIR"
+#define WORKERS "WORKERS"
+#define SHARD_BY "SHARDBY"
+#define DEDUP_KEY "DEDUPKEY"
+#define DEDUP_IGNORE "DEDUPIGNORE"
+#define DEDUP_SIZE "DEDUPSIZE"
+#define DEDUP_REFRESH "DEDUPREFRESH"
+#define STATS_SOCKET "STATSSOCKET"
+#define STATS_FILE "STATSFILE"
+#define STATS_INTERVAL "STATSINTERVAL"
 
 int set_config_param(vmeconfig_t *config, const char *key, const char *value);
 
@@ -116,6 +128,8 @@ int set_config_param(vmeconfig_t *config, const char *key, const char *value)
 		config->dpi_port = strdup(value);
     } else if (cmp_strings(key, DPI_SOCKET_PATH)) {
         config->dpi_socket_path = strdup(value);
+    } else if (cmp_strings(key, DPI_SHM_PATH)) {
+        config->dpi_shm_path = strdup(value);
     } else if (cmp_strings(key, VANTIQ_URL)) {
         size_t len = strlen(value);
         if (value[len-1] != '/') {
@@ -129,6 +143,28 @@ int set_config_param(vmeconfig_t *config, const char *key, const char *value)
 		config->vantiq_token = strdup(value);
     } else if (cmp_strings(key, LOG_LEVEL)) {
         config->log_level = strdup(value);
+    } else if (cmp_strings(key, DPI_CREDIT)) {
+        config->dpi_credit = strdup(value);
+    } else if (cmp_strings(key, SPOOL_DIR)) {
+        config->spool_dir = strdup(value);
+    } else if (cmp_strings(key, WORKERS)) {
+        config->workers = strdup(value);
+    } else if (cmp_strings(key, SHARD_BY)) {
+        config->shard_by = strdup(value);
+    } else if (cmp_strings(key, DEDUP_KEY)) {
+        config->dedup_key = strdup(value);
+    } else if (cmp_strings(key, DEDUP_IGNORE)) {
+        config->dedup_ignore = strdup(value);
+    } else if (cmp_strings(key, DEDUP_SIZE)) {
+        config->dedup_size = strdup(value);
+    } else if (cmp_strings(key, DEDUP_REFRESH)) {
+        config->dedup_refresh = strdup(value);
+    } else if (cmp_strings(key, STATS_SOCKET)) {
+        config->stats_socket = strdup(value);
+    } else if (cmp_strings(key, STATS_FILE)) {
+        config->stats_file = strdup(value);
+    } else if (cmp_strings(key, STATS_INTERVAL)) {
+        config->stats_interval = strdup(value);
 	} else {
         return 0;
 	}
@@ -0,0 +1,114 @@
+//
+//  flight.c
+//
+//  single-flight coalescing of identical reads. the first caller to ask for a given verb + url becomes the leader
+//  and goes to the server, anyone asking for the same thing while that request is outstanding waits for it to land
+//  and gets a private copy of the leader's result.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flight.h"
+#include "utils.h"
+#include "log.h"
+
+void vc_flights_init(vc_flights_t *flights)
+{
+    pthread_mutex_init(&flights->lock, NULL);
+    flights->head = NULL;
+}
+
+void vc_flights_destroy(vc_flights_t *flights)
+{
+    pthread_mutex_destroy(&flights->lock);
+}
+
+static void free_flight(vc_flight_t *flight)
+{
+    pthread_cond_destroy(&flight->landed);
+    vme_free_result(flight->result);
+    free(flight->key);
+    free(flight);
+}
+
+/*
+ * vc_flight_join --
+ *
+ *      flights - the client's set of outstanding requests
+ *      verb / url - what identifies the request
+ *      leader - set to 1 if the caller must perform the request (and later call vc_flight_land), 0 if it should call
+ *          vc_flight_wait for someone else's result
+ */
+vc_flight_t *vc_flight_join(vc_flights_t *flights, const char *verb, const char *url, int *leader)
+{
+    size_t len = strlen(verb) + strlen(url) + 2;
+    char *key = malloc(len);
+    snprintf(key, len, "%s %s", verb, url);
+
+    pthread_mutex_lock(&flights->lock);
+    vc_flight_t *flight = flights->head;
+    while (flight != NULL && strcmp(flight->key, key) != 0)
+        flight = flight->next;
+    if (flight != NULL) {
+        flight->waiters++;
+        *leader = 0;
+        free(key);
+        log_debug("joining in flight request %s", flight->key);
+    } else {
+        flight = malloc(sizeof(vc_flight_t));
+        memset(flight, 0, sizeof(vc_flight_t));
+        flight->key = key;
+        pthread_cond_init(&flight->landed, NULL);
+        flight->next = flights->head;
+        flights->head = flight;
+        *leader = 1;
+    }
+    pthread_mutex_unlock(&flights->lock);
+    return flight;
+}
+
+/*
+ * the leader is done. take the flight off the list so new callers start a fresh request, leave a copy of the result
+ * for anyone waiting and wake them up.
+ */
+void vc_flight_land(vc_flights_t *flights, vc_flight_t *flight, const vme_result_t *result)
+{
+    pthread_mutex_lock(&flights->lock);
+    vc_flight_t **pp = &flights->head;
+    while (*pp != flight)
+        pp = &(*pp)->next;
+    *pp = flight->next;
+
+    if (flight->waiters == 0) {
+        pthread_mutex_unlock(&flights->lock);
+        free_flight(flight);
+        return;
+    }
+    flight->result = dup_result(result);
+    flight->done = 1;
+    pthread_cond_broadcast(&flight->landed);
+    pthread_mutex_unlock(&flights->lock);
+}
+
+/*
+ * wait for the leader to land and return a copy of its result that belongs to the caller. the last waiter out
+ * cleans up.
+ */
+vme_result_t *vc_flight_wait(vc_flights_t *flights, vc_flight_t *flight)
+{
+    pthread_mutex_lock(&flights->lock);
+    while (!flight->done)
+        pthread_cond_wait(&flight->landed, &flights->lock);
+    vme_result_t *result = (--flight->waiters == 0 ? flight->result : dup_result(flight->result));
+    if (flight->waiters == 0) {
+        flight->result = NULL;
+        pthread_mutex_unlock(&flights->lock);
+        free_flight(flight);
+    } else {
+        pthread_mutex_unlock(&flights->lock);
+    }
+    return result;
+}
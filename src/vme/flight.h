@@ -0,0 +1,36 @@
+//  flight.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#ifndef VANTIQ_FLIGHT_H
+#define VANTIQ_FLIGHT_H
+
+#include <pthread.h>
+
+#include "vme.h"
+
+/*
+ * a request in flight that identical requests from other threads can piggyback on
+ */
+typedef struct vc_flight {
+    char             *key;      // verb + full url
+    int               done;
+    int               waiters;  // callers sharing the leader's response
+    vme_result_t     *result;   // copy handed to each waiter
+    pthread_cond_t    landed;
+    struct vc_flight *next;
+} vc_flight_t;
+
+typedef struct vc_flights {
+    pthread_mutex_t   lock;
+    vc_flight_t      *head;
+} vc_flights_t;
+
+void vc_flights_init(vc_flights_t *flights);
+void vc_flights_destroy(vc_flights_t *flights);
+
+vc_flight_t *vc_flight_join(vc_flights_t *flights, const char *verb, const char *url, int *leader);
+void vc_flight_land(vc_flights_t *flights, vc_flight_t *flight, const vme_result_t *result);
+vme_result_t *vc_flight_wait(vc_flights_t *flights, vc_flight_t *flight);
+
+#endif
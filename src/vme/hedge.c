@@ -0,0 +1,187 @@
+//
+//  hedge.c
+//
+//  hedged reads. a read that takes longer than most recent reads did is probably stuck behind a slow server node
+//  or a lost packet, so after that point (a percentile of the recent latency) the same GET is sent again on a
+//  second connection and whichever response arrives first is used. reads are idempotent, so the duplicate is
+//  harmless to the server, but it is extra load: duplicates are paid for from a budget that only grows by a fraction
+//  of a request per read.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hedge.h"
+#include "transfer.h"
+#include "adapt.h"
+#include "utils.h"
+#include "vantiq_client.h"
+#include "log.h"
+
+#define DEFAULT_PERCENTILE  95.0
+#define DEFAULT_BUDGET      0.05
+#define MIN_SAMPLES         20      // don't hedge until we know what normal looks like
+#define MAX_TOKENS          5.0     // a burst of slow reads can hedge this many in a row
+
+vc_hedge_t *vc_hedge_create(vantiq_client_t *vc, const vme_hedge_opts_t *opts)
+{
+    vc_hedge_t *hedge = malloc(sizeof(vc_hedge_t));
+    memset(hedge, 0, sizeof(vc_hedge_t));
+    if (opts != NULL)
+        hedge->opts = *opts;
+    if (hedge->opts.percentile <= 0 || hedge->opts.percentile >= 100)
+        hedge->opts.percentile = DEFAULT_PERCENTILE;
+    if (hedge->opts.budget <= 0)
+        hedge->opts.budget = DEFAULT_BUDGET;
+    pthread_mutex_init(&hedge->lock, NULL);
+    hedge->pool = vc_xfer_pool_create(vc, 2);
+    return hedge;
+}
+
+void vc_hedge_destroy(vc_hedge_t *hedge)
+{
+    if (hedge == NULL)
+        return;
+    vc_xfer_pool_destroy(hedge->pool);
+    pthread_mutex_destroy(&hedge->lock);
+    free(hedge);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+/*
+ * how long to give a read before hedging it, -1 if it shouldn't be hedged (too little history, no budget)
+ */
+static double hedge_delay(vc_hedge_t *hedge)
+{
+    pthread_mutex_lock(&hedge->lock);
+    hedge->stats.reads++;
+    hedge->tokens += hedge->opts.budget;
+    if (hedge->tokens > MAX_TOKENS)
+        hedge->tokens = MAX_TOKENS;
+    double delay = -1;
+    if (hedge->n_samples >= MIN_SAMPLES && hedge->tokens >= 1) {
+        double sorted[HEDGE_WINDOW];
+        memcpy(sorted, hedge->window, hedge->n_samples * sizeof(double));
+        qsort(sorted, hedge->n_samples, sizeof(double), cmp_double);
+        uint32_t idx = (uint32_t)(hedge->opts.percentile / 100.0 * (hedge->n_samples - 1) + 0.5);
+        delay = sorted[idx];
+        if (delay < hedge->opts.min_delay_ms)
+            delay = hedge->opts.min_delay_ms;
+        hedge->stats.delay_ms = delay;
+    }
+    pthread_mutex_unlock(&hedge->lock);
+    return delay;
+}
+
+static void record_latency(vc_hedge_t *hedge, double ms)
+{
+    pthread_mutex_lock(&hedge->lock);
+    hedge->window[hedge->next_sample] = ms;
+    hedge->next_sample = (hedge->next_sample + 1) % HEDGE_WINDOW;
+    if (hedge->n_samples < HEDGE_WINDOW)
+        hedge->n_samples++;
+    pthread_mutex_unlock(&hedge->lock);
+}
+
+/*
+ * vc_hedged_get --
+ *
+ *      vc - the client, locked by the caller
+ *      url - the read
+ *      hdrs - request headers to use in place of the client's, NULL for the client's
+ *      code / status - how the winning request went
+ *
+ * RETURN: the result as prepare_result would build it. the response's validators are left in vc->resp_etag and
+ *      vc->resp_last_modified for the cache.
+ */
+vme_result_t *vc_hedged_get(vantiq_client_t *vc, const char *url, struct curl_slist *hdrs, CURLcode *code,
+                            long *status)
+{
+    vc_hedge_t *hedge = vc->hedge;
+    vc_xfer_pool_t *pool = hedge->pool;
+    vc_xfer_t *primary = &pool->xfers[0], *backup = &pool->xfers[1];
+    struct timespec started;
+    double delay = hedge_delay(hedge);
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    vc_xfer_start_get(pool, primary, url, hdrs, NULL);
+    vc_xfer_t *winner = NULL;
+    if (delay >= 0) {
+        double elapsed;
+        while (winner == NULL && (elapsed = vc_elapsed_ms(&started)) < delay)
+            winner = vc_xfer_wait(pool, (int)(delay - elapsed) + 1);
+        if (winner == NULL) {
+            pthread_mutex_lock(&hedge->lock);
+            int afford = (hedge->tokens >= 1);
+            if (afford) {
+                hedge->tokens -= 1;
+                hedge->stats.hedged++;
+            }
+            pthread_mutex_unlock(&hedge->lock);
+            if (afford) {
+                log_debug("hedging %s after %.1f ms", url, delay);
+                vc_xfer_start_get(pool, backup, url, hdrs, NULL);
+            }
+        }
+    }
+    while (winner == NULL)
+        winner = vc_xfer_wait(pool, -1);
+    /* a request that never got a response loses to one still trying */
+    vc_xfer_t *other = (winner == primary ? backup : primary);
+    if (winner->code != CURLE_OK && other->busy) {
+        vc_xfer_release(pool, winner);
+        winner = NULL;
+        while (winner == NULL)
+            winner = vc_xfer_wait(pool, -1);
+        other = NULL;
+    }
+    if (other != NULL && other->busy)
+        vc_xfer_cancel(pool, other);
+
+    /* what the caller waited, whichever request won. timing a winning backup from when it was sent would leave
+       the slow reads out of the window and pull the percentile, and with it the delay, ever lower */
+    if (winner->code == CURLE_OK)
+        record_latency(hedge, vc_elapsed_ms(&started));
+    if (winner == backup) {
+        pthread_mutex_lock(&hedge->lock);
+        hedge->stats.hedge_wins++;
+        pthread_mutex_unlock(&hedge->lock);
+    }
+
+    vme_result_t *result = malloc(sizeof(vme_result_t));
+    memset(result, 0, sizeof(vme_result_t));
+    *code = winner->code;
+    *status = winner->status;
+    result->vme_http_status = winner->status;
+    if (winner->code != CURLE_OK)
+        result->vme_error_msg = strdup(winner->errbuf[0] != '\0' ? winner->errbuf : curl_easy_strerror(winner->code));
+    if (winner->resp->len > 0) {
+        result->vme_size = winner->resp->len;
+        if (winner->status >= 400) {
+            free(result->vme_error_msg);
+            result->vme_error_msg = vmebuf_tostr(winner->resp);
+        } else {
+            result->vme_json_data = vmebuf_tostr(winner->resp);
+        }
+    } else if (winner->status >= 400 && result->vme_error_msg == NULL) {
+        char errMsg[32];
+        snprintf(errMsg, sizeof(errMsg), "HTTP status %ld", winner->status);
+        result->vme_error_msg = strdup(errMsg);
+    }
+    result->vme_count = winner->total_count;
+    free(vc->resp_etag);
+    free(vc->resp_last_modified);
+    vc->resp_etag = winner->etag;
+    vc->resp_last_modified = winner->last_modified;
+    winner->etag = winner->last_modified = NULL;
+    vc_xfer_release(pool, winner);
+    return result;
+}
@@ -0,0 +1,39 @@
+//  hedge.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#ifndef VANTIQ_HEDGE_H
+#define VANTIQ_HEDGE_H
+
+#include <pthread.h>
+#include <curl/curl.h>
+
+#include "vme.h"
+
+#define HEDGE_WINDOW 128
+
+struct vc_xfer_pool;
+struct vantiq_client;
+
+/*
+ * the client's hedging policy and what it has observed: the latency of recent reads, a budget of duplicates
+ * that grows with every read and is spent by every hedge, and a spare pair of connections
+ */
+typedef struct vc_hedge {
+    vme_hedge_opts_t        opts;
+    pthread_mutex_t         lock;
+    double                  window[HEDGE_WINDOW];   // ms
+    uint32_t                n_samples;
+    uint32_t                next_sample;
+    double                  tokens;
+    struct vc_xfer_pool    *pool;
+    vme_hedge_stats_t       stats;
+} vc_hedge_t;
+
+vc_hedge_t *vc_hedge_create(struct vantiq_client *vc, const vme_hedge_opts_t *opts);
+void vc_hedge_destroy(vc_hedge_t *hedge);
+
+vme_result_t *vc_hedged_get(struct vantiq_client *vc, const char *url, struct curl_slist *hdrs, CURLcode *code,
+                            long *status);
+
+#endif
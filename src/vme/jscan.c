@@ -0,0 +1,122 @@
+//
+//  jscan.c
+//
+//  find the boundaries of the top level elements of a JSON array (or of a stream of newline / whitespace
+//  separated JSON values, i.e. NDJSON) without parsing them. data may arrive in arbitrary chunks, e.g. from
+//  vme_select_callback, so all the state needed to pick up where the last chunk left off lives in vc_jscan_t.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <string.h>
+
+#include "jscan.h"
+
+void vc_jscan_init(vc_jscan_t *scan)
+{
+    memset(scan, 0, sizeof(vc_jscan_t));
+    scan->elem_depth = -1;
+}
+
+/*
+ * the first significant byte decides what we are looking at: a '[' is the enclosing array, anything else means
+ * the values follow one another at the top level
+ */
+static int detect(vc_jscan_t *scan, char c)
+{
+    if (scan->elem_depth >= 0)
+        return 0;
+    if (c == '[') {
+        scan->elem_depth = 1;
+        scan->depth = 1;
+        return 1;
+    }
+    scan->elem_depth = 0;
+    return 0;
+}
+
+/*
+ * vc_jscan_next --
+ *
+ *      scan - scanner state
+ *      data / len - the next chunk of input
+ *      event - set to JSCAN_START / JSCAN_END when an element starts / ends, JSCAN_NONE otherwise
+ *
+ * RETURN: number of bytes consumed. scanning stops right after the first event, so an element occupies the bytes
+ *      from the one before the offset returned with JSCAN_START through the one before the offset returned with
+ *      JSCAN_END. bare scalars end on the delimiter that follows them, which is left unconsumed.
+ */
+size_t vc_jscan_next(vc_jscan_t *scan, const char *data, size_t len, int *event)
+{
+    *event = JSCAN_NONE;
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+        if (scan->in_string) {
+            if (scan->escape) {
+                scan->escape = 0;
+            } else if (c == '\\') {
+                scan->escape = 1;
+            } else if (c == '"') {
+                scan->in_string = 0;
+                if (scan->depth == scan->elem_depth) {
+                    *event = JSCAN_END;
+                    return i + 1;
+                }
+            }
+            continue;
+        }
+        if (scan->in_scalar) {
+            if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == ',' || c == ']' || c == '}') {
+                scan->in_scalar = 0;
+                *event = JSCAN_END;
+                return i;
+            }
+            continue;
+        }
+        switch (c) {
+            case ' ': case '\t': case '\r': case '\n': case ',': case ':':
+                break;
+            case '[':
+            case '{':
+                if (detect(scan, c))
+                    break;
+                if (scan->depth++ == scan->elem_depth) {
+                    *event = JSCAN_START;
+                    return i + 1;
+                }
+                break;
+            case ']':
+            case '}':
+                if (--scan->depth == scan->elem_depth) {
+                    *event = JSCAN_END;
+                    return i + 1;
+                }
+                break;
+            case '"':
+                detect(scan, c);
+                scan->in_string = 1;
+                if (scan->depth == scan->elem_depth) {
+                    *event = JSCAN_START;
+                    return i + 1;
+                }
+                break;
+            default:
+                detect(scan, c);
+                if (scan->depth == scan->elem_depth) {
+                    scan->in_scalar = 1;
+                    *event = JSCAN_START;
+                    return i + 1;
+                }
+                break;
+        }
+    }
+    return len;
+}
+
+/*
+ * true when input stopped part way through an element. at the very end of the input that is only legitimate for
+ * a bare scalar (the last value of NDJSON without a trailing newline), which ends with the input.
+ */
+int vc_jscan_in_element(const vc_jscan_t *scan)
+{
+    return scan->in_scalar || scan->in_string || (scan->elem_depth >= 0 && scan->depth > scan->elem_depth);
+}
@@ -0,0 +1,26 @@
+//  jscan.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#ifndef VANTIQ_JSCAN_H
+#define VANTIQ_JSCAN_H
+
+#include <stddef.h>
+
+#define JSCAN_NONE  0
+#define JSCAN_START 1   // the last byte consumed is the first byte of an element
+#define JSCAN_END   2   // the last byte consumed is the last byte of an element
+
+typedef struct vc_jscan {
+    int depth;          // nesting depth, counting the enclosing array if there is one
+    int elem_depth;     // depth elements live at: 1 inside a JSON array, 0 for NDJSON, -1 until we know
+    int in_string;
+    int escape;
+    int in_scalar;      // inside a bare number / true / false / null element
+} vc_jscan_t;
+
+void vc_jscan_init(vc_jscan_t *scan);
+size_t vc_jscan_next(vc_jscan_t *scan, const char *data, size_t len, int *event);
+int vc_jscan_in_element(const vc_jscan_t *scan);
+
+#endif
@@ -0,0 +1,177 @@
+//
+//  jsonpatch.c
+//
+//  structural diff of two json documents, producing an RFC 6902 json patch
+//  (http://jsonpatch.com/) that turns the first into the second. only add,
+//  remove and replace are generated; arrays are matched by position after
+//  trimming their common head and tail, so an insert or delete near either
+//  end stays small.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "vme.h"
+#include "utils.h"
+
+static void diff_value(cJSON *ops, vmebuf_t *path, const cJSON *from, const cJSON *to);
+
+static void add_op(cJSON *ops, const char *op, vmebuf_t *path, const cJSON *value)
+{
+    cJSON *item = cJSON_CreateObject();
+    cJSON_AddStringToObject(item, "op", op);
+    cJSON_AddStringToObject(item, "path", path->len == 0 ? "" : path->data);
+    if (value != NULL)
+        cJSON_AddItemToObject(item, "value", cJSON_Duplicate(value, 1));
+    cJSON_AddItemToArray(ops, item);
+}
+
+/* append one reference token to a json pointer, escaping ~ and / as ~0 and ~1 */
+static size_t push_key(vmebuf_t *path, const char *key)
+{
+    size_t mark = path->len;
+    vmebuf_concat(path, "/", 1);
+    for (const char *p = key; *p; p++) {
+        if (*p == '~')
+            vmebuf_concat(path, "~0", 2);
+        else if (*p == '/')
+            vmebuf_concat(path, "~1", 2);
+        else
+            vmebuf_push(path, *p);
+    }
+    vmebuf_push(path, 0);
+    path->len--;
+    return mark;
+}
+
+static size_t push_index(vmebuf_t *path, int index)
+{
+    char key[16];
+    snprintf(key, sizeof(key), "%d", index);
+    return push_key(path, key);
+}
+
+static void pop(vmebuf_t *path, size_t mark)
+{
+    path->len = mark;
+    path->data[mark] = 0;
+}
+
+static void diff_object(cJSON *ops, vmebuf_t *path, const cJSON *from, const cJSON *to)
+{
+    for (const cJSON *f = from->child; f != NULL; f = f->next) {
+        const cJSON *t = cJSON_GetObjectItemCaseSensitive(to, f->string);
+        size_t mark = push_key(path, f->string);
+        if (t == NULL)
+            add_op(ops, "remove", path, NULL);
+        else
+            diff_value(ops, path, f, t);
+        pop(path, mark);
+    }
+    for (const cJSON *t = to->child; t != NULL; t = t->next) {
+        if (cJSON_GetObjectItemCaseSensitive(from, t->string) != NULL)
+            continue;
+        size_t mark = push_key(path, t->string);
+        add_op(ops, "add", path, t);
+        pop(path, mark);
+    }
+}
+
+static void diff_array(cJSON *ops, vmebuf_t *path, const cJSON *from, const cJSON *to)
+{
+    int nf = cJSON_GetArraySize(from), nt = cJSON_GetArraySize(to);
+    const cJSON **fa = malloc(sizeof(cJSON *) * (nf + 1));
+    const cJSON **ta = malloc(sizeof(cJSON *) * (nt + 1));
+    int i = 0;
+    for (const cJSON *c = from->child; c != NULL; c = c->next)
+        fa[i++] = c;
+    i = 0;
+    for (const cJSON *c = to->child; c != NULL; c = c->next)
+        ta[i++] = c;
+
+    int head = 0, tail = 0;
+    while (head < nf && head < nt && cJSON_Compare(fa[head], ta[head], 1))
+        head++;
+    while (tail < nf - head && tail < nt - head && cJSON_Compare(fa[nf - 1 - tail], ta[nt - 1 - tail], 1))
+        tail++;
+
+    // what's left in the middle is changed in place pairwise, then trimmed or grown
+    int mf = nf - head - tail, mt = nt - head - tail;
+    int common = (mf < mt ? mf : mt);
+    for (i = 0; i < common; i++) {
+        size_t mark = push_index(path, head + i);
+        diff_value(ops, path, fa[head + i], ta[head + i]);
+        pop(path, mark);
+    }
+    for (i = mf - 1; i >= common; i--) {
+        size_t mark = push_index(path, head + i);
+        add_op(ops, "remove", path, NULL);
+        pop(path, mark);
+    }
+    for (i = common; i < mt; i++) {
+        size_t mark = push_index(path, head + i);
+        add_op(ops, "add", path, ta[head + i]);
+        pop(path, mark);
+    }
+    free(fa);
+    free(ta);
+}
+
+static size_t printed_size(const cJSON *json)
+{
+    char *text = cJSON_PrintUnformatted(json);
+    size_t size = strlen(text);
+    free(text);
+    return size;
+}
+
+static void diff_value(cJSON *ops, vmebuf_t *path, const cJSON *from, const cJSON *to)
+{
+    if (cJSON_Compare(from, to, 1))
+        return;
+    int container = ((cJSON_IsObject(from) && cJSON_IsObject(to)) || (cJSON_IsArray(from) && cJSON_IsArray(to)));
+    if (!container) {
+        add_op(ops, "replace", path, to);
+        return;
+    }
+
+    // diff the children separately, and keep that only if it beats replacing the whole value.
+    // the document itself is never replaced, that's what an update is for
+    cJSON *sub = cJSON_CreateArray();
+    if (cJSON_IsObject(to))
+        diff_object(sub, path, from, to);
+    else
+        diff_array(sub, path, from, to);
+    if (path->len > 0 && cJSON_GetArraySize(sub) > 1) {
+        cJSON *whole = cJSON_CreateArray();
+        add_op(whole, "replace", path, to);
+        if (printed_size(whole) < printed_size(sub)) {
+            cJSON_Delete(sub);
+            sub = whole;
+        } else {
+            cJSON_Delete(whole);
+        }
+    }
+    while (sub->child != NULL)
+        cJSON_AddItemToArray(ops, cJSON_DetachItemViaPointer(sub, sub->child));
+    cJSON_Delete(sub);
+}
+
+/*
+ * json_diff --
+ *
+ *      from - the document as it was
+ *      to - the document as it should be
+ *
+ * RETURN a json array of patch operations, empty when the two are equal. the caller deletes it
+ */
+cJSON *json_diff(const cJSON *from, const cJSON *to)
+{
+    cJSON *ops = cJSON_CreateArray();
+    vmebuf_t *path = vmebuf_ensure_size(NULL, 64);
+    diff_value(ops, path, from, to);
+    vmebuf_dealloc(path);
+    return ops;
+}
@@ -0,0 +1,681 @@
+//
+//  localagg.c
+//
+//  run an aggregation pipeline locally, over JSON streamed from vme_select_callback or held in memory (e.g. a
+//  cached select result). instances are split out of the stream one at a time and pushed through the stages;
+//  $match, $project, $skip and $limit work row by row, $group, $sort and $count hold on to what they need until the
+//  input is finished. numeric $group accumulators buffer their values in small blocks which are folded in by the
+//  vme_reduce_f64 kernels.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "vme.h"
+#include "cjson.h"
+#include "jscan.h"
+#include "where.h"
+#include "utils.h"
+#include "log.h"
+
+/* values buffered per numeric accumulator before they are reduced */
+#define ACC_BLOCK 16
+
+#define GROUP_MIN_BUCKETS 64
+
+typedef enum {
+    STAGE_MATCH,
+    STAGE_PROJECT,
+    STAGE_SKIP,
+    STAGE_LIMIT,
+    STAGE_GROUP,
+    STAGE_SORT,
+    STAGE_COUNT
+} stage_kind_t;
+
+typedef enum {
+    ACC_SUM,
+    ACC_AVG,
+    ACC_MIN,
+    ACC_MAX,
+    ACC_FIRST,
+    ACC_LAST
+} acc_op_t;
+
+typedef struct {
+    const char *name;           // output property
+    acc_op_t    op;
+    const char *path;           // property the accumulator reads, NULL for a constant
+    double      constant;       // e.g. the 1 of {"$sum": 1}
+} acc_spec_t;
+
+typedef struct {
+    vme_reduction_t red;
+    double          block[ACC_BLOCK];
+    int             n_block;
+    cJSON          *other;      // $first / $last value, or the extreme non numeric value for $min / $max
+} acc_state_t;
+
+typedef struct group {
+    cJSON          *id;
+    char           *key;        // printed id, what groups are told apart by
+    uint32_t        hash;
+    struct group   *hnext;
+    struct group   *next;       // in order of first appearance
+    acc_state_t     accs[];
+} group_t;
+
+typedef struct {
+    stage_kind_t    kind;
+    const cJSON    *spec;       // the stage's argument, owned by the parsed pipeline
+    vme_where_t    *where;      // $match
+    long            n;          // $skip / $limit
+    long            seen;
+    /* $group */
+    const cJSON    *id_expr;
+    acc_spec_t     *accs;
+    int             n_accs;
+    group_t       **buckets;
+    uint32_t        n_buckets;
+    uint32_t        n_groups;
+    group_t        *first;
+    group_t        *last;
+    /* $sort */
+    cJSON         **rows;
+    size_t          n_rows;
+    size_t          max_rows;
+} stage_t;
+
+struct vme_agg {
+    cJSON      *pipeline;
+    stage_t    *stages;
+    int         n_stages;
+    int         first_blocking;     // index of the first $group / $sort / $count, n_stages if there is none
+    cJSON      *out;
+    cJSON      *out_tail;
+    uint32_t    out_count;
+    char       *error;
+    int         done;               // nothing more can come out, ignore the rest of the input
+    vc_jscan_t  scan;
+    vmebuf_t   *elem;               // the instance being split out of the input
+    int         in_elem;
+};
+
+static uint32_t str_hash(const char *str)
+{
+    uint32_t h = 2166136261u;
+    while (*str != '\0') {
+        h ^= (uint8_t)*str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void agg_fail(vme_agg_t *agg, const char *errMsg)
+{
+    if (agg->error == NULL)
+        agg->error = strdup(errMsg);
+    agg->done = 1;
+}
+
+/*
+ * "$prop" refers to a property of the instance, anything else is a literal
+ */
+static const char *field_ref(const cJSON *expr)
+{
+    if (cJSON_IsString(expr) && expr->valuestring[0] == '$' && expr->valuestring[1] != '\0')
+        return expr->valuestring + 1;
+    return NULL;
+}
+
+/*
+ * inclusion ({"a": 1, "b": "$c.d"}) builds a new instance, exclusion ({"a": 0}) removes properties. _id is kept
+ * by an inclusion unless it is explicitly excluded.
+ */
+static cJSON *project_doc(const cJSON *spec, cJSON *doc)
+{
+    int inclusion = 0;
+    for (const cJSON *f = spec->child; f != NULL; f = f->next) {
+        if (strcmp(f->string, "_id") != 0 && (field_ref(f) != NULL || cJSON_IsTrue(f)
+                                              || (cJSON_IsNumber(f) && f->valuedouble != 0)))
+            inclusion = 1;
+    }
+    if (!cJSON_IsObject(doc))
+        return doc;
+
+    if (!inclusion) {
+        for (const cJSON *f = spec->child; f != NULL; f = f->next)
+            cJSON_DeleteItemFromObjectCaseSensitive(doc, f->string);
+        return doc;
+    }
+
+    cJSON *out = cJSON_CreateObject();
+    const cJSON *idSpec = cJSON_GetObjectItemCaseSensitive(spec, "_id");
+    cJSON *id = cJSON_GetObjectItemCaseSensitive(doc, "_id");
+    if (id != NULL && !(idSpec != NULL && (cJSON_IsFalse(idSpec) || (cJSON_IsNumber(idSpec) && idSpec->valuedouble == 0))))
+        cJSON_AddItemToObject(out, "_id", cJSON_Duplicate(id, 1));
+    for (const cJSON *f = spec->child; f != NULL; f = f->next) {
+        if (strcmp(f->string, "_id") == 0 && field_ref(f) == NULL)
+            continue;
+        const char *path = field_ref(f);
+        if (path == NULL && !(cJSON_IsTrue(f) || cJSON_IsNumber(f)))
+            cJSON_AddItemToObject(out, f->string, cJSON_Duplicate(f, 1));
+        else {
+            cJSON *value = json_lookup_path(doc, (path != NULL ? path : f->string));
+            if (value != NULL)
+                cJSON_AddItemToObject(out, f->string, cJSON_Duplicate(value, 1));
+        }
+    }
+    cJSON_Delete(doc);
+    return out;
+}
+
+/*
+ * the group _id for an instance: "$prop", an object of such references, or a constant (everything in one group)
+ */
+static cJSON *eval_id(const cJSON *expr, const cJSON *doc)
+{
+    const char *path = field_ref(expr);
+    if (path != NULL) {
+        cJSON *value = json_lookup_path(doc, path);
+        return (value != NULL ? cJSON_Duplicate(value, 1) : cJSON_CreateNull());
+    }
+    if (cJSON_IsObject(expr)) {
+        cJSON *id = cJSON_CreateObject();
+        for (const cJSON *f = expr->child; f != NULL; f = f->next)
+            cJSON_AddItemToObject(id, f->string, eval_id(f, doc));
+        return id;
+    }
+    return cJSON_Duplicate(expr, 1);
+}
+
+static void acc_flush(acc_state_t *st)
+{
+    if (st->n_block > 0) {
+        vme_reduce_f64(&st->red, st->block, st->n_block, NULL);
+        st->n_block = 0;
+    }
+}
+
+static void acc_add(const acc_spec_t *spec, acc_state_t *st, const cJSON *doc)
+{
+    const cJSON *value = (spec->path != NULL ? json_lookup_path(doc, spec->path) : NULL);
+    switch (spec->op) {
+        case ACC_FIRST:
+        case ACC_LAST:
+            if (spec->op == ACC_LAST || st->other == NULL) {
+                cJSON_Delete(st->other);
+                st->other = (value != NULL ? cJSON_Duplicate(value, 1) : cJSON_CreateNull());
+            }
+            return;
+        default:
+            break;
+    }
+
+    double d;
+    if (spec->path == NULL)
+        d = spec->constant;
+    else if (value != NULL && cJSON_IsNumber(value))
+        d = value->valuedouble;
+    else {
+        /* $sum / $avg ignore anything that isn't a number, $min / $max also order other values */
+        if ((spec->op == ACC_MIN || spec->op == ACC_MAX) && value != NULL && !cJSON_IsNull(value)) {
+            int c = (st->other != NULL ? json_value_cmp(value, st->other) : 0);
+            if (st->other == NULL || (spec->op == ACC_MIN ? c < 0 : c > 0)) {
+                cJSON_Delete(st->other);
+                st->other = cJSON_Duplicate(value, 1);
+            }
+        }
+        return;
+    }
+    st->block[st->n_block++] = d;
+    if (st->n_block == ACC_BLOCK)
+        acc_flush(st);
+}
+
+/*
+ * the final value of an accumulator. numbers sort before every other type, so a numeric minimum beats any
+ * non numeric one while a non numeric maximum beats any number.
+ */
+static cJSON *acc_value(const acc_spec_t *spec, acc_state_t *st)
+{
+    acc_flush(st);
+    switch (spec->op) {
+        case ACC_SUM:
+            return cJSON_CreateNumber(st->red.sum);
+        case ACC_AVG:
+            return (st->red.count > 0 ? cJSON_CreateNumber(st->red.sum / st->red.count) : cJSON_CreateNull());
+        case ACC_MIN:
+            if (st->red.count > 0)
+                return cJSON_CreateNumber(st->red.min);
+            return (st->other != NULL ? cJSON_Duplicate(st->other, 1) : cJSON_CreateNull());
+        case ACC_MAX:
+            if (st->other != NULL)
+                return cJSON_Duplicate(st->other, 1);
+            return (st->red.count > 0 ? cJSON_CreateNumber(st->red.max) : cJSON_CreateNull());
+        default:
+            return (st->other != NULL ? cJSON_Duplicate(st->other, 1) : cJSON_CreateNull());
+    }
+}
+
+static void group_rehash(stage_t *st)
+{
+    uint32_t nBuckets = st->n_buckets * 2;
+    group_t **buckets = calloc(nBuckets, sizeof(group_t *));
+    for (group_t *g = st->first; g != NULL; g = g->next) {
+        g->hnext = buckets[g->hash & (nBuckets - 1)];
+        buckets[g->hash & (nBuckets - 1)] = g;
+    }
+    free(st->buckets);
+    st->buckets = buckets;
+    st->n_buckets = nBuckets;
+}
+
+static void group_add(stage_t *st, const cJSON *doc)
+{
+    cJSON *id = eval_id(st->id_expr, doc);
+    char *key = cJSON_PrintUnformatted(id);
+    uint32_t h = str_hash(key);
+    group_t *g = st->buckets[h & (st->n_buckets - 1)];
+    while (g != NULL && (g->hash != h || strcmp(g->key, key) != 0))
+        g = g->hnext;
+    if (g == NULL) {
+        size_t size = sizeof(group_t) + st->n_accs * sizeof(acc_state_t);
+        g = malloc(size);
+        memset(g, 0, size);
+        g->id = id;
+        g->key = key;
+        g->hash = h;
+        g->hnext = st->buckets[h & (st->n_buckets - 1)];
+        st->buckets[h & (st->n_buckets - 1)] = g;
+        if (st->last != NULL)
+            st->last->next = g;
+        else
+            st->first = g;
+        st->last = g;
+        if (++st->n_groups > st->n_buckets)
+            group_rehash(st);
+    } else {
+        cJSON_Delete(id);
+        free(key);
+    }
+    for (int i = 0; i < st->n_accs; i++)
+        acc_add(&st->accs[i], &g->accs[i], doc);
+}
+
+static int sort_cmp(const cJSON *spec, const cJSON *a, const cJSON *b)
+{
+    for (const cJSON *key = spec->child; key != NULL; key = key->next) {
+        int c = json_value_cmp(json_lookup_path(a, key->string), json_lookup_path(b, key->string));
+        if (c != 0)
+            return (cJSON_IsNumber(key) && key->valuedouble < 0 ? -c : c);
+    }
+    return 0;
+}
+
+/*
+ * bottom up merge sort, stable so rows that compare equal keep their input order
+ */
+static void sort_rows(const cJSON *spec, cJSON **rows, size_t n)
+{
+    cJSON **tmp = malloc((n + 1) * sizeof(cJSON *));
+    cJSON **src = rows, **dst = tmp;
+    for (size_t width = 1; width < n; width *= 2) {
+        for (size_t lo = 0; lo < n; lo += 2 * width) {
+            size_t mid = (lo + width < n ? lo + width : n);
+            size_t hi = (lo + 2 * width < n ? lo + 2 * width : n);
+            size_t i = lo, j = mid, k = lo;
+            while (i < mid && j < hi)
+                dst[k++] = (sort_cmp(spec, src[j], src[i]) < 0 ? src[j++] : src[i++]);
+            while (i < mid)
+                dst[k++] = src[i++];
+            while (j < hi)
+                dst[k++] = src[j++];
+        }
+        cJSON **t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != rows)
+        memcpy(rows, src, n * sizeof(cJSON *));
+    free(tmp);
+}
+
+static void emit(vme_agg_t *agg, cJSON *doc)
+{
+    if (agg->out_tail != NULL) {
+        agg->out_tail->next = doc;
+        doc->prev = agg->out_tail;
+    } else {
+        agg->out->child = doc;
+    }
+    agg->out_tail = doc;
+    agg->out_count++;
+}
+
+/*
+ * run an instance through the pipeline starting at stage idx. doc is consumed.
+ */
+static void push_row(vme_agg_t *agg, int idx, cJSON *doc)
+{
+    for (; idx < agg->n_stages; idx++) {
+        stage_t *st = &agg->stages[idx];
+        switch (st->kind) {
+            case STAGE_MATCH:
+                if (!vme_where_eval(st->where, doc)) {
+                    cJSON_Delete(doc);
+                    return;
+                }
+                break;
+            case STAGE_PROJECT:
+                doc = project_doc(st->spec, doc);
+                break;
+            case STAGE_SKIP:
+                if (st->seen < st->n) {
+                    st->seen++;
+                    cJSON_Delete(doc);
+                    return;
+                }
+                break;
+            case STAGE_LIMIT:
+                if (st->seen >= st->n) {
+                    cJSON_Delete(doc);
+                    return;
+                }
+                /* with nothing buffering ahead of us, later input can't make it out */
+                if (++st->seen == st->n && idx < agg->first_blocking)
+                    agg->done = 1;
+                break;
+            case STAGE_GROUP:
+                group_add(st, doc);
+                cJSON_Delete(doc);
+                return;
+            case STAGE_SORT:
+                if (st->n_rows == st->max_rows) {
+                    st->max_rows = (st->max_rows == 0 ? 64 : st->max_rows * 2);
+                    st->rows = realloc(st->rows, st->max_rows * sizeof(cJSON *));
+                }
+                st->rows[st->n_rows++] = doc;
+                return;
+            case STAGE_COUNT:
+                st->seen++;
+                cJSON_Delete(doc);
+                return;
+        }
+    }
+    emit(agg, doc);
+}
+
+/*
+ * the input is done: let a blocking stage pass on what it has been holding
+ */
+static void flush_stage(vme_agg_t *agg, int idx)
+{
+    stage_t *st = &agg->stages[idx];
+    switch (st->kind) {
+        case STAGE_GROUP:
+            for (group_t *g = st->first; g != NULL; g = g->next) {
+                cJSON *doc = cJSON_CreateObject();
+                cJSON_AddItemToObject(doc, "_id", g->id);
+                g->id = NULL;
+                for (int i = 0; i < st->n_accs; i++)
+                    cJSON_AddItemToObject(doc, st->accs[i].name, acc_value(&st->accs[i], &g->accs[i]));
+                push_row(agg, idx + 1, doc);
+            }
+            break;
+        case STAGE_SORT:
+            sort_rows(st->spec, st->rows, st->n_rows);
+            for (size_t i = 0; i < st->n_rows; i++)
+                push_row(agg, idx + 1, st->rows[i]);
+            st->n_rows = 0;
+            break;
+        case STAGE_COUNT: {
+            cJSON *doc = cJSON_CreateObject();
+            cJSON_AddNumberToObject(doc, st->spec->valuestring, (double)st->seen);
+            push_row(agg, idx + 1, doc);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static int parse_group(vme_agg_t *agg, stage_t *st)
+{
+    st->id_expr = cJSON_GetObjectItemCaseSensitive(st->spec, "_id");
+    if (st->id_expr == NULL) {
+        agg_fail(agg, "$group requires an _id");
+        return -1;
+    }
+    st->accs = calloc(cJSON_GetArraySize(st->spec) + 1, sizeof(acc_spec_t));
+    for (const cJSON *f = st->spec->child; f != NULL; f = f->next) {
+        if (strcmp(f->string, "_id") == 0)
+            continue;
+        acc_spec_t *acc = &st->accs[st->n_accs++];
+        acc->name = f->string;
+        const cJSON *op = (cJSON_IsObject(f) ? f->child : NULL);
+        static const char *ops[] = { "$sum", "$avg", "$min", "$max", "$first", "$last" };
+        int found = 0;
+        for (int i = 0; op != NULL && i < (int)(sizeof(ops) / sizeof(ops[0])); i++) {
+            if (strcmp(op->string, ops[i]) == 0) {
+                acc->op = (acc_op_t)i;
+                found = 1;
+            }
+        }
+        if (!found) {
+            agg_fail(agg, "unsupported $group accumulator, expected one of $sum, $avg, $min, $max, $first, $last");
+            return -1;
+        }
+        acc->path = field_ref(op);
+        if (acc->path == NULL) {
+            if (!cJSON_IsNumber(op) || acc->op == ACC_FIRST || acc->op == ACC_LAST) {
+                agg_fail(agg, "$group accumulators take a \"$property\" or a number");
+                return -1;
+            }
+            acc->constant = op->valuedouble;
+        }
+    }
+    st->n_buckets = GROUP_MIN_BUCKETS;
+    st->buckets = calloc(st->n_buckets, sizeof(group_t *));
+    return 0;
+}
+
+static int parse_stage(vme_agg_t *agg, const cJSON *stageSpec, stage_t *st)
+{
+    const cJSON *spec = (cJSON_IsObject(stageSpec) ? stageSpec->child : NULL);
+    if (spec == NULL || spec->next != NULL) {
+        agg_fail(agg, "each pipeline stage must be an object with a single operator");
+        return -1;
+    }
+    st->spec = spec;
+    const char *name = spec->string;
+    if (strcmp(name, "$match") == 0 && cJSON_IsObject(spec)) {
+        st->kind = STAGE_MATCH;
+        st->where = vc_where_compile_json(spec);
+        if (st->where == NULL) {
+            agg_fail(agg, "unsupported $match, see vme_where_compile for the operators evaluated locally");
+            return -1;
+        }
+    } else if (strcmp(name, "$project") == 0 && cJSON_IsObject(spec)) {
+        st->kind = STAGE_PROJECT;
+    } else if ((strcmp(name, "$skip") == 0 || strcmp(name, "$limit") == 0) && cJSON_IsNumber(spec)
+               && spec->valuedouble >= 0) {
+        st->kind = (name[1] == 's' ? STAGE_SKIP : STAGE_LIMIT);
+        st->n = (long)spec->valuedouble;
+    } else if (strcmp(name, "$group") == 0 && cJSON_IsObject(spec)) {
+        st->kind = STAGE_GROUP;
+        return parse_group(agg, st);
+    } else if (strcmp(name, "$sort") == 0 && cJSON_IsObject(spec)) {
+        st->kind = STAGE_SORT;
+    } else if (strcmp(name, "$count") == 0 && cJSON_IsString(spec) && spec->valuestring[0] != '\0') {
+        st->kind = STAGE_COUNT;
+    } else {
+        char errMsg[128];
+        snprintf(errMsg, sizeof(errMsg), "unsupported or malformed pipeline stage %.64s", name);
+        agg_fail(agg, errMsg);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * vme_agg_open --
+ *
+ *      pipeline - json specification of the pipeline. supported stages: $match, $project, $group (accumulators
+ *          $sum, $avg, $min, $max, $first, $last), $sort, $skip, $limit and $count
+ *
+ * RETURN: a local aggregation to feed instances to, finish with vme_agg_finish. an invalid pipeline is reported
+ *      by vme_agg_finish.
+ */
+vme_agg_t *vme_agg_open(const char *pipeline)
+{
+    vme_agg_t *agg = malloc(sizeof(vme_agg_t));
+    memset(agg, 0, sizeof(vme_agg_t));
+    agg->out = cJSON_CreateArray();
+    agg->elem = vmebuf_alloc();
+    vc_jscan_init(&agg->scan);
+
+    agg->pipeline = (pipeline != NULL ? cJSON_Parse(pipeline) : NULL);
+    if (agg->pipeline == NULL || !cJSON_IsArray(agg->pipeline)) {
+        agg_fail(agg, "pipeline must be a JSON array of stages");
+        return agg;
+    }
+    agg->stages = calloc(cJSON_GetArraySize(agg->pipeline) + 1, sizeof(stage_t));
+    agg->first_blocking = -1;
+    for (const cJSON *s = agg->pipeline->child; s != NULL; s = s->next) {
+        stage_t *st = &agg->stages[agg->n_stages++];
+        if (parse_stage(agg, s, st) != 0)
+            break;
+        if (agg->first_blocking < 0 && (st->kind == STAGE_GROUP || st->kind == STAGE_SORT || st->kind == STAGE_COUNT))
+            agg->first_blocking = agg->n_stages - 1;
+    }
+    if (agg->first_blocking < 0)
+        agg->first_blocking = agg->n_stages;
+    return agg;
+}
+
+static void process_elem(vme_agg_t *agg)
+{
+    vmebuf_push(agg->elem, '\0');
+    cJSON *doc = cJSON_Parse(agg->elem->data);
+    vmebuf_truncate(agg->elem);
+    agg->in_elem = 0;
+    if (doc == NULL) {
+        agg_fail(agg, "aggregation input is not valid JSON");
+        return;
+    }
+    push_row(agg, 0, doc);
+}
+
+/*
+ * vme_agg_feed --
+ *
+ *      agg - aggregation returned by vme_agg_open
+ *      data / size - the next chunk of a JSON array of instances (or of newline delimited instances). chunks need
+ *          not respect instance boundaries.
+ *
+ * RETURN: size, so it can stand in for a vme_select_callback callback (see vme_agg_callback)
+ */
+size_t vme_agg_feed(vme_agg_t *agg, const char *data, size_t size)
+{
+    size_t off = 0, segStart = 0;
+    while (off < size && !agg->done) {
+        int event;
+        size_t n = vc_jscan_next(&agg->scan, data + off, size - off, &event);
+        if (event == JSCAN_START) {
+            agg->in_elem = 1;
+            segStart = off + n - 1;
+        } else if (event == JSCAN_END) {
+            vmebuf_concat(agg->elem, data + segStart, off + n - segStart);
+            process_elem(agg);
+        }
+        off += n;
+    }
+    if (agg->in_elem && !agg->done)
+        vmebuf_concat(agg->elem, data + segStart, size - segStart);
+    return size;
+}
+
+size_t vme_agg_callback(void *state, const char *data, size_t size)
+{
+    return vme_agg_feed((vme_agg_t *)state, data, size);
+}
+
+static void free_agg(vme_agg_t *agg)
+{
+    for (int i = 0; i < agg->n_stages; i++) {
+        stage_t *st = &agg->stages[i];
+        group_t *g = st->first;
+        while (g != NULL) {
+            group_t *next = g->next;
+            for (int j = 0; j < st->n_accs; j++)
+                cJSON_Delete(g->accs[j].other);
+            cJSON_Delete(g->id);
+            free(g->key);
+            free(g);
+            g = next;
+        }
+        vme_where_free(st->where);
+        free(st->buckets);
+        free(st->accs);
+        for (size_t j = 0; j < st->n_rows; j++)
+            cJSON_Delete(st->rows[j]);
+        free(st->rows);
+    }
+    free(agg->stages);
+    cJSON_Delete(agg->pipeline);
+    cJSON_Delete(agg->out);
+    vmebuf_dealloc(agg->elem);
+    free(agg->error);
+    free(agg);
+}
+
+/*
+ * vme_agg_finish --
+ *
+ *      agg - aggregation returned by vme_agg_open, freed by this call
+ *
+ * RETURN: the pipeline's output as a JSON array in vme_json_data with vme_count set to the number of results, or
+ *      vme_error_msg explaining what was wrong with the pipeline or its input
+ */
+vme_result_t *vme_agg_finish(vme_agg_t *agg)
+{
+    if (agg->error == NULL && agg->in_elem) {
+        /* a bare value at the very end of NDJSON ends with the input, anything else was cut short */
+        if (agg->scan.in_scalar)
+            process_elem(agg);
+        else
+            agg_fail(agg, "aggregation input ended part way through an instance");
+    }
+    if (agg->error != NULL) {
+        vme_result_t *result = vme_error_result(agg->error);
+        free_agg(agg);
+        return result;
+    }
+    for (int i = agg->first_blocking; i < agg->n_stages; i++)
+        flush_stage(agg, i);
+
+    vme_result_t *result = malloc(sizeof(vme_result_t));
+    memset(result, 0, sizeof(vme_result_t));
+    result->vme_json_data = cJSON_PrintUnformatted(agg->out);
+    result->vme_size = strlen(result->vme_json_data);
+    result->vme_count = agg->out_count;
+    free_agg(agg);
+    return result;
+}
+
+/*
+ * vme_aggregate_local --
+ *
+ *      json / size - JSON array of instances, e.g. the vme_json_data of a (cached) select
+ *      pipeline - as for vme_agg_open
+ */
+vme_result_t *vme_aggregate_local(const char *json, size_t size, const char *pipeline)
+{
+    vme_agg_t *agg = vme_agg_open(pipeline);
+    vme_agg_feed(agg, json, size);
+    return vme_agg_finish(agg);
+}
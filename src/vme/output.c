@@ -0,0 +1,202 @@
+//
+//  output.c
+//
+//  stream select results straight to a file descriptor. bytes go from libcurl's receive buffer to write(2) as they
+//  arrive, so the size of a result set is limited by the disk rather than by memory. results can be written as the
+//  JSON array the server sends or as NDJSON, one instance per line.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vme.h"
+#include "jscan.h"
+#include "utils.h"
+#include "vantiq_client.h"
+
+typedef struct {
+    int                 fd;
+    vme_output_opts_t   opts;
+    vc_jscan_t          scan;
+    size_t              bytes;      // written so far
+    uint32_t            rows;
+    size_t              unsynced;   // bytes written since the last fsync
+    int                 err;        // errno of the first failed write / fsync
+} output_state_t;
+
+static int sync_fd(output_state_t *out)
+{
+    /* pipes and sockets can't be synced, which is fine */
+    if (fsync(out->fd) != 0 && errno != EINVAL && errno != EROFS && errno != ENOTSUP) {
+        out->err = errno;
+        return -1;
+    }
+    out->unsynced = 0;
+    return 0;
+}
+
+static int write_all(output_state_t *out, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(out->fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            out->err = errno;
+            return -1;
+        }
+        data += n;
+        len -= n;
+        out->bytes += n;
+        out->unsynced += n;
+    }
+    if (out->opts.fsync == VME_FSYNC_EVERY && out->unsynced >= out->opts.fsync_bytes)
+        return sync_fd(out);
+    return 0;
+}
+
+/*
+ * an instance is written as is, except that line breaks between its tokens (there can be none inside JSON strings)
+ * are left out so it stays on one line
+ */
+static int write_oneline(output_state_t *out, const char *data, size_t len)
+{
+    size_t start = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == '\n' || data[i] == '\r') {
+            if (write_all(out, data + start, i - start) != 0)
+                return -1;
+            start = i + 1;
+        }
+    }
+    return write_all(out, data + start, len - start);
+}
+
+static size_t output_callback(void *state, const char *data, size_t size)
+{
+    output_state_t *out = (output_state_t *)state;
+    if (out->err != 0)
+        return 0;
+    int ndjson = (out->opts.format == VME_OUTPUT_NDJSON);
+    if (!ndjson && write_all(out, data, size) != 0)
+        return 0;
+
+    /* count instances, and for NDJSON pick out their bytes */
+    size_t off = 0, segStart = 0;
+    while (off < size) {
+        int event;
+        off += vc_jscan_next(&out->scan, data + off, size - off, &event);
+        if (event == JSCAN_START) {
+            segStart = off - 1;
+        } else if (event == JSCAN_END) {
+            out->rows++;
+            if (ndjson && (write_oneline(out, data + segStart, off - segStart) != 0 || write_all(out, "\n", 1) != 0))
+                return 0;
+        }
+    }
+    if (ndjson && vc_jscan_in_element(&out->scan) && write_oneline(out, data + segStart, size - segStart) != 0)
+        return 0;
+    return size;
+}
+
+/*
+ * vme_select_to_fd --
+ *
+ *      vme ... limit - as for vme_select
+ *      fd - where the results go, e.g. a file or a socket. left open.
+ *      opts - output format and fsync policy, NULL for the JSON array as received and no fsync
+ *
+ * RETURN: vme_size is the number of bytes written, vme_count the number of instances. vme_json_data is NULL. if the
+ *      server rejects the select nothing is written and vme_error_msg explains why.
+ */
+vme_result_t *vme_select_to_fd(VME vme, const char *rsURI, const char *propSpecs, const char *where,
+                               const char *sortSpec, int page, int limit, int fd, const vme_output_opts_t *opts)
+{
+    vantiq_client_t *vc = vc_from_vme(vme);
+    if (vc == NULL)
+        return vme_error_result("invalid VME handle");
+
+    output_state_t out;
+    memset(&out, 0, sizeof(out));
+    out.fd = fd;
+    if (opts != NULL)
+        out.opts = *opts;
+    vc_jscan_init(&out.scan);
+
+    /* the callback state has to stay ours for the whole request */
+    pthread_mutex_lock(&vc->lock);
+    void *prevState = vc->callback_state;
+    vc->callback_state = &out;
+    vme_result_t *result = vme_select_callback(vme, rsURI, propSpecs, where, sortSpec, page, limit, output_callback);
+    vc->callback_state = prevState;
+    pthread_mutex_unlock(&vc->lock);
+
+    if (result->vme_error_msg == NULL && out.opts.format == VME_OUTPUT_NDJSON && vc_jscan_in_element(&out.scan)) {
+        /* only a bare value can end with the input */
+        if (out.scan.in_scalar) {
+            out.rows++;
+            write_all(&out, "\n", 1);
+        }
+    }
+    if (out.err == 0 && result->vme_error_msg == NULL && out.opts.fsync != VME_FSYNC_NONE && out.unsynced > 0)
+        sync_fd(&out);
+    if (out.err != 0) {
+        char errMsg[128];
+        snprintf(errMsg, sizeof(errMsg), "writing select results failed: %s", strerror(out.err));
+        vme_free_result(result);
+        result = vme_error_result(errMsg);
+    }
+    result->vme_size = out.bytes;
+    result->vme_count = out.rows;
+    return result;
+}
+
+/*
+ * vme_select_to_file --
+ *
+ *      path - file to write the results to. they are written to <path>.part which replaces path only once the whole
+ *          result set is on disk, so readers never see a partial file.
+ *
+ * everything else as for vme_select_to_fd.
+ */
+vme_result_t *vme_select_to_file(VME vme, const char *rsURI, const char *propSpecs, const char *where,
+                                 const char *sortSpec, int page, int limit, const char *path,
+                                 const vme_output_opts_t *opts)
+{
+    size_t len = strlen(path) + sizeof(".part");
+    char *partPath = malloc(len);
+    snprintf(partPath, len, "%s.part", path);
+
+    char errMsg[256];
+    int fd = open(partPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        snprintf(errMsg, sizeof(errMsg), "can't create %.180s: %s", partPath, strerror(errno));
+        free(partPath);
+        return vme_error_result(errMsg);
+    }
+    vme_result_t *result = vme_select_to_fd(vme, rsURI, propSpecs, where, sortSpec, page, limit, fd, opts);
+
+    const char *failed = NULL;
+    if (close(fd) != 0)
+        failed = "close";
+    else if (result->vme_error_msg == NULL && rename(partPath, path) != 0)
+        failed = "rename";
+    if (failed != NULL && result->vme_error_msg == NULL) {
+        snprintf(errMsg, sizeof(errMsg), "%s of %.180s failed: %s", failed, partPath, strerror(errno));
+        size_t bytes = result->vme_size;
+        uint32_t rows = result->vme_count;
+        vme_free_result(result);
+        result = vme_error_result(errMsg);
+        result->vme_size = bytes;
+        result->vme_count = rows;
+    }
+    if (result->vme_error_msg != NULL)
+        unlink(partPath);
+    free(partPath);
+    return result;
+}
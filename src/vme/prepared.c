@@ -0,0 +1,330 @@
+//
+//  prepared.c
+//
+//  prepared selects and aggregates. the static parts of the request url (resource path, projection, sort spec and
+//  the text of the where clause or pipeline) are url encoded once when the statement is prepared. each '?' outside
+//  of a JSON string in the where clause / pipeline is a parameter; only the values bound to parameters are encoded
+//  when they are bound, so executing a statement again is a matter of gluing pre-encoded fragments together.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "vme.h"
+#include "cjson.h"
+#include "utils.h"
+#include "vantiq_client.h"
+
+#define PLACEHOLDER '?'
+
+struct vme_prepared {
+    VME         vme;
+    char       *rsURI;          // resource targeted, /aggregate appended for pipelines
+    char       *base;           // server url + rsURI
+    int         is_aggregate;
+    int         n_params;
+    char      **fragments;      // n_params + 1 encoded fragments surrounding the parameters
+    char      **bound;          // encoded value for each parameter, NULL until bound
+};
+
+/*
+ * append the url encoded form of str to buf
+ */
+static void concat_escaped(vantiq_client_t *vc, vmebuf_t *buf, const char *str, size_t len)
+{
+    if (len == 0)
+        return;
+    char *escaped = curl_easy_escape(vc->curl, str, (int)len);
+    if (escaped != NULL) {
+        vmebuf_concat(buf, escaped, strlen(escaped));
+        curl_free(escaped);
+    } else {
+        vmebuf_concat(buf, str, len);
+    }
+}
+
+/*
+ * count the placeholders in a JSON text. a '?' inside a JSON string is just a question mark.
+ */
+static int count_placeholders(const char *json)
+{
+    int n = 0, inString = 0;
+    for (const char *p = json; *p != '\0'; p++) {
+        if (inString) {
+            if (*p == '\\' && p[1] != '\0')
+                p++;
+            else if (*p == '"')
+                inString = 0;
+        } else if (*p == '"') {
+            inString = 1;
+        } else if (*p == PLACEHOLDER) {
+            n++;
+        }
+    }
+    return n;
+}
+
+/*
+ * split a JSON text at its placeholders, encoding each piece. the first piece is appended to 'lead' (which holds
+ * whatever static text precedes the JSON in the url), the last piece is left in 'lead' for the caller to finish.
+ */
+static void split_placeholders(vantiq_client_t *vc, vme_prepared_t *stmt, vmebuf_t *lead, const char *json)
+{
+    int frag = 0, inString = 0;
+    const char *start = json;
+    for (const char *p = json; *p != '\0'; p++) {
+        if (inString) {
+            if (*p == '\\' && p[1] != '\0')
+                p++;
+            else if (*p == '"')
+                inString = 0;
+        } else if (*p == '"') {
+            inString = 1;
+        } else if (*p == PLACEHOLDER) {
+            concat_escaped(vc, lead, start, p - start);
+            stmt->fragments[frag++] = vmebuf_tostr(lead);
+            vmebuf_truncate(lead);
+            start = p + 1;
+        }
+    }
+    concat_escaped(vc, lead, start, strlen(start));
+}
+
+static vme_prepared_t *alloc_prepared(VME vme, vantiq_client_t *vc, const char *rsURI, int nParams)
+{
+    vme_prepared_t *stmt = malloc(sizeof(vme_prepared_t));
+    memset(stmt, 0, sizeof(vme_prepared_t));
+    stmt->vme = vme;
+    stmt->rsURI = strdup(rsURI);
+    size_t len = strlen(vc->server_url) + strlen(rsURI) + 1;
+    stmt->base = malloc(len);
+    snprintf(stmt->base, len, "%s%s", vc->server_url, rsURI);
+    stmt->n_params = nParams;
+    stmt->fragments = calloc(nParams + 1, sizeof(char *));
+    stmt->bound = calloc(nParams + 1, sizeof(char *));
+    return stmt;
+}
+
+/*
+ * vme_prepare_select --
+ *
+ *      vme - handle returned from call to vme_init
+ *      rsURI - path to the resource we are selecting from
+ *      propSpecs - projected properties, may be NULL
+ *      where - where clause, may be NULL. each '?' not inside a JSON string is a parameter to bind before executing
+ *          e.g. {"salary" : {"$gt" : ?}, "dept" : ?}
+ *      sortSpec - how to order the results, may be NULL
+ *
+ * RETURN: a statement to bind / execute repeatedly, free with vme_free_prepared. NULL for an invalid handle.
+ */
+vme_prepared_t *vme_prepare_select(VME vme, const char *rsURI, const char *propSpecs, const char *where,
+                                   const char *sortSpec)
+{
+    vantiq_client_t *vc = vc_from_vme(vme);
+    if (vc == NULL)
+        return NULL;
+    vme_prepared_t *stmt = alloc_prepared(vme, vc, rsURI, (where != NULL ? count_placeholders(where) : 0));
+
+    /* same parameter order create_url produces for vme_select, so both share cache entries */
+    vmebuf_t *lead = vmebuf_alloc();
+    if (sortSpec != NULL) {
+        vmebuf_concat(lead, "sort=", sizeof("sort=")-1);
+        concat_escaped(vc, lead, sortSpec, strlen(sortSpec));
+    }
+    if (where != NULL) {
+        if (lead->len > 0)
+            vmebuf_push(lead, ';');
+        vmebuf_concat(lead, "where=", sizeof("where=")-1);
+        split_placeholders(vc, stmt, lead, where);
+    }
+    if (propSpecs != NULL) {
+        if (lead->len > 0)
+            vmebuf_push(lead, ';');
+        vmebuf_concat(lead, "props=", sizeof("props=")-1);
+        concat_escaped(vc, lead, propSpecs, strlen(propSpecs));
+    }
+    stmt->fragments[stmt->n_params] = vmebuf_tostr(lead);
+    vmebuf_dealloc(lead);
+    return stmt;
+}
+
+/*
+ * vme_prepare_aggregate --
+ *
+ *      vme - handle returned from call to vme_init
+ *      rsURI - path to the resource we are aggregating
+ *      pipeline - json specification for the pipeline, '?' outside of JSON strings are parameters
+ *          e.g. [{"$match": {"salary" : {"$gt" : ?}}}, {"$group": {"_id": "$dept", "total": {"$sum": "$salary"}}}]
+ *
+ * RETURN: a statement to bind / execute repeatedly, free with vme_free_prepared. NULL for an invalid handle.
+ */
+vme_prepared_t *vme_prepare_aggregate(VME vme, const char *rsURI, const char *pipeline)
+{
+    vantiq_client_t *vc = vc_from_vme(vme);
+    if (vc == NULL)
+        return NULL;
+    char *aggRsURI = build_aggregate_rsuri(rsURI);
+    vme_prepared_t *stmt = alloc_prepared(vme, vc, aggRsURI, count_placeholders(pipeline));
+    free(aggRsURI);
+    stmt->is_aggregate = 1;
+
+    vmebuf_t *lead = vmebuf_alloc();
+    vmebuf_concat(lead, "pipeline=", sizeof("pipeline=")-1);
+    split_placeholders(vc, stmt, lead, pipeline);
+    stmt->fragments[stmt->n_params] = vmebuf_tostr(lead);
+    vmebuf_dealloc(lead);
+    return stmt;
+}
+
+/*
+ * the parameter count of a statement, so callers can check their where clause was understood
+ */
+int vme_prepared_param_count(const vme_prepared_t *stmt)
+{
+    return stmt->n_params;
+}
+
+/*
+ * remember the url encoded form of a JSON value for parameter 'index' (1 based)
+ */
+static int bind_encoded(vme_prepared_t *stmt, int index, const char *json)
+{
+    vantiq_client_t *vc = vc_from_vme(stmt->vme);
+    if (vc == NULL || index < 1 || index > stmt->n_params)
+        return -1;
+    vmebuf_t *buf = vmebuf_alloc();
+    concat_escaped(vc, buf, json, strlen(json));
+    free(stmt->bound[index-1]);
+    stmt->bound[index-1] = vmebuf_tostr(buf);
+    vmebuf_dealloc(buf);
+    return 0;
+}
+
+/*
+ * vme_bind_json / vme_bind_string / vme_bind_double / vme_bind_int --
+ *
+ *      stmt - statement returned by vme_prepare_select or vme_prepare_aggregate
+ *      index - which '?' to replace, 1 is the first
+ *      value - the value. strings are quoted and escaped for you, vme_bind_json takes any JSON text as is
+ *          (e.g. an array for $in)
+ *
+ * RETURN: 0 on success, -1 for an invalid statement or index, or a value JSON can't hold (nan, inf)
+ */
+int vme_bind_json(vme_prepared_t *stmt, int index, const char *json)
+{
+    return bind_encoded(stmt, index, json);
+}
+
+int vme_bind_string(vme_prepared_t *stmt, int index, const char *value)
+{
+    cJSON *str = cJSON_CreateString(value);
+    char *json = cJSON_PrintUnformatted(str);
+    int rc = bind_encoded(stmt, index, json);
+    free(json);
+    cJSON_Delete(str);
+    return rc;
+}
+
+int vme_bind_double(vme_prepared_t *stmt, int index, double value)
+{
+    if (!isfinite(value))
+        return -1;
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.17g", value);
+    return bind_encoded(stmt, index, buf);
+}
+
+int vme_bind_int(vme_prepared_t *stmt, int index, int64_t value)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%" PRId64, value);
+    return bind_encoded(stmt, index, buf);
+}
+
+/*
+ * glue the url together from the pre-encoded pieces. page and limit only apply to selects.
+ */
+static vme_result_t *exec_prepared(vme_prepared_t *stmt, int page, int limit)
+{
+    vantiq_client_t *vc = vc_from_vme(stmt->vme);
+    if (vc == NULL)
+        return vme_error_result("invalid VME handle");
+    for (int i = 0; i < stmt->n_params; i++) {
+        if (stmt->bound[i] == NULL) {
+            char errMsg[64];
+            snprintf(errMsg, sizeof(errMsg), "parameter %d of prepared statement is not bound", i + 1);
+            return vme_error_result(errMsg);
+        }
+    }
+
+    vmebuf_t *url = vmebuf_ensure_size(NULL, strlen(stmt->base) + strlen(stmt->fragments[stmt->n_params]) + 64);
+    vmebuf_concat(url, stmt->base, strlen(stmt->base));
+    size_t mark = url->len;
+    char buf[32];
+    if (limit > 0) {
+        int n = snprintf(buf, sizeof(buf), "?limit=%d", limit);
+        vmebuf_concat(url, buf, n);
+    }
+    if (page > 0) {
+        int n = snprintf(buf, sizeof(buf), "%cpage=%d", (url->len > mark ? ';' : '?'), page);
+        vmebuf_concat(url, buf, n);
+    }
+    if (stmt->n_params > 0 || strlen(stmt->fragments[0]) > 0)
+        vmebuf_push(url, (url->len > mark ? ';' : '?'));
+    for (int i = 0; i < stmt->n_params; i++) {
+        vmebuf_concat(url, stmt->fragments[i], strlen(stmt->fragments[i]));
+        vmebuf_concat(url, stmt->bound[i], strlen(stmt->bound[i]));
+    }
+    vmebuf_concat(url, stmt->fragments[stmt->n_params], strlen(stmt->fragments[stmt->n_params]));
+    vmebuf_push(url, '\0');
+
+    vme_result_t *result = vc_get_url(vc, stmt->rsURI, url->data);
+    vmebuf_dealloc(url);
+    return result;
+}
+
+/*
+ * vme_exec_select --
+ *
+ *      stmt - statement returned by vme_prepare_select with all its parameters bound
+ *      page / limit - as for vme_select
+ *
+ * bindings stay in place after execution, so a polling loop only re-binds what changed.
+ */
+vme_result_t *vme_exec_select(vme_prepared_t *stmt, int page, int limit)
+{
+    if (stmt == NULL || stmt->is_aggregate)
+        return vme_error_result("not a prepared select");
+    return exec_prepared(stmt, page, limit);
+}
+
+/*
+ * vme_exec_aggregate --
+ *
+ *      stmt - statement returned by vme_prepare_aggregate with all its parameters bound
+ */
+vme_result_t *vme_exec_aggregate(vme_prepared_t *stmt)
+{
+    if (stmt == NULL || !stmt->is_aggregate)
+        return vme_error_result("not a prepared aggregate");
+    return exec_prepared(stmt, 0, 0);
+}
+
+void vme_free_prepared(vme_prepared_t *stmt)
+{
+    if (stmt == NULL)
+        return;
+    for (int i = 0; i <= stmt->n_params; i++) {
+        free(stmt->fragments[i]);
+        free(stmt->bound[i]);
+    }
+    free(stmt->fragments);
+    free(stmt->bound);
+    free(stmt->base);
+    free(stmt->rsURI);
+    free(stmt);
+}
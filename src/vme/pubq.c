@@ -0,0 +1,356 @@
+//
+//  pubq.c
+//
+//  asynchronous publishing. vme_publish_async copies the message into a bounded ring and returns, and
+//  vme_publish_async_buf queues the caller's buffer itself; a sender thread owned by the client takes messages off
+//  the ring in order and posts them. what happens when the ring is full is up to the app: wait for room, throw away
+//  the oldest queued message, or refuse the new one.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+
+#include "pubq.h"
+#include "utils.h"
+#include "vantiq_client.h"
+#include "log.h"
+
+#define DEFAULT_CAPACITY 1024
+#define SPINS 64
+
+static void deadline_in(struct timespec *ts, int ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static int try_enqueue(vc_pubq_t *q, vc_pubmsg_t *msg)
+{
+    uint64_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    for (;;) {
+        vc_pubslot_t *slot = &q->slots[pos & q->mask];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)seq - (int64_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->msg = msg;
+                __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -1;      // full
+        } else {
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static vc_pubmsg_t *try_dequeue(vc_pubq_t *q)
+{
+    uint64_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        vc_pubslot_t *slot = &q->slots[pos & q->mask];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)seq - (int64_t)(pos + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                vc_pubmsg_t *msg = slot->msg;
+                __atomic_store_n(&slot->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+                return msg;
+            }
+        } else if (diff < 0) {
+            return NULL;    // empty
+        } else {
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* messages handed over with vc_pubq_push_buf give their buffer back as they go */
+static void free_msg(vc_pubmsg_t *msg)
+{
+    if (msg->buf != NULL) {
+        if (msg->release != NULL)
+            msg->release(msg->release_state, msg->buf);
+        else
+            vmebuf_dealloc(msg->buf);
+    }
+    free(msg);
+}
+
+/*
+ * a message left the ring, sent or not. wake anyone waiting for room or for the ring to empty.
+ */
+static void message_done(vc_pubq_t *q)
+{
+    __atomic_add_fetch(&q->completed, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&q->blocked, __ATOMIC_SEQ_CST) > 0 || __atomic_load_n(&q->flushing, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&q->lock);
+        pthread_cond_broadcast(&q->space);
+        pthread_cond_broadcast(&q->idle);
+        pthread_mutex_unlock(&q->lock);
+    }
+}
+
+static void *sender_main(void *arg)
+{
+    vc_pubq_t *q = (vc_pubq_t *)arg;
+    vantiq_client_t *vc = (vantiq_client_t *)q->vme;
+    while (!__atomic_load_n(&q->stop, __ATOMIC_ACQUIRE)) {
+        vc_pubmsg_t *msg = try_dequeue(q);
+        if (msg == NULL) {
+            pthread_mutex_lock(&q->lock);
+            __atomic_store_n(&q->sender_sleeping, 1, __ATOMIC_SEQ_CST);
+            /* re-check now that producers can see we're asleep; the timeout is only a safety net */
+            if ((msg = try_dequeue(q)) == NULL && !q->stop) {
+                struct timespec ts;
+                deadline_in(&ts, 100);
+                pthread_cond_timedwait(&q->nonempty, &q->lock, &ts);
+            }
+            __atomic_store_n(&q->sender_sleeping, 0, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&q->lock);
+            if (msg == NULL)
+                continue;
+        }
+
+        vmebuf_t body = { .len = msg->size, .limit = msg->size, .data = msg->data };
+        vmebuf_t *msgBuf = (msg->buf != NULL ? msg->buf : &body);
+        char *rsURI = vme_build_system_rsuri(q->vme, TOPICS, msg->topic, NULL);
+        vme_result_t *result = vc_post(vc, rsURI, msgBuf, NULL);
+        vc_stats_publish(&vc->stats, result);
+        free(rsURI);
+        if (result->vme_error_msg == NULL) {
+            __atomic_add_fetch(&q->published, 1, __ATOMIC_RELAXED);
+        } else {
+            __atomic_add_fetch(&q->failed, 1, __ATOMIC_RELAXED);
+            log_debug("async publish to %s failed: %s", msg->topic, result->vme_error_msg);
+            if (q->opts.on_error != NULL)
+                q->opts.on_error(q->opts.state, msg->topic, msgBuf->data, msg->size, result->vme_error_msg);
+        }
+        vme_free_result(result);
+        free_msg(msg);
+        message_done(q);
+    }
+    return NULL;
+}
+
+vc_pubq_t *vc_pubq_create(VME vme, const vme_publish_opts_t *opts)
+{
+    vc_pubq_t *q = NULL;
+    if (posix_memalign((void **)&q, 64, sizeof(vc_pubq_t)) != 0)
+        return NULL;
+    memset(q, 0, sizeof(vc_pubq_t));
+    q->vme = vme;
+    if (opts != NULL)
+        q->opts = *opts;
+    uint64_t capacity = 2;
+    while (capacity < (q->opts.capacity == 0 ? DEFAULT_CAPACITY : q->opts.capacity))
+        capacity <<= 1;
+    q->opts.capacity = (uint32_t)capacity;
+    q->mask = capacity - 1;
+    q->slots = malloc(capacity * sizeof(vc_pubslot_t));
+    for (uint64_t i = 0; i < capacity; i++) {
+        q->slots[i].seq = i;
+        q->slots[i].msg = NULL;
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&q->nonempty, &attr);
+    pthread_cond_init(&q->space, &attr);
+    pthread_cond_init(&q->idle, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&q->sender, NULL, sender_main, q) != 0) {
+        log_debug("failed to start the publish sender thread");
+        free(q->slots);
+        q->slots = NULL;
+        vc_pubq_destroy(q);
+        return NULL;
+    }
+    return q;
+}
+
+/*
+ * stops the sender after the publish in progress. anything still queued is discarded; flush first to avoid that.
+ */
+void vc_pubq_destroy(vc_pubq_t *q)
+{
+    if (q == NULL)
+        return;
+    if (q->slots != NULL) {
+        pthread_mutex_lock(&q->lock);
+        __atomic_store_n(&q->stop, 1, __ATOMIC_RELEASE);
+        pthread_cond_signal(&q->nonempty);
+        pthread_mutex_unlock(&q->lock);
+        pthread_join(q->sender, NULL);
+
+        vc_pubmsg_t *msg;
+        uint32_t discarded = 0;
+        while ((msg = try_dequeue(q)) != NULL) {
+            free_msg(msg);
+            discarded++;
+        }
+        if (discarded > 0)
+            log_debug("discarded %u queued publishes", discarded);
+        free(q->slots);
+    }
+    pthread_cond_destroy(&q->idle);
+    pthread_cond_destroy(&q->space);
+    pthread_cond_destroy(&q->nonempty);
+    pthread_mutex_destroy(&q->lock);
+    free(q);
+}
+
+/*
+ * put msg on the ring according to the queue's policy. a message that can't be queued is freed
+ */
+static int enqueue(vc_pubq_t *q, vc_pubmsg_t *msg)
+{
+    vc_stats_t *stats = &((vantiq_client_t *)q->vme)->stats;
+    for (int spins = 0; try_enqueue(q, msg) != 0; spins++) {
+        if (q->opts.when_full == VME_QUEUE_FAIL) {
+            free_msg(msg);
+            __atomic_add_fetch(&stats->publish_dropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        } else if (q->opts.when_full == VME_QUEUE_DROP_OLDEST) {
+            vc_pubmsg_t *oldest = try_dequeue(q);
+            if (oldest != NULL) {
+                free_msg(oldest);
+                __atomic_add_fetch(&q->dropped, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&stats->publish_dropped, 1, __ATOMIC_RELAXED);
+                message_done(q);
+            }
+        } else if (spins < SPINS) {
+            sched_yield();
+        } else {
+            pthread_mutex_lock(&q->lock);
+            __atomic_add_fetch(&q->blocked, 1, __ATOMIC_SEQ_CST);
+            if (try_enqueue(q, msg) == 0) {
+                __atomic_sub_fetch(&q->blocked, 1, __ATOMIC_SEQ_CST);
+                pthread_mutex_unlock(&q->lock);
+                break;
+            }
+            struct timespec ts;
+            deadline_in(&ts, 100);
+            pthread_cond_timedwait(&q->space, &q->lock, &ts);
+            __atomic_sub_fetch(&q->blocked, 1, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&q->lock);
+        }
+    }
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&q->sender_sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&q->lock);
+        pthread_cond_signal(&q->nonempty);
+        pthread_mutex_unlock(&q->lock);
+    }
+    return 0;
+}
+
+/*
+ * vc_pubq_push --
+ *
+ *      q - the client's publish queue
+ *      topic / json / size - as for vme_publish. both are copied.
+ *
+ * RETURN: 0 when queued, -1 if the queue is full and the policy is VME_QUEUE_FAIL
+ */
+int vc_pubq_push(vc_pubq_t *q, const char *topic, const char *json, size_t size)
+{
+    size_t topicLen = strlen(topic);
+    vc_pubmsg_t *msg = malloc(sizeof(vc_pubmsg_t) + size + 1 + topicLen + 1);
+    msg->size = size;
+    msg->buf = NULL;
+    memcpy(msg->data, json, size);
+    msg->data[size] = '\0';
+    msg->topic = msg->data + size + 1;
+    memcpy(msg->topic, topic, topicLen + 1);
+    return enqueue(q, msg);
+}
+
+/*
+ * vc_pubq_push_buf --
+ *
+ *      q - the client's publish queue
+ *      topic - as for vme_publish, copied
+ *      buf / release / state - as for vme_publish_buf. buf is queued as it is and released once sent or dropped
+ *
+ * RETURN: as for vc_pubq_push
+ */
+int vc_pubq_push_buf(vc_pubq_t *q, const char *topic, vmebuf_t *buf, vme_release_fn release, void *state)
+{
+    size_t topicLen = strlen(topic);
+    vc_pubmsg_t *msg = malloc(sizeof(vc_pubmsg_t) + topicLen + 1);
+    msg->size = buf->len;
+    msg->buf = buf;
+    msg->release = release;
+    msg->release_state = state;
+    msg->topic = msg->data;
+    memcpy(msg->topic, topic, topicLen + 1);
+    return enqueue(q, msg);
+}
+
+/*
+ * vc_pubq_flush --
+ *
+ *      q - the client's publish queue
+ *      timeoutMs - how long to wait for the queue to empty, negative to wait as long as it takes
+ *
+ * RETURN: vme_count is the number published since the last flush, vme_error_msg says how many failed or were
+ *      dropped, or that we timed out
+ */
+vme_result_t *vc_pubq_flush(vc_pubq_t *q, int timeoutMs)
+{
+    struct timespec deadline;
+    if (timeoutMs >= 0)
+        deadline_in(&deadline, timeoutMs);
+    int timedOut = 0;
+    pthread_mutex_lock(&q->lock);
+    __atomic_add_fetch(&q->flushing, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&q->completed, __ATOMIC_SEQ_CST) != __atomic_load_n(&q->head, __ATOMIC_SEQ_CST)) {
+        struct timespec ts;
+        deadline_in(&ts, 100);
+        if (timeoutMs >= 0 && (ts.tv_sec > deadline.tv_sec
+                               || (ts.tv_sec == deadline.tv_sec && ts.tv_nsec > deadline.tv_nsec)))
+            ts = deadline;
+        if (pthread_cond_timedwait(&q->idle, &q->lock, &ts) == ETIMEDOUT && timeoutMs >= 0
+            && ts.tv_sec == deadline.tv_sec && ts.tv_nsec == deadline.tv_nsec) {
+            timedOut = 1;
+            break;
+        }
+    }
+    __atomic_sub_fetch(&q->flushing, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&q->lock);
+
+    uint64_t pending = __atomic_load_n(&q->head, __ATOMIC_SEQ_CST) - __atomic_load_n(&q->completed, __ATOMIC_SEQ_CST);
+    uint64_t published = __atomic_exchange_n(&q->published, 0, __ATOMIC_RELAXED);
+    uint64_t failed = __atomic_exchange_n(&q->failed, 0, __ATOMIC_RELAXED);
+    uint64_t dropped = __atomic_exchange_n(&q->dropped, 0, __ATOMIC_RELAXED);
+
+    vme_result_t *result;
+    char errMsg[128];
+    if (timedOut && pending > 0) {
+        snprintf(errMsg, sizeof(errMsg), "timed out with %llu publishes pending", (unsigned long long)pending);
+        result = vme_error_result(errMsg);
+    } else if (failed > 0 || dropped > 0) {
+        snprintf(errMsg, sizeof(errMsg), "%llu publishes failed, %llu dropped",
+                 (unsigned long long)failed, (unsigned long long)dropped);
+        result = vme_error_result(errMsg);
+    } else {
+        result = malloc(sizeof(vme_result_t));
+        memset(result, 0, sizeof(vme_result_t));
+    }
+    result->vme_count = (uint32_t)published;
+    return result;
+}
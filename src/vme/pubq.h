@@ -0,0 +1,60 @@
+//  pubq.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#ifndef VANTIQ_PUBQ_H
+#define VANTIQ_PUBQ_H
+
+#include <pthread.h>
+
+#include "vme.h"
+
+typedef struct vc_pubmsg {
+    char       *topic;      // points into data, after the payload
+    size_t      size;
+    vmebuf_t   *buf;        // when set, the payload is here rather than in data and is released once sent
+    vme_release_fn release;
+    void       *release_state;
+    char        data[];
+} vc_pubmsg_t;
+
+typedef struct vc_pubslot {
+    uint64_t     seq;
+    vc_pubmsg_t *msg;
+} vc_pubslot_t;
+
+/*
+ * a bounded multi-producer queue of publishes (Vyukov's ring: each slot carries the sequence number of the lap it
+ * is ready for, so producers claim slots with a single CAS) drained by one sender thread. the mutex and conditions
+ * are only for sleeping when the queue is empty or full, never on the fast path.
+ */
+typedef struct vc_pubq {
+    VME                 vme;
+    vme_publish_opts_t  opts;
+    uint64_t            mask;
+    vc_pubslot_t       *slots;
+    uint64_t            head __attribute__((aligned(64)));  // next position to enqueue
+    uint64_t            tail __attribute__((aligned(64)));  // next position to dequeue
+    uint64_t            completed __attribute__((aligned(64)));  // sent, failed or dropped
+    int                 sender_sleeping;
+    int                 blocked;        // producers waiting for room
+    int                 flushing;       // callers waiting for the queue to empty
+    int                 stop;
+    pthread_mutex_t     lock;
+    pthread_cond_t      nonempty;
+    pthread_cond_t      space;
+    pthread_cond_t      idle;
+    pthread_t           sender;
+    uint64_t            published;      // since the last flush
+    uint64_t            failed;
+    uint64_t            dropped;
+} vc_pubq_t;
+
+vc_pubq_t *vc_pubq_create(VME vme, const vme_publish_opts_t *opts);
+void vc_pubq_destroy(vc_pubq_t *q);
+
+int vc_pubq_push(vc_pubq_t *q, const char *topic, const char *json, size_t size);
+int vc_pubq_push_buf(vc_pubq_t *q, const char *topic, vmebuf_t *buf, vme_release_fn release, void *state);
+vme_result_t *vc_pubq_flush(vc_pubq_t *q, int timeoutMs);
+
+#endif
@@ -0,0 +1,165 @@
+//
+//  reduce.c
+//
+//  sum / min / max / count reduction kernels over arrays of doubles, e.g. a decoded column or the values buffered
+//  by a local $group accumulator. the dense kernel keeps two vectors of partial results per statistic so the adds
+//  of consecutive iterations don't wait on each other; SSE2 on x86-64, NEON on arm64, a 4-way unrolled scalar loop
+//  elsewhere.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "vme.h"
+
+void vme_reduction_init(vme_reduction_t *acc)
+{
+    memset(acc, 0, sizeof(vme_reduction_t));
+}
+
+static void reduce_scalar(vme_reduction_t *acc, const double *values, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        double v = values[i];
+        if (acc->count == 0 || v < acc->min)
+            acc->min = v;
+        if (acc->count == 0 || v > acc->max)
+            acc->max = v;
+        acc->sum += v;
+        acc->count++;
+    }
+}
+
+/*
+ * reduce n values with no nulls among them
+ */
+static void reduce_dense(vme_reduction_t *acc, const double *values, size_t n)
+{
+    size_t i = 0;
+    if (n >= 4) {
+        double sum, mn, mx;
+#if defined(__SSE2__)
+        __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+        __m128d mn0 = _mm_loadu_pd(values), mn1 = _mm_loadu_pd(values + 2);
+        __m128d mx0 = mn0, mx1 = mn1;
+        for (; i + 4 <= n; i += 4) {
+            __m128d a = _mm_loadu_pd(values + i), b = _mm_loadu_pd(values + i + 2);
+            s0 = _mm_add_pd(s0, a);
+            s1 = _mm_add_pd(s1, b);
+            mn0 = _mm_min_pd(mn0, a);
+            mn1 = _mm_min_pd(mn1, b);
+            mx0 = _mm_max_pd(mx0, a);
+            mx1 = _mm_max_pd(mx1, b);
+        }
+        double lanes[2];
+        _mm_storeu_pd(lanes, _mm_add_pd(s0, s1));
+        sum = lanes[0] + lanes[1];
+        _mm_storeu_pd(lanes, _mm_min_pd(mn0, mn1));
+        mn = (lanes[0] < lanes[1] ? lanes[0] : lanes[1]);
+        _mm_storeu_pd(lanes, _mm_max_pd(mx0, mx1));
+        mx = (lanes[0] > lanes[1] ? lanes[0] : lanes[1]);
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+        float64x2_t s0 = vdupq_n_f64(0.0), s1 = vdupq_n_f64(0.0);
+        float64x2_t mn0 = vld1q_f64(values), mn1 = vld1q_f64(values + 2);
+        float64x2_t mx0 = mn0, mx1 = mn1;
+        for (; i + 4 <= n; i += 4) {
+            float64x2_t a = vld1q_f64(values + i), b = vld1q_f64(values + i + 2);
+            s0 = vaddq_f64(s0, a);
+            s1 = vaddq_f64(s1, b);
+            mn0 = vminq_f64(mn0, a);
+            mn1 = vminq_f64(mn1, b);
+            mx0 = vmaxq_f64(mx0, a);
+            mx1 = vmaxq_f64(mx1, b);
+        }
+        sum = vaddvq_f64(vaddq_f64(s0, s1));
+        mn = vminvq_f64(vminq_f64(mn0, mn1));
+        mx = vmaxvq_f64(vmaxq_f64(mx0, mx1));
+#else
+        double s[4] = { 0, 0, 0, 0 };
+        double lo[4] = { values[0], values[1], values[2], values[3] };
+        double hi[4] = { values[0], values[1], values[2], values[3] };
+        for (; i + 4 <= n; i += 4) {
+            for (int j = 0; j < 4; j++) {
+                double v = values[i + j];
+                s[j] += v;
+                lo[j] = (v < lo[j] ? v : lo[j]);
+                hi[j] = (v > hi[j] ? v : hi[j]);
+            }
+        }
+        sum = (s[0] + s[1]) + (s[2] + s[3]);
+        mn = lo[0];
+        mx = hi[0];
+        for (int j = 1; j < 4; j++) {
+            mn = (lo[j] < mn ? lo[j] : mn);
+            mx = (hi[j] > mx ? hi[j] : mx);
+        }
+#endif
+        if (acc->count == 0 || mn < acc->min)
+            acc->min = mn;
+        if (acc->count == 0 || mx > acc->max)
+            acc->max = mx;
+        acc->sum += sum;
+        acc->count += i;
+    }
+    reduce_scalar(acc, values + i, n - i);
+}
+
+/*
+ * vme_reduce_f64 --
+ *
+ *      acc - running reduction, start it off with vme_reduction_init. reducing more values adds to it.
+ *      values - n values
+ *      nulls - optional null bitmap laid out like vme_column_t::nulls (bit i % 8 of nulls[i / 8] set means
+ *          values[i] is skipped), NULL when every value counts
+ */
+void vme_reduce_f64(vme_reduction_t *acc, const double *values, size_t n, const uint8_t *nulls)
+{
+    if (nulls == NULL) {
+        reduce_dense(acc, values, n);
+        return;
+    }
+    /* hand runs of 8-value groups without nulls to the dense kernel in one go */
+    size_t i = 0;
+    while (i < n) {
+        size_t run = i;
+        while (run + 8 <= n && nulls[run / 8] == 0)
+            run += 8;
+        if (run > i) {
+            reduce_dense(acc, values + i, run - i);
+            i = run;
+            continue;
+        }
+        size_t end = (i + 8 < n ? i + 8 : n);
+        for (; i < end; i++) {
+            if (!((nulls[i / 8] >> (i % 8)) & 1))
+                reduce_scalar(acc, values + i, 1);
+        }
+    }
+}
+
+/*
+ * same as vme_reduce_f64 for an int64 column. values are converted to double in blocks, sums of integers beyond
+ * 2^53 lose precision.
+ */
+void vme_reduce_i64(vme_reduction_t *acc, const int64_t *values, size_t n, const uint8_t *nulls)
+{
+    double block[256];
+    for (size_t i = 0; i < n; i += 256) {
+        size_t len = (n - i < 256 ? n - i : 256);
+        for (size_t j = 0; j < len; j++)
+            block[j] = (double)values[i + j];
+        if (nulls == NULL) {
+            reduce_dense(acc, block, len);
+        } else {
+            /* i is a multiple of 256, so the bitmap for this block starts on a byte boundary */
+            vme_reduce_f64(acc, block, len, nulls + i / 8);
+        }
+    }
+}
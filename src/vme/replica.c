@@ -0,0 +1,504 @@
+//
+//  replica.c
+//
+//  a local replica of a type kept up to date incrementally. every sync asks only for instances whose mark property
+//  (ars_modifiedAt unless told otherwise) is at or past the highest mark seen so far and merges them in by key.
+//  deletions show up either through a tombstone type (instances recording the key of what was deleted and when)
+//  or by a full reconcile, which fetches just the keys of every instance and drops whatever the server no longer
+//  has. the cost of keeping up is proportional to churn rather than to the size of the type.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "vme.h"
+#include "cjson.h"
+#include "utils.h"
+#include "where.h"
+#include "vantiq_client.h"
+#include "log.h"
+
+#define REPLICA_PAGE_SIZE 500
+#define REPLICA_MIN_BUCKETS 64
+
+typedef struct replica_entry {
+    char                 *key;
+    uint32_t              hash;
+    char                 *json;         // the instance, unformatted
+    uint32_t              generation;   // last reconcile that saw the key on the server
+    struct replica_entry *hnext;
+} replica_entry_t;
+
+struct vme_replica {
+    VME                 vme;
+    char               *rsURI;
+    char               *key_prop;
+    char               *mark_prop;
+    cJSON              *mark;           // high-water mark, NULL before the first sync
+    char               *tomb_rsURI;
+    char               *tomb_key_prop;
+    char               *tomb_mark_prop;
+    cJSON              *tomb_mark;
+    replica_entry_t   **buckets;
+    uint32_t            n_buckets;
+    size_t              count;
+    uint32_t            generation;
+};
+
+static uint32_t str_hash(const char *str)
+{
+    uint32_t h = 2166136261u;
+    while (*str != '\0') {
+        h ^= (uint8_t)*str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*
+ * the key of an instance as a string: strings as is, anything else printed as JSON. NULL if there is no key.
+ */
+static char *instance_key(const cJSON *inst, const char *keyProp)
+{
+    const cJSON *key = json_lookup_path(inst, keyProp);
+    if (key == NULL || cJSON_IsNull(key))
+        return NULL;
+    if (cJSON_IsString(key))
+        return strdup(key->valuestring);
+    return cJSON_PrintUnformatted(key);
+}
+
+static replica_entry_t **find_slot(vme_replica_t *rep, const char *key, uint32_t h)
+{
+    replica_entry_t **pp = &rep->buckets[h & (rep->n_buckets - 1)];
+    while (*pp != NULL && ((*pp)->hash != h || strcmp((*pp)->key, key) != 0))
+        pp = &(*pp)->hnext;
+    return pp;
+}
+
+static void rehash(vme_replica_t *rep)
+{
+    uint32_t nBuckets = rep->n_buckets * 2;
+    replica_entry_t **buckets = calloc(nBuckets, sizeof(replica_entry_t *));
+    for (uint32_t i = 0; i < rep->n_buckets; i++) {
+        replica_entry_t *e = rep->buckets[i];
+        while (e != NULL) {
+            replica_entry_t *next = e->hnext;
+            e->hnext = buckets[e->hash & (nBuckets - 1)];
+            buckets[e->hash & (nBuckets - 1)] = e;
+            e = next;
+        }
+    }
+    free(rep->buckets);
+    rep->buckets = buckets;
+    rep->n_buckets = nBuckets;
+}
+
+static void free_entry(replica_entry_t *e)
+{
+    free(e->key);
+    free(e->json);
+    free(e);
+}
+
+/*
+ * add or replace an instance. key is consumed. RETURN 1 if the replica changed, 0 if it already had the instance
+ * exactly as it is.
+ */
+static int merge(vme_replica_t *rep, char *key, const cJSON *inst)
+{
+    uint32_t h = str_hash(key);
+    replica_entry_t **pp = find_slot(rep, key, h);
+    char *json = cJSON_PrintUnformatted(inst);
+    if (*pp != NULL) {
+        int changed = (strcmp((*pp)->json, json) != 0);
+        free((*pp)->json);
+        (*pp)->json = json;
+        (*pp)->generation = rep->generation;
+        free(key);
+        return changed;
+    }
+    replica_entry_t *e = malloc(sizeof(replica_entry_t));
+    e->key = key;
+    e->hash = h;
+    e->json = json;
+    e->generation = rep->generation;
+    e->hnext = NULL;
+    *pp = e;
+    if (++rep->count > rep->n_buckets)
+        rehash(rep);
+    return 1;
+}
+
+static int remove_key(vme_replica_t *rep, const char *key)
+{
+    replica_entry_t **pp = find_slot(rep, key, str_hash(key));
+    if (*pp == NULL)
+        return 0;
+    replica_entry_t *e = *pp;
+    *pp = e->hnext;
+    free_entry(e);
+    rep->count--;
+    return 1;
+}
+
+/*
+ * vme_replica_open --
+ *
+ *      vme - handle returned from call to vme_init
+ *      rsURI - the type to replicate
+ *      keyProp - property identifying an instance, NULL means "_id"
+ *      markProp - property that increases whenever an instance changes, NULL means "ars_modifiedAt"
+ *
+ * RETURN: an empty replica, vme_replica_sync fills it. NULL for an invalid handle.
+ */
+vme_replica_t *vme_replica_open(VME vme, const char *rsURI, const char *keyProp, const char *markProp)
+{
+    if (vc_from_vme(vme) == NULL)
+        return NULL;
+    vme_replica_t *rep = malloc(sizeof(vme_replica_t));
+    memset(rep, 0, sizeof(vme_replica_t));
+    rep->vme = vme;
+    rep->rsURI = strdup(rsURI);
+    rep->key_prop = strdup(keyProp != NULL ? keyProp : "_id");
+    rep->mark_prop = strdup(markProp != NULL ? markProp : "ars_modifiedAt");
+    rep->n_buckets = REPLICA_MIN_BUCKETS;
+    rep->buckets = calloc(rep->n_buckets, sizeof(replica_entry_t *));
+    return rep;
+}
+
+/*
+ * vme_replica_set_tombstones --
+ *
+ *      rep - replica returned by vme_replica_open
+ *      rsURI - type the application records deletions in
+ *      keyProp - property of a tombstone holding the key of the deleted instance
+ *      markProp - property of a tombstone that increases with each deletion, NULL means "ars_createdAt"
+ *
+ * from then on every sync also applies tombstones recorded since the last one.
+ */
+void vme_replica_set_tombstones(vme_replica_t *rep, const char *rsURI, const char *keyProp, const char *markProp)
+{
+    free(rep->tomb_rsURI);
+    free(rep->tomb_key_prop);
+    free(rep->tomb_mark_prop);
+    rep->tomb_rsURI = strdup(rsURI);
+    rep->tomb_key_prop = strdup(keyProp);
+    rep->tomb_mark_prop = strdup(markProp != NULL ? markProp : "ars_createdAt");
+}
+
+/*
+ * {"<markProp>": {"$gte": <mark>}}. instances sharing the mark of the last sync come back again, which merging
+ * makes harmless, whereas $gt could miss instances written within the same tick after we looked.
+ */
+static char *since_where(const char *markProp, const cJSON *mark)
+{
+    if (mark == NULL)
+        return NULL;
+    cJSON *where = cJSON_CreateObject();
+    cJSON *cond = cJSON_CreateObject();
+    cJSON_AddItemToObject(cond, "$gte", cJSON_Duplicate(mark, 1));
+    cJSON_AddItemToObject(where, markProp, cond);
+    char *str = cJSON_PrintUnformatted(where);
+    cJSON_Delete(where);
+    return str;
+}
+
+static char *sort_spec(const char *prop, const char *tieProp)
+{
+    size_t len = strlen(prop) + (tieProp != NULL ? strlen(tieProp) : 0) + 16;
+    char *sort = malloc(len);
+    if (tieProp != NULL)
+        snprintf(sort, len, "{\"%s\":1,\"%s\":1}", prop, tieProp);
+    else
+        snprintf(sort, len, "{\"%s\":1}", prop);
+    return sort;
+}
+
+/*
+ * the where clause for the page following 'last': whatever sorts after it by the order property then, among
+ * instances sharing that, by the tie property (none when the order property is unique). NULL if last lacks either.
+ */
+static char *after_where(const char *orderProp, const char *tieProp, const cJSON *last)
+{
+    const cJSON *order = json_lookup_path(last, orderProp);
+    const cJSON *tie = (tieProp != NULL ? json_lookup_path(last, tieProp) : NULL);
+    if (order == NULL || cJSON_IsNull(order) || (tieProp != NULL && (tie == NULL || cJSON_IsNull(tie))))
+        return NULL;
+    cJSON *where = cJSON_CreateObject();
+    cJSON *later = cJSON_CreateObject();
+    cJSON_AddItemToObject(later, "$gt", cJSON_Duplicate(order, 1));
+    if (tieProp == NULL) {
+        cJSON_AddItemToObject(where, orderProp, later);
+    } else {
+        /* {"$or": [{<order>: {"$gt": <order>}}, {<order>: <order>, <tie>: {"$gt": <tie>}}]} */
+        cJSON *or = cJSON_AddArrayToObject(where, "$or");
+        cJSON *past = cJSON_CreateObject();
+        cJSON_AddItemToObject(past, orderProp, later);
+        cJSON_AddItemToArray(or, past);
+        cJSON *same = cJSON_CreateObject();
+        cJSON *tieLater = cJSON_CreateObject();
+        cJSON_AddItemToObject(tieLater, "$gt", cJSON_Duplicate(tie, 1));
+        cJSON_AddItemToObject(same, orderProp, cJSON_Duplicate(order, 1));
+        cJSON_AddItemToObject(same, tieProp, tieLater);
+        cJSON_AddItemToArray(or, same);
+    }
+    char *str = cJSON_PrintUnformatted(where);
+    cJSON_Delete(where);
+    return str;
+}
+
+typedef void (*page_fn_t)(vme_replica_t *rep, const cJSON *inst, uint32_t *changed);
+
+/*
+ * select in order of orderProp then tieProp (NULL when orderProp is unique), starting with what satisfies
+ * where, handing each instance to fn. paging keeps the size of any one response bounded no matter how much
+ * changed. each page asks for what sorts after the last instance of the one before rather than for page N, so
+ * instances that change (and so move to the end) while we page can't shift others past us unseen.
+ */
+static vme_result_t *fetch_pages(vme_replica_t *rep, const char *rsURI, const char *props, const char *where,
+                                 const char *orderProp, const char *tieProp, page_fn_t fn)
+{
+    vantiq_client_t *vc = vc_from_vme(rep->vme);
+    if (vc == NULL)
+        return vme_error_result("invalid VME handle");
+    char *sort = sort_spec(orderProp, tieProp);
+    char *after = NULL;
+    uint32_t changed = 0;
+    for (;;) {
+        struct param *params = build_select_params(props, (after != NULL ? after : where), sort, 0,
+                                                   REPLICA_PAGE_SIZE);
+        vme_result_t *result = vc_get_uncached(vc, rsURI, params);
+        free_params(params);
+        free(after);
+        after = NULL;
+        if (result->vme_error_msg != NULL) {
+            free(sort);
+            return result;
+        }
+        cJSON *insts = (result->vme_json_data != NULL ? cJSON_Parse(result->vme_json_data) : NULL);
+        vme_free_result(result);
+        if (insts == NULL || !cJSON_IsArray(insts)) {
+            cJSON_Delete(insts);
+            free(sort);
+            return vme_error_result("replica sync expected a JSON array of instances");
+        }
+        int n = 0;
+        const cJSON *last = NULL;
+        for (const cJSON *inst = insts->child; inst != NULL; last = inst, inst = inst->next, n++)
+            fn(rep, inst, &changed);
+        if (n < REPLICA_PAGE_SIZE) {
+            cJSON_Delete(insts);
+            break;
+        }
+        after = after_where(orderProp, tieProp, last);
+        cJSON_Delete(insts);
+        if (after == NULL) {
+            free(sort);
+            return vme_error_result("replica sync can't page past an instance without its mark or key");
+        }
+    }
+    free(sort);
+    vme_result_t *result = malloc(sizeof(vme_result_t));
+    memset(result, 0, sizeof(vme_result_t));
+    result->vme_count = changed;
+    return result;
+}
+
+static void advance_mark(cJSON **mark, const cJSON *value)
+{
+    if (value != NULL && !cJSON_IsNull(value) && (*mark == NULL || json_value_cmp(*mark, value) < 0)) {
+        cJSON_Delete(*mark);
+        *mark = cJSON_Duplicate(value, 1);
+    }
+}
+
+static void merge_changed(vme_replica_t *rep, const cJSON *inst, uint32_t *changed)
+{
+    char *key = instance_key(inst, rep->key_prop);
+    if (key == NULL) {
+        log_debug("replica of %s skipping an instance without %s", rep->rsURI, rep->key_prop);
+        return;
+    }
+    if (merge(rep, key, inst))
+        (*changed)++;
+    advance_mark(&rep->mark, json_lookup_path(inst, rep->mark_prop));
+}
+
+static void apply_tombstone(vme_replica_t *rep, const cJSON *tomb, uint32_t *changed)
+{
+    char *key = instance_key(tomb, rep->tomb_key_prop);
+    if (key != NULL && remove_key(rep, key))
+        (*changed)++;
+    free(key);
+    advance_mark(&rep->tomb_mark, json_lookup_path(tomb, rep->tomb_mark_prop));
+}
+
+static void mark_present(vme_replica_t *rep, const cJSON *inst, uint32_t *changed)
+{
+    char *key = instance_key(inst, rep->key_prop);
+    if (key == NULL)
+        return;
+    replica_entry_t *e = *find_slot(rep, key, str_hash(key));
+    if (e != NULL)
+        e->generation = rep->generation;
+    free(key);
+}
+
+/*
+ * vme_replica_sync --
+ *
+ *      rep - replica returned by vme_replica_open
+ *
+ * RETURN: vme_count is the number of instances added, replaced or removed. the first sync loads the whole type.
+ *      on error the replica holds whatever was merged before the error and the next sync picks up from there.
+ */
+vme_result_t *vme_replica_sync(vme_replica_t *rep)
+{
+    char *where = since_where(rep->mark_prop, rep->mark);
+    vme_result_t *result = fetch_pages(rep, rep->rsURI, NULL, where, rep->mark_prop, "_id", merge_changed);
+    free(where);
+    if (result->vme_error_msg != NULL || rep->tomb_rsURI == NULL)
+        return result;
+
+    /* tombstones from before our first sync refer to instances we never had */
+    where = since_where(rep->tomb_mark_prop, rep->tomb_mark);
+    vme_result_t *tombs = fetch_pages(rep, rep->tomb_rsURI, NULL, where, rep->tomb_mark_prop, "_id", apply_tombstone);
+    free(where);
+    if (tombs->vme_error_msg != NULL) {
+        vme_free_result(result);
+        return tombs;
+    }
+    result->vme_count += tombs->vme_count;
+    vme_free_result(tombs);
+    return result;
+}
+
+/*
+ * vme_replica_reconcile --
+ *
+ *      rep - replica returned by vme_replica_open
+ *
+ * catch up on deletions without tombstones: sync, then fetch the key of every instance on the server and drop local
+ * instances that are gone. run it now and then, e.g. every Nth sync.
+ * RETURN: as for vme_replica_sync
+ */
+vme_result_t *vme_replica_reconcile(vme_replica_t *rep)
+{
+    vme_result_t *result = vme_replica_sync(rep);
+    if (result->vme_error_msg != NULL)
+        return result;
+
+    rep->generation++;
+    size_t len = strlen(rep->key_prop) + 5;
+    char *props = malloc(len);
+    snprintf(props, len, "[\"%s\"]", rep->key_prop);
+    vme_result_t *keys = fetch_pages(rep, rep->rsURI, props, NULL, rep->key_prop, NULL, mark_present);
+    free(props);
+    if (keys->vme_error_msg != NULL) {
+        vme_free_result(result);
+        return keys;
+    }
+    vme_free_result(keys);
+
+    for (uint32_t i = 0; i < rep->n_buckets; i++) {
+        replica_entry_t **pp = &rep->buckets[i];
+        while (*pp != NULL) {
+            replica_entry_t *e = *pp;
+            if (e->generation != rep->generation) {
+                *pp = e->hnext;
+                free_entry(e);
+                rep->count--;
+                result->vme_count++;
+            } else {
+                pp = &e->hnext;
+            }
+        }
+    }
+    return result;
+}
+
+/*
+ * the instance with the given key as unformatted JSON, NULL if the replica doesn't have it. the string belongs to
+ * the replica and is only good until the next sync or reconcile.
+ */
+const char *vme_replica_get(vme_replica_t *rep, const char *key)
+{
+    replica_entry_t *e = *find_slot(rep, key, str_hash(key));
+    return (e != NULL ? e->json : NULL);
+}
+
+size_t vme_replica_count(const vme_replica_t *rep)
+{
+    return rep->count;
+}
+
+/*
+ * vme_replica_select --
+ *
+ *      rep - replica returned by vme_replica_open
+ *      where - where clause evaluated locally (see vme_where_compile), NULL for every instance
+ *
+ * RETURN: a JSON array of the matching instances, in no particular order, with vme_count set to their number
+ */
+vme_result_t *vme_replica_select(vme_replica_t *rep, const char *where)
+{
+    vme_where_t *w = vme_where_compile(where);
+    if (w == NULL)
+        return vme_error_result("where clause can't be evaluated locally");
+    vmebuf_t *out = vmebuf_alloc();
+    vmebuf_push(out, '[');
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < rep->n_buckets; i++) {
+        for (replica_entry_t *e = rep->buckets[i]; e != NULL; e = e->hnext) {
+            int match = 1;
+            if (where != NULL) {
+                cJSON *inst = cJSON_Parse(e->json);
+                match = vme_where_eval(w, inst);
+                cJSON_Delete(inst);
+            }
+            if (match) {
+                if (count++ > 0)
+                    vmebuf_push(out, ',');
+                vmebuf_concat(out, e->json, strlen(e->json));
+            }
+        }
+    }
+    vmebuf_push(out, ']');
+    vme_where_free(w);
+
+    vme_result_t *result = malloc(sizeof(vme_result_t));
+    memset(result, 0, sizeof(vme_result_t));
+    result->vme_size = out->len;
+    result->vme_json_data = vmebuf_tostr(out);
+    result->vme_count = count;
+    vmebuf_dealloc(out);
+    return result;
+}
+
+void vme_replica_close(vme_replica_t *rep)
+{
+    if (rep == NULL)
+        return;
+    for (uint32_t i = 0; i < rep->n_buckets; i++) {
+        replica_entry_t *e = rep->buckets[i];
+        while (e != NULL) {
+            replica_entry_t *next = e->hnext;
+            free_entry(e);
+            e = next;
+        }
+    }
+    free(rep->buckets);
+    cJSON_Delete(rep->mark);
+    cJSON_Delete(rep->tomb_mark);
+    free(rep->tomb_rsURI);
+    free(rep->tomb_key_prop);
+    free(rep->tomb_mark_prop);
+    free(rep->rsURI);
+    free(rep->key_prop);
+    free(rep->mark_prop);
+    free(rep);
+}
@@ -0,0 +1,736 @@
+//
+//  spool.c
+//
+//  store and forward. publishes and inserts are appended to a log on disk and a drainer thread replays them, in
+//  order, whenever the server can be reached, so nothing is lost while the uplink is down. the log is a directory
+//  of fixed size, memory mapped segment files; records carry a CRC so a torn write at the tail is recognized and
+//  dropped. a small ack file remembers how far delivery got: on open only the segment being written needs to be
+//  scanned, and segments are deleted as soon as everything in them has been delivered.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vme.h"
+#include "utils.h"
+#include "log.h"
+
+#define DEFAULT_SEGMENT_BYTES   (4 * 1024 * 1024)
+#define DEFAULT_MAX_BYTES       (64 * 1024 * 1024)
+#define DEFAULT_RETRY_MS        1000
+#define MAX_BACKOFF             32
+
+#define SEG_MAGIC   "VMESPOOL"
+#define SEG_VERSION 1
+#define REC_MAGIC   0x52505356      // "VSPR"
+#define ACK_MAGIC   0x4b505356      // "VSPK"
+
+#define ALIGN8(n)   (((n) + 7) & ~(size_t)7)
+
+enum { SPOOL_PUBLISH = 1, SPOOL_INSERT = 2, SPOOL_UPSERT = 3 };
+
+typedef struct seg_hdr {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    count;      // records in the segment, filled in when it is sealed
+    uint64_t    number;
+    uint64_t    size;
+} seg_hdr_t;
+
+/*
+ * a record is this header, the target (topic or resource URI) and the payload, padded to 8 bytes. the CRC covers
+ * everything after the crc field. magic is stored last.
+ */
+typedef struct rec_hdr {
+    uint32_t    magic;
+    uint32_t    crc;
+    uint32_t    length;
+    uint16_t    target_len;
+    uint8_t     kind;
+    uint8_t     reserved;
+    uint64_t    seq;
+} rec_hdr_t;
+
+typedef struct ack_rec {
+    uint32_t    magic;
+    uint32_t    crc;
+    uint64_t    seg;
+    uint64_t    off;
+    uint64_t    idx;
+} ack_rec_t;
+
+struct vme_spool {
+    VME                 vme;
+    char               *dir;
+    vme_spool_opts_t    opts;
+    uint64_t            max_segments;
+    pthread_mutex_t     lock;
+    pthread_cond_t      wake;       // the drainer: something was appended, or we're closing
+    pthread_cond_t      drained;    // flushers: nothing is pending
+    // the segment being appended to
+    uint64_t            write_seg;
+    int                 write_fd;
+    char               *write_map;
+    size_t              write_size;
+    size_t              write_off;
+    uint32_t            write_count;
+    size_t              synced_off; // how much of it vme_spool_sync has made durable
+    int                 group_sync; // set once vme_spool_sync is used
+    uint64_t            seq;
+    // the drainer's position
+    uint64_t            read_seg;
+    size_t              read_off;
+    uint64_t            read_idx;
+    uint64_t            read_map_seg;
+    char               *read_map;
+    size_t              read_size;
+    int                 ack_fd;
+    uint64_t            pending;
+    uint64_t            delivered;  // since the last flush
+    uint64_t            rejected;
+    pthread_t           drainer;
+    int                 draining;
+    int                 stop;
+};
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32(const void *data, size_t len)
+{
+    pthread_once(&crc_once, crc_init);
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t c = 0xffffffff;
+    while (len-- > 0)
+        c = crc_table[(c ^ *p++) & 0xff] ^ (c >> 8);
+    return c ^ 0xffffffff;
+}
+
+static void seg_path(const vme_spool_t *sp, uint64_t n, char *path, size_t size)
+{
+    snprintf(path, size, "%s/%016llx.seg", sp->dir, (unsigned long long)n);
+}
+
+static void deadline_in(struct timespec *ts, uint32_t ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static int past(const struct timespec *deadline)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec));
+}
+
+/*
+ * the record at off, or NULL if there isn't a complete, intact one there (the end of the segment)
+ */
+static const rec_hdr_t *valid_record(const char *map, size_t size, size_t off, size_t *total)
+{
+    if (off + sizeof(rec_hdr_t) > size)
+        return NULL;
+    const rec_hdr_t *rec = (const rec_hdr_t *)(map + off);
+    if (__atomic_load_n(&rec->magic, __ATOMIC_ACQUIRE) != REC_MAGIC)
+        return NULL;
+    size_t len = ALIGN8(sizeof(rec_hdr_t) + rec->target_len + (size_t)rec->length);
+    if (len > size - off)
+        return NULL;
+    if (crc32(&rec->length, sizeof(rec_hdr_t) - 8 + rec->target_len + rec->length) != rec->crc)
+        return NULL;
+    *total = len;
+    return rec;
+}
+
+/*
+ * walk the records of a mapped segment. RETURN: the offset just past the last intact record
+ */
+static size_t scan_segment(const char *map, size_t size, uint32_t *count)
+{
+    size_t off = sizeof(seg_hdr_t), total;
+    *count = 0;
+    while (valid_record(map, size, off, &total) != NULL) {
+        off += total;
+        (*count)++;
+    }
+    return off;
+}
+
+static char *map_segment(const vme_spool_t *sp, uint64_t n, int writable, int *fdOut, size_t *sizeOut)
+{
+    char path[1024];
+    seg_path(sp, n, path, sizeof(path));
+    int fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    struct stat st;
+    char *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(seg_hdr_t))
+        map = mmap(NULL, st.st_size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED || memcmp(map, SEG_MAGIC, 8) != 0) {
+        if (map != MAP_FAILED)
+            munmap(map, st.st_size);
+        close(fd);
+        log_debug("spool segment %s is unusable", path);
+        return NULL;
+    }
+    *sizeOut = st.st_size;
+    if (fdOut != NULL)
+        *fdOut = fd;
+    else
+        close(fd);
+    return map;
+}
+
+static int create_segment(vme_spool_t *sp, uint64_t n, size_t size)
+{
+    char path[1024];
+    seg_path(sp, n, path, sizeof(path));
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        return -1;
+    char *map = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    seg_hdr_t *hdr = (seg_hdr_t *)map;
+    memcpy(hdr->magic, SEG_MAGIC, 8);
+    hdr->version = SEG_VERSION;
+    hdr->count = 0;
+    hdr->number = n;
+    hdr->size = size;
+    sp->write_seg = n;
+    sp->write_fd = fd;
+    sp->write_map = map;
+    sp->write_size = size;
+    sp->write_off = sizeof(seg_hdr_t);
+    sp->write_count = 0;
+    sp->synced_off = 0;
+    return 0;
+}
+
+static void close_write_segment(vme_spool_t *sp)
+{
+    if (sp->write_map == NULL)
+        return;
+    munmap(sp->write_map, sp->write_size);
+    close(sp->write_fd);
+    sp->write_map = NULL;
+}
+
+static void close_read_segment(vme_spool_t *sp)
+{
+    if (sp->read_map == NULL)
+        return;
+    munmap(sp->read_map, sp->read_size);
+    sp->read_map = NULL;
+    sp->read_map_seg = 0;
+}
+
+static void persist_ack(vme_spool_t *sp)
+{
+    ack_rec_t ack;
+    ack.magic = ACK_MAGIC;
+    ack.seg = sp->read_seg;
+    ack.off = sp->read_off;
+    ack.idx = sp->read_idx;
+    ack.crc = crc32(&ack.seg, sizeof(ack) - 8);
+    if (pwrite(sp->ack_fd, &ack, sizeof(ack), 0) != sizeof(ack))
+        log_debug("failed to record spool progress in %s: %s", sp->dir, strerror(errno));
+    else if (sp->opts.sync)
+        fdatasync(sp->ack_fd);
+}
+
+static vme_result_t *deliver(vme_spool_t *sp, int kind, const char *target, const char *payload, size_t len)
+{
+    switch (kind) {
+        case SPOOL_PUBLISH:
+            return vme_publish(sp->vme, target, payload, len);
+        case SPOOL_INSERT:
+            return vme_insert(sp->vme, target, payload, len);
+        case SPOOL_UPSERT:
+            return vme_upsert(sp->vme, target, payload, len);
+        default:
+            return vme_error_result("[\"unknown spool record\"]");
+    }
+}
+
+static void *drainer_main(void *arg)
+{
+    vme_spool_t *sp = (vme_spool_t *)arg;
+    uint32_t backoff = sp->opts.retry_ms;
+
+    pthread_mutex_lock(&sp->lock);
+    while (!sp->stop) {
+        if (sp->read_seg == sp->write_seg && sp->read_off >= sp->write_off) {
+            pthread_cond_broadcast(&sp->drained);
+            struct timespec ts;
+            deadline_in(&ts, 1000);
+            pthread_cond_timedwait(&sp->wake, &sp->lock, &ts);
+            continue;
+        }
+        if (sp->read_map_seg != sp->read_seg) {
+            close_read_segment(sp);
+            sp->read_map = map_segment(sp, sp->read_seg, 0, NULL, &sp->read_size);
+            if (sp->read_map != NULL)
+                sp->read_map_seg = sp->read_seg;
+        }
+
+        size_t total = 0;
+        const rec_hdr_t *rec = (sp->read_map == NULL ? NULL
+                                : valid_record(sp->read_map, sp->read_size, sp->read_off, &total));
+        if (rec == NULL) {
+            if (sp->read_seg < sp->write_seg) {
+                /* done with a sealed segment */
+                char path[1024];
+                seg_path(sp, sp->read_seg, path, sizeof(path));
+                close_read_segment(sp);
+                sp->read_seg++;
+                sp->read_off = sizeof(seg_hdr_t);
+                sp->read_idx = 0;
+                persist_ack(sp);
+                unlink(path);
+            } else {
+                log_debug("spool segment %llu is damaged before its end", (unsigned long long)sp->read_seg);
+                sp->pending -= (sp->write_count > sp->read_idx ? sp->write_count - sp->read_idx : 0);
+                sp->read_off = sp->write_off;
+                sp->read_idx = sp->write_count;
+                persist_ack(sp);
+            }
+            continue;
+        }
+
+        /* written records never change, so the payload can be used without the lock */
+        char *target = strndup((const char *)(rec + 1), rec->target_len);
+        const char *payload = (const char *)(rec + 1) + rec->target_len;
+        int kind = rec->kind;
+        size_t len = rec->length;
+        pthread_mutex_unlock(&sp->lock);
+        vme_result_t *result = deliver(sp, kind, target, payload, len);
+        pthread_mutex_lock(&sp->lock);
+
+        /* only records the server will never accept are skipped; an expired token, throttling or an outage
+           all pass, so anything else is retried */
+        int rejected = (kind < SPOOL_PUBLISH || kind > SPOOL_UPSERT || vme_rejected(result));
+        if (result->vme_error_msg == NULL || rejected) {
+            if (rejected) {
+                log_debug("server rejected spooled record for %s: %s", target, result->vme_error_msg);
+                sp->rejected++;
+            } else {
+                sp->delivered++;
+            }
+            sp->read_off += total;
+            sp->read_idx++;
+            sp->pending--;
+            persist_ack(sp);
+            backoff = sp->opts.retry_ms;
+        } else {
+            log_debug("spool delivery to %s failed, retrying in %u ms: %s", target, backoff, result->vme_error_msg);
+            struct timespec retryAt;
+            deadline_in(&retryAt, backoff);
+            while (!sp->stop && !past(&retryAt))
+                pthread_cond_timedwait(&sp->wake, &sp->lock, &retryAt);
+            if (backoff < sp->opts.retry_ms * MAX_BACKOFF)
+                backoff *= 2;
+        }
+        vme_free_result(result);
+        free(target);
+    }
+    close_read_segment(sp);
+    pthread_mutex_unlock(&sp->lock);
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+static uint64_t *list_segments(const char *dir, size_t *n)
+{
+    size_t cap = 16;
+    uint64_t *segs = malloc(cap * sizeof(uint64_t));
+    *n = 0;
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return segs;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        unsigned long long num;
+        char suffix[8];
+        if (strlen(ent->d_name) != 20 || sscanf(ent->d_name, "%16llx%7s", &num, suffix) != 2
+            || strcmp(suffix, ".seg") != 0)
+            continue;
+        if (*n == cap)
+            segs = realloc(segs, (cap *= 2) * sizeof(uint64_t));
+        segs[(*n)++] = num;
+    }
+    closedir(d);
+    qsort(segs, *n, sizeof(uint64_t), cmp_u64);
+    return segs;
+}
+
+/*
+ * find where delivery left off and where appends go, deleting whatever was already delivered. only the last
+ * segment is scanned; sealed segments know their record count.
+ */
+static int recover(vme_spool_t *sp)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/ack", sp->dir);
+    sp->ack_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (sp->ack_fd == -1)
+        return -1;
+    ack_rec_t ack;
+    int haveAck = (pread(sp->ack_fd, &ack, sizeof(ack), 0) == sizeof(ack) && ack.magic == ACK_MAGIC
+                   && ack.crc == crc32(&ack.seg, sizeof(ack) - 8));
+
+    size_t n;
+    uint64_t *segs = list_segments(sp->dir, &n);
+    size_t first = 0;
+    if (haveAck) {
+        while (first < n && segs[first] < ack.seg) {
+            seg_path(sp, segs[first++], path, sizeof(path));
+            unlink(path);
+        }
+    }
+
+    int rc = 0;
+    if (first == n) {
+        rc = create_segment(sp, (haveAck && ack.seg > 0 ? ack.seg : 1), sp->opts.segment_bytes);
+        sp->read_seg = sp->write_seg;
+        sp->read_off = sizeof(seg_hdr_t);
+        sp->read_idx = 0;
+    } else {
+        if (haveAck && segs[first] == ack.seg) {
+            sp->read_seg = ack.seg;
+            sp->read_off = ack.off;
+            sp->read_idx = ack.idx;
+        } else {
+            sp->read_seg = segs[first];
+            sp->read_off = sizeof(seg_hdr_t);
+            sp->read_idx = 0;
+        }
+        uint64_t records = 0;
+        for (size_t i = first; i < n; i++) {
+            size_t size;
+            int fd = -1;
+            char *map = map_segment(sp, segs[i], (i == n - 1), (i == n - 1 ? &fd : NULL), &size);
+            if (map == NULL) {
+                if (i == n - 1)
+                    rc = create_segment(sp, segs[i] + 1, sp->opts.segment_bytes);
+                continue;
+            }
+            uint32_t count = ((seg_hdr_t *)map)->count;
+            if (i == n - 1) {
+                sp->write_seg = segs[i];
+                sp->write_fd = fd;
+                sp->write_map = map;
+                sp->write_size = size;
+                sp->write_off = scan_segment(map, size, &sp->write_count);
+                count = sp->write_count;
+            } else {
+                if (count == 0)
+                    scan_segment(map, size, &count);
+                munmap(map, size);
+            }
+            records += count;
+        }
+        if (sp->read_seg == sp->write_seg && sp->read_off > sp->write_off) {
+            /* the tail we had delivered from didn't survive; carry on from what did */
+            sp->read_off = sp->write_off;
+            sp->read_idx = sp->write_count;
+        }
+        sp->pending = (records > sp->read_idx ? records - sp->read_idx : 0);
+    }
+    free(segs);
+    if (rc == 0)
+        persist_ack(sp);
+    return rc;
+}
+
+/*
+ * vme_spool_open --
+ *
+ *      vme - handle returned from call to vme_init, used by the drainer to deliver spooled records. NULL only
+ *          spools, e.g. when the app starts without a connection; records are delivered once the spool is
+ *          reopened with a handle.
+ *      dir - directory holding the spool, created if need be. anything left in it by an earlier run is delivered
+ *          first.
+ *      opts - segment size, the bound on the spool's size, how often to retry and whether to sync every write.
+ *          NULL means 4MB segments, 64MB in all, retries starting at 1s.
+ *
+ * RETURN: the spool, NULL if the directory couldn't be set up
+ */
+vme_spool_t *vme_spool_open(VME vme, const char *dir, const vme_spool_opts_t *opts)
+{
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+        log_debug("failed to create spool directory %s: %s", dir, strerror(errno));
+        return NULL;
+    }
+    vme_spool_t *sp = malloc(sizeof(vme_spool_t));
+    memset(sp, 0, sizeof(vme_spool_t));
+    sp->vme = vme;
+    sp->dir = strdup(dir);
+    sp->ack_fd = -1;
+    if (opts != NULL)
+        sp->opts = *opts;
+    if (sp->opts.segment_bytes == 0)
+        sp->opts.segment_bytes = DEFAULT_SEGMENT_BYTES;
+    if (sp->opts.segment_bytes < 4096)
+        sp->opts.segment_bytes = 4096;
+    if (sp->opts.max_bytes == 0)
+        sp->opts.max_bytes = DEFAULT_MAX_BYTES;
+    if (sp->opts.retry_ms == 0)
+        sp->opts.retry_ms = DEFAULT_RETRY_MS;
+    sp->max_segments = sp->opts.max_bytes / sp->opts.segment_bytes;
+    if (sp->max_segments < 2)
+        sp->max_segments = 2;
+
+    if (recover(sp) != 0) {
+        log_debug("failed to open spool %s: %s", dir, strerror(errno));
+        close_write_segment(sp);
+        if (sp->ack_fd != -1)
+            close(sp->ack_fd);
+        free(sp->dir);
+        free(sp);
+        return NULL;
+    }
+
+    pthread_mutex_init(&sp->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sp->wake, &attr);
+    pthread_cond_init(&sp->drained, &attr);
+    pthread_condattr_destroy(&attr);
+    if (vme != NULL)
+        sp->draining = (pthread_create(&sp->drainer, NULL, drainer_main, sp) == 0);
+    return sp;
+}
+
+static int spool_append(vme_spool_t *sp, int kind, const char *target, const char *json, size_t size)
+{
+    if (sp == NULL || target == NULL)
+        return -1;
+    size_t targetLen = strlen(target);
+    if (targetLen > UINT16_MAX || size > UINT32_MAX)
+        return -1;
+    size_t need = ALIGN8(sizeof(rec_hdr_t) + targetLen + size);
+
+    pthread_mutex_lock(&sp->lock);
+    if (sp->write_off + need > sp->write_size) {
+        if (sp->write_seg + 1 - sp->read_seg + 1 > sp->max_segments) {
+            pthread_mutex_unlock(&sp->lock);
+            log_debug("spool %s is full", sp->dir);
+            return -1;
+        }
+        /* seal the current segment and start the next one */
+        if (sp->write_map != NULL) {
+            ((seg_hdr_t *)sp->write_map)->count = sp->write_count;
+            if (sp->opts.sync || sp->group_sync)
+                msync(sp->write_map, sp->write_size, MS_SYNC);
+            close_write_segment(sp);
+        }
+        uint64_t next = sp->write_seg + 1;
+        size_t segSize = sp->opts.segment_bytes;
+        if (sizeof(seg_hdr_t) + need > segSize)
+            segSize = ALIGN8(sizeof(seg_hdr_t) + need);
+        if (create_segment(sp, next, segSize) != 0) {
+            log_debug("failed to add a spool segment to %s: %s", sp->dir, strerror(errno));
+            /* keep appending where we were once there is room again */
+            if ((sp->write_map = map_segment(sp, next - 1, 1, &sp->write_fd, &sp->write_size)) == NULL)
+                sp->write_size = 0;
+            pthread_mutex_unlock(&sp->lock);
+            return -1;
+        }
+    }
+
+    char *at = sp->write_map + sp->write_off;
+    rec_hdr_t *rec = (rec_hdr_t *)at;
+    rec->length = (uint32_t)size;
+    rec->target_len = (uint16_t)targetLen;
+    rec->kind = (uint8_t)kind;
+    rec->reserved = 0;
+    rec->seq = sp->seq++;
+    memcpy(at + sizeof(rec_hdr_t), target, targetLen);
+    memcpy(at + sizeof(rec_hdr_t) + targetLen, json, size);
+    rec->crc = crc32(&rec->length, sizeof(rec_hdr_t) - 8 + targetLen + size);
+    __atomic_store_n(&rec->magic, REC_MAGIC, __ATOMIC_RELEASE);
+    if (sp->opts.sync) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t start = sp->write_off & ~(page - 1);
+        msync(sp->write_map + start, sp->write_off + need - start, MS_SYNC);
+    }
+    sp->write_off += need;
+    sp->write_count++;
+    sp->pending++;
+    pthread_cond_signal(&sp->wake);
+    pthread_mutex_unlock(&sp->lock);
+    return 0;
+}
+
+/*
+ * vme_spool_publish / vme_spool_insert / vme_spool_upsert --
+ *
+ *      sp - spool returned by vme_spool_open
+ *      topic or rsURI / json / size - as for vme_publish, vme_insert and vme_upsert
+ *
+ * the record is on disk (and synced, if the spool was opened with sync set) when these return; delivery happens
+ * later, in the order records were spooled. a record may be delivered twice if we crash right after sending it.
+ *
+ * RETURN: 0 once spooled, -1 if the spool is full or can't be written
+ */
+int vme_spool_publish(vme_spool_t *sp, const char *topic, const char *json, size_t size)
+{
+    return spool_append(sp, SPOOL_PUBLISH, topic, json, size);
+}
+
+int vme_spool_insert(vme_spool_t *sp, const char *rsURI, const char *json, size_t size)
+{
+    return spool_append(sp, SPOOL_INSERT, rsURI, json, size);
+}
+
+int vme_spool_upsert(vme_spool_t *sp, const char *rsURI, const char *json, size_t size)
+{
+    return spool_append(sp, SPOOL_UPSERT, rsURI, json, size);
+}
+
+/*
+ * vme_spool_sync --
+ *
+ *      sp - spool returned by vme_spool_open
+ *
+ * make every record appended so far durable. for a spool opened without sync this lets an app append a batch and
+ * commit it with a single flush to disk. once it has been used, segments are also synced as they fill up.
+ *
+ * RETURN: 0, or -1 if the sync failed
+ */
+int vme_spool_sync(vme_spool_t *sp)
+{
+    int rc = 0;
+    pthread_mutex_lock(&sp->lock);
+    sp->group_sync = 1;
+    if (sp->write_map != NULL && sp->synced_off < sp->write_off) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t start = sp->synced_off & ~(page - 1);
+        rc = msync(sp->write_map + start, sp->write_off - start, MS_SYNC);
+        if (rc == 0)
+            sp->synced_off = sp->write_off;
+    }
+    pthread_mutex_unlock(&sp->lock);
+    return rc;
+}
+
+/*
+ * the number of spooled records not yet delivered
+ */
+uint64_t vme_spool_pending(vme_spool_t *sp)
+{
+    pthread_mutex_lock(&sp->lock);
+    uint64_t pending = sp->pending;
+    pthread_mutex_unlock(&sp->lock);
+    return pending;
+}
+
+/*
+ * vme_spool_flush --
+ *
+ *      sp - spool returned by vme_spool_open
+ *      timeoutMs - how long to wait for everything to be delivered, negative waits as long as it takes
+ *
+ * RETURN: vme_count is the number of records delivered since the last flush. vme_error_msg is set if the server
+ *      rejected any of them (they are not retried) or if records were still spooled when we gave up waiting.
+ */
+vme_result_t *vme_spool_flush(vme_spool_t *sp, int timeoutMs)
+{
+    struct timespec deadline;
+    if (timeoutMs >= 0)
+        deadline_in(&deadline, (uint32_t)timeoutMs);
+    pthread_mutex_lock(&sp->lock);
+    while (sp->pending > 0 && (timeoutMs < 0 || !past(&deadline))) {
+        struct timespec ts;
+        deadline_in(&ts, 100);
+        if (timeoutMs >= 0 && !past(&ts) && (ts.tv_sec > deadline.tv_sec
+                                             || (ts.tv_sec == deadline.tv_sec && ts.tv_nsec > deadline.tv_nsec)))
+            ts = deadline;
+        pthread_cond_timedwait(&sp->drained, &sp->lock, &ts);
+    }
+    uint64_t pending = sp->pending;
+    uint64_t delivered = sp->delivered;
+    uint64_t rejected = sp->rejected;
+    sp->delivered = sp->rejected = 0;
+    pthread_mutex_unlock(&sp->lock);
+
+    vme_result_t *result;
+    char errMsg[128];
+    if (pending > 0) {
+        snprintf(errMsg, sizeof(errMsg), "timed out with %llu records spooled", (unsigned long long)pending);
+        result = vme_error_result(errMsg);
+    } else if (rejected > 0) {
+        snprintf(errMsg, sizeof(errMsg), "%llu spooled records were rejected", (unsigned long long)rejected);
+        result = vme_error_result(errMsg);
+    } else {
+        result = malloc(sizeof(vme_result_t));
+        memset(result, 0, sizeof(vme_result_t));
+    }
+    result->vme_count = (uint32_t)delivered;
+    return result;
+}
+
+/*
+ * stop the drainer after the delivery in progress. undelivered records stay on disk for the next vme_spool_open.
+ */
+void vme_spool_close(vme_spool_t *sp)
+{
+    if (sp == NULL)
+        return;
+    pthread_mutex_lock(&sp->lock);
+    sp->stop = 1;
+    pthread_cond_signal(&sp->wake);
+    pthread_mutex_unlock(&sp->lock);
+    if (sp->draining)
+        pthread_join(sp->drainer, NULL);
+
+    persist_ack(sp);
+    if (sp->opts.sync && sp->write_map != NULL)
+        msync(sp->write_map, sp->write_size, MS_SYNC);
+    close_write_segment(sp);
+    close(sp->ack_fd);
+    pthread_cond_destroy(&sp->drained);
+    pthread_cond_destroy(&sp->wake);
+    pthread_mutex_destroy(&sp->lock);
+    free(sp->dir);
+    free(sp);
+}
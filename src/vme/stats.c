@@ -0,0 +1,101 @@
+//
+//  stats.c
+//
+//  counters for vme_get_stats. every request is accounted for once curl is done with it, from what curl itself
+//  measured: the bytes each way, the status and the total time. percentiles come from a window of the most recent
+//  latencies, so they follow the server as it speeds up or slows down rather than averaging over the whole run.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+
+void vc_stats_init(vc_stats_t *st)
+{
+    memset(st, 0, sizeof(vc_stats_t));
+    pthread_mutex_init(&st->lock, NULL);
+}
+
+void vc_stats_destroy(vc_stats_t *st)
+{
+    pthread_mutex_destroy(&st->lock);
+}
+
+/*
+ * account for a request curl has finished with, before the handle is reset or reused. code is what the perform
+ * returned; a request that didn't get a response or got an error status counts as an error
+ */
+void vc_stats_request(vc_stats_t *st, CURL *curl, CURLcode code)
+{
+    long status = 0;
+    curl_off_t sent = 0, received = 0, took = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &sent);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &received);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &took);
+
+    __atomic_add_fetch(&st->requests, 1, __ATOMIC_RELAXED);
+    if (code != CURLE_OK || status >= 400)
+        __atomic_add_fetch(&st->errors, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&st->bytes_out, (uint64_t)sent, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&st->bytes_in, (uint64_t)received, __ATOMIC_RELAXED);
+
+    double ms = took / 1000.0;
+    pthread_mutex_lock(&st->lock);
+    st->timed++;
+    st->total_ms += ms;
+    if (ms > st->max_ms)
+        st->max_ms = ms;
+    st->window[st->next_sample] = ms;
+    st->next_sample = (st->next_sample + 1) % STATS_WINDOW;
+    if (st->n_samples < STATS_WINDOW)
+        st->n_samples++;
+    pthread_mutex_unlock(&st->lock);
+}
+
+/* account for a publish to a topic, synchronous or from the queue */
+void vc_stats_publish(vc_stats_t *st, const vme_result_t *result)
+{
+    if (result->vme_error_msg == NULL)
+        __atomic_add_fetch(&st->published, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_add_fetch(&st->publish_errors, 1, __ATOMIC_RELAXED);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+static double percentile(const double *sorted, uint32_t n, double p)
+{
+    return sorted[(uint32_t)(p / 100.0 * (n - 1) + 0.5)];
+}
+
+/* fill in everything but the publish queue's figures */
+void vc_stats_get(vc_stats_t *st, vme_stats_t *stats)
+{
+    stats->requests = __atomic_load_n(&st->requests, __ATOMIC_RELAXED);
+    stats->errors = __atomic_load_n(&st->errors, __ATOMIC_RELAXED);
+    stats->bytes_out = __atomic_load_n(&st->bytes_out, __ATOMIC_RELAXED);
+    stats->bytes_in = __atomic_load_n(&st->bytes_in, __ATOMIC_RELAXED);
+    stats->published = __atomic_load_n(&st->published, __ATOMIC_RELAXED);
+    stats->publish_errors = __atomic_load_n(&st->publish_errors, __ATOMIC_RELAXED);
+    stats->publish_dropped = __atomic_load_n(&st->publish_dropped, __ATOMIC_RELAXED);
+
+    double sorted[STATS_WINDOW];
+    pthread_mutex_lock(&st->lock);
+    uint32_t n = st->n_samples;
+    memcpy(sorted, st->window, n * sizeof(double));
+    stats->latency_avg_ms = (st->timed > 0 ? st->total_ms / st->timed : 0);
+    stats->latency_max_ms = st->max_ms;
+    pthread_mutex_unlock(&st->lock);
+    if (n > 0) {
+        qsort(sorted, n, sizeof(double), cmp_double);
+        stats->latency_p50_ms = percentile(sorted, n, 50);
+        stats->latency_p99_ms = percentile(sorted, n, 99);
+    }
+}
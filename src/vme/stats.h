@@ -0,0 +1,43 @@
+//  stats.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#ifndef VANTIQ_STATS_H
+#define VANTIQ_STATS_H
+
+#include <pthread.h>
+#include <curl/curl.h>
+
+#include "vme.h"
+
+#define STATS_WINDOW 256
+
+/*
+ * a client's running totals, see vme_get_stats. the counters are bumped atomically by whichever thread finished
+ * the request, the latencies are kept under the lock
+ */
+typedef struct vc_stats {
+    uint64_t        requests;
+    uint64_t        errors;
+    uint64_t        bytes_out;
+    uint64_t        bytes_in;
+    uint64_t        published;
+    uint64_t        publish_errors;
+    uint64_t        publish_dropped;
+    pthread_mutex_t lock;
+    uint64_t        timed;
+    double          total_ms;
+    double          max_ms;
+    double          window[STATS_WINDOW];   // the most recent latencies, ms
+    uint32_t        n_samples;
+    uint32_t        next_sample;
+} vc_stats_t;
+
+void vc_stats_init(vc_stats_t *st);
+void vc_stats_destroy(vc_stats_t *st);
+
+void vc_stats_request(vc_stats_t *st, CURL *curl, CURLcode code);
+void vc_stats_publish(vc_stats_t *st, const vme_result_t *result);
+void vc_stats_get(vc_stats_t *st, vme_stats_t *stats);
+
+#endif
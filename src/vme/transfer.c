@@ -0,0 +1,246 @@
+//
+//  transfer.c
+//
+//  a small pool of requests run concurrently on a curl multi handle, for the bulk paths that want several
+//  connections to the server in flight at once. each slot owns an easy handle that is reused from one request to
+//  the next so its connection stays open. request bodies are pulled from the caller through a callback, so they
+//  never have to be assembled in memory.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "transfer.h"
+#include "log.h"
+
+static size_t xfer_read(char *buffer, size_t size, size_t nitems, void *userp)
+{
+    vc_xfer_t *xfer = (vc_xfer_t *)userp;
+    return xfer->body_fn(buffer, size * nitems, xfer->body_arg);
+}
+
+static size_t xfer_write(void *contents, size_t size, size_t nmemb, void *userp)
+{
+    vc_xfer_t *xfer = (vc_xfer_t *)userp;
+    vmebuf_concat(xfer->resp, contents, size * nmemb);
+    return size * nmemb;
+}
+
+static char *header_value(const char *buffer, size_t len, size_t nameSz)
+{
+    const char *start = buffer + nameSz;
+    const char *end = buffer + len;
+    while (start < end && (*start == ' ' || *start == '\t'))
+        start++;
+    while (end > start && (end[-1] == '\r' || end[-1] == '\n' || end[-1] == ' '))
+        end--;
+    char *value = malloc(end - start + 1);
+    memcpy(value, start, end - start);
+    value[end - start] = '\0';
+    return value;
+}
+
+#define HEADER_IS(name) (len > sizeof(name) - 1 && strncasecmp(buffer, name, sizeof(name) - 1) == 0)
+
+static size_t xfer_header(char *buffer, size_t size, size_t nitems, void *userp)
+{
+    vc_xfer_t *xfer = (vc_xfer_t *)userp;
+    size_t len = size * nitems;
+    if (HEADER_IS("X-Total-Count:")) {
+        char *value = header_value(buffer, len, sizeof("X-Total-Count:") - 1);
+        xfer->total_count = (uint32_t)strtoul(value, NULL, 10);
+        free(value);
+    } else if (HEADER_IS("ETag:")) {
+        free(xfer->etag);
+        xfer->etag = header_value(buffer, len, sizeof("ETag:") - 1);
+    } else if (HEADER_IS("Last-Modified:")) {
+        free(xfer->last_modified);
+        xfer->last_modified = header_value(buffer, len, sizeof("Last-Modified:") - 1);
+    }
+    return len;
+}
+
+vc_xfer_pool_t *vc_xfer_pool_create(vantiq_client_t *vc, int nXfers)
+{
+    vc_xfer_pool_t *pool = malloc(sizeof(vc_xfer_pool_t));
+    memset(pool, 0, sizeof(vc_xfer_pool_t));
+    pool->vc = vc;
+    pool->multi = curl_multi_init();
+    pool->n_xfers = (nXfers > 0 ? nXfers : 1);
+    pool->xfers = calloc(pool->n_xfers, sizeof(vc_xfer_t));
+    for (int i = 0; i < pool->n_xfers; i++) {
+        pool->xfers[i].curl = curl_easy_init();
+        pool->xfers[i].resp = vmebuf_alloc();
+    }
+    return pool;
+}
+
+void vc_xfer_pool_destroy(vc_xfer_pool_t *pool)
+{
+    if (pool == NULL)
+        return;
+    for (int i = 0; i < pool->n_xfers; i++) {
+        if (pool->xfers[i].busy)
+            curl_multi_remove_handle(pool->multi, pool->xfers[i].curl);
+        curl_easy_cleanup(pool->xfers[i].curl);
+        vmebuf_dealloc(pool->xfers[i].resp);
+        free(pool->xfers[i].etag);
+        free(pool->xfers[i].last_modified);
+    }
+    curl_multi_cleanup(pool->multi);
+    free(pool->xfers);
+    free(pool);
+}
+
+/*
+ * a slot that isn't running a request, NULL if they all are
+ */
+vc_xfer_t *vc_xfer_idle(vc_xfer_pool_t *pool)
+{
+    for (int i = 0; i < pool->n_xfers; i++) {
+        if (!pool->xfers[i].busy)
+            return &pool->xfers[i];
+    }
+    return NULL;
+}
+
+/*
+ * the same options common_curl_setup applies to the client's own handle
+ */
+static void xfer_setup(vc_xfer_pool_t *pool, vc_xfer_t *xfer, const char *url, struct curl_slist *hdrs, void *user)
+{
+    CURL *curl = xfer->curl;
+    curl_easy_reset(curl);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 1L);
+    if (log_get_level() <= LOG_DEBUG)
+        curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 0L);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, (hdrs != NULL ? hdrs : pool->vc->http_hdrs));
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, xfer_write);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, xfer);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, xfer_header);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, xfer);
+    xfer->errbuf[0] = '\0';
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, xfer->errbuf);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, xfer);
+
+    xfer->busy = 1;
+    xfer->user = user;
+    xfer->status = 0;
+    xfer->code = CURLE_OK;
+    xfer->total_count = 0;
+    free(xfer->etag);
+    free(xfer->last_modified);
+    xfer->etag = xfer->last_modified = NULL;
+    vmebuf_truncate(xfer->resp);
+}
+
+/*
+ * vc_xfer_start --
+ *
+ *      method - "POST", "PUT", ...
+ *      url - full request url
+ *      bodyLen - exact size of the body bodyFn produces, sent as the Content-Length
+ *      user - handed back in the slot when the request completes
+ */
+void vc_xfer_start(vc_xfer_pool_t *pool, vc_xfer_t *xfer, const char *method, const char *url, size_t bodyLen,
+                   vc_body_fn_t bodyFn, void *bodyArg, void *user)
+{
+    xfer_setup(pool, xfer, url, NULL, user);
+    CURL *curl = xfer->curl;
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    if (strcmp(method, "POST") != 0)
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)bodyLen);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, xfer_read);
+    curl_easy_setopt(curl, CURLOPT_READDATA, xfer);
+    xfer->body_fn = bodyFn;
+    xfer->body_arg = bodyArg;
+    curl_multi_add_handle(pool->multi, curl);
+    pool->active++;
+}
+
+/*
+ * a GET of url. hdrs replaces the client's request headers when not NULL (e.g. to add validators).
+ */
+void vc_xfer_start_get(vc_xfer_pool_t *pool, vc_xfer_t *xfer, const char *url, struct curl_slist *hdrs, void *user)
+{
+    xfer_setup(pool, xfer, url, hdrs, user);
+    curl_easy_setopt(xfer->curl, CURLOPT_HTTPGET, 1L);
+    xfer->body_fn = NULL;
+    xfer->body_arg = NULL;
+    curl_multi_add_handle(pool->multi, xfer->curl);
+    pool->active++;
+}
+
+/*
+ * abandon a request in flight, the slot is free again on return
+ */
+void vc_xfer_cancel(vc_xfer_pool_t *pool, vc_xfer_t *xfer)
+{
+    if (!xfer->busy)
+        return;
+    curl_multi_remove_handle(pool->multi, xfer->curl);
+    pool->active--;
+    vc_xfer_release(pool, xfer);
+}
+
+/*
+ * drive the requests in flight until one of them completes or timeoutMs passes (< 0 waits as long as it takes).
+ * RETURN: the completed slot, still busy until released, or NULL if nothing completed / nothing is in flight
+ */
+vc_xfer_t *vc_xfer_wait(vc_xfer_pool_t *pool, int timeoutMs)
+{
+    if (pool->active == 0)
+        return NULL;
+    for (;;) {
+        int running, queued;
+        curl_multi_perform(pool->multi, &running);
+        CURLMsg *msg;
+        while ((msg = curl_multi_info_read(pool->multi, &queued)) != NULL) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            vc_xfer_t *xfer = NULL;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&xfer);
+            xfer->code = msg->data.result;
+            curl_easy_getinfo(xfer->curl, CURLINFO_RESPONSE_CODE, &xfer->status);
+            vc_stats_request(&pool->vc->stats, xfer->curl, xfer->code);
+            curl_multi_remove_handle(pool->multi, xfer->curl);
+            pool->active--;
+            return xfer;
+        }
+        if (timeoutMs == 0)
+            return NULL;
+        int numfds;
+        curl_multi_wait(pool->multi, NULL, 0, (timeoutMs > 0 ? timeoutMs : 1000), &numfds);
+        if (timeoutMs > 0)
+            timeoutMs = 0;  // one more look at what completed, then give up
+    }
+}
+
+void vc_xfer_release(vc_xfer_pool_t *pool, vc_xfer_t *xfer)
+{
+    (void)pool;
+    xfer->busy = 0;
+    xfer->user = NULL;
+}
+
+/*
+ * why a completed request failed, NULL if it succeeded. the server's explanation when there is one.
+ */
+const char *vc_xfer_error(const vc_xfer_t *xfer)
+{
+    if (xfer->code != CURLE_OK)
+        return (xfer->errbuf[0] != '\0' ? xfer->errbuf : curl_easy_strerror(xfer->code));
+    if (xfer->status >= 400) {
+        vmebuf_push(xfer->resp, '\0');
+        xfer->resp->len--;
+        return (xfer->resp->len > 0 ? xfer->resp->data : "request failed");
+    }
+    return NULL;
+}
@@ -0,0 +1,51 @@
+//  transfer.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#ifndef VANTIQ_TRANSFER_H
+#define VANTIQ_TRANSFER_H
+
+#include <curl/curl.h>
+
+#include "vme.h"
+#include "vantiq_client.h"
+
+/* fill dst with up to max bytes of the request body, 0 once it has all been sent */
+typedef size_t (*vc_body_fn_t)(char *dst, size_t max, void *arg);
+
+typedef struct vc_xfer {
+    CURL           *curl;       // kept across transfers so its connection is reused
+    int             busy;
+    vc_body_fn_t    body_fn;
+    void           *body_arg;
+    vmebuf_t       *resp;       // response body
+    long            status;     // HTTP status, 0 if the request never got a response
+    CURLcode        code;
+    char            errbuf[CURL_ERROR_SIZE];
+    uint32_t        total_count;    // X-Total-Count of the response
+    char           *etag;           // validators of the response, NULL if it had none
+    char           *last_modified;
+    void           *user;       // the caller's per transfer state
+} vc_xfer_t;
+
+typedef struct vc_xfer_pool {
+    vantiq_client_t *vc;
+    CURLM           *multi;
+    vc_xfer_t       *xfers;
+    int              n_xfers;
+    int              active;
+} vc_xfer_pool_t;
+
+vc_xfer_pool_t *vc_xfer_pool_create(vantiq_client_t *vc, int nXfers);
+void vc_xfer_pool_destroy(vc_xfer_pool_t *pool);
+
+vc_xfer_t *vc_xfer_idle(vc_xfer_pool_t *pool);
+void vc_xfer_start(vc_xfer_pool_t *pool, vc_xfer_t *xfer, const char *method, const char *url, size_t bodyLen,
+                   vc_body_fn_t bodyFn, void *bodyArg, void *user);
+void vc_xfer_start_get(vc_xfer_pool_t *pool, vc_xfer_t *xfer, const char *url, struct curl_slist *hdrs, void *user);
+void vc_xfer_cancel(vc_xfer_pool_t *pool, vc_xfer_t *xfer);
+vc_xfer_t *vc_xfer_wait(vc_xfer_pool_t *pool, int timeoutMs);
+void vc_xfer_release(vc_xfer_pool_t *pool, vc_xfer_t *xfer);
+const char *vc_xfer_error(const vc_xfer_t *xfer);
+
+#endif
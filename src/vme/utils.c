@@ -11,6 +11,7 @@
 #include <string.h>
 #include <assert.h>
 #include "vme.h"
+#include "utils.h"
 
 
 const char *vme_system_types[] = {
@@ -106,3 +107,112 @@ char *build_rsuri(const int apiVers, const char *ns, const char *rsName, const c
     assert(needed <= len);
     return path;
 }
+
+/*
+ * adjust a resource path to perform an aggregate pipeline operation on it.
+ * RETURN: allocated string, must be freed
+ */
+char *build_aggregate_rsuri(const char *rsURI)
+{
+    size_t len = strlen(rsURI);
+    char *aggRsURI = malloc(len+sizeof("/aggregate"));
+    strcpy(aggRsURI, rsURI);
+    if (rsURI[len - 1] == '/') {
+        strcat(aggRsURI, "aggregate");
+    } else {
+        strcat(aggRsURI, "/aggregate");
+    }
+    return aggRsURI;
+}
+
+/*
+ * deep copy of a result, e.g. so several callers can each free their own.
+ * RETURN: allocated result, must be freed with vme_free_result
+ */
+vme_result_t *dup_result(const vme_result_t *result)
+{
+    vme_result_t *copy = malloc(sizeof(vme_result_t));
+    memcpy(copy, result, sizeof(vme_result_t));
+    if (result->vme_json_data != NULL) {
+        copy->vme_json_data = malloc(result->vme_size + 1);
+        memcpy(copy->vme_json_data, result->vme_json_data, result->vme_size);
+        copy->vme_json_data[result->vme_size] = '\0';
+    }
+    if (result->vme_error_msg != NULL)
+        copy->vme_error_msg = strdup(result->vme_error_msg);
+    return copy;
+}
+
+/*
+ * look up a (possibly dotted, e.g. "address.zip") property of a JSON object.
+ * RETURN: the property within doc, NULL if any part of the path is missing
+ */
+cJSON *json_lookup_path(const cJSON *doc, const char *path)
+{
+    const char *dot;
+    while (doc != NULL && (dot = strchr(path, '.')) != NULL) {
+        cJSON *child = (cJSON_IsObject(doc) ? doc->child : NULL);
+        size_t len = dot - path;
+        while (child != NULL && !(child->string != NULL && strncmp(child->string, path, len) == 0
+                                  && child->string[len] == '\0'))
+            child = child->next;
+        doc = child;
+        path = dot + 1;
+    }
+    return (doc != NULL && cJSON_IsObject(doc) ? cJSON_GetObjectItemCaseSensitive(doc, path) : NULL);
+}
+
+/*
+ * rank JSON types the way the server orders values of different types
+ */
+static int type_rank(const cJSON *v)
+{
+    if (v == NULL || cJSON_IsNull(v))
+        return 0;
+    if (cJSON_IsNumber(v))
+        return 1;
+    if (cJSON_IsString(v))
+        return 2;
+    if (cJSON_IsObject(v))
+        return 3;
+    if (cJSON_IsArray(v))
+        return 4;
+    return 5; // booleans
+}
+
+/*
+ * total order over JSON values: by type first (null < numbers < strings < objects < arrays < booleans), then by
+ * value. a missing value (NULL) compares equal to null.
+ * RETURN: < 0, 0, > 0 like strcmp
+ */
+int json_value_cmp(const cJSON *a, const cJSON *b)
+{
+    int ra = type_rank(a), rb = type_rank(b);
+    if (ra != rb)
+        return ra - rb;
+    switch (ra) {
+        case 1:
+            return (a->valuedouble < b->valuedouble ? -1 : (a->valuedouble > b->valuedouble ? 1 : 0));
+        case 2:
+            return strcmp(a->valuestring, b->valuestring);
+        case 3:
+        case 4: {
+            const cJSON *ca = a->child, *cb = b->child;
+            for (; ca != NULL && cb != NULL; ca = ca->next, cb = cb->next) {
+                if (ra == 3) {
+                    int c = strcmp(ca->string, cb->string);
+                    if (c != 0)
+                        return c;
+                }
+                int c = json_value_cmp(ca, cb);
+                if (c != 0)
+                    return c;
+            }
+            return (ca != NULL ? 1 : (cb != NULL ? -1 : 0));
+        }
+        case 5:
+            return cJSON_IsTrue(a) - cJSON_IsTrue(b);
+        default:
+            return 0;
+    }
+}
@@ -8,9 +8,18 @@
 #define utils_h
 
 #include <stdio.h>
+#include "vme.h"
+#include "cjson.h"
 
 /* utility interfaces */
 
 char *build_rsuri(const int apiVers, const char *ns, const char *rsName, const char *rsID);
+char *build_aggregate_rsuri(const char *rsURI);
+vme_result_t *vme_error_result(const char *errMsg);
+vme_result_t *dup_result(const vme_result_t *result);
+
+cJSON *json_lookup_path(const cJSON *doc, const char *path);
+int json_value_cmp(const cJSON *a, const cJSON *b);
+cJSON *json_diff(const cJSON *from, const cJSON *to);
 
 #endif /* utils_h */
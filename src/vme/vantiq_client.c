@@ -73,6 +73,27 @@ char *create_auth_hdr(vantiq_client_t *vc, const char *token) {
 }
 
 #define COUNT_HEADER "X-Total-Count:"
+#define ETAG_HEADER "ETag:"
+#define LAST_MODIFIED_HEADER "Last-Modified:"
+
+/*
+ * copy out the value of a "Name: value\r\n" header, dropping the surrounding
+ * white space. returns an allocated string
+ */
+static char *header_value(const char *buffer, size_t len, size_t nameSz)
+{
+    const char *start = buffer + nameSz;
+    const char *end = buffer + len;
+    while (start < end && (*start == ' ' || *start == '\t'))
+        start++;
+    while (end > start && (end[-1] == '\r' || end[-1] == '\n' || end[-1] == ' '))
+        end--;
+    char *value = malloc(end - start + 1);
+    memcpy(value, start, end - start);
+    value[end - start] = '\0';
+    return value;
+}
+
 /*
  * header_callback is a function invoked by libcurl when a response is received.
  * you get a single call back for each response header returned by the server.
@@ -81,6 +102,9 @@ char *create_auth_hdr(vantiq_client_t *vc, const char *token) {
  * libvme, we will sometimes received the count of results from the server in
  * the form of the X-Total-Count: <n> response header. we need to parse that
  * and record the returned count value in the vantiq client.
+ *
+ * when the response cache is on we also hang on to the validators (ETag and
+ * Last-Modified) so the cached copy can be revalidated later.
  */
 static size_t header_callback(char *buffer, size_t size, size_t nitems, void *userdata)
 {
@@ -95,6 +119,15 @@ static size_t header_callback(char *buffer, size_t size, size_t nitems, void *us
         memcpy(countBuf, buffer + pos, len - pos);
         countBuf[len-pos] = 0;
         vc->result_count = atoi(countBuf);
+    } else if (vc->cache != NULL) {
+        if (len > sizeof(ETAG_HEADER)-1 && strncasecmp(buffer, ETAG_HEADER, sizeof(ETAG_HEADER)-1) == 0) {
+            free(vc->resp_etag);
+            vc->resp_etag = header_value(buffer, len, sizeof(ETAG_HEADER)-1);
+        } else if (len > sizeof(LAST_MODIFIED_HEADER)-1 &&
+                   strncasecmp(buffer, LAST_MODIFIED_HEADER, sizeof(LAST_MODIFIED_HEADER)-1) == 0) {
+            free(vc->resp_last_modified);
+            vc->resp_last_modified = header_value(buffer, len, sizeof(LAST_MODIFIED_HEADER)-1);
+        }
     }
     return len;
 }
@@ -106,7 +139,8 @@ static size_t header_callback(char *buffer, size_t size, size_t nitems, void *us
  * result data is chunked, this call back may be called multiple times.
  *
  * if the libvme user has specified that s/he wants control over this via their
- * own callback, we pass the responsbility on to that function.
+ * own callback, we pass the responsbility on to that function (unless the
+ * server is telling us why the request failed).
  */
 static size_t
 write_callback(void *contents, size_t size, size_t nmemb, void *userp)
@@ -114,7 +148,11 @@ write_callback(void *contents, size_t size, size_t nmemb, void *userp)
     size_t realsize = size * nmemb;
     vantiq_client_t *vc = (vantiq_client_t *)userp;
 
-    if (vc->recv_callback != NULL) {
+    long rc = 0;
+    if (vc->recv_callback != NULL)
+        curl_easy_getinfo(vc->curl, CURLINFO_RESPONSE_CODE, &rc);
+    /* error explanations are buffered for the result rather than handed to the user's callback as data */
+    if (vc->recv_callback != NULL && rc < 400) {
         realsize = vc->recv_callback(vc->callback_state, contents, realsize);
     } else {
         vc->recv_buf = vmebuf_ensure_incr_size(vc->recv_buf, realsize);
@@ -130,7 +168,8 @@ write_callback(void *contents, size_t size, size_t nmemb, void *userp)
  * data is chunked, this call back may be called multiple times.
  *
  * if the libvme user has specified that s/he wants control over this via their
- * own callback, we pass the responsbility on to that function.
+ * own callback, we pass the responsbility on to that function (unless the
+ * server is telling us why the request failed).
  */
 static size_t read_callback(void *dest, size_t size, size_t nmemb, void *userp)
 {
@@ -259,6 +298,14 @@ vantiq_client_t *vc_init(const char *url, const char *authToken, uint8_t apiVers
     memset(vc, 0, sizeof(vantiq_client_t));
     vc->magic = VC_MAGIC;
     vc->api_version = apiVersion;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&vc->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    vc_flights_init(&vc->flights);
+    vc_stats_init(&vc->stats);
     // we'll always want the authorization header
     char *authHdr = create_auth_hdr(vc, authToken);
     log_debug("using %s as the authorization header", authHdr);
@@ -345,20 +392,25 @@ vme_result_t *prepare_result(CURLcode resCode, const char *protErrMsg, vantiq_cl
         result->vme_error_msg = (strlen(protErrMsg) > 0 ? strdup(protErrMsg) : strdup(curl_easy_strerror(resCode)));
     }
 
+    long rc = 0;
+    curl_easy_getinfo(vc->curl, CURLINFO_RESPONSE_CODE, &rc);
+    result->vme_http_status = rc;
+
     // we got some kind of response message. could be error explanation or valid results
     if (vc->recv_buf->len > 0) {
-        long rc;
-        curl_easy_getinfo(vc->curl, CURLINFO_RESPONSE_CODE, &rc);
-
         result->vme_size = vc->recv_buf->len;
 
+        /* zero terminated so results can be handed to cJSON_Parse / strdup */
         if (rc >= 400) {
-            result->vme_error_msg = malloc(vc->recv_buf->len);
-            memcpy(result->vme_error_msg, vc->recv_buf->data, vc->recv_buf->len);
+            free(result->vme_error_msg);
+            result->vme_error_msg = vmebuf_tostr(vc->recv_buf);
         } else {
-            result->vme_json_data = malloc(vc->recv_buf->len);
-            memcpy(result->vme_json_data, vc->recv_buf->data, vc->recv_buf->len);
+            result->vme_json_data = vmebuf_tostr(vc->recv_buf);
         }
+    } else if (rc >= 400 && result->vme_error_msg == NULL) {
+        char errMsg[32];
+        snprintf(errMsg, sizeof(errMsg), "HTTP status %ld", rc);
+        result->vme_error_msg = strdup(errMsg);
     }
     result->vme_count = vc->result_count;
     vc->result_count = 0;
@@ -370,11 +422,16 @@ vme_result_t *prepare_result(CURLcode resCode, const char *protErrMsg, vantiq_cl
  */
 vme_result_t *vc_put(vantiq_client_t *vc, const char *rsURI, const vmebuf_t *msg, struct param *params)
 {
+    pthread_mutex_lock(&vc->lock);
+    if (vc->cache != NULL)
+        vc_cache_invalidate(vc->cache, rsURI);
     common_curl_setup(vc);
 
     /* Now specify we want to put data */
     curl_easy_setopt(vc->curl, CURLOPT_PUT, 1L);
-    return _putorpost(vc, rsURI, msg, params);
+    vme_result_t *result = _putorpost(vc, rsURI, msg, params);
+    pthread_mutex_unlock(&vc->lock);
+    return result;
 }
 
 /*
@@ -382,11 +439,16 @@ vme_result_t *vc_put(vantiq_client_t *vc, const char *rsURI, const vmebuf_t *msg
  */
 vme_result_t *vc_post(vantiq_client_t *vc, const char *rsURI, const vmebuf_t *msg, struct param *params)
 {
+    pthread_mutex_lock(&vc->lock);
+    if (vc->cache != NULL)
+        vc_cache_invalidate(vc->cache, rsURI);
     common_curl_setup(vc);
 
     /* Now specify we want to post data */
     curl_easy_setopt(vc->curl, CURLOPT_POST, 1L);
-    return _putorpost(vc, rsURI, msg, params);
+    vme_result_t *result = _putorpost(vc, rsURI, msg, params);
+    pthread_mutex_unlock(&vc->lock);
+    return result;
 }
 
 /*
@@ -432,6 +494,7 @@ vme_result_t *_putorpost(vantiq_client_t *vc, const char *rsURI, const vmebuf_t
     curl_easy_setopt(vc->curl, CURLOPT_ERRORBUFFER, errbuf);
     /* Perform the request, resCode will get the return code */
     CURLcode resCode = curl_easy_perform(vc->curl);
+    vc_stats_request(&vc->stats, vc->curl, resCode);
 
     vme_result_t *result = prepare_result(resCode, errbuf, vc);
 
@@ -457,6 +520,7 @@ vme_result_t *_getordelete(vantiq_client_t *vc, const char *rsURI, struct param
     vc->recv_buf->len = 0;
     /* Perform the request, res will get the return code */
     CURLcode res = curl_easy_perform(vc->curl);
+    vc_stats_request(&vc->stats, vc->curl, res);
     vme_result_t *result = prepare_result(res, errBuf, vc);
     curl_easy_reset(vc->curl);
     free(url);
@@ -464,14 +528,161 @@ vme_result_t *_getordelete(vantiq_client_t *vc, const char *rsURI, struct param
     return result;
 }
 
+/*
+ * build the request headers for revalidating a stale cache entry: our usual
+ * headers plus If-None-Match and/or If-Modified-Since. the list must be freed
+ * with curl_slist_free_all once the request is done.
+ */
+static struct curl_slist *conditional_hdrs(vantiq_client_t *vc, const vc_cache_entry_t *entry)
+{
+    struct curl_slist *hdrs = NULL;
+    for (struct curl_slist *h = vc->http_hdrs; h != NULL; h = h->next)
+        hdrs = curl_slist_append(hdrs, h->data);
+
+    vmebuf_t *buf = vmebuf_alloc();
+    if (entry->etag != NULL) {
+        vmebuf_concat(buf, "If-None-Match: ", sizeof("If-None-Match: ")-1);
+        vmebuf_concat(buf, entry->etag, strlen(entry->etag));
+        vmebuf_push(buf, '\0');
+        hdrs = curl_slist_append(hdrs, buf->data);
+        vmebuf_truncate(buf);
+    }
+    if (entry->last_modified != NULL) {
+        vmebuf_concat(buf, "If-Modified-Since: ", sizeof("If-Modified-Since: ")-1);
+        vmebuf_concat(buf, entry->last_modified, strlen(entry->last_modified));
+        vmebuf_push(buf, '\0');
+        hdrs = curl_slist_append(hdrs, buf->data);
+    }
+    vmebuf_dealloc(buf);
+    return hdrs;
+}
+
+/*
+ * underpinning for the GET requests (selects and aggregates). when the response
+ * cache is enabled a fresh entry is returned without touching the network, a
+ * stale entry with validators is revalidated with a conditional GET, and any
+ * successful response is remembered. results streamed to a user callback are
+ * never cached, nor are requests that asked to bypass the cache.
+ */
+static vme_result_t *_cached_get(vantiq_client_t *vc, const char *rsURI, const char *url, int allowCache)
+{
+    pthread_mutex_lock(&vc->lock);
+    int useCache = (allowCache && vc->cache != NULL && vc->recv_callback == NULL);
+    vc_cache_entry_t *entry = NULL;
+    struct curl_slist *hdrs = NULL;
+
+    if (useCache) {
+        entry = vc_cache_lookup(vc->cache, url);
+        if (entry != NULL && vc_cache_is_fresh(entry)) {
+            log_debug("cache hit for %s", url);
+            vme_result_t *result = vc_cache_result(entry);
+            pthread_mutex_unlock(&vc->lock);
+            return result;
+        }
+        if (entry != NULL && (entry->etag != NULL || entry->last_modified != NULL))
+            hdrs = conditional_hdrs(vc, entry);
+    }
+
+    CURLcode res;
+    long rc = 0;
+    char errBuf[CURL_ERROR_SIZE];
+    vme_result_t *result = NULL;
+    if (vc->hedge != NULL && vc->recv_callback == NULL) {
+        result = vc_hedged_get(vc, url, hdrs, &res, &rc);
+    } else {
+        common_curl_setup(vc);
+        curl_easy_setopt(vc->curl, CURLOPT_HTTPGET, 1L);
+        if (hdrs != NULL)
+            curl_easy_setopt(vc->curl, CURLOPT_HTTPHEADER, hdrs);
+        curl_easy_setopt(vc->curl, CURLOPT_URL, url);
+
+        errBuf[0] = 0;
+        curl_easy_setopt(vc->curl, CURLOPT_ERRORBUFFER, errBuf);
+
+        vc->recv_buf->len = 0;
+        res = curl_easy_perform(vc->curl);
+        vc_stats_request(&vc->stats, vc->curl, res);
+        curl_easy_getinfo(vc->curl, CURLINFO_RESPONSE_CODE, &rc);
+    }
+
+    if (res == CURLE_OK && rc == 304 && entry != NULL) {
+        log_debug("cache revalidated %s", url);
+        vme_free_result(result);
+        vc_cache_refresh(vc->cache, entry);
+        result = vc_cache_result(entry);
+        vc->result_count = 0;
+    } else {
+        if (result == NULL)
+            result = prepare_result(res, errBuf, vc);
+        if (useCache && res == CURLE_OK && rc == 200 && result->vme_error_msg == NULL)
+            vc_cache_store(vc->cache, url, rsURI, result, vc->resp_etag, vc->resp_last_modified);
+    }
+    curl_easy_reset(vc->curl);
+
+    free(vc->resp_etag);
+    free(vc->resp_last_modified);
+    vc->resp_etag = vc->resp_last_modified = NULL;
+    if (hdrs != NULL)
+        curl_slist_free_all(hdrs);
+    pthread_mutex_unlock(&vc->lock);
+    return result;
+}
+
+/*
+ * send an HTTP GET request for an already constructed url, rsURI is the
+ * resource it targets.
+ *
+ * GETs are idempotent, so when another thread already has the very same
+ * request outstanding we wait for its response instead of sending our own.
+ * results streamed to a user callback can't be shared and always go to the
+ * server.
+ */
+vme_result_t *vc_get_url(vantiq_client_t *vc, const char *rsURI, const char *url)
+{
+    vme_result_t *result;
+
+    if (vc->recv_callback != NULL) {
+        result = _cached_get(vc, rsURI, url, 1);
+    } else {
+        int leader;
+        vc_flight_t *flight = vc_flight_join(&vc->flights, "GET", url, &leader);
+        if (leader) {
+            result = _cached_get(vc, rsURI, url, 1);
+            vc_flight_land(&vc->flights, flight, result);
+        } else {
+            result = vc_flight_wait(&vc->flights, flight);
+        }
+    }
+    return result;
+}
+
+static vme_result_t *_get(vantiq_client_t *vc, const char *rsURI, struct param *params)
+{
+    char *url = create_url(vc, rsURI, params);
+    vme_result_t *result = vc_get_url(vc, rsURI, url);
+    free(url);
+    return result;
+}
+
 /*
  * send an HTTP GET request
  */
 vme_result_t *vc_get(vantiq_client_t *vc, const char *rsURI, struct param *params)
 {
-    common_curl_setup(vc);
-    curl_easy_setopt(vc->curl, CURLOPT_HTTPGET, 1L);
-    return _getordelete(vc, rsURI, params);
+    return _get(vc, rsURI, params);
+}
+
+/*
+ * send an HTTP GET request straight to the server, neither consulting nor
+ * filling the response cache. for callers that need to see the latest state,
+ * e.g. replica sync.
+ */
+vme_result_t *vc_get_uncached(vantiq_client_t *vc, const char *rsURI, struct param *params)
+{
+    char *url = create_url(vc, rsURI, params);
+    vme_result_t *result = _cached_get(vc, rsURI, url, 0);
+    free(url);
+    return result;
 }
 
 /*
@@ -479,9 +690,14 @@ vme_result_t *vc_get(vantiq_client_t *vc, const char *rsURI, struct param *param
  */
 vme_result_t *vc_delete(vantiq_client_t *vc, const char *rsURI, struct param *params)
 {
+    pthread_mutex_lock(&vc->lock);
+    if (vc->cache != NULL)
+        vc_cache_invalidate(vc->cache, rsURI);
     common_curl_setup(vc);
     curl_easy_setopt(vc->curl, CURLOPT_CUSTOMREQUEST, "DELETE");
-    return _getordelete(vc, rsURI, params);
+    vme_result_t *result = _getordelete(vc, rsURI, params);
+    pthread_mutex_unlock(&vc->lock);
+    return result;
 }
 
 /*
@@ -491,6 +707,9 @@ vme_result_t *vc_delete(vantiq_client_t *vc, const char *rsURI, struct param *pa
  */
 vme_result_t *vc_patch(vantiq_client_t *vc, const char *rsURI, const char *json)
 {
+    pthread_mutex_lock(&vc->lock);
+    if (vc->cache != NULL)
+        vc_cache_invalidate(vc->cache, rsURI);
     common_curl_setup(vc);
     curl_easy_setopt(vc->curl, CURLOPT_CUSTOMREQUEST, "PATCH");
     curl_easy_setopt(vc->curl, CURLOPT_POSTFIELDS, json);
@@ -505,11 +724,13 @@ vme_result_t *vc_patch(vantiq_client_t *vc, const char *rsURI, const char *json)
 
     /* Perform the request, resCode will get the return code */
     CURLcode resCode = curl_easy_perform(vc->curl);
+    vc_stats_request(&vc->stats, vc->curl, resCode);
 
     vme_result_t *result = prepare_result(resCode, errbuf, vc);
 
     curl_easy_reset(vc->curl);
     free(topicUrl);
+    pthread_mutex_unlock(&vc->lock);
     return result;
 }
 
@@ -518,23 +739,25 @@ vme_result_t *vc_patch(vantiq_client_t *vc, const char *rsURI, const char *json)
  */
 vme_result_t *vc_aggregate(vantiq_client_t *vc, const char *rsURI, struct param *params)
 {
-    common_curl_setup(vc);
-    curl_easy_setopt(vc->curl, CURLOPT_HTTPGET, 1L);
-    vme_result_t *result = _getordelete(vc, rsURI, params);
-    return result;
+    return _get(vc, rsURI, params);
 }
 
 /*
- * execute the specified (via rsURI) VANTIQ procedure.
+ * execute the specified (via rsURI) VANTIQ procedure. a procedure may change
+ * any type so the response cache, if any, is emptied.
  */
 vme_result_t *vc_execute(vantiq_client_t *vc, const char *rsURI, const char *argsDoc)
 {
     vmebuf_t *msg = vmebuf_ensure_size(NULL, strlen(argsDoc));
     vmebuf_concat(msg, argsDoc, strlen(argsDoc));
 
+    pthread_mutex_lock(&vc->lock);
+    if (vc->cache != NULL)
+        vc_cache_invalidate(vc->cache, NULL);
     common_curl_setup(vc);
     curl_easy_setopt(vc->curl, CURLOPT_POST, 1L);
     vme_result_t *result = _putorpost(vc, rsURI, msg, NULL);
+    pthread_mutex_unlock(&vc->lock);
     vmebuf_dealloc(msg);
     return result;
 }
@@ -546,9 +769,11 @@ vme_result_t *vc_query(vantiq_client_t *vc, const char *rsURI, const char *qPara
 {
     vmebuf_t *msg = vmebuf_ensure_size(NULL, strlen(qParams));
     vmebuf_concat(msg, qParams, strlen(qParams));
+    pthread_mutex_lock(&vc->lock);
     common_curl_setup(vc);
     curl_easy_setopt(vc->curl, CURLOPT_POST, 1L);
     vme_result_t *result = _putorpost(vc, rsURI, msg, NULL);
+    pthread_mutex_unlock(&vc->lock);
     vmebuf_dealloc(msg);
     return result;
 }
@@ -560,10 +785,16 @@ vme_result_t *vc_query(vantiq_client_t *vc, const char *rsURI, const char *qPara
 void vc_teardown(vantiq_client_t *vc)
 {
     log_debug("tearing down vantiq client %s", vc->server_url);
+    vc_pubq_destroy(vc->pubq);
     vc->magic = 0;
     if (vc->recv_buf != NULL) {
         vmebuf_dealloc(vc->recv_buf);
     }
+    vc_cache_destroy(vc->cache);
+    vc_hedge_destroy(vc->hedge);
+    vc_flights_destroy(&vc->flights);
+    vc_stats_destroy(&vc->stats);
+    pthread_mutex_destroy(&vc->lock);
     curl_slist_free_all(vc->http_hdrs);
     curl_easy_cleanup(vc->curl);
     free(vc);
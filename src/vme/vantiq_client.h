@@ -5,8 +5,14 @@
 #ifndef VANTIQ_CLIENT_H
 #define VANTIQ_CLIENT_H
 
+#include <pthread.h>
 #include <curl/curl.h>
 #include "vme.h"
+#include "cache.h"
+#include "flight.h"
+#include "pubq.h"
+#include "hedge.h"
+#include "stats.h"
 
 typedef struct vc_sendstate {
     const char *readptr;
@@ -24,6 +30,14 @@ struct vantiq_client {
     size_t           (*recv_callback)(void *state, const char *data, size_t size);
     void              *callback_state;
     vc_sendstate_t     send_state;
+    vc_cache_t        *cache;
+    char              *resp_etag;
+    char              *resp_last_modified;
+    pthread_mutex_t    lock;        // serializes use of the curl handle and the client state (recursive)
+    vc_flights_t       flights;     // outstanding GETs other threads may piggyback on
+    vc_pubq_t         *pubq;        // created by the first async publish
+    vc_hedge_t        *hedge;       // hedging policy for reads, NULL when off
+    vc_stats_t         stats;
 };
 
 struct param {
@@ -36,6 +50,7 @@ typedef struct vantiq_client vantiq_client_t;
 
 struct param *build_param(struct param *head, const char *key, const char *value);
 void free_params(struct param *params);
+struct param *build_select_params(const char *propSpecs, const char *where, const char *sortSpec, int page, int limit);
 
 char *construct_url(vantiq_client_t *vc, const char *url, int nParams, ...);
 char *create_url(vantiq_client_t *vc, const char *rsPath, struct param *params);
@@ -48,6 +63,8 @@ void vc_teardown(vantiq_client_t *vc);
 vme_result_t *vc_post(vantiq_client_t *vc, const char *topic, const vmebuf_t *msg, struct param *params);
 vme_result_t *vc_put(vantiq_client_t *vc, const char *topic, const vmebuf_t *msg, struct param *params);
 vme_result_t *vc_get(vantiq_client_t *vc, const char *rsPath, struct param *params);
+vme_result_t *vc_get_url(vantiq_client_t *vc, const char *rsPath, const char *url);
+vme_result_t *vc_get_uncached(vantiq_client_t *vc, const char *rsPath, struct param *params);
 vme_result_t *vc_delete(vantiq_client_t *vc, const char *rsPath, struct param *params);
 vme_result_t *vc_patch(vantiq_client_t *vc, const char *rsURI, const char *json);
 vme_result_t *vc_aggregate(vantiq_client_t *vc, const char *rsURI, struct param *params);
@@ -65,6 +65,21 @@ vme_result_t *vme_error_result(const char *errMsg)
     return err;
 }
 
+/*
+ * vme_rejected --
+ *
+ *      result - result of any request
+ *
+ * RETURN: 1 if the request failed with a client error that sending it again won't fix, 0 otherwise. see vme.h
+ */
+int vme_rejected(const vme_result_t *result)
+{
+    long status = result->vme_http_status;
+    if (result->vme_error_msg == NULL || status < 400 || status >= 500)
+        return 0;
+    return (status != 401 && status != 403 && status != 408 && status != 429);
+}
+
 /*
  * vme_callback_state --
  *
@@ -78,11 +93,146 @@ void vme_callback_state(VME vme, void *state)
 
     vantiq_client_t *vc = vc_from_vme(vme);
     if (vc != NULL) {
+        pthread_mutex_lock(&vc->lock);
         vc->callback_state = state;
+        pthread_mutex_unlock(&vc->lock);
     }
     // silently fail if we must
 }
 
+/*
+ * vme_enable_cache --
+ *
+ *      vme - handle returned from call to vme_init
+ *      ttlSecs - how long a response is served from the cache before it must be fetched or revalidated
+ *      maxBytes - upper bound on the memory held by cached responses
+ *
+ * turn on client side caching of select and aggregate results. see vme.h for the details on invalidation.
+ */
+int vme_enable_cache(VME vme, uint32_t ttlSecs, size_t maxBytes)
+{
+    vantiq_client_t *vc = vc_from_vme(vme);
+    if (vc == NULL)
+        return -1;
+    pthread_mutex_lock(&vc->lock);
+    vc_cache_destroy(vc->cache);
+    vc->cache = vc_cache_create(ttlSecs, maxBytes);
+    pthread_mutex_unlock(&vc->lock);
+    return 0;
+}
+
+/*
+ * vme_disable_cache --
+ *
+ *      vme - handle returned from call to vme_init
+ *
+ * turn off the response cache and release everything it holds
+ */
+void vme_disable_cache(VME vme)
+{
+    vantiq_client_t *vc = vc_from_vme(vme);
+    if (vc != NULL) {
+        pthread_mutex_lock(&vc->lock);
+        vc_cache_destroy(vc->cache);
+        vc->cache = NULL;
+        pthread_mutex_unlock(&vc->lock);
+    }
+}
+
+/*
+ * vme_invalidate_cache --
+ *
+ *      vme - handle returned from call to vme_init
+ *      rsURI - resource whose type should be dropped from the cache, NULL to drop everything
+ *
+ * useful when the app knows the data was changed behind our back (e.g. by a rule on the server)
+ */
+void vme_invalidate_cache(VME vme, const char *rsURI)
+{
+    vantiq_client_t *vc = vc_from_vme(vme);
+    if (vc != NULL) {
+        pthread_mutex_lock(&vc->lock);
+        if (vc->cache != NULL)
+            vc_cache_invalidate(vc->cache, rsURI);
+        pthread_mutex_unlock(&vc->lock);
+    }
+}
+
+/*
+ * vme_enable_hedging --
+ *
+ *      vme - handle returned from call to vme_init
+ *      opts - when to hedge and how much extra load to allow, NULL for the defaults (95th percentile, 5%)
+ *
+ * see vme.h. returns 0 on success, -1 for an invalid handle. enabling it again starts over with the new options.
+ */
+int vme_enable_hedging(VME vme, const vme_hedge_opts_t *opts)
+{
+    vantiq_client_t *vc = vc_from_vme(vme);
+    if (vc == NULL)
+        return -1;
+    pthread_mutex_lock(&vc->lock);
+    vc_hedge_destroy(vc->hedge);
+    vc->hedge = vc_hedge_create(vc, opts);
+    pthread_mutex_unlock(&vc->lock);
+    return 0;
+}
+
+void vme_disable_hedging(VME vme)
+{
+    vantiq_client_t *vc = vc_from_vme(vme);
+    if (vc != NULL) {
+        pthread_mutex_lock(&vc->lock);
+        vc_hedge_destroy(vc->hedge);
+        vc->hedge = NULL;
+        pthread_mutex_unlock(&vc->lock);
+    }
+}
+
+/*
+ * vme_hedging_stats --
+ *
+ *      vme - handle returned from call to vme_init
+ *      stats - filled in with how many reads were hedged and how often it paid off, zeroes if hedging is off
+ */
+void vme_hedging_stats(VME vme, vme_hedge_stats_t *stats)
+{
+    memset(stats, 0, sizeof(vme_hedge_stats_t));
+    vantiq_client_t *vc = vc_from_vme(vme);
+    if (vc != NULL) {
+        pthread_mutex_lock(&vc->lock);
+        if (vc->hedge != NULL) {
+            pthread_mutex_lock(&vc->hedge->lock);
+            *stats = vc->hedge->stats;
+            pthread_mutex_unlock(&vc->hedge->lock);
+        }
+        pthread_mutex_unlock(&vc->lock);
+    }
+}
+
+/*
+ * vme_get_stats --
+ *
+ *      vme - handle returned from call to vme_init
+ *      stats - filled in with the client's request, publish and queue figures, see vme.h
+ */
+int vme_get_stats(VME vme, vme_stats_t *stats)
+{
+    memset(stats, 0, sizeof(vme_stats_t));
+    vantiq_client_t *vc = vc_from_vme(vme);
+    if (vc == NULL)
+        return -1;
+    vc_stats_get(&vc->stats, stats);
+    vc_pubq_t *q = __atomic_load_n(&vc->pubq, __ATOMIC_ACQUIRE);
+    if (q != NULL) {
+        uint64_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        uint64_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+        stats->queue_depth = (uint32_t)(head > tail ? head - tail : 0);
+        stats->queue_capacity = q->opts.capacity;
+    }
+    return 0;
+}
+
 /*
  * _select --
  *
@@ -136,9 +286,12 @@ vme_result_t *vme_select_callback(VME vme,
     /* TODO: i18n */
     if (vc == NULL)
         return vme_error_result("invalid VME handle");
+    /* hold the client for the whole request so other threads' responses don't end up in our callback */
+    pthread_mutex_lock(&vc->lock);
     vc->recv_callback = callback;
     vme_result_t *result = vme_select(vme, rsURI, propSpecs, where, sortSpec, page, limit);
     vc->recv_callback = NULL;
+    pthread_mutex_unlock(&vc->lock);
     return result;
 }
 
@@ -394,20 +547,169 @@ vme_result_t *vme_upsert(VME vme, const char *rsURI, const char *json, size_t si
  */
 vme_result_t *vme_publish(VME vme, const char *topic, const char *json, size_t size)
 {
-    vmebuf_t *msg = vmebuf_ensure_size(NULL, size);
-    vmebuf_concat(msg, json, size);
+    /* the body is only read from, so send it from where it is */
+    vmebuf_t msg = { .len = size, .limit = size, .data = (char *)json };
 
     vantiq_client_t *vc = vc_from_vme(vme);
     /* TODO: i18n */
     if (vc == NULL)
         return vme_error_result("invalid VME handle");
     char *rsURI = vme_build_system_rsuri(vme, TOPICS, topic, NULL);
-    vme_result_t *result = vc_post(vc, rsURI, msg, NULL);
+    vme_result_t *result = vc_post(vc, rsURI, &msg, NULL);
+    vc_stats_publish(&vc->stats, result);
     free(rsURI);
-    vmebuf_dealloc(msg);
     return result;
 }
 
+/*
+ * vme_publish_buf --
+ *
+ *      vme - handle returned from call to vme_init
+ *      topic - as for vme_publish
+ *      msg - JSON formatted data to publish, msg->len bytes of it. owned by the call from here on
+ *      release - called with msg once the publish is over, whatever the outcome. NULL to vmebuf_dealloc it
+ *      state - passed through to release
+ *
+ * publishes msg without copying it, for apps that build or receive a message in a buffer of its own and
+ * would rather hand it over than keep it until the publish returns.
+ */
+vme_result_t *vme_publish_buf(VME vme, const char *topic, vmebuf_t *msg, vme_release_fn release, void *state)
+{
+    vme_result_t *result;
+    vantiq_client_t *vc = vc_from_vme(vme);
+    /* TODO: i18n */
+    if (vc == NULL) {
+        result = vme_error_result("invalid VME handle");
+    } else {
+        char *rsURI = vme_build_system_rsuri(vme, TOPICS, topic, NULL);
+        result = vc_post(vc, rsURI, msg, NULL);
+        vc_stats_publish(&vc->stats, result);
+        free(rsURI);
+    }
+    if (release != NULL)
+        release(state, msg);
+    else
+        vmebuf_dealloc(msg);
+    return result;
+}
+
+/*
+ * the client's publish queue, started with default options if the app didn't configure one
+ */
+static vc_pubq_t *publish_queue(vantiq_client_t *vc, const vme_publish_opts_t *opts)
+{
+    vc_pubq_t *q = __atomic_load_n(&vc->pubq, __ATOMIC_ACQUIRE);
+    if (q != NULL)
+        return q;
+    pthread_mutex_lock(&vc->lock);
+    if ((q = vc->pubq) == NULL) {
+        q = vc_pubq_create((VME)vc, opts);
+        __atomic_store_n(&vc->pubq, q, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&vc->lock);
+    return q;
+}
+
+/*
+ * vme_publish_queue --
+ *
+ *      vme - handle returned from call to vme_init
+ *      opts - queue capacity, what to do when it is full and where to report failed publishes
+ *
+ * configures the queue behind vme_publish_async. this must come before the first async publish, which otherwise
+ * starts a queue of 1024 messages that blocks when full.
+ *
+ * RETURN: 0 on success, -1 if the queue is already running
+ */
+int vme_publish_queue(VME vme, const vme_publish_opts_t *opts)
+{
+    vantiq_client_t *vc = vc_from_vme(vme);
+    if (vc == NULL)
+        return -1;
+    int rc = -1;
+    pthread_mutex_lock(&vc->lock);
+    if (vc->pubq == NULL) {
+        vc_pubq_t *q = vc_pubq_create(vme, opts);
+        __atomic_store_n(&vc->pubq, q, __ATOMIC_RELEASE);
+        rc = (q != NULL ? 0 : -1);
+    }
+    pthread_mutex_unlock(&vc->lock);
+    return rc;
+}
+
+/*
+ * vme_publish_async --
+ *
+ *      vme - handle returned from call to vme_init
+ *      topic - as for vme_publish
+ *      json - JSON formatted data to publish, copied before returning
+ *      size - size of the data.
+ *
+ * queues the message for the client's sender thread and returns without waiting on the network. messages go out
+ * in the order they were queued. failures are reported to the queue's on_error callback and summed up by
+ * vme_publish_flush.
+ *
+ * RETURN: 0 once queued, -1 if it couldn't be (an invalid handle, or a full queue that fails new messages)
+ */
+int vme_publish_async(VME vme, const char *topic, const char *json, size_t size)
+{
+    vantiq_client_t *vc = vc_from_vme(vme);
+    if (vc == NULL)
+        return -1;
+    vc_pubq_t *q = publish_queue(vc, NULL);
+    if (q == NULL)
+        return -1;
+    return vc_pubq_push(q, topic, json, size);
+}
+
+/*
+ * vme_publish_async_buf --
+ *
+ *      vme - handle returned from call to vme_init
+ *      topic - as for vme_publish, copied before returning
+ *      msg / release / state - as for vme_publish_buf. msg is queued as is and released by the sender thread
+ *
+ * RETURN: as for vme_publish_async. msg is released even when it couldn't be queued
+ */
+int vme_publish_async_buf(VME vme, const char *topic, vmebuf_t *msg, vme_release_fn release, void *state)
+{
+    vantiq_client_t *vc = vc_from_vme(vme);
+    vc_pubq_t *q = (vc == NULL ? NULL : publish_queue(vc, NULL));
+    if (q == NULL) {
+        if (release != NULL)
+            release(state, msg);
+        else
+            vmebuf_dealloc(msg);
+        return -1;
+    }
+    return vc_pubq_push_buf(q, topic, msg, release, state);
+}
+
+/*
+ * vme_publish_flush --
+ *
+ *      vme - handle returned from call to vme_init
+ *      timeoutMs - how long to wait for the queue to drain, negative waits as long as it takes
+ *
+ * call before vme_teardown, which discards whatever is still queued.
+ *
+ * RETURN: vme_count is the number of messages published since the last flush. vme_error_msg is set if any failed
+ *      or were dropped since then, or if the queue didn't drain in time.
+ */
+vme_result_t *vme_publish_flush(VME vme, int timeoutMs)
+{
+    vantiq_client_t *vc = vc_from_vme(vme);
+    if (vc == NULL)
+        return vme_error_result("invalid VME handle");
+    vc_pubq_t *q = __atomic_load_n(&vc->pubq, __ATOMIC_ACQUIRE);
+    if (q == NULL) {
+        vme_result_t *result = malloc(sizeof(vme_result_t));
+        memset(result, 0, sizeof(vme_result_t));
+        return result;
+    }
+    return vc_pubq_flush(q, timeoutMs);
+}
+
 /*
  * vme_free_result --
  *
@@ -447,6 +749,100 @@ vme_result_t *vme_patch(VME vme, const char *rsURI, const char *json)
     return vc_patch(vc, rsURI, json);
 }
 
+/*
+ * vme_json_diff --
+ *
+ *      from - json document as it was
+ *      to - json document as it should be
+ *
+ * RETURN an allocated json patch that turns from into to, "[]" if they are the same, or NULL if either isn't json
+ */
+char *vme_json_diff(const char *from, const char *to)
+{
+    cJSON *a = cJSON_Parse(from);
+    cJSON *b = cJSON_Parse(to);
+    char *patch = NULL;
+    if (a != NULL && b != NULL) {
+        cJSON *ops = json_diff(a, b);
+        patch = cJSON_PrintUnformatted(ops);
+        cJSON_Delete(ops);
+    }
+    cJSON_Delete(a);
+    cJSON_Delete(b);
+    return patch;
+}
+
+static int removes_any(const cJSON *ops)
+{
+    for (const cJSON *op = ops->child; op != NULL; op = op->next) {
+        const cJSON *kind = cJSON_GetObjectItemCaseSensitive(op, "op");
+        if (cJSON_IsString(kind) && strcmp(kind->valuestring, "remove") == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * _id and the ars_ properties belong to the server, which would refuse, or worse apply, a patch touching them.
+ * an instance as last read carries them and the one it should become often doesn't, so leave them out of the diff
+ */
+static void drop_system_props(cJSON *doc)
+{
+    cJSON *prop = doc->child;
+    while (prop != NULL) {
+        cJSON *next = prop->next;
+        if (prop->string != NULL && (strcmp(prop->string, "_id") == 0 || strncmp(prop->string, "ars_", 4) == 0))
+            cJSON_Delete(cJSON_DetachItemViaPointer(doc, prop));
+        prop = next;
+    }
+}
+
+/*
+ * vme_update_delta --
+ *
+ *      vme - handle returned from call to vme_init
+ *      rsURI - path to the instance being updated
+ *      from - the instance as last read
+ *      to - the instance as it should be
+ *
+ * update an instance with either a json patch or the whole new document, whichever is smaller on the wire.
+ */
+vme_result_t *vme_update_delta(VME vme, const char *rsURI, const char *from, const char *to)
+{
+    vantiq_client_t *vc = vc_from_vme(vme);
+    if (vc == NULL)
+        return vme_error_result("invalid VME handle");
+    cJSON *a = cJSON_Parse(from);
+    cJSON *b = cJSON_Parse(to);
+    if (a == NULL || b == NULL || !cJSON_IsObject(b)) {
+        cJSON_Delete(a);
+        cJSON_Delete(b);
+        return vme_error_result("documents must be json objects");
+    }
+    if (cJSON_IsObject(a))
+        drop_system_props(a);
+    drop_system_props(b);
+    cJSON *ops = json_diff(a, b);
+    vme_result_t *result;
+    if (cJSON_GetArraySize(ops) == 0) {
+        result = malloc(sizeof(vme_result_t));
+        memset(result, 0, sizeof(vme_result_t));
+    } else {
+        char *patch = cJSON_PrintUnformatted(ops);
+        size_t size = strlen(to);
+        if (strlen(patch) < size || removes_any(ops)) {
+            result = vc_patch(vc, rsURI, patch);
+        } else {
+            result = vme_update(vme, rsURI, to, size);
+        }
+        free(patch);
+    }
+    cJSON_Delete(ops);
+    cJSON_Delete(a);
+    cJSON_Delete(b);
+    return result;
+}
+
 /*
  * vme_build_custom_rsuri --
  *
@@ -523,15 +919,7 @@ vme_result_t *vme_aggregate(VME vme, const char *rsURI, const char *pipeline)
     vantiq_client_t *vc = vc_from_vme(vme);
     if (vc == NULL)
         return vme_error_result("invalid VME handle");
-    // adjust the URI to perform an aggregate pipeline operation.
-    size_t len = strlen(rsURI);
-    char *aggRsURI = malloc(len+sizeof("/aggregate"));
-    strcpy(aggRsURI, rsURI);
-    if (rsURI[len - 1] == '/') {
-        strcat(aggRsURI, "aggregate");
-    } else {
-        strcat(aggRsURI, "/aggregate");
-    }
+    char *aggRsURI = build_aggregate_rsuri(rsURI);
     struct param *params = build_param(NULL, "pipeline", pipeline);
     vme_result_t *result = vc_aggregate(vc, aggRsURI, params);
     free_params(params);
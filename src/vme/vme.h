@@ -22,6 +22,7 @@ typedef struct vme_result {
     uint32_t    vme_count;
     char       *vme_json_data;
     char       *vme_error_msg;
+    long        vme_http_status;    // of the server's response, 0 if there wasn't one
 } vme_result_t;
 
 typedef enum vantiq_sys_type {
@@ -91,6 +92,13 @@ void vme_teardown(VME vme);
  * to deallocate all associated resources with the request.
  */
 void vme_free_result(vme_result_t *result);
+/*
+ * vme_rejected tells a failure the server will repeat however often the
+ * request is sent (400, 404, 409, 422, ...) from one worth retrying: no
+ * response at all, 401 / 403 while a token is renewed, 408, 429 and 5xx.
+ * store and forward callers should only give up on the former.
+ */
+int vme_rejected(const vme_result_t *result);
 
 /*
  * REST API interfaces
@@ -100,6 +108,12 @@ void vme_free_result(vme_result_t *result);
  *
  * and the details for HTTP binding:
  * https://api.vantiq.com/docs/system/api/index.html#rest-over-http-binding
+ *
+ * a VME handle may be shared by several threads. requests on the same handle
+ * are serialized, except that identical reads (select, select_one,
+ * select_count and aggregate with the same parameters) issued while one is
+ * already outstanding share that single request and each caller gets its own
+ * copy of the result. vme_select_callback is never shared.
  */
 vme_result_t *vme_select_one(VME vme, const char *rsURI, const char *props, const char *where);
 vme_result_t *vme_select_count(VME vme, const char *rsURI, const char *propSpecs, const char *where, const char *sortSpec);
@@ -113,10 +127,232 @@ vme_result_t *vme_upsert(VME vme, const char *rsURI, const char *json, size_t si
 vme_result_t *vme_patch(VME vme, const char *rsURI, const char *json);
 vme_result_t *vme_aggregate(VME vme, const char *rsURI, const char *json);
 
+/*
+ * json patches
+ *
+ * vme_json_diff compares two json documents and returns an RFC 6902 patch
+ * (an allocated string, "[]" when they are equal, NULL if either doesn't
+ * parse) that vme_patch can apply to turn the first into the second.
+ *
+ * vme_update_delta updates an instance given both its old and new contents,
+ * sending the patch or the new document, whichever is smaller. a patch is
+ * always used when properties were removed, since an update only sets the
+ * properties it is given. _id and the ars_ system properties are left out
+ * of the comparison, so from may be the instance as read from the server.
+ * when nothing changed nothing is sent, and the result has vme_count 0.
+ */
+char *vme_json_diff(const char *from, const char *to);
+vme_result_t *vme_update_delta(VME vme, const char *rsURI, const char *from, const char *to);
+
+/*
+ * adaptive batching
+ *
+ * a controller that the bulk loader and buffered writers consult for their
+ * batch size (and the loader for its number of connections) in place of
+ * fixed limits. it grows batches while they keep requests under target_ms
+ * and raise rows/sec, and backs off when requests run long or fail.
+ * vme_adapt_settings reports what it has settled on. apps that batch on
+ * their own can feed a controller the outcome of each request with
+ * vme_adapt_record, along with how many of their requests were in flight at
+ * the time, and size their batches from its settings.
+ */
+typedef struct vme_adapt vme_adapt_t;
+
+typedef struct vme_adapt_opts {
+    uint32_t    target_ms;          // per request, 0 means 1000
+    uint32_t    min_count;          // instances per batch, 0 means 10
+    uint32_t    max_count;          // 0 means 5000
+    size_t      max_bytes;          // 0 means 4MB
+    int         max_concurrency;    // 0 means 8
+} vme_adapt_opts_t;
+
+typedef struct vme_adapt_settings {
+    uint32_t    batch_count;
+    size_t      batch_bytes;
+    int         concurrency;
+    double      latency_ms;         // moving average per request
+    double      rows_per_sec;       // moving average
+} vme_adapt_settings_t;
+
+vme_adapt_t *vme_adapt_create(const vme_adapt_opts_t *opts);
+void vme_adapt_settings(vme_adapt_t *a, vme_adapt_settings_t *settings);
+void vme_adapt_record(vme_adapt_t *a, uint32_t rows, size_t bytes, double latencyMs, int inFlight, int ok);
+void vme_adapt_free(vme_adapt_t *a);
+
+/*
+ * bulk loading from a file
+ *
+ * vme_insert_file maps a file of instances (a JSON array or NDJSON) and
+ * inserts it in batches of at most batch_bytes / batch_count, split on
+ * instance boundaries, with up to concurrency requests in flight on separate
+ * connections. on_batch, if given, is called as each batch completes;
+ * error_msg is NULL when it succeeded. offset / length locate the batch's
+ * instances in the file and data points at them for the duration of the
+ * call, so a failed batch can be retried, e.g. by building a JSON array of it
+ * for vme_insert.
+ */
+typedef struct vme_batch {
+    size_t      offset;
+    size_t      length;
+    uint32_t    count;          // instances in the batch
+    const char *data;
+    long        http_status;
+    const char *error_msg;
+} vme_batch_t;
+
+typedef struct vme_load_opts {
+    size_t      batch_bytes;    // 0 means 256KB
+    uint32_t    batch_count;    // 0 means 500
+    int         concurrency;    // 0 means 4
+    int         upsert;
+    void      (*on_batch)(void *state, const vme_batch_t *batch);
+    void       *state;
+    vme_adapt_t *adapt;         // overrides the limits and concurrency above
+} vme_load_opts_t;
+
+vme_result_t *vme_insert_file(VME vme, const char *rsURI, const char *path, const vme_load_opts_t *opts);
+
+/*
+ * buffered writers
+ *
+ * a writer gathers instances added one at a time into JSON array batches and
+ * inserts (or upserts) each batch in a single request once it holds
+ * max_count instances or max_bytes bytes, once its first instance has waited
+ * linger_ms, or when flushed. on_batch reports each batch as it completes,
+ * from whichever thread sent it: offset is the sequence number (from 0) of
+ * the batch's first instance and data / length the request body. a writer may
+ * be shared by several threads.
+ */
+typedef struct vme_writer vme_writer_t;
+
+typedef struct vme_writer_opts {
+    size_t      max_bytes;      // 0 means 256KB
+    uint32_t    max_count;      // 0 means 500
+    uint32_t    linger_ms;      // 0 means no time limit
+    int         upsert;
+    void      (*on_batch)(void *state, const vme_batch_t *batch);
+    void       *state;
+    vme_adapt_t *adapt;         // overrides max_bytes and max_count
+} vme_writer_opts_t;
+
+vme_writer_t *vme_writer_open(VME vme, const char *rsURI, const vme_writer_opts_t *opts);
+int vme_writer_add(vme_writer_t *w, const char *json, size_t size);
+vme_result_t *vme_writer_flush(vme_writer_t *w);
+vme_result_t *vme_writer_close(vme_writer_t *w);
+
+/*
+ * store and forward spool
+ *
+ * publishes, inserts and upserts are appended to a log of memory mapped
+ * segment files under dir and delivered in order by a background thread
+ * whenever the server can be reached; what is still spooled when the spool is
+ * closed (or the app crashes) is delivered after the next open. records the
+ * server rejects are skipped, anything else is retried with a growing delay.
+ * appends fail once max_bytes worth of segments are waiting for delivery.
+ * a spool opened without a VME handle (say, because vme_init couldn't reach
+ * the server) only appends.
+ * sync makes each append (and the delivery progress) durable before
+ * returning. without it, vme_spool_sync makes everything appended so far
+ * durable at once.
+ */
+typedef struct vme_spool vme_spool_t;
+
+typedef struct vme_spool_opts {
+    size_t      segment_bytes;  // 0 means 4MB
+    size_t      max_bytes;      // 0 means 64MB
+    uint32_t    retry_ms;       // first retry delay, 0 means 1s
+    int         sync;
+} vme_spool_opts_t;
+
+vme_spool_t *vme_spool_open(VME vme, const char *dir, const vme_spool_opts_t *opts);
+int vme_spool_publish(vme_spool_t *sp, const char *topic, const char *json, size_t size);
+int vme_spool_insert(vme_spool_t *sp, const char *rsURI, const char *json, size_t size);
+int vme_spool_upsert(vme_spool_t *sp, const char *rsURI, const char *json, size_t size);
+int vme_spool_sync(vme_spool_t *sp);
+uint64_t vme_spool_pending(vme_spool_t *sp);
+vme_result_t *vme_spool_flush(vme_spool_t *sp, int timeoutMs);
+void vme_spool_close(vme_spool_t *sp);
+
+/*
+ * prepared selects and aggregates
+ *
+ * for queries that are run over and over (e.g. polling loops) the request is
+ * encoded once up front. any '?' in the where clause or pipeline that is not
+ * inside a JSON string is a parameter, numbered from 1, that must be bound
+ * before executing. only bound values are encoded at bind time; bindings stay
+ * in place across executions.
+ */
+typedef struct vme_prepared vme_prepared_t;
+
+vme_prepared_t *vme_prepare_select(VME vme, const char *rsURI, const char *propSpecs, const char *where, const char *sortSpec);
+vme_prepared_t *vme_prepare_aggregate(VME vme, const char *rsURI, const char *pipeline);
+int vme_prepared_param_count(const vme_prepared_t *stmt);
+int vme_bind_json(vme_prepared_t *stmt, int index, const char *json);
+int vme_bind_string(vme_prepared_t *stmt, int index, const char *value);
+int vme_bind_double(vme_prepared_t *stmt, int index, double value);
+int vme_bind_int(vme_prepared_t *stmt, int index, int64_t value);
+vme_result_t *vme_exec_select(vme_prepared_t *stmt, int page, int limit);
+vme_result_t *vme_exec_aggregate(vme_prepared_t *stmt);
+void vme_free_prepared(vme_prepared_t *stmt);
+
 vme_result_t *vme_publish(VME vme, const char *topic, const char *json, size_t size);
 vme_result_t *vme_execute(VME vme, const char *procID, const char *argsDoc);
 vme_result_t *vme_query_source(VME vme, const char *sourceID, const char *argsDoc);
 
+/*
+ * asynchronous publishing. vme_publish_async copies the message onto a
+ * bounded queue and returns; a sender thread publishes queued messages in
+ * order. when the queue is full, VME_QUEUE_BLOCK waits for room,
+ * VME_QUEUE_DROP_OLDEST discards the oldest queued message and
+ * VME_QUEUE_FAIL refuses the new one. on_error is called from the sender
+ * thread for each publish that fails. vme_publish_flush waits for the queue
+ * to drain and should be called before vme_teardown.
+ */
+typedef enum vme_queue_policy {
+    VME_QUEUE_BLOCK = 0,
+    VME_QUEUE_DROP_OLDEST = 1,
+    VME_QUEUE_FAIL = 2
+} vme_queue_policy_t;
+
+typedef struct vme_publish_opts {
+    uint32_t            capacity;       // messages, rounded up to a power of 2. 0 means 1024
+    vme_queue_policy_t  when_full;
+    void              (*on_error)(void *state, const char *topic, const char *json, size_t size, const char *errMsg);
+    void               *state;
+} vme_publish_opts_t;
+
+int vme_publish_queue(VME vme, const vme_publish_opts_t *opts);
+int vme_publish_async(VME vme, const char *topic, const char *json, size_t size);
+vme_result_t *vme_publish_flush(VME vme, int timeoutMs);
+
+/*
+ * select results written straight to a file descriptor (or a file) as they
+ * arrive instead of being held in memory. VME_OUTPUT_JSON writes the JSON
+ * array as the server sends it, VME_OUTPUT_NDJSON one instance per line.
+ * VME_FSYNC_END syncs once everything is written, VME_FSYNC_EVERY whenever
+ * another fsync_bytes have been written. vme_size / vme_count of the result
+ * hold the number of bytes / instances written.
+ */
+typedef enum vme_output_format {
+    VME_OUTPUT_JSON = 0,
+    VME_OUTPUT_NDJSON = 1
+} vme_output_format_t;
+
+typedef enum vme_fsync {
+    VME_FSYNC_NONE = 0,
+    VME_FSYNC_END = 1,
+    VME_FSYNC_EVERY = 2
+} vme_fsync_t;
+
+typedef struct vme_output_opts {
+    vme_output_format_t format;
+    vme_fsync_t         fsync;
+    size_t              fsync_bytes;    // VME_FSYNC_EVERY
+} vme_output_opts_t;
+
+vme_result_t *vme_select_to_fd(VME vme, const char *rsURI, const char *propSpecs, const char *where, const char *sortSpec, int page, int limit, int fd, const vme_output_opts_t *opts);
+vme_result_t *vme_select_to_file(VME vme, const char *rsURI, const char *propSpecs, const char *where, const char *sortSpec, int page, int limit, const char *path, const vme_output_opts_t *opts);
+
 /* helper functions */
 
 /*
@@ -125,6 +361,79 @@ vme_result_t *vme_query_source(VME vme, const char *sourceID, const char *argsDo
  * object boundaries in JSON results. You are basically getting a buffer of bytes
  */
 void vme_callback_state(VME vme, void *state);
+/*
+ * an opt-in cache for selects and aggregates. responses are keyed by the full
+ * request URL and are served locally for ttlSecs seconds. once stale, entries
+ * the server tagged with an ETag or Last-Modified header are revalidated with a
+ * conditional request rather than fetched again. at most maxBytes are held,
+ * least recently used entries are evicted first. inserts, updates, upserts,
+ * deletes and patches through this VME drop all entries for the same type;
+ * executing a procedure empties the cache. changes made by other clients are
+ * only seen once an entry expires.
+ *
+ * vme_enable_cache returns 0 on success, -1 for an invalid handle. enabling an
+ * already enabled cache discards its contents.
+ */
+int vme_enable_cache(VME vme, uint32_t ttlSecs, size_t maxBytes);
+void vme_disable_cache(VME vme);
+/*
+ * drop cached results for the type rsURI refers to, or everything if rsURI is NULL
+ */
+void vme_invalidate_cache(VME vme, const char *rsURI);
+/*
+ * opt-in hedging of reads (selects, select_one / select_count and
+ * aggregates). when a read has taken longer than the given percentile of
+ * recent reads (and at least min_delay_ms) the same request is sent again on
+ * a second connection and whichever response comes back first is used.
+ * budget caps the duplicates as a fraction of reads, e.g. 0.05 for at most
+ * one extra request per 20. hedging starts once 20 reads have been timed.
+ * results streamed to a callback are never hedged.
+ */
+typedef struct vme_hedge_opts {
+    double      percentile;     // 0 means 95
+    uint32_t    min_delay_ms;
+    double      budget;         // 0 means 0.05
+} vme_hedge_opts_t;
+
+typedef struct vme_hedge_stats {
+    uint64_t    reads;
+    uint64_t    hedged;         // duplicates sent
+    uint64_t    hedge_wins;     // duplicates that answered first
+    double      delay_ms;       // the most recent hedging delay
+} vme_hedge_stats_t;
+
+int vme_enable_hedging(VME vme, const vme_hedge_opts_t *opts);
+void vme_disable_hedging(VME vme);
+void vme_hedging_stats(VME vme, vme_hedge_stats_t *stats);
+/*
+ * what a client has done since vme_init, for monitoring. requests counts every
+ * HTTP request that went to the server, bulk load batches and hedged
+ * duplicates that answered included, but not reads served from the cache or
+ * shared with another thread's identical request; errors are those that got
+ * no response or an error status. the latency percentiles are over the most
+ * recent requests, the average and max over all of them. published counts
+ * publishes to topics, synchronous or queued. the queue figures stay zero
+ * until the publish queue is started.
+ *
+ * vme_get_stats returns 0, or -1 (with stats zeroed) for an invalid handle.
+ */
+typedef struct vme_stats {
+    uint64_t    requests;
+    uint64_t    errors;
+    uint64_t    bytes_out;          // request bodies
+    uint64_t    bytes_in;           // response bodies
+    double      latency_avg_ms;
+    double      latency_p50_ms;
+    double      latency_p99_ms;
+    double      latency_max_ms;
+    uint64_t    published;
+    uint64_t    publish_errors;
+    uint64_t    publish_dropped;    // discarded or refused by a full queue
+    uint32_t    queue_depth;        // publishes waiting to be sent
+    uint32_t    queue_capacity;
+} vme_stats_t;
+
+int vme_get_stats(VME vme, vme_stats_t *stats);
 /*
  * Most of the calls require a resource path indicating which resource you are
  * attempting to access. THere are system resources and "custom" resources or
@@ -139,6 +448,135 @@ char *vme_build_custom_rsuri(VME vme, const char *rsName, const char *rsID);
 const char *vme_mapto_rsname(vme_rstype_t type);
 
 
+/*
+ * columnar decoding of select results
+ *
+ * vme_decode_columns turns a JSON array of instances into one column per
+ * requested property: a contiguous array of values plus a null bitmap (bit
+ * row % 8 of nulls[row / 8] is set when the value is missing, null or of the
+ * wrong type). strings are dictionary encoded, codes[row] indexes dict.
+ *
+ * a column's type is that of its first non null value; integral numbers are
+ * decoded as int64 unless some value in the column has a fraction, in which
+ * case the whole column is double.
+ */
+typedef enum vme_coltype {
+    VME_COL_NULL = 0,       // no usable values at all
+    VME_COL_INT64 = 1,
+    VME_COL_DOUBLE = 2,
+    VME_COL_BOOL = 3,
+    VME_COL_STRING = 4
+} vme_coltype_t;
+
+typedef struct vme_column {
+    char           *name;
+    vme_coltype_t   type;
+    int64_t        *i64;        // VME_COL_INT64
+    double         *f64;        // VME_COL_DOUBLE
+    uint8_t        *u8;         // VME_COL_BOOL, 0 or 1
+    uint32_t       *codes;      // VME_COL_STRING, index into dict
+    char          **dict;
+    uint32_t        dict_size;
+    uint8_t        *nulls;
+    size_t          null_count;
+} vme_column_t;
+
+typedef struct vme_columns {
+    size_t          n_rows;
+    int             n_cols;
+    vme_column_t   *cols;
+} vme_columns_t;
+
+#define vme_column_is_null(col, row) (((col)->nulls[(row) / 8] >> ((row) % 8)) & 1)
+
+vme_columns_t *vme_decode_columns(const char *json, const char **props, int nProps);
+vme_column_t *vme_find_column(vme_columns_t *cols, const char *name);
+void vme_free_columns(vme_columns_t *cols);
+
+/*
+ * incremental replicas
+ *
+ * a local copy of a type refreshed by fetching only what changed since the
+ * last sync: instances whose mark property (ars_modifiedAt by default) is at
+ * or past the highest mark seen so far are merged in by key (_id by default).
+ * deletions are picked up from an optional tombstone type the application
+ * writes to when it deletes, or by an occasional vme_replica_reconcile. a
+ * replica is not safe to use from several threads at once.
+ */
+typedef struct vme_replica vme_replica_t;
+
+vme_replica_t *vme_replica_open(VME vme, const char *rsURI, const char *keyProp, const char *markProp);
+void vme_replica_set_tombstones(vme_replica_t *rep, const char *rsURI, const char *keyProp, const char *markProp);
+vme_result_t *vme_replica_sync(vme_replica_t *rep);
+vme_result_t *vme_replica_reconcile(vme_replica_t *rep);
+const char *vme_replica_get(vme_replica_t *rep, const char *key);
+size_t vme_replica_count(const vme_replica_t *rep);
+vme_result_t *vme_replica_select(vme_replica_t *rep, const char *where);
+void vme_replica_close(vme_replica_t *rep);
+
+/*
+ * reduction kernels
+ *
+ * count, sum, min and max of an array of numbers in a single pass, vectorized
+ * where the platform allows. a reduction accumulates across calls, so a column
+ * can be reduced a block at a time. nulls is an optional bitmap laid out like
+ * vme_column_t::nulls; set bits mark values to skip.
+ */
+typedef struct vme_reduction {
+    size_t  count;
+    double  sum;
+    double  min;        // only meaningful when count > 0
+    double  max;
+} vme_reduction_t;
+
+void vme_reduction_init(vme_reduction_t *acc);
+void vme_reduce_f64(vme_reduction_t *acc, const double *values, size_t n, const uint8_t *nulls);
+void vme_reduce_i64(vme_reduction_t *acc, const int64_t *values, size_t n, const uint8_t *nulls);
+
+/*
+ * local where clause evaluation
+ *
+ * a where clause as passed to vme_select is compiled once and can then be
+ * evaluated against any number of instances without a server round trip,
+ * e.g. to filter cached or streamed results, or to drop data nobody is
+ * interested in before paying to send it. operators: $eq, $ne, $gt, $gte,
+ * $lt, $lte, $in, $nin, $exists, $not, $and, $or and $nor. range operators
+ * only match values of the same type as their operand; a condition on an
+ * array property matches if any element matches.
+ */
+typedef struct vme_where vme_where_t;
+struct cJSON;
+
+vme_where_t *vme_where_compile(const char *where);
+int vme_where_eval(const vme_where_t *w, const struct cJSON *instance);
+vme_result_t *vme_where_filter(const vme_where_t *w, const char *json, size_t size);
+void vme_where_free(vme_where_t *w);
+
+/*
+ * local aggregation
+ *
+ * runs an aggregation pipeline in process rather than on the server: over a
+ * JSON array of instances already in memory (e.g. a cached select result) with
+ * vme_aggregate_local, or over a select as it streams in:
+ *
+ *      vme_agg_t *agg = vme_agg_open(pipeline);
+ *      vme_callback_state(vme, agg);
+ *      vme_result_t *sel = vme_select_callback(vme, rsURI, NULL, where, NULL, 0, 0, vme_agg_callback);
+ *      vme_result_t *result = vme_agg_finish(agg);
+ *
+ * only the instance being parsed, $group state and rows held by $sort are kept
+ * in memory. supported stages are $match, $project, $group (with $sum, $avg,
+ * $min, $max, $first and $last), $sort, $skip, $limit and $count. $project
+ * outputs dotted paths under their dotted name.
+ */
+typedef struct vme_agg vme_agg_t;
+
+vme_agg_t *vme_agg_open(const char *pipeline);
+size_t vme_agg_feed(vme_agg_t *agg, const char *data, size_t size);
+size_t vme_agg_callback(void *state, const char *data, size_t size);
+vme_result_t *vme_agg_finish(vme_agg_t *agg);
+vme_result_t *vme_aggregate_local(const char *json, size_t size, const char *pipeline);
+
 typedef struct
 {
     size_t len;        // current length of buffer (used bytes)
@@ -157,12 +595,35 @@ void  vmebuf_concat(vmebuf_t *buf, const char *data, size_t len);
 char *vmebuf_tostr(vmebuf_t *buf);
 void  vmebuf_dealloc(vmebuf_t *buf);
 
+/*
+ * publishing without a copy. vme_publish_buf and vme_publish_async_buf take
+ * over msg: its bytes are sent from where they are and, once the publish is
+ * over, whether or not it worked, msg goes to release to be recycled, or is
+ * vmebuf_dealloc'd when release is NULL.
+ */
+typedef void (*vme_release_fn)(void *state, vmebuf_t *msg);
+
+vme_result_t *vme_publish_buf(VME vme, const char *topic, vmebuf_t *msg, vme_release_fn release, void *state);
+int vme_publish_async_buf(VME vme, const char *topic, vmebuf_t *msg, vme_release_fn release, void *state);
+
 typedef struct {
     char *dpi_port;
     char *dpi_socket_path;
+    char *dpi_shm_path;
     char *vantiq_url;
     char *vantiq_token;
     char *log_level;
+    char *dpi_credit;
+    char *spool_dir;
+    char *workers;
+    char *shard_by;
+    char *dedup_key;
+    char *dedup_ignore;
+    char *dedup_size;
+    char *dedup_refresh;
+    char *stats_socket;
+    char *stats_file;
+    char *stats_interval;
 } vmeconfig_t;
 
 int vme_parse_config(const char *path, vmeconfig_t *config);
@@ -0,0 +1,512 @@
+//
+//  where.c
+//
+//  evaluate where clauses ({"salary": {"$gt": 200000.0}, "dept": {"$in": ["Sales", "Eng"]}}) locally. the clause is
+//  compiled once into a flat program: nodes in prefix order, each knowing the size of its subtree so $and / $or can
+//  short circuit by jumping over children. property paths are split up front and shared between nodes, constants
+//  are typed and $in lists are sorted for binary search.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "vme.h"
+#include "cjson.h"
+#include "jscan.h"
+#include "where.h"
+#include "utils.h"
+#include "log.h"
+
+#define MAX_PATH_SEGMENTS 16
+
+typedef enum {
+    OP_TRUE,        // empty clause
+    OP_AND,
+    OP_OR,
+    OP_NOR,
+    OP_NOT,
+    OP_EQ,
+    OP_NE,
+    OP_GT,
+    OP_GTE,
+    OP_LT,
+    OP_LTE,
+    OP_IN,
+    OP_NIN,
+    OP_EXISTS
+} where_op_t;
+
+typedef enum {
+    CONST_NUM,
+    CONST_STR,
+    CONST_NULL,
+    CONST_OTHER     // bool, object, array: compared with json_value_cmp
+} const_type_t;
+
+typedef struct {
+    uint8_t         op;
+    uint8_t         ctype;
+    uint16_t        path;       // index into vme_where::paths
+    uint32_t        size;       // nodes in this subtree, itself included
+    double          num;
+    const char     *str;
+    const cJSON    *value;
+    /* $in / $nin: numbers and strings sorted for bsearch, anything else checked one by one */
+    double         *nums;
+    const char    **strs;
+    const cJSON   **others;
+    uint32_t        n_nums;
+    uint32_t        n_strs;
+    uint32_t        n_others;
+    uint8_t         has_null;
+} where_node_t;
+
+typedef struct {
+    char           *segs[MAX_PATH_SEGMENTS];
+    int             n_segs;
+    char           *text;
+} where_path_t;
+
+struct vme_where {
+    cJSON          *owned;      // parsed clause when we compiled from text
+    where_node_t   *nodes;
+    uint32_t        n_nodes;
+    uint32_t        max_nodes;
+    where_path_t   *paths;
+    uint16_t        n_paths;
+    int             failed;
+};
+
+static uint32_t new_node(vme_where_t *w, where_op_t op)
+{
+    if (w->n_nodes == w->max_nodes) {
+        w->max_nodes = (w->max_nodes == 0 ? 16 : w->max_nodes * 2);
+        w->nodes = realloc(w->nodes, w->max_nodes * sizeof(where_node_t));
+    }
+    where_node_t *node = &w->nodes[w->n_nodes];
+    memset(node, 0, sizeof(where_node_t));
+    node->op = op;
+    node->size = 1;
+    return w->n_nodes++;
+}
+
+static uint16_t intern_path(vme_where_t *w, const char *text)
+{
+    for (uint16_t i = 0; i < w->n_paths; i++) {
+        if (strcmp(w->paths[i].text, text) == 0)
+            return i;
+    }
+    w->paths = realloc(w->paths, (w->n_paths + 1) * sizeof(where_path_t));
+    where_path_t *path = &w->paths[w->n_paths];
+    memset(path, 0, sizeof(where_path_t));
+    path->text = strdup(text);
+    char *copy = strdup(text), *save = NULL;
+    for (char *seg = strtok_r(copy, ".", &save); seg != NULL; seg = strtok_r(NULL, ".", &save)) {
+        if (path->n_segs == MAX_PATH_SEGMENTS) {
+            log_debug("where clause path %s is nested too deeply", text);
+            w->failed = 1;
+            break;
+        }
+        path->segs[path->n_segs++] = strdup(seg);
+    }
+    free(copy);
+    return w->n_paths++;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+static int cmp_str(const void *a, const void *b)
+{
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static void set_constant(where_node_t *node, const cJSON *value)
+{
+    node->value = value;
+    if (cJSON_IsNumber(value)) {
+        node->ctype = CONST_NUM;
+        node->num = value->valuedouble;
+    } else if (cJSON_IsString(value)) {
+        node->ctype = CONST_STR;
+        node->str = value->valuestring;
+    } else if (cJSON_IsNull(value)) {
+        node->ctype = CONST_NULL;
+    } else {
+        node->ctype = CONST_OTHER;
+    }
+}
+
+static void compile_set(where_node_t *node, const cJSON *list)
+{
+    uint32_t n = (uint32_t)cJSON_GetArraySize(list);
+    node->nums = malloc((n + 1) * sizeof(double));
+    node->strs = malloc((n + 1) * sizeof(char *));
+    node->others = malloc((n + 1) * sizeof(cJSON *));
+    for (const cJSON *elem = list->child; elem != NULL; elem = elem->next) {
+        if (cJSON_IsNumber(elem))
+            node->nums[node->n_nums++] = elem->valuedouble;
+        else if (cJSON_IsString(elem))
+            node->strs[node->n_strs++] = elem->valuestring;
+        else if (cJSON_IsNull(elem))
+            node->has_null = 1;
+        else
+            node->others[node->n_others++] = elem;
+    }
+    qsort(node->nums, node->n_nums, sizeof(double), cmp_double);
+    qsort(node->strs, node->n_strs, sizeof(char *), cmp_str);
+}
+
+static void compile_query(vme_where_t *w, const cJSON *query);
+
+/*
+ * the conditions on one property: a plain value means equality, an object of operators means all of them
+ */
+static void compile_field(vme_where_t *w, uint16_t path, const cJSON *cond)
+{
+    if (!cJSON_IsObject(cond) || cond->child == NULL || cond->child->string[0] != '$') {
+        uint32_t n = new_node(w, OP_EQ);
+        w->nodes[n].path = path;
+        set_constant(&w->nodes[n], cond);
+        return;
+    }
+
+    static const struct { const char *name; where_op_t op; } ops[] = {
+        { "$eq", OP_EQ }, { "$ne", OP_NE }, { "$gt", OP_GT }, { "$gte", OP_GTE }, { "$lt", OP_LT },
+        { "$lte", OP_LTE }, { "$in", OP_IN }, { "$nin", OP_NIN }, { "$exists", OP_EXISTS }, { "$not", OP_NOT }
+    };
+    uint32_t and = new_node(w, OP_AND);
+    for (const cJSON *c = cond->child; c != NULL; c = c->next) {
+        int i = 0, nOps = (int)(sizeof(ops) / sizeof(ops[0]));
+        while (i < nOps && strcmp(c->string, ops[i].name) != 0)
+            i++;
+        if (i == nOps || ((ops[i].op == OP_IN || ops[i].op == OP_NIN) && !cJSON_IsArray(c))) {
+            log_debug("unsupported where clause operator %s", c->string);
+            w->failed = 1;
+            return;
+        }
+        if (ops[i].op == OP_NOT) {
+            uint32_t not = new_node(w, OP_NOT);
+            compile_field(w, path, c);
+            w->nodes[not].size = w->n_nodes - not;
+            continue;
+        }
+        uint32_t n = new_node(w, ops[i].op);
+        where_node_t *node = &w->nodes[n];
+        node->path = path;
+        if (node->op == OP_IN || node->op == OP_NIN)
+            compile_set(node, c);
+        else
+            set_constant(node, c);
+    }
+    w->nodes[and].size = w->n_nodes - and;
+}
+
+/*
+ * a query document: the implicit $and of its properties, plus $and / $or / $nor over arrays of query documents
+ */
+static void compile_query(vme_where_t *w, const cJSON *query)
+{
+    if (!cJSON_IsObject(query)) {
+        log_debug("where clause must be a JSON object");
+        w->failed = 1;
+        return;
+    }
+    uint32_t and = new_node(w, OP_AND);
+    for (const cJSON *f = query->child; f != NULL && !w->failed; f = f->next) {
+        if (f->string[0] != '$') {
+            compile_field(w, intern_path(w, f->string), f);
+            continue;
+        }
+        where_op_t op = (strcmp(f->string, "$and") == 0 ? OP_AND : strcmp(f->string, "$or") == 0 ? OP_OR
+                         : strcmp(f->string, "$nor") == 0 ? OP_NOR : OP_TRUE);
+        if (op == OP_TRUE || !cJSON_IsArray(f)) {
+            log_debug("unsupported where clause operator %s", f->string);
+            w->failed = 1;
+            return;
+        }
+        uint32_t n = new_node(w, op);
+        for (const cJSON *sub = f->child; sub != NULL; sub = sub->next)
+            compile_query(w, sub);
+        w->nodes[n].size = w->n_nodes - n;
+    }
+    w->nodes[and].size = w->n_nodes - and;
+}
+
+vme_where_t *vc_where_compile_json(const cJSON *where)
+{
+    vme_where_t *w = malloc(sizeof(vme_where_t));
+    memset(w, 0, sizeof(vme_where_t));
+    compile_query(w, where);
+    if (w->failed) {
+        vme_where_free(w);
+        return NULL;
+    }
+    return w;
+}
+
+/*
+ * vme_where_compile --
+ *
+ *      where - where clause as passed to vme_select, NULL or "{}" matches everything
+ *
+ * RETURN: the compiled clause, free with vme_where_free. NULL if the clause isn't valid JSON or uses an operator we
+ *      can't evaluate locally (supported: $eq, $ne, $gt, $gte, $lt, $lte, $in, $nin, $exists, $not, $and, $or, $nor)
+ */
+vme_where_t *vme_where_compile(const char *where)
+{
+    cJSON *parsed = cJSON_Parse(where != NULL ? where : "{}");
+    if (parsed == NULL) {
+        log_debug("where clause is not valid JSON");
+        return NULL;
+    }
+    vme_where_t *w = vc_where_compile_json(parsed);
+    if (w == NULL) {
+        cJSON_Delete(parsed);
+        return NULL;
+    }
+    w->owned = parsed;
+    return w;
+}
+
+void vme_where_free(vme_where_t *w)
+{
+    if (w == NULL)
+        return;
+    for (uint32_t i = 0; i < w->n_nodes; i++) {
+        free(w->nodes[i].nums);
+        free(w->nodes[i].strs);
+        free(w->nodes[i].others);
+    }
+    for (uint16_t i = 0; i < w->n_paths; i++) {
+        for (int j = 0; j < w->paths[i].n_segs; j++)
+            free(w->paths[i].segs[j]);
+        free(w->paths[i].text);
+    }
+    free(w->paths);
+    free(w->nodes);
+    cJSON_Delete(w->owned);
+    free(w);
+}
+
+static const cJSON *resolve(const where_path_t *path, const cJSON *doc)
+{
+    for (int i = 0; i < path->n_segs && doc != NULL; i++)
+        doc = (cJSON_IsObject(doc) ? cJSON_GetObjectItemCaseSensitive(doc, path->segs[i]) : NULL);
+    return doc;
+}
+
+/*
+ * compare a value from the instance with a node's constant, -2 when range comparisons don't apply (different types)
+ */
+static int cmp_constant(const where_node_t *node, const cJSON *value)
+{
+    switch (node->ctype) {
+        case CONST_NUM:
+            if (!cJSON_IsNumber(value))
+                return -2;
+            return (value->valuedouble < node->num ? -1 : (value->valuedouble > node->num ? 1 : 0));
+        case CONST_STR:
+            if (!cJSON_IsString(value))
+                return -2;
+            int c = strcmp(value->valuestring, node->str);
+            return (c < 0 ? -1 : (c > 0 ? 1 : 0));
+        case CONST_NULL:
+            return (value == NULL || cJSON_IsNull(value) ? 0 : -2);
+        default:
+            if (value == NULL || !((value->type & 0xFF) == (node->value->type & 0xFF)
+                                   || (cJSON_IsBool(value) && cJSON_IsBool(node->value))))
+                return -2;
+            c = json_value_cmp(value, node->value);
+            return (c < 0 ? -1 : (c > 0 ? 1 : 0));
+    }
+}
+
+static int in_set(const where_node_t *node, const cJSON *value)
+{
+    if (value == NULL || cJSON_IsNull(value))
+        return node->has_null;
+    if (cJSON_IsNumber(value))
+        return bsearch(&value->valuedouble, node->nums, node->n_nums, sizeof(double), cmp_double) != NULL;
+    if (cJSON_IsString(value))
+        return bsearch(&value->valuestring, node->strs, node->n_strs, sizeof(char *), cmp_str) != NULL;
+    for (uint32_t i = 0; i < node->n_others; i++) {
+        if (json_value_cmp(value, node->others[i]) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * a leaf against a single value
+ */
+static int eval_value(const where_node_t *node, where_op_t op, const cJSON *value)
+{
+    int c;
+    switch (op) {
+        case OP_EQ:
+            return cmp_constant(node, value) == 0;
+        case OP_GT:
+            return (c = cmp_constant(node, value)) != -2 && c > 0;
+        case OP_GTE:
+            return (c = cmp_constant(node, value)) != -2 && c >= 0;
+        case OP_LT:
+            return (c = cmp_constant(node, value)) != -2 && c < 0;
+        case OP_LTE:
+            return (c = cmp_constant(node, value)) != -2 && c <= 0;
+        case OP_IN:
+            return in_set(node, value);
+        default:
+            return 0;
+    }
+}
+
+/*
+ * an array property matches if the whole array or any of its elements does
+ */
+static int eval_leaf(const where_node_t *node, where_op_t op, const cJSON *value)
+{
+    if (eval_value(node, op, value))
+        return 1;
+    if (cJSON_IsArray(value)) {
+        for (const cJSON *elem = value->child; elem != NULL; elem = elem->next) {
+            if (eval_value(node, op, elem))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+static int eval_node(const vme_where_t *w, uint32_t i, const cJSON *doc, const cJSON **values, uint8_t *resolved)
+{
+    const where_node_t *node = &w->nodes[i];
+    switch (node->op) {
+        case OP_TRUE:
+            return 1;
+        case OP_AND:
+        case OP_OR:
+        case OP_NOR: {
+            int want = (node->op == OP_AND);
+            for (uint32_t child = i + 1; child < i + node->size; child += w->nodes[child].size) {
+                if (eval_node(w, child, doc, values, resolved) != want)
+                    return (node->op == OP_OR);
+            }
+            return (node->op != OP_OR);
+        }
+        case OP_NOT:
+            return !eval_node(w, i + 1, doc, values, resolved);
+        default:
+            break;
+    }
+
+    /* several conditions on one property look it up once */
+    if (!resolved[node->path]) {
+        values[node->path] = resolve(&w->paths[node->path], doc);
+        resolved[node->path] = 1;
+    }
+    const cJSON *value = values[node->path];
+    switch (node->op) {
+        case OP_EXISTS:
+            return (value != NULL) == (cJSON_IsTrue(node->value) || (node->ctype == CONST_NUM && node->num != 0));
+        case OP_NE:
+            return !eval_leaf(node, OP_EQ, value);
+        case OP_NIN:
+            return !eval_leaf(node, OP_IN, value);
+        default:
+            return eval_leaf(node, node->op, value);
+    }
+}
+
+/*
+ * vme_where_eval --
+ *
+ *      w - compiled where clause
+ *      instance - the instance to test
+ *
+ * RETURN: 1 if the instance satisfies the clause, 0 if not. a compiled clause may be evaluated by several threads
+ *      at once.
+ */
+int vme_where_eval(const vme_where_t *w, const cJSON *instance)
+{
+    const cJSON *values[w->n_paths + 1];
+    uint8_t resolved[w->n_paths + 1];
+    memset(resolved, 0, sizeof(resolved));
+    return eval_node(w, 0, instance, values, resolved);
+}
+
+/*
+ * test one instance of the input, appending it to out if it passes. -1 if it doesn't parse.
+ */
+static int filter_elem(const vme_where_t *w, vmebuf_t *out, vmebuf_t *elem, const char *data, size_t len,
+                       uint32_t *count)
+{
+    vmebuf_truncate(elem);
+    vmebuf_concat(elem, data, len);
+    vmebuf_push(elem, '\0');
+    cJSON *inst = cJSON_Parse(elem->data);
+    if (inst == NULL)
+        return -1;
+    if (vme_where_eval(w, inst)) {
+        if ((*count)++ > 0)
+            vmebuf_push(out, ',');
+        vmebuf_concat(out, data, len);
+    }
+    cJSON_Delete(inst);
+    return 0;
+}
+
+/*
+ * vme_where_filter --
+ *
+ *      w - compiled where clause
+ *      json / size - JSON array (or newline delimited stream) of instances
+ *
+ * RETURN: a JSON array of the instances that satisfy the clause in vme_json_data, copied byte for byte from the
+ *      input, with vme_count set to their number. e.g. to only insert what the server side rules care about.
+ */
+vme_result_t *vme_where_filter(const vme_where_t *w, const char *json, size_t size)
+{
+    vmebuf_t *out = vmebuf_ensure_size(NULL, size + 3);
+    vmebuf_t *elem = vmebuf_alloc();
+    vc_jscan_t scan;
+    vc_jscan_init(&scan);
+    vmebuf_push(out, '[');
+
+    uint32_t count = 0;
+    size_t off = 0, start = 0;
+    int rc = 0;
+    while (off < size && rc == 0) {
+        int event;
+        off += vc_jscan_next(&scan, json + off, size - off, &event);
+        if (event == JSCAN_START)
+            start = off - 1;
+        else if (event == JSCAN_END)
+            rc = filter_elem(w, out, elem, json + start, off - start, &count);
+    }
+    /* a bare value at the very end of NDJSON ends with the input */
+    if (rc == 0 && scan.in_scalar)
+        rc = filter_elem(w, out, elem, json + start, size - start, &count);
+    else if (rc == 0 && vc_jscan_in_element(&scan))
+        rc = -2;
+    vmebuf_dealloc(elem);
+    if (rc != 0) {
+        vmebuf_dealloc(out);
+        return vme_error_result(rc == -1 ? "filter input is not valid JSON"
+                                : "filter input ended part way through an instance");
+    }
+    vmebuf_push(out, ']');
+
+    vme_result_t *result = malloc(sizeof(vme_result_t));
+    memset(result, 0, sizeof(vme_result_t));
+    result->vme_size = out->len;
+    result->vme_json_data = vmebuf_tostr(out);
+    result->vme_count = count;
+    vmebuf_dealloc(out);
+    return result;
+}
@@ -0,0 +1,14 @@
+//  where.h
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#ifndef VANTIQ_WHERE_H
+#define VANTIQ_WHERE_H
+
+#include "vme.h"
+#include "cjson.h"
+
+/* compile a where clause that is already parsed. the program refers to where, which must outlive it */
+vme_where_t *vc_where_compile_json(const cJSON *where);
+
+#endif
@@ -0,0 +1,282 @@
+//
+//  writer.c
+//
+//  a buffered writer for applications that produce one instance at a time. instances are gathered into a JSON
+//  array and sent as one insert (or upsert) when the batch reaches its byte or instance limit, when the oldest
+//  instance in it has waited the linger time, or when the application flushes. a background thread takes care of
+//  the linger deadline so a trickle of instances doesn't sit in the buffer forever.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "vme.h"
+#include "utils.h"
+#include "vantiq_client.h"
+#include "adapt.h"
+#include "log.h"
+
+#define DEFAULT_MAX_BYTES (256 * 1024)
+#define DEFAULT_MAX_COUNT 500
+
+struct vme_writer {
+    VME                 vme;
+    char               *rsURI;
+    vme_writer_opts_t   opts;
+    pthread_mutex_t     lock;           // the pending batch and the statistics
+    pthread_cond_t      wake;           // tells the linger thread about a new deadline or closing
+    pthread_mutex_t     send_lock;      // batches go out one at a time, in order
+    vmebuf_t           *buf;            // "[inst,inst,..." of the pending batch
+    uint32_t            count;
+    uint64_t            first_seq;      // sequence number of the first pending instance
+    uint64_t            next_seq;
+    struct timespec     deadline;       // when the pending batch must go, if linger is set
+    pthread_t           linger;
+    int                 has_linger;
+    int                 closing;
+    uint64_t            written;
+    uint32_t            failed_batches;
+};
+
+static vme_result_t *ok_result(void)
+{
+    vme_result_t *result = malloc(sizeof(vme_result_t));
+    memset(result, 0, sizeof(vme_result_t));
+    return result;
+}
+
+/*
+ * send whatever is pending. the buffer is swapped out under the lock so instances can keep being added while the
+ * batch is on the wire.
+ */
+static vme_result_t *writer_send(vme_writer_t *w)
+{
+    pthread_mutex_lock(&w->send_lock);
+    pthread_mutex_lock(&w->lock);
+    if (w->count == 0) {
+        pthread_mutex_unlock(&w->lock);
+        pthread_mutex_unlock(&w->send_lock);
+        return ok_result();
+    }
+    vmebuf_t *batch = w->buf;
+    uint32_t count = w->count;
+    uint64_t firstSeq = w->first_seq;
+    w->buf = vmebuf_alloc();
+    w->count = 0;
+    pthread_mutex_unlock(&w->lock);
+
+    vmebuf_push(batch, ']');
+    vme_result_t *result;
+    vantiq_client_t *vc = vc_from_vme(w->vme);
+    if (vc == NULL) {
+        result = vme_error_result("invalid VME handle");
+    } else {
+        struct param *params = (w->opts.upsert ? build_param(NULL, "upsert", "true") : NULL);
+        struct timespec started;
+        clock_gettime(CLOCK_MONOTONIC, &started);
+        result = vc_post(vc, w->rsURI, batch, params);
+        /* one batch at a time */
+        vme_adapt_record(w->opts.adapt, count, batch->len, vc_elapsed_ms(&started), 1, result->vme_error_msg == NULL);
+        free_params(params);
+    }
+
+    if (w->opts.on_batch != NULL) {
+        vme_batch_t info;
+        info.offset = firstSeq;
+        info.length = batch->len;
+        info.count = count;
+        info.data = batch->data;
+        info.http_status = result->vme_http_status;
+        info.error_msg = result->vme_error_msg;
+        w->opts.on_batch(w->opts.state, &info);
+    }
+    pthread_mutex_lock(&w->lock);
+    if (result->vme_error_msg == NULL)
+        w->written += count;
+    else
+        w->failed_batches++;
+    pthread_mutex_unlock(&w->lock);
+    pthread_mutex_unlock(&w->send_lock);
+
+    vmebuf_dealloc(batch);
+    if (result->vme_error_msg != NULL)
+        log_debug("writer batch of %u instances for %s failed: %s", count, w->rsURI, result->vme_error_msg);
+    return result;
+}
+
+/*
+ * the batch limits in force: fixed, or whatever the controller currently thinks best
+ */
+static void batch_limits(vme_writer_t *w, size_t *maxBytes, uint32_t *maxCount)
+{
+    if (w->opts.adapt != NULL) {
+        vme_adapt_settings_t settings;
+        vme_adapt_settings(w->opts.adapt, &settings);
+        *maxBytes = settings.batch_bytes;
+        *maxCount = settings.batch_count;
+    } else {
+        *maxBytes = w->opts.max_bytes;
+        *maxCount = w->opts.max_count;
+    }
+}
+
+static void *linger_main(void *arg)
+{
+    vme_writer_t *w = (vme_writer_t *)arg;
+    pthread_mutex_lock(&w->lock);
+    while (!w->closing) {
+        if (w->count == 0) {
+            pthread_cond_wait(&w->wake, &w->lock);
+            continue;
+        }
+        if (pthread_cond_timedwait(&w->wake, &w->lock, &w->deadline) == ETIMEDOUT && w->count > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (now.tv_sec > w->deadline.tv_sec
+                || (now.tv_sec == w->deadline.tv_sec && now.tv_nsec >= w->deadline.tv_nsec)) {
+                pthread_mutex_unlock(&w->lock);
+                vme_free_result(writer_send(w));
+                pthread_mutex_lock(&w->lock);
+            }
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/*
+ * vme_writer_open --
+ *
+ *      vme - handle returned from call to vme_init
+ *      rsURI - path to the resource we are inserting into
+ *      opts - when to send a batch, insert or upsert, and a per batch callback. NULL sends batches of up to 500
+ *          instances / 256KB, only when full or flushed.
+ *
+ * RETURN: the writer, NULL for an invalid handle
+ */
+vme_writer_t *vme_writer_open(VME vme, const char *rsURI, const vme_writer_opts_t *opts)
+{
+    if (vc_from_vme(vme) == NULL)
+        return NULL;
+    vme_writer_t *w = malloc(sizeof(vme_writer_t));
+    memset(w, 0, sizeof(vme_writer_t));
+    w->vme = vme;
+    w->rsURI = strdup(rsURI);
+    if (opts != NULL)
+        w->opts = *opts;
+    if (w->opts.max_bytes == 0)
+        w->opts.max_bytes = DEFAULT_MAX_BYTES;
+    if (w->opts.max_count == 0)
+        w->opts.max_count = DEFAULT_MAX_COUNT;
+    w->buf = vmebuf_alloc();
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_mutex_init(&w->send_lock, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&w->wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (w->opts.linger_ms > 0)
+        w->has_linger = (pthread_create(&w->linger, NULL, linger_main, w) == 0);
+    return w;
+}
+
+/*
+ * vme_writer_add --
+ *
+ *      w - writer returned by vme_writer_open
+ *      json / size - one instance
+ *
+ * RETURN: 0 once the instance is buffered (or sent, if it filled the batch), -1 for an empty instance. the
+ *      outcome of sending is reported to the on_batch callback.
+ */
+int vme_writer_add(vme_writer_t *w, const char *json, size_t size)
+{
+    if (w == NULL || json == NULL || size == 0)
+        return -1;
+    size_t maxBytes;
+    uint32_t maxCount;
+    batch_limits(w, &maxBytes, &maxCount);
+    pthread_mutex_lock(&w->lock);
+    /* don't let this instance push the batch over its byte limit, unless it is too big to share a batch anyway */
+    while (w->count > 0 && w->buf->len + 1 + size + 1 > maxBytes) {
+        pthread_mutex_unlock(&w->lock);
+        vme_free_result(writer_send(w));
+        pthread_mutex_lock(&w->lock);
+    }
+    vmebuf_push(w->buf, (w->count == 0 ? '[' : ','));
+    vmebuf_concat(w->buf, json, size);
+    if (w->count++ == 0) {
+        w->first_seq = w->next_seq;
+        if (w->has_linger) {
+            clock_gettime(CLOCK_MONOTONIC, &w->deadline);
+            w->deadline.tv_sec += w->opts.linger_ms / 1000;
+            w->deadline.tv_nsec += (long)(w->opts.linger_ms % 1000) * 1000000L;
+            if (w->deadline.tv_nsec >= 1000000000L) {
+                w->deadline.tv_sec++;
+                w->deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_signal(&w->wake);
+        }
+    }
+    w->next_seq++;
+    int full = (w->count >= maxCount || w->buf->len + 1 >= maxBytes);
+    pthread_mutex_unlock(&w->lock);
+    if (full)
+        vme_free_result(writer_send(w));
+    return 0;
+}
+
+/*
+ * send the pending batch now. RETURN: the result of the insert, an empty result if nothing was pending
+ */
+vme_result_t *vme_writer_flush(vme_writer_t *w)
+{
+    return writer_send(w);
+}
+
+/*
+ * vme_writer_close --
+ *
+ *      w - writer returned by vme_writer_open, freed by this call
+ *
+ * sends what is still pending. RETURN: vme_count is the number of instances written over the writer's lifetime,
+ *      vme_error_msg is set if any batch failed
+ */
+vme_result_t *vme_writer_close(vme_writer_t *w)
+{
+    if (w == NULL)
+        return vme_error_result("invalid writer");
+    pthread_mutex_lock(&w->lock);
+    w->closing = 1;
+    pthread_cond_signal(&w->wake);
+    pthread_mutex_unlock(&w->lock);
+    if (w->has_linger)
+        pthread_join(w->linger, NULL);
+    vme_free_result(writer_send(w));
+
+    vme_result_t *result;
+    if (w->failed_batches > 0) {
+        char errMsg[64];
+        snprintf(errMsg, sizeof(errMsg), "%u batches failed", w->failed_batches);
+        result = vme_error_result(errMsg);
+    } else {
+        result = ok_result();
+    }
+    result->vme_count = (uint32_t)w->written;
+
+    pthread_cond_destroy(&w->wake);
+    pthread_mutex_destroy(&w->send_lock);
+    pthread_mutex_destroy(&w->lock);
+    vmebuf_dealloc(w->buf);
+    free(w->rsURI);
+    free(w);
+    return result;
+}
@@ -21,8 +21,26 @@ void cunit_register() {
     CU_add_test(pSuiteVME, "test_aggregates", test_aggregates);
     CU_add_test(pSuiteVME, "test_updates", test_updates);
     CU_add_test(pSuiteVME, "test_selects", test_selects);
+    CU_add_test(pSuiteVME, "test_prepared", test_prepared);
     CU_add_test(pSuiteVME, "test_publish", test_publish);
+    CU_add_test(pSuiteVME, "test_publish_async", test_publish_async);
+    CU_add_test(pSuiteVME, "test_publish_buf", test_publish_buf);
     CU_add_test(pSuiteVME, "test_patch", test_patch);
+    CU_add_test(pSuiteVME, "test_update_delta", test_update_delta);
+    CU_add_test(pSuiteVME, "test_cache", test_cache);
     CU_add_test(pSuiteVME, "test_execute", test_execute);
+    CU_add_test(pSuiteVME, "test_concurrent_selects", test_concurrent_selects);
+    CU_add_test(pSuiteVME, "test_columns", test_columns);
+    CU_add_test(pSuiteVME, "test_local_aggregate", test_local_aggregate);
+    CU_add_test(pSuiteVME, "test_where", test_where);
+    CU_add_test(pSuiteVME, "test_replica", test_replica);
+    CU_add_test(pSuiteVME, "test_select_to_file", test_select_to_file);
+    CU_add_test(pSuiteVME, "test_insert_file", test_insert_file);
+    CU_add_test(pSuiteVME, "test_writer", test_writer);
+    CU_add_test(pSuiteVME, "test_spool", test_spool);
+    CU_add_test(pSuiteVME, "test_adapt", test_adapt);
+    CU_add_test(pSuiteVME, "test_hedge", test_hedge);
+    CU_add_test(pSuiteVME, "test_stats", test_stats);
+    CU_add_test(pSuiteVME, "test_dpi_frame", test_dpi_frame);
     CU_add_test(pSuiteVME, "test_deletes", test_deletes);
 }
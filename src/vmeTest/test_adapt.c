@@ -0,0 +1,121 @@
+//  test_adapt.c
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "CUnit/Basic.h"
+#include "vme.h"
+#include "vme_test.h"
+
+void test_adapt()
+{
+    // a server where each instance costs 0.1ms on top of 5ms per request
+    {
+        vme_adapt_opts_t opts = { 100, 10, 5000, 0, 4 };
+        vme_adapt_t *a = vme_adapt_create(&opts);
+        vme_adapt_settings_t s;
+        vme_adapt_settings(a, &s);
+        CU_ASSERT_EQUAL(s.batch_count, 10);
+        CU_ASSERT_EQUAL(s.concurrency, 1);
+
+        for (int i = 0; i < 200; i++) {
+            vme_adapt_settings(a, &s);
+            for (int c = 0; c < s.concurrency; c++)
+                vme_adapt_record(a, s.batch_count, s.batch_count * 50, 5 + 0.1 * s.batch_count, s.concurrency, 1);
+        }
+        vme_adapt_settings(a, &s);
+        CU_ASSERT_TRUE(s.batch_count >= 500 && s.batch_count <= 950);
+        CU_ASSERT_TRUE(s.latency_ms <= 100);
+        CU_ASSERT_TRUE(s.rows_per_sec > 5000);
+        CU_ASSERT_TRUE(s.batch_bytes >= (size_t)s.batch_count * 50);
+
+        // a failure backs off
+        uint32_t before = s.batch_count;
+        for (int c = 0; c < s.concurrency; c++)
+            vme_adapt_record(a, s.batch_count, s.batch_count * 50, 5 + 0.1 * s.batch_count, s.concurrency, 0);
+        vme_adapt_settings(a, &s);
+        CU_ASSERT_TRUE(s.batch_count <= before / 2 + 1);
+        vme_adapt_free(a);
+    }
+
+    // batches capped at 200 instances (25ms) leave room to try more connections. a caller that sends one batch at
+    // a time gains nothing from them and the controller mustn't think it does; one that uses them gains 8 fold
+    for (int serial = 1; serial >= 0; serial--) {
+        vme_adapt_opts_t opts = { 100, 10, 200, 0, 8 };
+        vme_adapt_t *a = vme_adapt_create(&opts);
+        vme_adapt_settings_t s;
+        for (int i = 0; i < 500; i++) {
+            vme_adapt_settings(a, &s);
+            int inFlight = (serial ? 1 : s.concurrency);
+            for (int c = 0; c < inFlight; c++)
+                vme_adapt_record(a, s.batch_count, s.batch_count * 50, 5 + 0.1 * s.batch_count, inFlight, 1);
+        }
+        vme_adapt_settings(a, &s);
+        CU_ASSERT_EQUAL(s.batch_count, 200);
+        if (serial) {
+            CU_ASSERT_TRUE(s.concurrency <= 2);     // at most mid-probe
+            CU_ASSERT_DOUBLE_EQUAL(s.rows_per_sec, 8000, 1);
+        } else {
+            CU_ASSERT_EQUAL(s.concurrency, 8);
+            CU_ASSERT_DOUBLE_EQUAL(s.rows_per_sec, 64000, 1);
+        }
+        vme_adapt_free(a);
+    }
+
+    // a writer sized by the controller
+    {
+        vmeconfig_t config;
+        if (vme_parse_config("config.properties", &config) == -1)
+            CU_ASSERT_EQUAL_FATAL(-1, 3);
+        VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+        char *rsURI = vme_build_custom_rsuri(vme, "VME_Test", NULL);
+
+        vme_adapt_opts_t aopts = { 2000, 5, 200, 0, 1 };
+        vme_adapt_t *a = vme_adapt_create(&aopts);
+        vme_writer_opts_t opts;
+        memset(&opts, 0, sizeof(opts));
+        opts.adapt = a;
+        vme_writer_t *w = vme_writer_open(vme, rsURI, &opts);
+        char inst[128];
+        for (int i = 0; i < 300; i++) {
+            int len = snprintf(inst, sizeof(inst), "{\"name\": \"adapt %d\", \"salary\": %d}", i, 4000 + i);
+            vme_writer_add(w, inst, len);
+        }
+        vme_result_t *result = vme_writer_close(w);
+        CU_ASSERT_PTR_NULL(result->vme_error_msg);
+        CU_ASSERT_EQUAL(result->vme_count, 300);
+        vme_free_result(result);
+
+        vme_adapt_settings_t s;
+        vme_adapt_settings(a, &s);
+        CU_ASSERT_TRUE(s.batch_count > 5);
+
+        // and a bulk load sharing what the controller learned
+        const char *path = "vme_test_adapt.json";
+        FILE *f = fopen(path, "w");
+        for (int i = 0; i < 500; i++)
+            fprintf(f, "{\"name\": \"adapt load %d\", \"salary\": %d}\n", i, 4000 + i);
+        fclose(f);
+        vme_load_opts_t lopts;
+        memset(&lopts, 0, sizeof(lopts));
+        lopts.adapt = a;
+        result = vme_insert_file(vme, rsURI, path, &lopts);
+        CU_ASSERT_PTR_NULL(result->vme_error_msg);
+        CU_ASSERT_EQUAL(result->vme_count, 500);
+        vme_free_result(result);
+        unlink(path);
+        vme_adapt_free(a);
+
+        result = vme_delete(vme, rsURI, "{\"salary\": {\"$lt\": 5000}}");
+        vme_free_result(result);
+        free(rsURI);
+        free(config.vantiq_url);
+        free(config.vantiq_token);
+        vme_teardown(vme);
+    }
+    CU_PASS("test adapt");
+}
@@ -0,0 +1,98 @@
+//  test_bulkload.c
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "CUnit/Basic.h"
+#include "vme.h"
+#include "cjson.h"
+#include "vme_test.h"
+
+#define N_INSTANCES 1234
+
+typedef struct {
+    int         batches;
+    int         failures;
+    uint32_t    instances;
+    uint32_t    failed_instances;
+    int         bad_bounds;
+} load_stats_t;
+
+static void on_batch(void *state, const vme_batch_t *batch)
+{
+    load_stats_t *stats = (load_stats_t *)state;
+    stats->batches++;
+    stats->instances += batch->count;
+    if (batch->data[0] != '{' || batch->data[batch->length - 1] != '}')
+        stats->bad_bounds++;
+    if (batch->error_msg != NULL) {
+        stats->failures++;
+        stats->failed_instances += batch->count;
+    }
+}
+
+static void write_file(const char *path, int ndjson)
+{
+    FILE *f = fopen(path, "w");
+    if (!ndjson)
+        fprintf(f, "[\n");
+    for (int i = 0; i < N_INSTANCES; i++) {
+        const char *sep = (ndjson ? "\n" : (i + 1 < N_INSTANCES ? ",\n" : "\n"));
+        fprintf(f, "  {\"name\": \"load %d\", \"note\": \"%s\", \"salary\": %d}%s", i,
+                (i == 700 ? "FAIL me" : "braces } and ] in \\\"strings\\\""), 1000 + i, sep);
+    }
+    if (!ndjson)
+        fprintf(f, "]\n");
+    fclose(f);
+}
+
+void test_insert_file()
+{
+    vmeconfig_t config;
+    if (vme_parse_config("config.properties", &config) == -1)
+        CU_ASSERT_EQUAL_FATAL(-1, 3);
+
+    VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+    char *rsURI = vme_build_custom_rsuri(vme, "VME_Test", NULL);
+    const char *path = "vme_test_load.json";
+
+    for (int ndjson = 0; ndjson <= 1; ndjson++) {
+        write_file(path, ndjson);
+        load_stats_t stats;
+        memset(&stats, 0, sizeof(stats));
+        vme_load_opts_t opts = { 8 * 1024, 100, 3, 0, on_batch, &stats };
+        vme_result_t *result = vme_insert_file(vme, rsURI, path, &opts);
+
+        // every instance went out exactly once; the one batch holding the bad instance failed
+        CU_ASSERT_EQUAL(stats.instances, N_INSTANCES);
+        CU_ASSERT_EQUAL(stats.bad_bounds, 0);
+        CU_ASSERT_EQUAL(stats.failures, 1);
+        CU_ASSERT_TRUE(stats.batches > N_INSTANCES / 100);
+        CU_ASSERT_PTR_NOT_NULL(result->vme_error_msg);
+        CU_ASSERT_EQUAL(result->vme_count, N_INSTANCES - stats.failed_instances);
+        vme_free_result(result);
+
+        // clean up what did get in
+        result = vme_delete(vme, rsURI, "{\"salary\": {\"$lt\": 5000}}");
+        vme_free_result(result);
+    }
+
+    // a missing file
+    {
+        vme_result_t *result = vme_insert_file(vme, rsURI, "no_such_file.json", NULL);
+        CU_ASSERT_PTR_NOT_NULL(result->vme_error_msg);
+        CU_ASSERT_EQUAL(result->vme_count, 0);
+        vme_free_result(result);
+    }
+
+    unlink(path);
+    free(rsURI);
+    free(config.vantiq_url);
+    free(config.vantiq_token);
+    vme_teardown(vme);
+    CU_PASS("test insert file");
+}
@@ -0,0 +1,72 @@
+//  test_cache.c
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "CUnit/Basic.h"
+#include "vme.h"
+#include "cjson.h"
+#include "vme_test.h"
+
+void test_cache()
+{
+    vmeconfig_t config;
+    if (vme_parse_config("config.properties", &config) == -1)
+        CU_ASSERT_EQUAL_FATAL(-1, 3);
+
+    VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+    CU_ASSERT_EQUAL(vme_enable_cache(vme, 60, 256 * 1024), 0);
+    char *rsURI = vme_build_custom_rsuri(vme, "VME_Test", NULL);
+
+    // the same select twice should give back identical results
+    {
+        vme_result_t *first = vme_select_one(vme, rsURI, "[\"_id\", \"salary\"]", "{ \"ssn\" : \"655-71-9041\"}");
+        vme_result_t *second = vme_select_one(vme, rsURI, "[\"_id\", \"salary\"]", "{ \"ssn\" : \"655-71-9041\"}");
+        CU_ASSERT_PTR_NULL(first->vme_error_msg);
+        CU_ASSERT_PTR_NULL(second->vme_error_msg);
+        CU_ASSERT_EQUAL_FATAL(first->vme_size, second->vme_size);
+        CU_ASSERT_TRUE(memcmp(first->vme_json_data, second->vme_json_data, first->vme_size) == 0);
+        CU_ASSERT_EQUAL(second->vme_http_status, 200);      // a hit looks like the response it was cached from
+        vme_free_result(second);
+
+        // an update of the type must invalidate the cached select
+        char *id = find_instance_id(first);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(id);
+        char *instURI = vme_build_custom_rsuri(vme, "VME_Test", id);
+        const char *expr = "{ \"salary\": 123456.00 }";
+        vme_result_t *result = vme_update(vme, instURI, expr, strlen(expr));
+        CU_ASSERT_PTR_NULL(result->vme_error_msg);
+        vme_free_result(result);
+
+        result = vme_select_one(vme, rsURI, "[\"_id\", \"salary\"]", "{ \"ssn\" : \"655-71-9041\"}");
+        CU_ASSERT_PTR_NULL(result->vme_error_msg);
+        cJSON *json = cJSON_Parse(result->vme_json_data);
+        cJSON *salary = find_instance_prop(json, "salary");
+        CU_ASSERT_PTR_NOT_NULL_FATAL(salary);
+        CU_ASSERT_TRUE(salary->valuedouble == 123456.00);
+        cJSON_Delete(json);
+        vme_free_result(result);
+        vme_free_result(first);
+        free(instURI);
+        free(id);
+    }
+
+    // a budget too small for any response means nothing is cached, but selects still work
+    {
+        CU_ASSERT_EQUAL(vme_enable_cache(vme, 60, 16), 0);
+        vme_result_t *result = vme_select_one(vme, rsURI, "[\"salary\"]", NULL);
+        CU_ASSERT_PTR_NULL(result->vme_error_msg);
+        CU_ASSERT_PTR_NOT_NULL(result->vme_json_data);
+        vme_free_result(result);
+    }
+
+    vme_disable_cache(vme);
+    free(rsURI);
+    free(config.vantiq_url);
+    free(config.vantiq_token);
+    vme_teardown(vme);
+    CU_PASS("test cache");
+}
@@ -0,0 +1,93 @@
+//  test_columns.c
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "CUnit/Basic.h"
+#include "vme.h"
+#include "cjson.h"
+#include "vme_test.h"
+
+void test_columns()
+{
+    // decoding doesn't need a server
+    {
+        const char *json = "[{\"id\": 1, \"salary\": 200000, \"dept\": \"Sales\", \"active\": true},"
+                           " {\"id\": 2, \"salary\": 250000.5, \"dept\": \"Marketing\", \"active\": false},"
+                           " {\"id\": 3, \"dept\": \"Sales\", \"active\": null},"
+                           " {\"id\": 4, \"salary\": \"lots\", \"dept\": \"Eng\", \"address\": {\"zip\": \"94607\"}}]";
+        const char *props[] = { "id", "salary", "dept", "active", "address.zip", "missing" };
+        vme_columns_t *cols = vme_decode_columns(json, props, 6);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(cols);
+        CU_ASSERT_EQUAL(cols->n_rows, 4);
+        CU_ASSERT_EQUAL(cols->n_cols, 6);
+
+        vme_column_t *id = vme_find_column(cols, "id");
+        CU_ASSERT_PTR_NOT_NULL_FATAL(id);
+        CU_ASSERT_EQUAL(id->type, VME_COL_INT64);
+        CU_ASSERT_EQUAL(id->i64[3], 4);
+        CU_ASSERT_EQUAL(id->null_count, 0);
+
+        vme_column_t *salary = vme_find_column(cols, "salary");
+        CU_ASSERT_EQUAL(salary->type, VME_COL_DOUBLE);
+        CU_ASSERT_DOUBLE_EQUAL(salary->f64[1], 250000.5, 0.001);
+        CU_ASSERT_FALSE(vme_column_is_null(salary, 0));
+        CU_ASSERT_TRUE(vme_column_is_null(salary, 2));
+        CU_ASSERT_TRUE(vme_column_is_null(salary, 3));  // wrong type
+        CU_ASSERT_EQUAL(salary->null_count, 2);
+
+        vme_column_t *dept = vme_find_column(cols, "dept");
+        CU_ASSERT_EQUAL(dept->type, VME_COL_STRING);
+        CU_ASSERT_EQUAL(dept->dict_size, 3);
+        CU_ASSERT_EQUAL(dept->codes[0], dept->codes[2]);
+        CU_ASSERT_STRING_EQUAL(dept->dict[dept->codes[1]], "Marketing");
+
+        vme_column_t *active = vme_find_column(cols, "active");
+        CU_ASSERT_EQUAL(active->type, VME_COL_BOOL);
+        CU_ASSERT_EQUAL(active->u8[0], 1);
+        CU_ASSERT_TRUE(vme_column_is_null(active, 2));
+
+        vme_column_t *zip = vme_find_column(cols, "address.zip");
+        CU_ASSERT_EQUAL(zip->type, VME_COL_STRING);
+        CU_ASSERT_STRING_EQUAL(zip->dict[zip->codes[3]], "94607");
+        CU_ASSERT_EQUAL(zip->null_count, 3);
+
+        CU_ASSERT_EQUAL(vme_find_column(cols, "missing")->type, VME_COL_NULL);
+        CU_ASSERT_PTR_NULL(vme_find_column(cols, "nope"));
+        vme_free_columns(cols);
+
+        CU_ASSERT_PTR_NULL(vme_decode_columns("{\"not\": \"an array\"}", NULL, 0));
+    }
+
+    // decode a page of select results, all properties of the first instance
+    {
+        vmeconfig_t config;
+        if (vme_parse_config("config.properties", &config) == -1)
+            CU_ASSERT_EQUAL_FATAL(-1, 3);
+        VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+        char *rsURI = vme_build_custom_rsuri(vme, "VME_Test", NULL);
+
+        vme_result_t *result = vme_select(vme, rsURI, "[\"salary\", \"id\"]", "{\"salary\" : {\"$gt\":245000.0}}", "{\"salary\":-1}", 0, 0);
+        CU_ASSERT_PTR_NULL_FATAL(result->vme_error_msg);
+        vme_columns_t *cols = vme_decode_columns(result->vme_json_data, NULL, 0);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(cols);
+        vme_column_t *salary = vme_find_column(cols, "salary");
+        CU_ASSERT_PTR_NOT_NULL_FATAL(salary);
+        for (size_t row = 1; row < cols->n_rows; row++) {
+            double prev = (salary->type == VME_COL_DOUBLE ? salary->f64[row-1] : (double)salary->i64[row-1]);
+            double cur = (salary->type == VME_COL_DOUBLE ? salary->f64[row] : (double)salary->i64[row]);
+            CU_ASSERT_TRUE(prev >= cur);
+        }
+        vme_free_columns(cols);
+        vme_free_result(result);
+
+        free(rsURI);
+        free(config.vantiq_url);
+        free(config.vantiq_token);
+        vme_teardown(vme);
+    }
+    CU_PASS("test columns");
+}
@@ -0,0 +1,192 @@
+//  test_dpi_frame.c
+//
+//  vipo's DPI framing (../vipo/dpi_frame.c). no server needed.
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "CUnit/Basic.h"
+#include "vme.h"
+#include "dpi_frame.h"
+#include "vme_test.h"
+
+/* hand the decoder len bytes the way a read would, as much as it has room for at a time */
+static void feed(dpi_decoder_t *dec, const char *data, size_t len)
+{
+    while (len > 0) {
+        size_t avail;
+        char *space = dpi_decoder_space(dec, &avail);
+        CU_ASSERT_TRUE_FATAL(avail > 0);
+        size_t n = (len < avail ? len : avail);
+        memcpy(space, data, n);
+        dpi_decoder_commit(dec, n);
+        data += n;
+        len -= n;
+    }
+}
+
+/* RETURN the length of a frame written to out */
+static size_t make_frame(char *out, dpi_frame_type_t type, const char *payload, uint32_t len)
+{
+    dpi_frame_header(out, type, len);
+    memcpy(out + DPI_FRAME_HDR_SIZE, payload, len);
+    return DPI_FRAME_HDR_SIZE + len;
+}
+
+void test_dpi_frame()
+{
+    dpi_decoder_t dec;
+    dpi_frame_t frame;
+    char wire[3 * DPI_COPYBREAK];
+
+    // back to back frames in one read are all taken in place
+    {
+        dpi_decoder_init(&dec, 1024);
+        size_t len = make_frame(wire, DPI_FRAME_DATA, "{\"a\":1}", 7);
+        len += make_frame(wire + len, DPI_FRAME_DATA, "{\"b\":22}", 8);
+        len += make_frame(wire + len, DPI_FRAME_EOT, "", 0);
+        feed(&dec, wire, len);
+
+        CU_ASSERT_EQUAL(dpi_decoder_next(&dec, &frame), 1);
+        CU_ASSERT_EQUAL(frame.type, DPI_FRAME_DATA);
+        CU_ASSERT_EQUAL(frame.len, 7);
+        CU_ASSERT_TRUE(memcmp(frame.payload, "{\"a\":1}", 7) == 0);
+        CU_ASSERT_PTR_NULL(frame.buf);
+        CU_ASSERT_EQUAL(dpi_decoder_next(&dec, &frame), 1);
+        CU_ASSERT_EQUAL(frame.len, 8);
+        CU_ASSERT_TRUE(memcmp(frame.payload, "{\"b\":22}", 8) == 0);
+        CU_ASSERT_EQUAL(dpi_decoder_next(&dec, &frame), 1);
+        CU_ASSERT_EQUAL(frame.type, DPI_FRAME_EOT);
+        CU_ASSERT_EQUAL(frame.len, 0);
+        CU_ASSERT_EQUAL(dpi_decoder_next(&dec, &frame), 0);
+        dpi_decoder_free(&dec);
+    }
+
+    // a header split across reads, then the payload in pieces
+    {
+        dpi_decoder_init(&dec, 1024);
+        size_t len = make_frame(wire, DPI_FRAME_DATA, "{\"split\":true}", 14);
+        feed(&dec, wire, 2);
+        CU_ASSERT_EQUAL(dpi_decoder_next(&dec, &frame), 0);
+        feed(&dec, wire + 2, 5);
+        CU_ASSERT_EQUAL(dpi_decoder_next(&dec, &frame), 0);
+        feed(&dec, wire + 7, len - 7);
+        CU_ASSERT_EQUAL(dpi_decoder_next(&dec, &frame), 1);
+        CU_ASSERT_EQUAL(frame.len, 14);
+        CU_ASSERT_TRUE(memcmp(frame.payload, "{\"split\":true}", 14) == 0);
+        CU_ASSERT_EQUAL(dpi_decoder_next(&dec, &frame), 0);
+        dpi_decoder_free(&dec);
+    }
+
+    // once the header of a large frame is in, the rest of it is read into a buffer of its own that is handed over
+    {
+        uint32_t big = DPI_COPYBREAK + 100;
+        char *payload = malloc(big);
+        for (uint32_t i = 0; i < big; i++)
+            payload[i] = (char) ('a' + i % 26);
+        dpi_decoder_init(&dec, 1024);
+        size_t len = make_frame(wire, DPI_FRAME_DATA, payload, big);
+        size_t next = make_frame(wire + len, DPI_FRAME_DATA, "{}", 2);
+        feed(&dec, wire, DPI_FRAME_HDR_SIZE + 10);
+        CU_ASSERT_EQUAL(dpi_decoder_next(&dec, &frame), 0);
+
+        size_t avail;
+        dpi_decoder_space(&dec, &avail);
+        CU_ASSERT_EQUAL(avail, big - 10);       // exactly the rest of the frame
+        feed(&dec, wire + DPI_FRAME_HDR_SIZE + 10, len - DPI_FRAME_HDR_SIZE - 10);
+        CU_ASSERT_EQUAL(dpi_decoder_next(&dec, &frame), 1);
+        CU_ASSERT_EQUAL(frame.len, big);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(frame.buf);
+        CU_ASSERT_TRUE(frame.payload == frame.buf->data);
+        CU_ASSERT_EQUAL(frame.buf->len, big);
+        CU_ASSERT_TRUE(frame.buf->limit > big);     // room for a NUL
+        CU_ASSERT_TRUE(memcmp(frame.payload, payload, big) == 0);
+        vmebuf_dealloc(frame.buf);
+
+        // and the frame after it lands back in the decoder's own buffer
+        feed(&dec, wire + len, next);
+        CU_ASSERT_EQUAL(dpi_decoder_next(&dec, &frame), 1);
+        CU_ASSERT_EQUAL(frame.len, 2);
+        CU_ASSERT_PTR_NULL(frame.buf);
+        CU_ASSERT_EQUAL(dpi_decoder_next(&dec, &frame), 0);
+        dpi_decoder_free(&dec);
+
+        // one that arrives whole with its header, in a buffer with room for it, is taken in place
+        dpi_decoder_init(&dec, 2 * big);
+        len = make_frame(wire, DPI_FRAME_DATA, payload, big);
+        char *space = dpi_decoder_space(&dec, &avail);
+        CU_ASSERT_TRUE_FATAL(avail >= len);
+        memcpy(space, wire, len);
+        dpi_decoder_commit(&dec, len);
+        CU_ASSERT_EQUAL(dpi_decoder_next(&dec, &frame), 1);
+        CU_ASSERT_EQUAL(frame.len, big);
+        CU_ASSERT_PTR_NULL(frame.buf);
+        CU_ASSERT_TRUE(memcmp(frame.payload, payload, big) == 0);
+        dpi_decoder_free(&dec);
+        free(payload);
+    }
+
+    // an unframed message is whatever arrived, detached along with any unread bytes
+    {
+        dpi_decoder_init(&dec, 8);
+        size_t len = make_frame(wire, DPI_FRAME_DATA, "{}", 2);
+        memcpy(wire + len, "{\"legacy\":1}", 12);
+        feed(&dec, wire, len + 12);
+        CU_ASSERT_EQUAL(dpi_decoder_next(&dec, &frame), 1);
+        vmebuf_t *msg = dpi_decoder_detach(&dec);
+        CU_ASSERT_EQUAL(msg->len, 12);
+        CU_ASSERT_TRUE(msg->limit > msg->len);
+        CU_ASSERT_TRUE(memcmp(msg->data, "{\"legacy\":1}", 12) == 0);
+        vmebuf_dealloc(msg);
+
+        // the decoder goes on with a fresh buffer
+        feed(&dec, "EOT", 3);
+        msg = dpi_decoder_detach(&dec);
+        CU_ASSERT_EQUAL(msg->len, 3);
+        CU_ASSERT_TRUE(memcmp(msg->data, "EOT", 3) == 0);
+        vmebuf_dealloc(msg);
+        dpi_decoder_free(&dec);
+    }
+
+    // a bad type or length is not framing
+    {
+        static const unsigned char bad[][DPI_FRAME_HDR_SIZE] = {
+            { 0, 0, 0, 2, 0 },                  // type 0
+            { 0, 0, 0, 2, DPI_FRAME_ACK + 1 },  // unknown type
+            { 1, 0, 0, 0, DPI_FRAME_DATA },     // 16MB, over DPI_FRAME_MAX
+        };
+        for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+            dpi_decoder_init(&dec, 1024);
+            feed(&dec, (const char *) bad[i], DPI_FRAME_HDR_SIZE);
+            CU_ASSERT_EQUAL(dpi_decoder_next(&dec, &frame), -1);
+            dpi_decoder_free(&dec);
+        }
+    }
+
+    // ACKs survive the round trip, and nothing else decodes as one
+    {
+        char ack[DPI_FRAME_HDR_SIZE + DPI_ACK_SIZE];
+        uint64_t count;
+        uint32_t window;
+        dpi_ack_encode(ack, 0x0102030405060708ULL, 0xfffffffeU);
+        dpi_decoder_init(&dec, 1024);
+        feed(&dec, ack, sizeof(ack));
+        CU_ASSERT_EQUAL(dpi_decoder_next(&dec, &frame), 1);
+        CU_ASSERT_EQUAL(frame.type, DPI_FRAME_ACK);
+        CU_ASSERT_EQUAL(frame.len, DPI_ACK_SIZE);
+        CU_ASSERT_EQUAL(dpi_ack_decode(&frame, &count, &window), 0);
+        CU_ASSERT_TRUE(count == 0x0102030405060708ULL);
+        CU_ASSERT_EQUAL(window, 0xfffffffeU);
+
+        frame.type = DPI_FRAME_DATA;
+        CU_ASSERT_EQUAL(dpi_ack_decode(&frame, &count, &window), -1);
+        frame.type = DPI_FRAME_ACK;
+        frame.len = DPI_ACK_SIZE - 1;
+        CU_ASSERT_EQUAL(dpi_ack_decode(&frame, &count, &window), -1);
+        dpi_decoder_free(&dec);
+    }
+    CU_PASS("test dpi frame");
+}
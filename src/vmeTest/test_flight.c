@@ -0,0 +1,73 @@
+//  test_flight.c
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "CUnit/Basic.h"
+#include "vme.h"
+#include "cjson.h"
+#include "vme_test.h"
+
+#define N_READERS 8
+
+struct reader {
+    VME           vme;
+    const char   *rsURI;
+    vme_result_t *result;
+};
+
+static void *run_reader(void *arg)
+{
+    struct reader *reader = (struct reader *)arg;
+    reader->result = vme_select(reader->vme, reader->rsURI, "[\"ssn\", \"salary\"]",
+                                "{\"salary\" : { \"$gt\" : 200000.0}}", NULL, 0, 100);
+    return NULL;
+}
+
+/*
+ * several threads issuing the same select at once must each get a complete, private copy of the result
+ */
+void test_concurrent_selects()
+{
+    vmeconfig_t config;
+    if (vme_parse_config("config.properties", &config) == -1)
+        CU_ASSERT_EQUAL_FATAL(-1, 3);
+
+    VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+    char *rsURI = vme_build_custom_rsuri(vme, "VME_Test", NULL);
+
+    pthread_t threads[N_READERS];
+    struct reader readers[N_READERS];
+    for (int i = 0; i < N_READERS; i++) {
+        readers[i].vme = vme;
+        readers[i].rsURI = rsURI;
+        readers[i].result = NULL;
+        pthread_create(&threads[i], NULL, run_reader, &readers[i]);
+    }
+    for (int i = 0; i < N_READERS; i++)
+        pthread_join(threads[i], NULL);
+
+    for (int i = 0; i < N_READERS; i++) {
+        CU_ASSERT_PTR_NOT_NULL_FATAL(readers[i].result);
+        CU_ASSERT_PTR_NULL(readers[i].result->vme_error_msg);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(readers[i].result->vme_json_data);
+        if (i > 0)
+            CU_ASSERT_NOT_EQUAL(readers[i].result->vme_json_data, readers[0].result->vme_json_data);
+        CU_ASSERT_EQUAL(readers[i].result->vme_size, readers[0].result->vme_size);
+        cJSON *json = cJSON_Parse(readers[i].result->vme_json_data);
+        CU_ASSERT_PTR_NOT_NULL(json);
+        cJSON_Delete(json);
+    }
+    for (int i = 0; i < N_READERS; i++)
+        vme_free_result(readers[i].result);
+
+    free(rsURI);
+    free(config.vantiq_url);
+    free(config.vantiq_token);
+    vme_teardown(vme);
+    CU_PASS("test concurrent selects");
+}
@@ -0,0 +1,75 @@
+//  test_hedge.c
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "CUnit/Basic.h"
+#include "vme.h"
+#include "vme_test.h"
+
+static double now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+void test_hedge()
+{
+    vmeconfig_t config;
+    if (vme_parse_config("config.properties", &config) == -1)
+        CU_ASSERT_EQUAL_FATAL(-1, 3);
+
+    VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+    vme_hedge_stats_t stats;
+
+    // off until enabled
+    vme_hedging_stats(vme, &stats);
+    CU_ASSERT_EQUAL(stats.reads, 0);
+
+    vme_hedge_opts_t opts = { .percentile = 75, .min_delay_ms = 10, .budget = 0.5 };
+    CU_ASSERT_EQUAL(vme_enable_hedging(vme, &opts), 0);
+    char *rsURI = vme_build_custom_rsuri(vme, "HedgeTest", NULL);
+
+    // the test server stalls every fifth read of this type; once the latency
+    // window has filled the stalled reads should be answered by the duplicate
+    double worst = 0;
+    for (int i = 0; i < 40; i++) {
+        double start = now_ms();
+        vme_result_t *result = vme_select(vme, rsURI, "[\"_id\", \"salary\"]", NULL, NULL, 0, 0);
+        double took = now_ms() - start;
+        CU_ASSERT_PTR_NULL(result->vme_error_msg);
+        CU_ASSERT_PTR_NOT_NULL(result->vme_json_data);
+        CU_ASSERT_EQUAL(result->vme_count, 50);
+        vme_free_result(result);
+        if (i >= 25 && took > worst)
+            worst = took;
+    }
+    CU_ASSERT_TRUE(worst < 1000);
+
+    vme_hedging_stats(vme, &stats);
+    CU_ASSERT_EQUAL(stats.reads, 40);
+    CU_ASSERT_TRUE(stats.hedged > 0);
+    CU_ASSERT_TRUE(stats.hedged <= 20);
+    CU_ASSERT_TRUE(stats.hedge_wins > 0);
+
+    // aggregates and counts go through the same path
+    vme_result_t *result = vme_select_count(vme, rsURI, NULL, NULL, NULL);
+    CU_ASSERT_PTR_NULL(result->vme_error_msg);
+    CU_ASSERT_EQUAL(result->vme_count, 50);
+    vme_free_result(result);
+
+    vme_disable_hedging(vme);
+    vme_hedging_stats(vme, &stats);
+    CU_ASSERT_EQUAL(stats.reads, 0);
+
+    free(rsURI);
+    free(config.vantiq_url);
+    free(config.vantiq_token);
+    vme_teardown(vme);
+    CU_PASS("test hedge");
+}
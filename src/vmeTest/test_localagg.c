@@ -0,0 +1,132 @@
+//  test_localagg.c
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "CUnit/Basic.h"
+#include "vme.h"
+#include "cjson.h"
+#include "vme_test.h"
+
+static cJSON *find_group(cJSON *groups, const char *id)
+{
+    for (cJSON *g = groups->child; g != NULL; g = g->next) {
+        cJSON *gid = cJSON_GetObjectItem(g, "_id");
+        if (cJSON_IsString(gid) && strcmp(gid->valuestring, id) == 0)
+            return g;
+    }
+    return NULL;
+}
+
+void test_local_aggregate()
+{
+    // the reduction kernels, with and without nulls
+    {
+        double values[37];
+        for (int i = 0; i < 37; i++)
+            values[i] = (i == 20 ? -5.0 : (double)i);
+        vme_reduction_t acc;
+        vme_reduction_init(&acc);
+        vme_reduce_f64(&acc, values, 37, NULL);
+        CU_ASSERT_EQUAL(acc.count, 37);
+        CU_ASSERT_DOUBLE_EQUAL(acc.sum, 666.0 - 25.0, 0.0001);
+        CU_ASSERT_DOUBLE_EQUAL(acc.min, -5.0, 0.0001);
+        CU_ASSERT_DOUBLE_EQUAL(acc.max, 36.0, 0.0001);
+
+        uint8_t nulls[5] = { 0, 0, 0x10, 0, 0x10 };   // skips rows 20 and 36
+        vme_reduction_init(&acc);
+        vme_reduce_f64(&acc, values, 37, nulls);
+        CU_ASSERT_EQUAL(acc.count, 35);
+        CU_ASSERT_DOUBLE_EQUAL(acc.sum, 666.0 - 20.0 - 36.0, 0.0001);
+        CU_ASSERT_DOUBLE_EQUAL(acc.min, 0.0, 0.0001);
+        CU_ASSERT_DOUBLE_EQUAL(acc.max, 35.0, 0.0001);
+    }
+
+    // pipelines over instances in memory, fed a few bytes at a time
+    {
+        const char *json = "[{\"dept\": \"Sales\", \"salary\": 100, \"name\": \"a\"},"
+                           " {\"dept\": \"Eng\", \"salary\": 300, \"name\": \"b \\\"]}\"},"
+                           " {\"dept\": \"Sales\", \"salary\": 200.5, \"name\": \"c\"},"
+                           " {\"dept\": \"Eng\", \"name\": \"d\"}]";
+        const char *pipeline = "[{\"$match\": {\"name\": {\"$ne\": \"c\"}}},"
+                               " {\"$group\": {\"_id\": \"$dept\", \"total\": {\"$sum\": \"$salary\"}, \"n\": {\"$sum\": 1},"
+                               " \"avg\": {\"$avg\": \"$salary\"}, \"low\": {\"$min\": \"$salary\"}, \"last\": {\"$last\": \"$name\"}}},"
+                               " {\"$sort\": {\"_id\": 1}}]";
+        vme_agg_t *agg = vme_agg_open(pipeline);
+        for (size_t off = 0; off < strlen(json); off += 7) {
+            size_t len = strlen(json) - off;
+            vme_agg_feed(agg, json + off, (len < 7 ? len : 7));
+        }
+        vme_result_t *result = vme_agg_finish(agg);
+        CU_ASSERT_PTR_NULL_FATAL(result->vme_error_msg);
+        CU_ASSERT_EQUAL(result->vme_count, 2);
+        cJSON *groups = cJSON_Parse(result->vme_json_data);
+        CU_ASSERT_STRING_EQUAL(cJSON_GetObjectItem(groups->child, "_id")->valuestring, "Eng");
+        cJSON *eng = find_group(groups, "Eng");
+        CU_ASSERT_DOUBLE_EQUAL(cJSON_GetObjectItem(eng, "total")->valuedouble, 300, 0.001);
+        CU_ASSERT_EQUAL(cJSON_GetObjectItem(eng, "n")->valueint, 2);
+        CU_ASSERT_DOUBLE_EQUAL(cJSON_GetObjectItem(eng, "avg")->valuedouble, 300, 0.001);
+        CU_ASSERT_STRING_EQUAL(cJSON_GetObjectItem(eng, "last")->valuestring, "d");
+        cJSON *sales = find_group(groups, "Sales");
+        CU_ASSERT_EQUAL(cJSON_GetObjectItem(sales, "n")->valueint, 1);
+        CU_ASSERT_DOUBLE_EQUAL(cJSON_GetObjectItem(sales, "low")->valuedouble, 100, 0.001);
+        cJSON_Delete(groups);
+        vme_free_result(result);
+
+        const char *top = "[{\"$match\": {\"salary\": {\"$gte\": 150}}}, {\"$sort\": {\"salary\": -1}},"
+                          " {\"$project\": {\"_id\": 0, \"who\": \"$name\"}}, {\"$limit\": 1}]";
+        result = vme_aggregate_local(json, strlen(json), top);
+        CU_ASSERT_PTR_NULL_FATAL(result->vme_error_msg);
+        CU_ASSERT_STRING_EQUAL(result->vme_json_data, "[{\"who\":\"b \\\"]}\"}]");
+        vme_free_result(result);
+
+        result = vme_aggregate_local(json, strlen(json), "[{\"$skip\": 1}, {\"$count\": \"rest\"}]");
+        CU_ASSERT_STRING_EQUAL(result->vme_json_data, "[{\"rest\":3}]");
+        vme_free_result(result);
+
+        result = vme_aggregate_local(json, strlen(json), "[{\"$unwind\": \"$dept\"}]");
+        CU_ASSERT_PTR_NOT_NULL(result->vme_error_msg);
+        vme_free_result(result);
+
+        result = vme_aggregate_local(json, strlen(json) - 3, "[{\"$count\": \"n\"}]");
+        CU_ASSERT_PTR_NOT_NULL(result->vme_error_msg);
+        vme_free_result(result);
+    }
+
+    // aggregate a select as it streams in, the same as aggregating the whole result afterwards
+    {
+        vmeconfig_t config;
+        if (vme_parse_config("config.properties", &config) == -1)
+            CU_ASSERT_EQUAL_FATAL(-1, 3);
+        VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+        char *rsURI = vme_build_custom_rsuri(vme, "VME_Test", NULL);
+        const char *pipeline = "[{\"$group\": {\"_id\": \"$dept\", \"total\": {\"$sum\": \"$salary\"}, \"n\": {\"$sum\": 1}}},"
+                               " {\"$sort\": {\"_id\": 1}}]";
+
+        vme_agg_t *agg = vme_agg_open(pipeline);
+        vme_callback_state(vme, agg);
+        vme_result_t *sel = vme_select_callback(vme, rsURI, NULL, NULL, NULL, 0, 0, vme_agg_callback);
+        CU_ASSERT_PTR_NULL(sel->vme_error_msg);
+        vme_free_result(sel);
+        vme_result_t *streamed = vme_agg_finish(agg);
+        CU_ASSERT_PTR_NULL_FATAL(streamed->vme_error_msg);
+
+        sel = vme_select(vme, rsURI, NULL, NULL, NULL, 0, 0);
+        CU_ASSERT_PTR_NULL_FATAL(sel->vme_error_msg);
+        vme_result_t *whole = vme_aggregate_local(sel->vme_json_data, sel->vme_size, pipeline);
+        CU_ASSERT_STRING_EQUAL(streamed->vme_json_data, whole->vme_json_data);
+        CU_ASSERT_TRUE(streamed->vme_count > 0);
+        vme_free_result(whole);
+        vme_free_result(sel);
+        vme_free_result(streamed);
+
+        free(rsURI);
+        free(config.vantiq_url);
+        free(config.vantiq_token);
+        vme_teardown(vme);
+    }
+    CU_PASS("test local aggregate");
+}
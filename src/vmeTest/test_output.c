@@ -0,0 +1,102 @@
+//  test_output.c
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "CUnit/Basic.h"
+#include "vme.h"
+#include "cjson.h"
+#include "vme_test.h"
+
+static char *slurp(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = malloc(*len + 1);
+    *len = fread(data, 1, *len, f);
+    data[*len] = '\0';
+    fclose(f);
+    return data;
+}
+
+void test_select_to_file()
+{
+    vmeconfig_t config;
+    if (vme_parse_config("config.properties", &config) == -1)
+        CU_ASSERT_EQUAL_FATAL(-1, 3);
+
+    VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+    char *rsURI = vme_build_custom_rsuri(vme, "VME_Test", NULL);
+    const char *path = "vme_test_select.json";
+
+    vme_result_t *expected = vme_select(vme, rsURI, "[\"_id\", \"salary\"]", NULL, NULL, 0, 0);
+    CU_ASSERT_PTR_NULL_FATAL(expected->vme_error_msg);
+    cJSON *expectedJson = cJSON_Parse(expected->vme_json_data);
+    int nExpected = cJSON_GetArraySize(expectedJson);
+
+    // the JSON array exactly as the server sent it
+    {
+        vme_result_t *result = vme_select_to_file(vme, rsURI, "[\"_id\", \"salary\"]", NULL, NULL, 0, 0, path, NULL);
+        CU_ASSERT_PTR_NULL(result->vme_error_msg);
+        CU_ASSERT_PTR_NULL(result->vme_json_data);
+        CU_ASSERT_EQUAL(result->vme_count, nExpected);
+        size_t len;
+        char *data = slurp(path, &len);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+        CU_ASSERT_EQUAL(len, result->vme_size);
+        CU_ASSERT_EQUAL(len, expected->vme_size);
+        CU_ASSERT_TRUE(memcmp(data, expected->vme_json_data, len) == 0);
+        free(data);
+        vme_free_result(result);
+    }
+
+    // one instance per line, synced at the end
+    {
+        vme_output_opts_t opts = { VME_OUTPUT_NDJSON, VME_FSYNC_END, 0 };
+        vme_result_t *result = vme_select_to_file(vme, rsURI, "[\"_id\", \"salary\"]", NULL, NULL, 0, 0, path, &opts);
+        CU_ASSERT_PTR_NULL(result->vme_error_msg);
+        CU_ASSERT_EQUAL(result->vme_count, nExpected);
+        size_t len;
+        char *data = slurp(path, &len);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+        CU_ASSERT_EQUAL(len, result->vme_size);
+        int lines = 0;
+        cJSON *inst = expectedJson->child;
+        for (char *line = strtok(data, "\n"); line != NULL; line = strtok(NULL, "\n"), lines++) {
+            cJSON *json = cJSON_Parse(line);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(inst);
+            CU_ASSERT_STRING_EQUAL(cJSON_GetObjectItem(json, "_id")->valuestring,
+                                   cJSON_GetObjectItem(inst, "_id")->valuestring);
+            cJSON_Delete(json);
+            inst = inst->next;
+        }
+        CU_ASSERT_EQUAL(lines, nExpected);
+        free(data);
+        vme_free_result(result);
+    }
+
+    // a file we can't create
+    {
+        vme_result_t *result = vme_select_to_file(vme, rsURI, NULL, NULL, NULL, 0, 0, "/no/such/dir/out.json", NULL);
+        CU_ASSERT_PTR_NOT_NULL(result->vme_error_msg);
+        vme_free_result(result);
+    }
+
+    unlink(path);
+    cJSON_Delete(expectedJson);
+    vme_free_result(expected);
+    free(rsURI);
+    free(config.vantiq_url);
+    free(config.vantiq_token);
+    vme_teardown(vme);
+    CU_PASS("test select to file");
+}
@@ -4,6 +4,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <ctype.h>
 #include <assert.h>
 
@@ -43,3 +44,95 @@ void test_patch()
     free(config.vantiq_token);
     vme_teardown(vme);
 }
+
+static void check_diff(const char *from, const char *to, const char *expected)
+{
+    char *patch = vme_json_diff(from, to);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(patch);
+    CU_ASSERT_STRING_EQUAL(patch, expected);
+    free(patch);
+}
+
+void test_update_delta()
+{
+    check_diff("{\"a\":1,\"b\":[1,2]}", "{\"b\":[1,2],\"a\":1}", "[]");
+    check_diff("{\"a\":1,\"b\":{\"c\":2,\"d\":3}}", "{\"a\":1,\"b\":{\"c\":5,\"d\":3},\"e\":true}",
+               "[{\"op\":\"replace\",\"path\":\"/b/c\",\"value\":5},{\"op\":\"add\",\"path\":\"/e\",\"value\":true}]");
+    check_diff("{\"x/y\":1,\"t~\":2}", "{\"t~\":3}",
+               "[{\"op\":\"remove\",\"path\":\"/x~1y\"},{\"op\":\"replace\",\"path\":\"/t~0\",\"value\":3}]");
+    check_diff("{\"l\":[1,2,3]}", "{\"l\":[0,1,2,3]}", "[{\"op\":\"add\",\"path\":\"/l/0\",\"value\":0}]");
+    check_diff("{\"l\":[1,2,3,4]}", "{\"l\":[1,2,4]}", "[{\"op\":\"remove\",\"path\":\"/l/2\"}]");
+    // when every property changes, replacing the whole value is shorter
+    check_diff("{\"o\":{\"p\":1,\"q\":2}}", "{\"o\":{\"p\":3,\"q\":4}}",
+               "[{\"op\":\"replace\",\"path\":\"/o\",\"value\":{\"p\":3,\"q\":4}}]");
+    CU_ASSERT_PTR_NULL(vme_json_diff("{", "{}"));
+
+    vmeconfig_t config;
+    vme_parse_config("config.properties", &config);
+    VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+    char *rsURI = vme_build_custom_rsuri(vme, "VME_Test", NULL);
+    vme_result_t *result = vme_select_one(vme, rsURI, NULL, NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(result->vme_json_data);
+    char *id = find_instance_id(result);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(id);
+    char *instURI = vme_build_custom_rsuri(vme, "VME_Test", id);
+
+    cJSON *json = cJSON_Parse(result->vme_json_data);
+    cJSON *inst = (cJSON_IsArray(json) ? json->child : json);
+    char *from = cJSON_PrintUnformatted(inst);
+    cJSON_ReplaceItemInObject(inst, "salary", cJSON_CreateNumber(98765.0));
+    char *to = cJSON_PrintUnformatted(inst);
+    vme_free_result(result);
+
+    // a one property change goes as a patch
+    result = vme_update_delta(vme, instURI, from, to);
+    CU_ASSERT_PTR_NULL(result->vme_error_msg);
+    vme_free_result(result);
+
+    // and it took
+    char where[256];
+    snprintf(where, sizeof(where), "{\"_id\": \"%s\"}", id);
+    result = vme_select_one(vme, rsURI, "[\"salary\"]", where);
+    CU_ASSERT_PTR_NULL_FATAL(result->vme_error_msg);
+    cJSON *back = cJSON_Parse(result->vme_json_data);
+    cJSON *salary = cJSON_GetObjectItem(cJSON_IsArray(back) ? back->child : back, "salary");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(salary);
+    CU_ASSERT_DOUBLE_EQUAL(salary->valuedouble, 98765.0, 0.001);
+    cJSON_Delete(back);
+    vme_free_result(result);
+
+    // nothing changed, nothing sent
+    result = vme_update_delta(vme, instURI, to, to);
+    CU_ASSERT_PTR_NULL(result->vme_error_msg);
+    CU_ASSERT_EQUAL(result->vme_count, 0);
+    vme_free_result(result);
+
+    // the system properties the server keeps don't have to be carried along
+    cJSON_DeleteItemFromObject(inst, "_id");
+    for (cJSON *prop = inst->child, *next; prop != NULL; prop = next) {
+        next = prop->next;
+        if (strncmp(prop->string, "ars_", 4) == 0)
+            cJSON_Delete(cJSON_DetachItemViaPointer(inst, prop));
+    }
+    char *bare = cJSON_PrintUnformatted(inst);
+    result = vme_update_delta(vme, instURI, to, bare);
+    CU_ASSERT_PTR_NULL(result->vme_error_msg);
+    CU_ASSERT_EQUAL(result->vme_count, 0);
+    vme_free_result(result);
+    free(bare);
+
+    result = vme_update_delta(vme, instURI, from, "[1]");
+    CU_ASSERT_PTR_NOT_NULL(result->vme_error_msg);
+    vme_free_result(result);
+
+    cJSON_Delete(json);
+    free(from);
+    free(to);
+    free(id);
+    free(instURI);
+    free(rsURI);
+    free(config.vantiq_url);
+    free(config.vantiq_token);
+    vme_teardown(vme);
+    CU_PASS("test update delta");
+}
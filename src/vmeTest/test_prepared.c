@@ -0,0 +1,89 @@
+//  test_prepared.c
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "CUnit/Basic.h"
+#include "vme.h"
+#include "cjson.h"
+#include "vme_test.h"
+
+void test_prepared()
+{
+    vmeconfig_t config;
+    if (vme_parse_config("config.properties", &config) == -1)
+        CU_ASSERT_EQUAL_FATAL(-1, 3);
+
+    VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+    char *rsURI = vme_build_custom_rsuri(vme, "VME_Test", NULL);
+
+    // a prepared select must return exactly what the equivalent vme_select does
+    {
+        vme_prepared_t *stmt = vme_prepare_select(vme, rsURI, "[\"ssn\", \"salary\"]",
+                                                  "{\"salary\" : {\"$gt\" : ?}, \"dept\" : ?}", "{\"salary\":-1}");
+        CU_ASSERT_PTR_NOT_NULL_FATAL(stmt);
+        CU_ASSERT_EQUAL(vme_prepared_param_count(stmt), 2);
+
+        vme_result_t *result = vme_exec_select(stmt, 0, 10);
+        CU_ASSERT_PTR_NOT_NULL(result->vme_error_msg); // nothing bound yet
+        vme_free_result(result);
+
+        CU_ASSERT_EQUAL(vme_bind_double(stmt, 1, NAN), -1);
+        CU_ASSERT_EQUAL(vme_bind_double(stmt, 1, -INFINITY), -1);
+        CU_ASSERT_EQUAL(vme_bind_double(stmt, 1, 200000.0), 0);
+        CU_ASSERT_EQUAL(vme_bind_string(stmt, 2, "Marketing"), 0);
+        CU_ASSERT_EQUAL(vme_bind_string(stmt, 3, "too many"), -1);
+        result = vme_exec_select(stmt, 0, 10);
+        CU_ASSERT_PTR_NULL(result->vme_error_msg);
+
+        vme_result_t *expected = vme_select(vme, rsURI, "[\"ssn\", \"salary\"]",
+                                            "{\"salary\" : {\"$gt\" : 200000.0}, \"dept\" : \"Marketing\"}",
+                                            "{\"salary\":-1}", 0, 10);
+        CU_ASSERT_PTR_NULL(expected->vme_error_msg);
+        CU_ASSERT_EQUAL_FATAL(result->vme_size, expected->vme_size);
+        CU_ASSERT_TRUE(memcmp(result->vme_json_data, expected->vme_json_data, result->vme_size) == 0);
+        vme_free_result(expected);
+        vme_free_result(result);
+
+        // re-bind one parameter and run again, paging through
+        CU_ASSERT_EQUAL(vme_bind_double(stmt, 1, 245000.0), 0);
+        result = vme_exec_select(stmt, 1, 5);
+        CU_ASSERT_PTR_NULL(result->vme_error_msg);
+        cJSON *json = cJSON_Parse(result->vme_json_data);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+        for (cJSON *inst = json->child; inst != NULL; inst = inst->next) {
+            cJSON *salary = find_instance_prop(inst, "salary");
+            CU_ASSERT_TRUE(salary != NULL && salary->valuedouble > 245000.0);
+        }
+        cJSON_Delete(json);
+        vme_free_result(result);
+        vme_free_prepared(stmt);
+    }
+
+    // prepared aggregate
+    {
+        vme_prepared_t *stmt = vme_prepare_aggregate(vme, rsURI,
+            "[{\"$match\": { \"salary\" : { \"$gt\" : ? } }}, { \"$group\": { \"_id\": \"$dept\", \"total\": { \"$sum\": \"$salary\"}}}]");
+        CU_ASSERT_PTR_NOT_NULL_FATAL(stmt);
+        CU_ASSERT_EQUAL(vme_bind_int(stmt, 1, 200000), 0);
+        vme_result_t *result = vme_exec_aggregate(stmt);
+        CU_ASSERT_PTR_NULL(result->vme_error_msg);
+        CU_ASSERT_PTR_NOT_NULL(result->vme_json_data);
+        vme_free_result(result);
+
+        result = vme_exec_select(stmt, 0, 0);
+        CU_ASSERT_PTR_NOT_NULL(result->vme_error_msg);
+        vme_free_result(result);
+        vme_free_prepared(stmt);
+    }
+
+    free(rsURI);
+    free(config.vantiq_url);
+    free(config.vantiq_token);
+    vme_teardown(vme);
+    CU_PASS("test prepared");
+}
@@ -8,12 +8,64 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <assert.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
 
 #include "CUnit/Basic.h"
 #include "vme.h"
 #include "cjson.h"
 #include "vme_test.h"
 
+/*
+ * holds the sender thread inside the error callback so the test can fill the queue
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+    int             entered;
+    int             released;
+    int             errors;
+} sender_gate_t;
+
+/* isn't JSON, so the server refuses to publish it whatever the namespace holds */
+static const char *bad = "{\"device\": ";
+
+static void on_error(void *state, const char *topic, const char *json, size_t size, const char *errMsg)
+{
+    sender_gate_t *gate = (sender_gate_t *)state;
+    pthread_mutex_lock(&gate->lock);
+    gate->errors++;
+    gate->entered = 1;
+    pthread_cond_broadcast(&gate->changed);
+    while (!gate->released)
+        pthread_cond_wait(&gate->changed, &gate->lock);
+    pthread_mutex_unlock(&gate->lock);
+}
+
+static void gate_wait_entered(sender_gate_t *gate)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 30;
+    pthread_mutex_lock(&gate->lock);
+    while (!gate->entered)
+        if (pthread_cond_timedwait(&gate->changed, &gate->lock, &deadline) == ETIMEDOUT)
+            break;
+    if (!gate->entered)
+        CU_FAIL("the bad publish was never reported");
+    pthread_mutex_unlock(&gate->lock);
+}
+
+static void gate_release(sender_gate_t *gate)
+{
+    pthread_mutex_lock(&gate->lock);
+    gate->released = 1;
+    pthread_cond_broadcast(&gate->changed);
+    pthread_mutex_unlock(&gate->lock);
+}
+
 void test_publish()
 {
     vmeconfig_t config;
@@ -44,3 +96,129 @@ void test_publish()
     free(config.vantiq_token);
     vme_teardown(vme);
 }
+
+void test_publish_async()
+{
+    vmeconfig_t config;
+    vme_parse_config("config.properties", &config);
+    const char *topic = "/ChinaUnicom/Smarthome/Discovery";
+    const char *msg = "{\"device\": \"async\"}";
+
+    // a full queue refuses new messages, or drops the oldest ones
+    for (int policy = VME_QUEUE_DROP_OLDEST; policy <= VME_QUEUE_FAIL; policy++) {
+        VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+        sender_gate_t gate;
+        memset(&gate, 0, sizeof(gate));
+        pthread_mutex_init(&gate.lock, NULL);
+        pthread_cond_init(&gate.changed, NULL);
+        vme_publish_opts_t opts = { 4, (vme_queue_policy_t)policy, on_error, &gate };
+        CU_ASSERT_EQUAL(vme_publish_queue(vme, &opts), 0);
+        CU_ASSERT_EQUAL(vme_publish_queue(vme, &opts), -1);
+
+        CU_ASSERT_EQUAL(vme_publish_async(vme, topic, bad, strlen(bad)), 0);
+        gate_wait_entered(&gate);
+        for (int i = 0; i < 4; i++)
+            CU_ASSERT_EQUAL(vme_publish_async(vme, topic, msg, strlen(msg)), 0);
+        int rc = vme_publish_async(vme, topic, msg, strlen(msg));
+        CU_ASSERT_EQUAL(rc, (policy == VME_QUEUE_FAIL ? -1 : 0));
+        gate_release(&gate);
+
+        vme_result_t *result = vme_publish_flush(vme, -1);
+        CU_ASSERT_PTR_NOT_NULL(result->vme_error_msg);
+        if (result->vme_error_msg != NULL)
+            CU_ASSERT_PTR_NOT_NULL(strstr(result->vme_error_msg,
+                                          (policy == VME_QUEUE_FAIL ? "1 publishes failed, 0 dropped" : "1 dropped")));
+        CU_ASSERT_EQUAL(result->vme_count, 4);
+        CU_ASSERT_EQUAL(gate.errors, 1);
+        vme_free_result(result);
+
+        // counts start over after a flush
+        result = vme_publish_flush(vme, 1000);
+        CU_ASSERT_PTR_NULL(result->vme_error_msg);
+        CU_ASSERT_EQUAL(result->vme_count, 0);
+        vme_free_result(result);
+
+        vme_teardown(vme);
+        pthread_cond_destroy(&gate.changed);
+        pthread_mutex_destroy(&gate.lock);
+    }
+
+    // the default queue blocks when full, so nothing is lost
+    {
+        VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+        for (int i = 0; i < 200; i++)
+            CU_ASSERT_EQUAL(vme_publish_async(vme, topic, msg, strlen(msg)), 0);
+        vme_result_t *result = vme_publish_flush(vme, 60000);
+        CU_ASSERT_PTR_NULL(result->vme_error_msg);
+        CU_ASSERT_EQUAL(result->vme_count, 200);
+        vme_free_result(result);
+        vme_teardown(vme);
+    }
+
+    free(config.vantiq_url);
+    free(config.vantiq_token);
+    CU_PASS("test publish async");
+}
+
+static void count_release(void *state, vmebuf_t *msg)
+{
+    __atomic_add_fetch((int *)state, 1, __ATOMIC_SEQ_CST);
+    vmebuf_dealloc(msg);
+}
+
+static vmebuf_t *msg_buf(const char *json)
+{
+    vmebuf_t *buf = vmebuf_alloc();
+    vmebuf_concat(buf, json, strlen(json));
+    return buf;
+}
+
+void test_publish_buf()
+{
+    vmeconfig_t config;
+    vme_parse_config("config.properties", &config);
+    const char *topic = "/ChinaUnicom/Smarthome/Discovery";
+    const char *msg = "{\"device\": \"handed over\"}";
+    int released = 0;
+
+    // the buffer comes back once the publish is over, or is freed when there's nowhere to give it back to
+    VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+    vme_result_t *result = vme_publish_buf(vme, topic, msg_buf(msg), count_release, &released);
+    CU_ASSERT_PTR_NULL(result->vme_error_msg);
+    CU_ASSERT_EQUAL(released, 1);
+    vme_free_result(result);
+    result = vme_publish_buf(vme, topic, msg_buf(msg), NULL, NULL);
+    CU_ASSERT_PTR_NULL(result->vme_error_msg);
+    vme_free_result(result);
+    result = vme_publish_buf(NULL, topic, msg_buf(msg), count_release, &released);
+    CU_ASSERT_PTR_NOT_NULL(result->vme_error_msg);
+    CU_ASSERT_EQUAL(released, 2);
+    vme_free_result(result);
+
+    // queued buffers come back from the sender thread, or right away when the queue refuses them
+    sender_gate_t gate;
+    memset(&gate, 0, sizeof(gate));
+    pthread_mutex_init(&gate.lock, NULL);
+    pthread_cond_init(&gate.changed, NULL);
+    vme_publish_opts_t opts = { 2, VME_QUEUE_FAIL, on_error, &gate };
+    CU_ASSERT_EQUAL(vme_publish_queue(vme, &opts), 0);
+    CU_ASSERT_EQUAL(vme_publish_async_buf(vme, topic, msg_buf(bad), count_release, &released), 0);
+    gate_wait_entered(&gate);
+    for (int i = 0; i < 2; i++)
+        CU_ASSERT_EQUAL(vme_publish_async_buf(vme, topic, msg_buf(msg), count_release, &released), 0);
+    CU_ASSERT_EQUAL(vme_publish_async_buf(vme, topic, msg_buf(msg), count_release, &released), -1);
+    CU_ASSERT_EQUAL(released, 3);
+    gate_release(&gate);
+    result = vme_publish_flush(vme, -1);
+    CU_ASSERT_EQUAL(result->vme_count, 2);
+    CU_ASSERT_EQUAL(gate.errors, 1);
+    CU_ASSERT_EQUAL(released, 6);
+    vme_free_result(result);
+
+    vme_teardown(vme);
+    pthread_cond_destroy(&gate.changed);
+    pthread_mutex_destroy(&gate.lock);
+    free(config.vantiq_url);
+    free(config.vantiq_token);
+    CU_PASS("test publish buf");
+}
@@ -0,0 +1,86 @@
+//  test_replica.c
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "CUnit/Basic.h"
+#include "vme.h"
+#include "cjson.h"
+#include "vme_test.h"
+
+void test_replica()
+{
+    vmeconfig_t config;
+    if (vme_parse_config("config.properties", &config) == -1)
+        CU_ASSERT_EQUAL_FATAL(-1, 3);
+
+    VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+    char *rsURI = vme_build_custom_rsuri(vme, "VME_Test", NULL);
+
+    vme_replica_t *rep = vme_replica_open(vme, rsURI, NULL, NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(rep);
+    CU_ASSERT_EQUAL(vme_replica_count(rep), 0);
+
+    // the first sync loads everything
+    vme_result_t *result = vme_replica_sync(rep);
+    CU_ASSERT_PTR_NULL_FATAL(result->vme_error_msg);
+    CU_ASSERT_TRUE(result->vme_count > 0);
+    CU_ASSERT_EQUAL(vme_replica_count(rep), result->vme_count);
+    size_t loaded = vme_replica_count(rep);
+    vme_free_result(result);
+
+    // instances at the last mark come back again, but only real changes count
+    result = vme_replica_sync(rep);
+    CU_ASSERT_PTR_NULL_FATAL(result->vme_error_msg);
+    CU_ASSERT_EQUAL(result->vme_count, 0);
+    CU_ASSERT_EQUAL(vme_replica_count(rep), loaded);
+    vme_free_result(result);
+
+    vme_result_t *all = vme_select(vme, rsURI, NULL, NULL, NULL, 0, 0);
+    CU_ASSERT_PTR_NULL_FATAL(all->vme_error_msg);
+    char *id = find_instance_id(all);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(id);
+    CU_ASSERT_PTR_NOT_NULL(vme_replica_get(rep, id));
+    CU_ASSERT_PTR_NULL(vme_replica_get(rep, "no such instance"));
+    vme_free_result(all);
+
+    // a change made on the server shows up after the next sync
+    char *instURI = vme_build_custom_rsuri(vme, "VME_Test", id);
+    const char *expr = "{ \"salary\": 424242.00 }";
+    result = vme_update(vme, instURI, expr, strlen(expr));
+    CU_ASSERT_PTR_NULL(result->vme_error_msg);
+    vme_free_result(result);
+
+    result = vme_replica_sync(rep);
+    CU_ASSERT_PTR_NULL_FATAL(result->vme_error_msg);
+    CU_ASSERT_TRUE(result->vme_count >= 1);
+    vme_free_result(result);
+    cJSON *inst = cJSON_Parse(vme_replica_get(rep, id));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(inst);
+    CU_ASSERT_DOUBLE_EQUAL(cJSON_GetObjectItem(inst, "salary")->valuedouble, 424242.00, 0.001);
+    cJSON_Delete(inst);
+
+    // local queries run over the replica
+    result = vme_replica_select(rep, "{\"salary\": 424242.00}");
+    CU_ASSERT_PTR_NULL(result->vme_error_msg);
+    CU_ASSERT_TRUE(result->vme_count >= 1);
+    vme_free_result(result);
+
+    // nothing was deleted, so a reconcile keeps every instance
+    result = vme_replica_reconcile(rep);
+    CU_ASSERT_PTR_NULL(result->vme_error_msg);
+    CU_ASSERT_EQUAL(vme_replica_count(rep), loaded);
+    vme_free_result(result);
+
+    vme_replica_close(rep);
+    free(instURI);
+    free(id);
+    free(rsURI);
+    free(config.vantiq_url);
+    free(config.vantiq_token);
+    vme_teardown(vme);
+    CU_PASS("test replica");
+}
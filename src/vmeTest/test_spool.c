@@ -0,0 +1,146 @@
+//  test_spool.c
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "CUnit/Basic.h"
+#include "vme.h"
+#include "vme_test.h"
+
+#define SPOOL_DIR "vme_test_spool"
+#define N_RECORDS 300
+
+static int count_segments(void)
+{
+    int n = 0;
+    DIR *d = opendir(SPOOL_DIR);
+    struct dirent *ent;
+    while (d != NULL && (ent = readdir(d)) != NULL) {
+        if (strstr(ent->d_name, ".seg") != NULL)
+            n++;
+    }
+    if (d != NULL)
+        closedir(d);
+    return n;
+}
+
+static void remove_spool(void)
+{
+    DIR *d = opendir(SPOOL_DIR);
+    struct dirent *ent;
+    char path[512];
+    while (d != NULL && (ent = readdir(d)) != NULL) {
+        if (ent->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", SPOOL_DIR, ent->d_name);
+        unlink(path);
+    }
+    if (d != NULL)
+        closedir(d);
+    rmdir(SPOOL_DIR);
+}
+
+void test_spool()
+{
+    vmeconfig_t config;
+    if (vme_parse_config("config.properties", &config) == -1)
+        CU_ASSERT_EQUAL_FATAL(-1, 3);
+
+    remove_spool();
+    char *rsURI = NULL;
+    char inst[128];
+    vme_spool_opts_t opts = { 4096, 256 * 1024, 50, 0 };
+
+    // only client errors are given up on; an expired token, throttling or an outage are retried
+    {
+        static const long retried[] = { 0, 401, 403, 408, 429, 500, 502, 503 };
+        static const long rejected[] = { 400, 404, 409, 413, 422 };
+        vme_result_t result;
+        memset(&result, 0, sizeof(result));
+        result.vme_error_msg = "[{\"code\": \"io.vantiq.test\", \"message\": \"refused\"}]";
+        for (size_t i = 0; i < sizeof(retried) / sizeof(retried[0]); i++) {
+            result.vme_http_status = retried[i];
+            CU_ASSERT_FALSE(vme_rejected(&result));
+        }
+        for (size_t i = 0; i < sizeof(rejected) / sizeof(rejected[0]); i++) {
+            result.vme_http_status = rejected[i];
+            CU_ASSERT_TRUE(vme_rejected(&result));
+        }
+        result.vme_error_msg = NULL;
+        result.vme_http_status = 200;
+        CU_ASSERT_FALSE(vme_rejected(&result));
+    }
+
+    // spool without a connection
+    {
+        VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+        rsURI = vme_build_custom_rsuri(vme, "VME_Test", NULL);
+        vme_teardown(vme);
+        vme_spool_t *sp = vme_spool_open(NULL, SPOOL_DIR, &opts);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(sp);
+        for (int i = 0; i < N_RECORDS; i++) {
+            int len = snprintf(inst, sizeof(inst), "{\"name\": \"spooled %d\", \"salary\": %d}", i, 3000 + i);
+            int rc = (i % 2 == 0 ? vme_spool_insert(sp, rsURI, inst, len)
+                      : vme_spool_publish(sp, "/ChinaUnicom/Smarthome/Discovery", inst, len));
+            CU_ASSERT_EQUAL(rc, 0);
+        }
+        CU_ASSERT_EQUAL(vme_spool_pending(sp), N_RECORDS);
+        CU_ASSERT_TRUE(count_segments() > 1);
+
+        vme_result_t *result = vme_spool_flush(sp, 300);
+        CU_ASSERT_PTR_NOT_NULL(result->vme_error_msg);
+        CU_ASSERT_EQUAL(result->vme_count, 0);
+        vme_free_result(result);
+
+        // the spool is bounded
+        char big[8000];
+        memset(big, ' ', sizeof(big));
+        big[0] = '{';
+        big[sizeof(big) - 1] = '}';
+        int full = 0;
+        for (int i = 0; i < 100 && !full; i++)
+            full = (vme_spool_publish(sp, "/ChinaUnicom/Smarthome/Discovery", big, sizeof(big)) == -1);
+        CU_ASSERT_TRUE(full);
+        vme_spool_close(sp);
+    }
+
+    // after a restart everything is delivered, in order, and the segments go away
+    {
+        VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+        vme_spool_t *sp = vme_spool_open(vme, SPOOL_DIR, &opts);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(sp);
+        uint64_t pending = vme_spool_pending(sp);
+        CU_ASSERT_TRUE(pending > N_RECORDS);
+
+        vme_result_t *result = vme_spool_flush(sp, 60000);
+        CU_ASSERT_PTR_NULL(result->vme_error_msg);
+        CU_ASSERT_EQUAL(result->vme_count, pending);
+        CU_ASSERT_EQUAL(vme_spool_pending(sp), 0);
+        CU_ASSERT_EQUAL(count_segments(), 1);
+        vme_free_result(result);
+
+        // records the server turns down are skipped rather than retried forever
+        int len = snprintf(inst, sizeof(inst), "{\"name\": \"FAIL\", \"salary\": 1}");
+        vme_spool_insert(sp, rsURI, inst, len);
+        result = vme_spool_flush(sp, 10000);
+        CU_ASSERT_PTR_NOT_NULL(result->vme_error_msg);
+        CU_ASSERT_EQUAL(vme_spool_pending(sp), 0);
+        vme_free_result(result);
+        vme_spool_close(sp);
+
+        result = vme_delete(vme, rsURI, "{\"salary\": {\"$lt\": 5000}}");
+        vme_free_result(result);
+        vme_teardown(vme);
+    }
+
+    remove_spool();
+    free(rsURI);
+    free(config.vantiq_url);
+    free(config.vantiq_token);
+    CU_PASS("test spool");
+}
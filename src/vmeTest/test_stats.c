@@ -0,0 +1,78 @@
+//  test_stats.c
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "CUnit/Basic.h"
+#include "vme.h"
+#include "vme_test.h"
+
+void test_stats()
+{
+    vmeconfig_t config;
+    if (vme_parse_config("config.properties", &config) == -1)
+        CU_ASSERT_EQUAL_FATAL(-1, 3);
+    const char *topic = "/ChinaUnicom/Smarthome/Discovery";
+    const char *msg = "{\"device\": \"stats\"}";
+    const char *bad = "{\"device\": ";     // not JSON, so always refused
+    vme_stats_t stats;
+
+    CU_ASSERT_EQUAL(vme_get_stats(NULL, &stats), -1);
+    CU_ASSERT_EQUAL(stats.requests, 0);
+
+    // logging in doesn't count
+    VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+    CU_ASSERT_EQUAL(vme_get_stats(vme, &stats), 0);
+    CU_ASSERT_EQUAL(stats.requests, 0);
+    CU_ASSERT_EQUAL(stats.queue_capacity, 0);
+
+    for (int i = 0; i < 3; i++) {
+        vme_result_t *result = vme_publish(vme, topic, msg, strlen(msg));
+        CU_ASSERT_PTR_NULL(result->vme_error_msg);
+        vme_free_result(result);
+    }
+    vme_result_t *result = vme_publish(vme, topic, bad, strlen(bad));
+    CU_ASSERT_PTR_NOT_NULL(result->vme_error_msg);
+    vme_free_result(result);
+
+    char *rsURI = vme_build_custom_rsuri(vme, "VME_Test", NULL);
+    result = vme_select(vme, rsURI, NULL, NULL, NULL, 0, 0);
+    CU_ASSERT_PTR_NULL(result->vme_error_msg);
+    size_t selected = result->vme_size;
+    vme_free_result(result);
+
+    vme_get_stats(vme, &stats);
+    CU_ASSERT_EQUAL(stats.requests, 5);
+    CU_ASSERT_EQUAL(stats.errors, 1);
+    CU_ASSERT_EQUAL(stats.published, 3);
+    CU_ASSERT_EQUAL(stats.publish_errors, 1);
+    CU_ASSERT_EQUAL(stats.bytes_out, 3 * strlen(msg) + strlen(bad));
+    CU_ASSERT_TRUE(stats.bytes_in >= selected);
+    CU_ASSERT_TRUE(stats.latency_avg_ms > 0);
+    CU_ASSERT_TRUE(stats.latency_p50_ms > 0);
+    CU_ASSERT_TRUE(stats.latency_p99_ms >= stats.latency_p50_ms);
+    CU_ASSERT_TRUE(stats.latency_max_ms >= stats.latency_p99_ms);
+
+    // queued publishes count once sent
+    vme_publish_opts_t opts = { 16, VME_QUEUE_BLOCK, NULL, NULL };
+    CU_ASSERT_EQUAL(vme_publish_queue(vme, &opts), 0);
+    for (int i = 0; i < 4; i++)
+        CU_ASSERT_EQUAL(vme_publish_async(vme, topic, msg, strlen(msg)), 0);
+    result = vme_publish_flush(vme, -1);
+    CU_ASSERT_PTR_NULL(result->vme_error_msg);
+    vme_free_result(result);
+    vme_get_stats(vme, &stats);
+    CU_ASSERT_EQUAL(stats.requests, 9);
+    CU_ASSERT_EQUAL(stats.published, 7);
+    CU_ASSERT_EQUAL(stats.queue_depth, 0);
+    CU_ASSERT_EQUAL(stats.queue_capacity, 16);
+
+    free(rsURI);
+    free(config.vantiq_url);
+    free(config.vantiq_token);
+    vme_teardown(vme);
+    CU_PASS("test stats");
+}
@@ -0,0 +1,80 @@
+//  test_where.c
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "CUnit/Basic.h"
+#include "vme.h"
+#include "cjson.h"
+#include "vme_test.h"
+
+static int matches(const char *where, const char *instance)
+{
+    vme_where_t *w = vme_where_compile(where);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(w);
+    cJSON *inst = cJSON_Parse(instance);
+    int rc = vme_where_eval(w, inst);
+    cJSON_Delete(inst);
+    vme_where_free(w);
+    return rc;
+}
+
+void test_where()
+{
+    const char *emp = "{\"name\": \"Fred\", \"salary\": 210000.0, \"dept\": \"Sales\", \"tags\": [\"a\", \"b\"],"
+                      " \"address\": {\"zip\": \"94607\"}, \"manager\": null}";
+
+    // evaluating doesn't need a server
+    CU_ASSERT_TRUE(matches(NULL, emp));
+    CU_ASSERT_TRUE(matches("{\"salary\": {\"$gt\": 200000.0}}", emp));
+    CU_ASSERT_FALSE(matches("{\"salary\": {\"$gt\": 200000.0, \"$lt\": 205000}}", emp));
+    CU_ASSERT_FALSE(matches("{\"salary\": {\"$gt\": \"200000\"}}", emp));   // no ordering across types
+    CU_ASSERT_TRUE(matches("{\"dept\": \"Sales\", \"address.zip\": \"94607\"}", emp));
+    CU_ASSERT_TRUE(matches("{\"dept\": {\"$in\": [\"Eng\", \"Sales\", 3]}}", emp));
+    CU_ASSERT_TRUE(matches("{\"dept\": {\"$nin\": [\"Eng\"]}}", emp));
+    CU_ASSERT_TRUE(matches("{\"tags\": \"b\"}", emp));
+    CU_ASSERT_FALSE(matches("{\"tags\": {\"$ne\": \"b\"}}", emp));
+    CU_ASSERT_TRUE(matches("{\"manager\": null, \"missing\": null}", emp));
+    CU_ASSERT_TRUE(matches("{\"missing\": {\"$exists\": false}, \"manager\": {\"$exists\": true}}", emp));
+    CU_ASSERT_TRUE(matches("{\"$or\": [{\"dept\": \"Eng\"}, {\"salary\": {\"$gte\": 210000}}]}", emp));
+    CU_ASSERT_FALSE(matches("{\"$and\": [{\"dept\": \"Sales\"}, {\"name\": {\"$not\": {\"$eq\": \"Fred\"}}}]}", emp));
+    CU_ASSERT_TRUE(matches("{\"$nor\": [{\"dept\": \"Eng\"}, {\"name\": \"Wilma\"}]}", emp));
+
+    CU_ASSERT_PTR_NULL(vme_where_compile("{\"name\": {\"$regex\": \"^F\"}}"));
+    CU_ASSERT_PTR_NULL(vme_where_compile("{\"name\": "));
+
+    // filter a select result locally, the same instances as selecting with the where clause
+    {
+        const char *where = "{\"salary\" : {\"$gt\":245000.0}}";
+        vme_where_t *w = vme_where_compile(where);
+
+        vmeconfig_t config;
+        if (vme_parse_config("config.properties", &config) == -1)
+            CU_ASSERT_EQUAL_FATAL(-1, 3);
+        VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+        char *rsURI = vme_build_custom_rsuri(vme, "VME_Test", NULL);
+
+        vme_result_t *all = vme_select(vme, rsURI, "[\"_id\", \"salary\"]", NULL, NULL, 0, 0);
+        CU_ASSERT_PTR_NULL_FATAL(all->vme_error_msg);
+        vme_result_t *filtered = vme_where_filter(w, all->vme_json_data, all->vme_size);
+        CU_ASSERT_PTR_NULL_FATAL(filtered->vme_error_msg);
+        cJSON *json = cJSON_Parse(filtered->vme_json_data);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(json);
+        CU_ASSERT_EQUAL(cJSON_GetArraySize(json), (int)filtered->vme_count);
+        for (cJSON *inst = json->child; inst != NULL; inst = inst->next)
+            CU_ASSERT_TRUE(cJSON_GetObjectItem(inst, "salary")->valuedouble > 245000.0);
+        cJSON_Delete(json);
+        vme_free_result(filtered);
+        vme_free_result(all);
+
+        free(rsURI);
+        free(config.vantiq_url);
+        free(config.vantiq_token);
+        vme_teardown(vme);
+        vme_where_free(w);
+    }
+    CU_PASS("test where");
+}
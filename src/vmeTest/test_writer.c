@@ -0,0 +1,123 @@
+//  test_writer.c
+//
+//  Copyright © 2018 VANTIQ. All rights reserved.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "CUnit/Basic.h"
+#include "vme.h"
+#include "vme_test.h"
+
+typedef struct {
+    pthread_mutex_t lock;
+    int             batches;
+    int             failures;
+    uint32_t        instances;
+    uint64_t        next_offset;
+    int             out_of_order;
+} writer_stats_t;
+
+static void on_batch(void *state, const vme_batch_t *batch)
+{
+    writer_stats_t *stats = (writer_stats_t *)state;
+    pthread_mutex_lock(&stats->lock);
+    stats->batches++;
+    stats->instances += batch->count;
+    if (batch->offset != stats->next_offset)
+        stats->out_of_order++;
+    stats->next_offset = batch->offset + batch->count;
+    if (batch->error_msg != NULL)
+        stats->failures++;
+    pthread_mutex_unlock(&stats->lock);
+}
+
+static int batches(writer_stats_t *stats)
+{
+    pthread_mutex_lock(&stats->lock);
+    int n = stats->batches;
+    pthread_mutex_unlock(&stats->lock);
+    return n;
+}
+
+void test_writer()
+{
+    vmeconfig_t config;
+    if (vme_parse_config("config.properties", &config) == -1)
+        CU_ASSERT_EQUAL_FATAL(-1, 3);
+
+    VME vme = vme_init(config.vantiq_url, config.vantiq_token, 1);
+    char *rsURI = vme_build_custom_rsuri(vme, "VME_Test", NULL);
+    char inst[128];
+
+    // count and linger triggers
+    {
+        writer_stats_t stats;
+        memset(&stats, 0, sizeof(stats));
+        pthread_mutex_init(&stats.lock, NULL);
+        vme_writer_opts_t opts = { 0, 10, 200, 0, on_batch, &stats };
+        vme_writer_t *w = vme_writer_open(vme, rsURI, &opts);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(w);
+
+        for (int i = 0; i < 25; i++) {
+            int len = snprintf(inst, sizeof(inst), "{\"name\": \"writer %d\", \"salary\": %d}", i, 1000 + i);
+            CU_ASSERT_EQUAL(vme_writer_add(w, inst, len), 0);
+        }
+        CU_ASSERT_EQUAL(batches(&stats), 2);
+
+        // the last five go once they have lingered
+        for (int i = 0; i < 50 && batches(&stats) < 3; i++)
+            usleep(100000);
+        CU_ASSERT_EQUAL(batches(&stats), 3);
+        CU_ASSERT_EQUAL(stats.instances, 25);
+
+        // a failing batch is reported, and an explicit flush sends a partial one
+        int len = snprintf(inst, sizeof(inst), "{\"name\": \"FAIL\", \"salary\": 1}");
+        vme_writer_add(w, inst, len);
+        vme_result_t *result = vme_writer_flush(w);
+        CU_ASSERT_PTR_NOT_NULL(result->vme_error_msg);
+        vme_free_result(result);
+        result = vme_writer_flush(w);
+        CU_ASSERT_PTR_NULL(result->vme_error_msg);
+        vme_free_result(result);
+
+        result = vme_writer_close(w);
+        CU_ASSERT_PTR_NOT_NULL(result->vme_error_msg);
+        CU_ASSERT_EQUAL(result->vme_count, 25);
+        CU_ASSERT_EQUAL(stats.failures, 1);
+        CU_ASSERT_EQUAL(stats.out_of_order, 0);
+        vme_free_result(result);
+        pthread_mutex_destroy(&stats.lock);
+    }
+
+    // byte limit, upsert, and what is left is sent on close
+    {
+        writer_stats_t stats;
+        memset(&stats, 0, sizeof(stats));
+        pthread_mutex_init(&stats.lock, NULL);
+        vme_writer_opts_t opts = { 1024, 0, 0, 1, on_batch, &stats };
+        vme_writer_t *w = vme_writer_open(vme, rsURI, &opts);
+        for (int i = 0; i < 100; i++) {
+            int len = snprintf(inst, sizeof(inst), "{\"name\": \"writer %d\", \"salary\": %d}", i, 2000 + i);
+            vme_writer_add(w, inst, len);
+        }
+        vme_result_t *result = vme_writer_close(w);
+        CU_ASSERT_PTR_NULL(result->vme_error_msg);
+        CU_ASSERT_EQUAL(result->vme_count, 100);
+        CU_ASSERT_TRUE(stats.batches >= 4);
+        CU_ASSERT_EQUAL(stats.out_of_order, 0);
+        vme_free_result(result);
+        pthread_mutex_destroy(&stats.lock);
+    }
+
+    vme_result_t *result = vme_delete(vme, rsURI, "{\"salary\": {\"$lt\": 5000}}");
+    vme_free_result(result);
+    free(rsURI);
+    free(config.vantiq_url);
+    free(config.vantiq_token);
+    vme_teardown(vme);
+    CU_PASS("test writer");
+}
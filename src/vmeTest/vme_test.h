@@ -13,6 +13,24 @@ void test_aggregates(void);
 void test_publish(void);
 void test_patch(void);
 void test_execute(void);
+void test_cache(void);
+void test_concurrent_selects(void);
+void test_prepared(void);
+void test_columns(void);
+void test_local_aggregate(void);
+void test_where(void);
+void test_replica(void);
+void test_select_to_file(void);
+void test_insert_file(void);
+void test_writer(void);
+void test_publish_async(void);
+void test_spool(void);
+void test_adapt(void);
+void test_hedge(void);
+void test_update_delta(void);
+void test_publish_buf(void);
+void test_stats(void);
+void test_dpi_frame(void);
 
 char *find_instance_id(vme_result_t *result);
 cJSON *find_instance_prop(cJSON *instance, const char *propName);